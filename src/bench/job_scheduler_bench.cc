@@ -0,0 +1,346 @@
+// Microbenchmarks for JobScheduler, run headless and printed as JSON on stdout
+// Usage: JobSchedulerBench [--workers N] [--spin US] [--yield US] [--quick]
+//   --workers  number of worker threads, default is the scheduler's own choice
+//   --spin     microseconds idle workers spin before yielding, as InitParameters::idleSpinMicroseconds
+//   --yield    microseconds idle workers then yield before sleeping, as InitParameters::idleYieldMicroseconds
+//   --quick    fewer iterations, for a smoke test rather than a baseline
+// Each measurement is repeated and the median reported, latencies also report their 99th percentile
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/job_scheduler.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+double percentile(std::vector<double> samples, double p) {
+    std::sort(samples.begin(), samples.end());
+    size_t index = static_cast<size_t>(p * (samples.size() - 1) + 0.5);
+    return samples[index];
+}
+
+double median(const std::vector<double>& samples) {
+    return percentile(samples, 0.5);
+}
+
+void emptyJob(uintptr_t) {
+
+}
+
+struct BenchConfig {
+    uint32_t numRepeats = 5;
+    uint32_t numJobs = 200000;
+    uint32_t numLatencySamples = 200;
+    uint32_t numCounterIDs = 1024;
+    uint32_t numCounterLookups = 1000000;
+};
+
+// Writes one result object per call, as elements of the "results" array
+class ResultWriter {
+public:
+    explicit ResultWriter(std::ostream& out) : m_out(out) {}
+
+    void begin(const std::string& name) {
+        m_out << (m_first ? "\n" : ",\n") << "    {\"name\": \"" << name << "\"";
+        m_first = false;
+    }
+
+    void field(const char* key, double value) {
+        m_out << ", \"" << key << "\": " << value;
+    }
+
+    void end() {
+        m_out << "}";
+    }
+
+private:
+    std::ostream& m_out;
+    bool m_first = true;
+};
+
+// Jobs enqueued one at a time with enqueueJob(), then all at once with enqueueJobs(), from outside the workers.
+//   Timed until all of them have run
+void benchEnqueue(JobScheduler& scheduler, const BenchConfig& config, ResultWriter& results) {
+    JobScheduler::CounterHandle counter = scheduler.getFreeCounter();
+
+    JobScheduler::JobDeclaration decl;
+    decl.pFunction = emptyJob;
+    decl.signalCounters[0] = counter;
+    decl.numSignalCounters = 1;
+    std::vector<JobScheduler::JobDeclaration> decls(config.numJobs, decl);
+
+    std::vector<double> singleSamples, batchSamples, workerSamples;
+    for (uint32_t r = 0; r < config.numRepeats; ++r) {
+        Clock::time_point start = Clock::now();
+        for (uint32_t i = 0; i < config.numJobs; ++i) {
+            scheduler.enqueueJob(decl);
+        }
+        scheduler.waitForCounter(counter);
+        singleSamples.push_back(secondsSince(start));
+
+        start = Clock::now();
+        scheduler.enqueueJobs(config.numJobs, decls.data());
+        scheduler.waitForCounter(counter);
+        batchSamples.push_back(secondsSince(start));
+
+        // From a worker the jobs go to its own deque rather than the injection queue
+        JobScheduler::JobDeclaration spawnDecl;
+        spawnDecl.signalCounters[0] = counter;
+        spawnDecl.numSignalCounters = 1;
+        JobScheduler* pScheduler = &scheduler;
+        JobScheduler::JobDeclaration* pDecls = decls.data();
+        uint32_t numJobs = config.numJobs;
+        spawnDecl.setClosure([pScheduler, pDecls, numJobs] {
+            pScheduler->enqueueJobs(numJobs, pDecls);
+        });
+
+        start = Clock::now();
+        scheduler.enqueueJob(spawnDecl);
+        scheduler.waitForCounter(counter);
+        workerSamples.push_back(secondsSince(start));
+    }
+
+    const std::pair<const char*, std::vector<double>*> variants[] = {
+        {"enqueue_job", &singleSamples},
+        {"enqueue_jobs", &batchSamples},
+        {"enqueue_jobs_from_worker", &workerSamples}
+    };
+    for (const auto& variant : variants) {
+        double seconds = median(*variant.second);
+        results.begin(variant.first);
+        results.field("jobs", config.numJobs);
+        results.field("ns_per_job", seconds * 1e9 / config.numJobs);
+        results.field("jobs_per_second", config.numJobs / seconds);
+        results.end();
+    }
+
+    scheduler.freeCounter(counter);
+}
+
+// A job fans out to width jobs on a counter, and a join job waits on it. Timed from enqueueing the first job to the join completing
+void benchFanOutFanIn(JobScheduler& scheduler, const BenchConfig& config, ResultWriter& results) {
+    JobScheduler::CounterHandle fanCounter = scheduler.getFreeCounter();
+    JobScheduler::CounterHandle doneCounter = scheduler.getFreeCounter();
+
+    for (uint32_t width : {16u, 256u, 4096u}) {
+        // The fan-out jobs, followed by the join
+        std::vector<JobScheduler::JobDeclaration> decls(width + 1);
+        for (uint32_t i = 0; i < width; ++i) {
+            decls[i].pFunction = emptyJob;
+            decls[i].signalCounters[0] = fanCounter;
+            decls[i].numSignalCounters = 1;
+        }
+        decls[width].pFunction = emptyJob;
+        decls[width].waitCounters[0] = fanCounter;
+        decls[width].numWaitCounters = 1;
+        decls[width].signalCounters[0] = doneCounter;
+        decls[width].numSignalCounters = 1;
+
+        JobScheduler::JobDeclaration rootDecl;
+        rootDecl.signalCounters[0] = doneCounter;
+        rootDecl.numSignalCounters = 1;
+        JobScheduler* pScheduler = &scheduler;
+        JobScheduler::JobDeclaration* pDecls = decls.data();
+        rootDecl.setClosure([pScheduler, pDecls, width] {
+            pScheduler->enqueueJobs(width + 1, pDecls);
+        });
+
+        std::vector<double> samples;
+        for (uint32_t r = 0; r < config.numLatencySamples; ++r) {
+            Clock::time_point start = Clock::now();
+            scheduler.enqueueJob(rootDecl);
+            scheduler.waitForCounter(doneCounter);
+            samples.push_back(secondsSince(start) * 1e6);
+        }
+
+        results.begin("fan_out_fan_in");
+        results.field("width", width);
+        results.field("median_us", median(samples));
+        results.field("p99_us", percentile(samples, 0.99));
+        results.end();
+    }
+
+    scheduler.freeCounter(fanCounter);
+    scheduler.freeCounter(doneCounter);
+}
+
+// Empty jobs all signalling one counter, against the same jobs spread over several counters
+void benchHotCounter(JobScheduler& scheduler, const BenchConfig& config, ResultWriter& results) {
+    static constexpr uint32_t numSpreadCounters = 64;
+
+    std::vector<JobScheduler::CounterHandle> counters(numSpreadCounters);
+    for (auto& counter : counters) counter = scheduler.getFreeCounter();
+
+    for (uint32_t numCounters : {1u, numSpreadCounters}) {
+        std::vector<JobScheduler::JobDeclaration> decls(config.numJobs);
+        for (uint32_t i = 0; i < config.numJobs; ++i) {
+            decls[i].pFunction = emptyJob;
+            decls[i].signalCounters[0] = counters[i % numCounters];
+            decls[i].numSignalCounters = 1;
+        }
+
+        std::vector<double> samples;
+        for (uint32_t r = 0; r < config.numRepeats; ++r) {
+            Clock::time_point start = Clock::now();
+            scheduler.enqueueJobs(config.numJobs, decls.data());
+            for (uint32_t i = 0; i < numCounters; ++i) {
+                scheduler.waitForCounter(counters[i]);
+            }
+            samples.push_back(secondsSince(start));
+        }
+
+        double seconds = median(samples);
+        results.begin("counter_contention");
+        results.field("counters", numCounters);
+        results.field("jobs", config.numJobs);
+        results.field("ns_per_job", seconds * 1e9 / config.numJobs);
+        results.end();
+    }
+
+    for (auto counter : counters) scheduler.freeCounter(counter);
+}
+
+// Creating counters by ID, then looking existing ones up
+void benchCounterByID(JobScheduler& scheduler, const BenchConfig& config, ResultWriter& results) {
+    std::vector<std::string> ids(config.numCounterIDs);
+    for (uint32_t i = 0; i < config.numCounterIDs; ++i) {
+        ids[i] = "bench_counter_" + std::to_string(i);
+    }
+
+    Clock::time_point start = Clock::now();
+    for (const auto& id : ids) {
+        scheduler.getCounterByID(id);
+    }
+    double createSeconds = secondsSince(start);
+
+    std::vector<double> samples;
+    uint32_t sink = 0;
+    for (uint32_t r = 0; r < config.numRepeats; ++r) {
+        start = Clock::now();
+        for (uint32_t i = 0; i < config.numCounterLookups; ++i) {
+            // Stride through the IDs so consecutive lookups don't hit the same entry
+            sink += scheduler.getCounterByID(ids[(i * 397) % config.numCounterIDs]);
+        }
+        samples.push_back(secondsSince(start));
+    }
+
+    results.begin("get_counter_by_id");
+    results.field("ids", config.numCounterIDs);
+    results.field("create_ns", createSeconds * 1e9 / config.numCounterIDs);
+    results.field("lookup_ns", median(samples) * 1e9 / config.numCounterLookups);
+    results.end();
+
+    // Keep the lookups from being optimized out
+    if (sink == 1) std::cerr << std::endl;
+}
+
+// A single job enqueued once every worker has gone to sleep. Measures until the job starts, and until the waiting thread
+//   sees it finish
+void benchWakeLatency(JobScheduler& scheduler, const BenchConfig& config, ResultWriter& results) {
+    JobScheduler::CounterHandle counter = scheduler.getFreeCounter();
+
+    // Nanoseconds since start, written by the job
+    static std::atomic<int64_t> jobStart;
+
+    std::vector<double> startSamples, returnSamples;
+    for (uint32_t r = 0; r < config.numLatencySamples; ++r) {
+        // Long enough for the workers to run out of jobs and sleep
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+        JobScheduler::JobDeclaration decl;
+        decl.signalCounters[0] = counter;
+        decl.numSignalCounters = 1;
+
+        Clock::time_point start = Clock::now();
+        decl.setClosure([start] {
+            jobStart = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        });
+        scheduler.enqueueJob(decl);
+        scheduler.waitForCounter(counter);
+        returnSamples.push_back(secondsSince(start) * 1e6);
+        startSamples.push_back(jobStart.load() * 1e-3);
+    }
+
+    results.begin("wake_latency");
+    results.field("job_start_median_us", median(startSamples));
+    results.field("job_start_p99_us", percentile(startSamples, 0.99));
+    results.field("waiter_return_median_us", median(returnSamples));
+    results.field("waiter_return_p99_us", percentile(returnSamples, 0.99));
+    results.end();
+
+    scheduler.freeCounter(counter);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    JobScheduler::InitParameters parameters;
+    BenchConfig config;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            parameters.numWorkers = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--spin") == 0 && i + 1 < argc) {
+            parameters.idleSpinMicroseconds = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--yield") == 0 && i + 1 < argc) {
+            parameters.idleYieldMicroseconds = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--quick") == 0) {
+            config.numRepeats = 2;
+            config.numJobs = 20000;
+            config.numLatencySamples = 20;
+            config.numCounterLookups = 100000;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--workers N] [--spin US] [--yield US] [--quick]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // The scheduler reports what it is doing on std::cout, keep stdout for the results
+    std::ostream out(std::cout.rdbuf());
+    std::cout.rdbuf(std::cerr.rdbuf());
+
+    JobScheduler scheduler;
+    scheduler.spawnThreads(parameters);
+
+    out.precision(9);
+    ResultWriter results(out);
+    out << "{\n  \"benchmark\": \"job_scheduler\",\n  \"hardware_threads\": " << std::thread::hardware_concurrency()
+        << ",\n  \"workers\": " << scheduler.getNumWorkers() << ",\n  \"idle_spin_us\": " << parameters.idleSpinMicroseconds
+        << ",\n  \"idle_yield_us\": " << parameters.idleYieldMicroseconds << ",\n  \"results\": [";
+
+    benchEnqueue(scheduler, config, results);
+    benchFanOutFanIn(scheduler, config, results);
+    benchHotCounter(scheduler, config, results);
+    benchCounterByID(scheduler, config, results);
+    benchWakeLatency(scheduler, config, results);
+
+    // Over the whole run, for tuning the idle policy (see JobScheduler::InitParameters::idleSpinMicroseconds)
+    JobScheduler::IdleStatistics idle = scheduler.getIdleStatistics();
+    results.begin("idle_statistics");
+    results.field("spin_wakeups", idle.numSpinWakeups);
+    results.field("yield_wakeups", idle.numYieldWakeups);
+    results.field("sleeps", idle.numSleeps);
+    results.field("spins", idle.numSpins);
+    results.field("wake_calls", idle.numWakeCalls);
+    results.end();
+
+    out << "\n  ]\n}" << std::endl;
+
+    scheduler.joinThreads();
+    std::cout.rdbuf(out.rdbuf());
+
+    return EXIT_SUCCESS;
+}
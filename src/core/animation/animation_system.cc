@@ -110,7 +110,35 @@ void AnimationSystem::processStateUpdates(float dt) {
     updateTransitions();
 }
 
+void AnimationSystem::setJobScheduler(JobScheduler* pScheduler) {
+    if (pScheduler != m_pScheduler) {
+        m_pScheduler = pScheduler;
+        m_jobCounter = pScheduler ? pScheduler->getFreeCounter() : JobScheduler::COUNTER_NULL;
+    }
+}
+
 void AnimationSystem::applyPosesToSkeletons() {
+    uint32_t count = static_cast<uint32_t>(m_stateInstances.size());
+
+    if (!m_pScheduler) {
+        applyPosesToSkeletonsRange(0, count, reinterpret_cast<uintptr_t>(this));
+        return;
+    }
+
+    // Blend tree evaluation and skinning matrices are costly enough to split down to single instances
+    m_pScheduler->parallelFor(0, count, 1, applyPosesToSkeletonsRange, reinterpret_cast<uintptr_t>(this), m_jobCounter,
+                              JobScheduler::JOB_PRIORITY_NORMAL, "ApplyPosesToSkeletons");
+    m_pScheduler->waitForCounterAndHelp(m_jobCounter);
+}
+
+void AnimationSystem::applyPosesToSkeletonsRange(uint32_t begin, uint32_t end, uintptr_t param) {
+    AnimationSystem* pSystem = reinterpret_cast<AnimationSystem*>(param);
+    for (uint32_t i = begin; i < end; ++i) {
+        pSystem->applyPoseToSkeleton(pSystem->m_stateInstances[i]);
+    }
+}
+
+void AnimationSystem::applyPoseToSkeleton(AnimationState& instance) const {
     static const auto getPose = [] (const AnimationState& instance,
                                     const AnimationStateNode* pState,
                                     float time) {
@@ -124,31 +152,27 @@ void AnimationSystem::applyPosesToSkeletons() {
                                                pState->isTimeScaleAbsolute());
     };
 
-    for (auto i = 0u; i < m_stateInstances.size(); ++i) {
-        AnimationState& instance = m_stateInstances[i];
+    instance.pSkeleton->copyLastSkinningMatrices();  // this should be moved
 
-        instance.pSkeleton->copyLastSkinningMatrices();  // this should be moved
+    if (instance.pCurrentTransition == nullptr) {
+        instance.pSkeleton->setPose(getPose(instance, instance.pCurrentState, instance.currentStateTimer));
+    } else {
+        SkeletonPose pose(nullptr);
 
-        if (instance.pCurrentTransition == nullptr) {
-            instance.pSkeleton->setPose(getPose(instance, instance.pCurrentState, instance.currentStateTimer));
+        if (!instance.useCachedPose) {
+            pose = getPose(instance, instance.pCurrentState, instance.currentStateTimer);
         } else {
-            SkeletonPose pose(nullptr);
-
-            if (!instance.useCachedPose) {
-                pose = getPose(instance, instance.pCurrentState, instance.currentStateTimer);
-            } else {
-                pose = *instance.pCachedPose;
-            }
-
-            pose.lerp(getPose(instance, instance.pCurrentTransition->getSecondNode(), instance.nextStateTimer),
-                      instance.currentTransitionTimer / instance.pCurrentTransition->getDuration());
-
-            instance.pSkeleton->setPose(pose);
+            pose = *instance.pCachedPose;
         }
 
-        instance.pSkeleton->applyCurrentPose();
-        instance.pSkeleton->computeSkinningMatrices();  // this should be moved
+        pose.lerp(getPose(instance, instance.pCurrentTransition->getSecondNode(), instance.nextStateTimer),
+                  instance.currentTransitionTimer / instance.pCurrentTransition->getDuration());
+
+        instance.pSkeleton->setPose(pose);
     }
+
+    instance.pSkeleton->applyCurrentPose();
+    instance.pSkeleton->computeSkinningMatrices();  // this should be moved
 }
 
 void AnimationSystem::cleanup() {
@@ -10,6 +10,7 @@
 #include "animation_instance.h"
 #include "animation_state_graph.h"
 
+#include "core/job_scheduler.h"
 #include "core/resources/resource_manager.h"
 
 class AnimationSystem {
@@ -62,6 +63,9 @@ public:
         m_pResManager = pResManager;
     }
 
+    // Used to apply poses in parallel. If no scheduler is set they are applied on the calling thread
+    void setJobScheduler(JobScheduler* pScheduler);
+
     uint32_t createAnimationStateInstance(const AnimationStateGraph* pStateGraph,
                                           Skeleton* pSkeleton);
 
@@ -98,6 +102,7 @@ public:
     void processStateUpdates(float dt);
 
     // Evaluate blend trees and copy their poses to the skeletons
+    // Blocks until all instances are updated
     void applyPosesToSkeletons();
 
     void cleanup();
@@ -117,6 +122,9 @@ private:
 
     const ResourceManager* m_pResManager = nullptr;
 
+    JobScheduler* m_pScheduler = nullptr;
+    JobScheduler::CounterHandle m_jobCounter = JobScheduler::COUNTER_NULL;
+
     void updateParameters();
 
     void processFlagTriggers();
@@ -125,6 +133,10 @@ private:
 
     void updateTransitions();
 
+    void applyPoseToSkeleton(AnimationState& instance) const;
+
+    static void applyPosesToSkeletonsRange(uint32_t begin, uint32_t end, uintptr_t param);
+
     const AnimationClipSet* getClipSet(const SkeletonDescription* pSkeletonDescription,
                                        const AnimationStateGraph* pStateGraph);
 
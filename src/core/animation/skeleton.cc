@@ -74,4 +74,5 @@ void Skeleton::computeSkinningMatrices() {
     for (size_t i = 0; i < m_joints.size(); ++i) {
         m_skinningMatrices[i] = m_joints[i].getWorldMatrix() * m_joints[i].getInverseBindMatrix();
     }
+    ++m_poseVersion;
 }
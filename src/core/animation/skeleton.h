@@ -49,6 +49,11 @@ public:
         return m_lastSkinningMatrices;
     }
 
+    // Bumped by computeSkinningMatrices(), so anything derived from the pose can tell if it is out of date
+    uint32_t getPoseVersion() const {
+        return m_poseVersion;
+    }
+
 private:
 
     const SkeletonDescription* m_pDescription;
@@ -56,6 +61,8 @@ private:
     std::vector<Joint> m_joints;
     std::vector<glm::mat4> m_skinningMatrices;
     std::vector<glm::mat4> m_lastSkinningMatrices;
+
+    uint32_t m_poseVersion = 0;
 };
 
 class SkeletonPose {
@@ -16,12 +16,9 @@ class PhysicsSystem;
 
 namespace Component {
 
+// Marks an entity as having its own transform, rather than taking its parent's. The transform itself is kept by GameWorld
+//   with the hierarchy, see GameWorld::setLocalTransform() and Entity::getWorldTransform()
 struct Transform {
-    glm::mat4 world = glm::mat4(1.0f);
-    glm::mat4 local = glm::mat4(1.0f);
-
-    glm::mat4 lastWorld = glm::mat4(1.0f);
-
     struct DirtyFlag {};
     //struct UpdatedFlag {};
 };
@@ -52,6 +49,24 @@ struct Children {
 struct TopLevel {
 };
 
+// Where the entity is in GameWorld's flattened transform hierarchy. Added and kept up to date by GameWorld, don't touch it
+struct HierarchyNode {
+    uint32_t index;
+};
+
+// Which of GameWorld's render buckets a Renderable is in. Also added and kept up to date by GameWorld
+// The flag is set when the Renderable is added or updated, and the entity moved to its new bucket in preRenderUpdate()
+struct RenderBucketID {
+    uint32_t index;
+
+    struct DirtyFlag {};
+};
+
+// The Renderable's leaf in GameWorld's BVH, added when its bounding sphere is first computed
+struct BVHProxy {
+    uint32_t index;
+};
+
 /*struct RenderableID {
     uint32_t id;
     Scene* pScene;
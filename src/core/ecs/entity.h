@@ -28,6 +28,12 @@ struct Entity {
         return pGameWorld->m_registry.replace<T>(id, args...);
     }
 
+    // Let the GameWorld know a component was changed in place through getComponent(), as if by updateComponent()
+    template<typename T>
+    void markComponentUpdated() {
+        pGameWorld->m_registry.patch<T>(id);
+    }
+
     template<typename T, typename ... Args, typename std::enable_if<!std::is_empty<T>::value>::type* = nullptr>
     T& addComponent(Args ... args) {
         return pGameWorld->m_registry.emplace<T>(id, args...);
@@ -49,6 +55,39 @@ struct Entity {
         return pGameWorld->m_registry.all_of<T>(id);
     }
 
+    // See GameWorld::setLocalTransform()
+    void setLocalTransform(const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale) {
+        pGameWorld->setLocalTransform(*this, translation, rotation, scale);
+    }
+
+    void setLocalTransform(const glm::mat4& local) {
+        pGameWorld->setLocalTransform(*this, local);
+    }
+
+    glm::mat4 getLocalTransform() const {
+        return pGameWorld->getLocalTransform(*this);
+    }
+
+    const glm::vec3& getLocalTranslation() const {
+        return pGameWorld->getLocalTranslation(*this);
+    }
+
+    const glm::quat& getLocalRotation() const {
+        return pGameWorld->getLocalRotation(*this);
+    }
+
+    const glm::vec3& getLocalScale() const {
+        return pGameWorld->getLocalScale(*this);
+    }
+
+    glm::mat4 getWorldTransform() const {
+        return pGameWorld->getWorldTransform(*this);
+    }
+
+    glm::mat4 getLastWorldTransform() const {
+        return pGameWorld->getLastWorldTransform(*this);
+    }
+
     bool operator==(const Entity& e) {
         return e.id == id && e.pGameWorld == pGameWorld;
     }
@@ -0,0 +1,190 @@
+#ifndef ENTITY_COMMAND_BUFFER_H_INCLUDED
+#define ENTITY_COMMAND_BUFFER_H_INCLUDED
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "entity.h"
+
+/** Records changes to a GameWorld's entities, to be made later by GameWorld::playbackCommands()
+ *  Get one with GameWorld::getCommandBuffer(). Each thread has its own, so jobs can record without locking
+ *  Nothing may be recorded during playback, it should be at a point in the frame where no jobs are touching the world
+ **/
+class EntityCommandBuffer {
+
+    friend class GameWorld;
+
+public:
+
+    EntityCommandBuffer() = default;
+
+    // Destroys the recorded components which were never played back
+    ~EntityCommandBuffer() {
+        clear();
+    }
+
+    // Recorded ops point into the buffer's own blocks
+    EntityCommandBuffer(const EntityCommandBuffer&) = delete;
+    EntityCommandBuffer& operator=(const EntityCommandBuffer&) = delete;
+
+    // An existing entity, or one to be created by a createEntity() command of any buffer
+    class EntityRef {
+
+        friend class EntityCommandBuffer;
+        friend class GameWorld;
+
+    public:
+
+        EntityRef(Entity e) : m_id(e.id) { }
+        EntityRef(entt::entity id) : m_id(id) { }
+
+    private:
+
+        EntityRef() = default;
+        EntityRef(uint32_t buffer, uint32_t created) : m_buffer(buffer), m_created(created) { }
+
+        static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+        entt::entity m_id = entt::null;
+        uint32_t m_buffer = NONE;
+        uint32_t m_created = NONE;
+    };
+
+    // The entity is created as GameWorld::createEntity() does, at the start of playback
+    EntityRef createEntity() {
+        m_commands.push_back({COMMAND_CREATE, EntityRef(m_index, m_numCreated), EntityRef(), 0});
+        return EntityRef(m_index, m_numCreated++);
+    }
+
+    // Destroyed entities are destroyed at the end of playback, so other commands on them are still fine
+    void destroyEntity(EntityRef e, EntityDestroyMode destroyMode = ENTITY_DESTROY_CLEAR_PARENT) {
+        m_commands.push_back({COMMAND_DESTROY, e, EntityRef(), static_cast<uint32_t>(destroyMode)});
+    }
+
+    // Replaces the component if the entity already has one by then
+    template<typename T, typename ... Args>
+    void addComponent(EntityRef e, Args ... args) {
+        if constexpr (std::is_empty<T>::value) {
+            recordComponentOp(e, [] (entt::registry& r, entt::entity id) { r.emplace_or_replace<T>(id); });
+        } else {
+            recordComponentOp(e, [component = T{args...}] (entt::registry& r, entt::entity id) {
+                r.emplace_or_replace<T>(id, component); });
+        }
+    }
+
+    template<typename T>
+    void removeComponent(EntityRef e) {
+        recordComponentOp(e, [] (entt::registry& r, entt::entity id) { r.remove<T>(id); });
+    }
+
+    void setParent(EntityRef e, EntityRef parent) {
+        m_commands.push_back({COMMAND_SET_PARENT, e, parent, 0});
+    }
+
+    void clearParent(EntityRef e) {
+        m_commands.push_back({COMMAND_CLEAR_PARENT, e, EntityRef(), 0});
+    }
+
+    bool empty() const {
+        return m_commands.empty();
+    }
+
+private:
+
+    enum CommandType { COMMAND_CREATE, COMMAND_DESTROY, COMMAND_COMPONENT, COMMAND_SET_PARENT, COMMAND_CLEAR_PARENT };
+
+    // param is the destroy mode or the component op, depending on the type
+    struct Command {
+        CommandType type;
+        EntityRef entity;
+        EntityRef parent;
+        uint32_t param;
+    };
+
+    // A recorded closure, placed in one of the buffer's blocks
+    struct ComponentOp {
+        void (*pInvoke)(void* pClosure, entt::registry& registry, entt::entity id);
+        void (*pDestroy)(void* pClosure);
+        void* pClosure;
+
+        void operator()(entt::registry& registry, entt::entity id) const {
+            pInvoke(pClosure, registry, id);
+        }
+    };
+
+    // Blocks are kept when the buffer is cleared and filled again from the first, so once they have grown to fit a
+    //   frame's commands, recording allocates nothing. They never move, so closures needn't be trivially copyable
+    struct Block {
+        std::unique_ptr<std::max_align_t[]> pData;
+        size_t size;
+    };
+
+    static constexpr size_t BLOCK_SIZE = 16 * 1024;
+
+    std::thread::id m_threadID;
+    uint32_t m_index = 0;
+
+    std::vector<Command> m_commands;
+    std::vector<ComponentOp> m_componentOps;
+    uint32_t m_numCreated = 0;
+
+    std::vector<Block> m_blocks;
+    size_t m_currentBlock = 0;
+    size_t m_blockOffset = 0;
+
+    // Where this buffer's created entities start in the GameWorld's list during playback
+    uint32_t m_firstCreated = 0;
+
+    template<typename F>
+    void recordComponentOp(EntityRef e, F&& f) {
+        typedef typename std::decay<F>::type Closure;
+        static_assert(alignof(Closure) <= alignof(std::max_align_t), "Component is over-aligned for a command buffer");
+
+        ComponentOp op;
+        op.pClosure = new (allocate(sizeof(Closure), alignof(Closure))) Closure(std::forward<F>(f));
+        op.pInvoke = [] (void* pClosure, entt::registry& registry, entt::entity id) {
+            (*static_cast<Closure*>(pClosure))(registry, id);
+        };
+        op.pDestroy = [] (void* pClosure) {
+            static_cast<Closure*>(pClosure)->~Closure();
+        };
+
+        m_commands.push_back({COMMAND_COMPONENT, e, EntityRef(), static_cast<uint32_t>(m_componentOps.size())});
+        m_componentOps.push_back(op);
+    }
+
+    void* allocate(size_t size, size_t alignment) {
+        for (;; ++m_currentBlock, m_blockOffset = 0) {
+            if (m_currentBlock == m_blocks.size()) {
+                size_t blockSize = std::max(BLOCK_SIZE, size);
+                size_t numElements = (blockSize + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+                m_blocks.push_back({std::make_unique<std::max_align_t[]>(numElements), numElements * sizeof(std::max_align_t)});
+            }
+
+            Block& block = m_blocks[m_currentBlock];
+            size_t offset = (m_blockOffset + alignment - 1) / alignment * alignment;
+            if (offset + size <= block.size) {
+                m_blockOffset = offset + size;
+                return reinterpret_cast<unsigned char*>(block.pData.get()) + offset;
+            }
+        }
+    }
+
+    void clear() {
+        for (const ComponentOp& op : m_componentOps) op.pDestroy(op.pClosure);
+        m_commands.clear();
+        m_componentOps.clear();
+        m_numCreated = 0;
+        m_currentBlock = 0;
+        m_blockOffset = 0;
+    }
+
+};
+
+#endif // ENTITY_COMMAND_BUFFER_H_INCLUDED
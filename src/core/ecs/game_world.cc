@@ -1,36 +1,225 @@
 #include "game_world.h"
 
+#include <algorithm>
 #include <iostream>
+#include <stdexcept>
+#include <thread>
 
 #include "entity.h"
+#include "entity_command_buffer.h"
 #include "components.h"
 
 #include "core/physics/physics.h"
 #include "core/scene/bounding_sphere.h"
 #include "core/scene/renderable.h"
 #include "core/scene/point_light.h"
+#include "core/util/math_util.h"
 
 // Ensure every Renderable has a Transform and Bounding Sphere
 static void onCreateRenderable(entt::registry& r, entt::entity e) {
-    (void) r.get_or_emplace<Component::Transform>(e);
+    if (!r.all_of<Component::Transform>(e)) r.emplace<Component::Transform>(e);
     r.emplace<BoundingSphere>(e);
+    // The Transform may already exist, it still needs to be updated for the sphere to be computed
+    r.emplace_or_replace<Component::Transform::DirtyFlag>(e);
+    r.emplace_or_replace<Component::RenderBucketID::DirtyFlag>(e);
 }
 
-GameWorld::GameWorld() {
-    // Transforms are initialized with the dirty flag set so everything always initializes correctly
-    m_registry.on_construct<Component::Transform>().connect<&entt::registry::emplace_or_replace<Component::Transform::DirtyFlag>>();
-    m_registry.on_update<Component::Transform>().connect<&entt::registry::emplace_or_replace<Component::Transform::DirtyFlag>>();
+static void onUpdateRenderable(entt::registry& r, entt::entity e) {
+    r.emplace_or_replace<Component::Transform::DirtyFlag>(e);
+    r.emplace_or_replace<Component::RenderBucketID::DirtyFlag>(e);
+}
+
+// The bucket's count is kept by onDestroyRenderBucketID, since the RenderBucketID may be destroyed before or after the
+//   Renderable when the entity is
+static void onDestroyRenderable(entt::registry& r, entt::entity e) {
+    r.remove<Component::RenderBucketID>(e);
+    r.remove<Component::RenderBucketID::DirtyFlag>(e);
+    r.remove<Component::BVHProxy>(e);
+}
+
+// Identifies the world in the threads' cached command buffers
+static std::atomic<uint64_t> nextWorldID{1};
+
+struct CommandBufferCache {
+    uint64_t worldID = 0;
+    EntityCommandBuffer* pBuffer = nullptr;
+};
+
+#if defined(__GNUC__) || defined(__clang__)
+#define VKJ_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define VKJ_NOINLINE __declspec(noinline)
+#else
+#define VKJ_NOINLINE
+#endif
+
+VKJ_NOINLINE static CommandBufferCache& getCommandBufferCache() {
+    static thread_local CommandBufferCache cache;
+    // As JobTracer::getThreadCache(), the volatile read stops the address being reused across a fiber switch
+    CommandBufferCache* volatile pCache = &cache;
+    return *pCache;
+}
+
+GameWorld::GameWorld() :
+    m_worldID(nextWorldID.fetch_add(1))
+{
+    m_registry.on_construct<Component::Transform>().connect<&GameWorld::onConstructTransform>(*this);
+    m_registry.on_destroy<Component::Transform>().connect<&GameWorld::onDestroyTransform>(*this);
 
     m_registry.on_construct<Component::Renderable>().connect<&onCreateRenderable>();
-    m_registry.on_update<Component::Renderable>().connect<&entt::registry::emplace_or_replace<Component::Transform::DirtyFlag>>();
+    m_registry.on_update<Component::Renderable>().connect<&onUpdateRenderable>();
+    m_registry.on_destroy<Component::Renderable>().connect<&onDestroyRenderable>();
+    m_registry.on_destroy<Component::RenderBucketID>().connect<&GameWorld::onDestroyRenderBucketID>(*this);
+    m_registry.on_destroy<Component::BVHProxy>().connect<&GameWorld::onDestroyBVHProxy>(*this);
+
+    // The root node, alone at depth 0
+    m_nodeEntities.push_back(entt::null);
+    m_nodeParents.push_back(0);
+    m_nodeWorlds.emplace_back();
+    m_nodeLastWorlds.emplace_back();
+    m_nodeTranslations.emplace_back(0.0f);
+    m_nodeRotations.emplace_back(1.0f, 0.0f, 0.0f, 0.0f);
+    m_nodeScales.emplace_back(1.0f);
+    m_nodeHasTransform.push_back(0);
+    m_nodeDirty.push_back(0);
+    m_nodeChanged.push_back(0);
+    m_nodeBoundsStale.push_back(0);
+    m_nodePoseVersions.push_back(0);
+    m_levelBegin = {0, 1};
+    m_levelDirty.push_back(0);
+    m_levelNumChanged.push_back(0);
+}
+
+GameWorld::~GameWorld() {
+
 }
 
 Entity GameWorld::createEntity() {
     Entity e = {m_registry.create(), this};
     e.addComponent<Component::TopLevel>();
+    insertNode(e.id, entt::null);
     return e;
 }
 
+void GameWorld::createEntities(uint32_t count, const uint32_t* parents, entt::entity* entitiesOut) {
+    if (count == 0) return;
+
+    // Each new node's level, which the parents being first allows in one pass
+    std::vector<uint32_t> depths(count);
+    uint32_t numLevels = getNumLevels();
+    for (uint32_t i = 0; i < count; ++i) {
+        if (parents[i] != NO_PARENT && parents[i] >= i) throw std::runtime_error("Entity parent must come before its children");
+        depths[i] = (parents[i] == NO_PARENT) ? 1 : depths[parents[i]] + 1;
+        numLevels = std::max(numLevels, depths[i] + 1);
+    }
+
+    m_registry.create(entitiesOut, entitiesOut + count);
+
+    while (getNumLevels() < numLevels) {
+        m_levelBegin.push_back(m_levelBegin.back());
+        m_levelDirty.push_back(0);
+        m_levelNumChanged.push_back(0);
+    }
+
+    std::vector<uint32_t> levelNumNew(numLevels, 0);
+    for (uint32_t depth : depths) ++levelNumNew[depth];
+
+    // The new nodes go at the end of their levels, so the existing nodes of each level shift down by the number of new
+    //   nodes above them
+    uint32_t numOldNodes = static_cast<uint32_t>(m_nodeEntities.size());
+    std::vector<uint32_t> oldToNew(numOldNodes);
+    std::vector<uint32_t> nextNewNode(numLevels);
+    uint32_t shift = 0;
+    for (uint32_t level = 0; level < numLevels; ++level) {
+        for (uint32_t node = m_levelBegin[level]; node < m_levelBegin[level + 1]; ++node) oldToNew[node] = node + shift;
+        m_levelBegin[level] += shift;
+        shift += levelNumNew[level];
+        nextNewNode[level] = m_levelBegin[level + 1] + shift - levelNumNew[level];
+        if (levelNumNew[level] > 0) m_levelDirty[level] = 1;
+    }
+    m_levelBegin.back() += shift;
+
+    // Nodes only move to higher indices, so moving from the back never overwrites one which is still to move
+    const auto spread = [&] (auto& nodes) {
+        nodes.resize(numOldNodes + count);
+        for (uint32_t node = numOldNodes; node-- > 1;) nodes[oldToNew[node]] = nodes[node];
+    };
+    spread(m_nodeEntities);
+    spread(m_nodeParents);
+    spread(m_nodeWorlds);
+    spread(m_nodeLastWorlds);
+    spread(m_nodeTranslations);
+    spread(m_nodeRotations);
+    spread(m_nodeScales);
+    spread(m_nodeHasTransform);
+    spread(m_nodeDirty);
+    spread(m_nodeChanged);
+    spread(m_nodeBoundsStale);
+    spread(m_nodePoseVersions);
+
+    for (uint32_t node = 1; node < numOldNodes; ++node) {
+        uint32_t to = oldToNew[node];
+        m_nodeParents[to] = oldToNew[m_nodeParents[to]];
+        if (to != node) m_registry.get<Component::HierarchyNode>(m_nodeEntities[to]).index = to;
+    }
+
+    std::vector<uint32_t> nodes(count);
+    std::vector<entt::entity> topLevel, children, parentEntities;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t node = nextNewNode[depths[i]]++;
+        uint32_t parentNode = (parents[i] == NO_PARENT) ? 0 : nodes[parents[i]];
+        nodes[i] = node;
+
+        m_nodeEntities[node] = entitiesOut[i];
+        m_nodeParents[node] = parentNode;
+        m_nodeWorlds[node] = m_nodeWorlds[parentNode];
+        m_nodeLastWorlds[node] = m_nodeWorlds[parentNode];
+        m_nodeTranslations[node] = glm::vec3(0.0f);
+        m_nodeRotations[node] = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+        m_nodeScales[node] = glm::vec3(1.0f);
+        m_nodeHasTransform[node] = 0;
+        m_nodeDirty[node] = 1;
+        m_nodeChanged[node] = 0;
+        m_nodeBoundsStale[node] = 1;
+        m_nodePoseVersions[node] = 0;
+
+        if (parents[i] == NO_PARENT) {
+            topLevel.push_back(entitiesOut[i]);
+        } else {
+            children.push_back(entitiesOut[i]);
+            if (parentEntities.empty() || parentEntities.back() != entitiesOut[parents[i]]) {
+                parentEntities.push_back(entitiesOut[parents[i]]);
+            }
+        }
+    }
+
+    // Components are added per type, default constructed and then filled in
+    m_registry.insert<Component::HierarchyNode>(entitiesOut, entitiesOut + count);
+    for (uint32_t i = 0; i < count; ++i) m_registry.get<Component::HierarchyNode>(entitiesOut[i]).index = nodes[i];
+
+    m_registry.insert<Component::TopLevel>(topLevel.begin(), topLevel.end());
+
+    // A parent's children aren't always next to each other, so it may have been listed more than once
+    std::sort(parentEntities.begin(), parentEntities.end());
+    parentEntities.erase(std::unique(parentEntities.begin(), parentEntities.end()), parentEntities.end());
+    m_registry.insert<Component::Children>(parentEntities.begin(), parentEntities.end());
+
+    m_registry.insert<Component::Parent>(children.begin(), children.end());
+    for (uint32_t i = 0; i < count; ++i) {
+        if (parents[i] == NO_PARENT) continue;
+        Entity parent = {entitiesOut[parents[i]], this};
+        m_registry.get<Component::Parent>(entitiesOut[i]).entity = parent;
+        parent.getComponent<Component::Children>().entities.push_back({entitiesOut[i], this});
+    }
+}
+
+static void unsetParent(Entity e) {
+    Entity parent = e.getComponent<Component::Parent>().entity;
+    std::vector<Entity>& pchildren = parent.getComponent<Component::Children>().entities;
+    pchildren.erase(std::find(pchildren.begin(), pchildren.end(), e));
+    if (pchildren.empty()) parent.removeComponent<Component::Children>();
+}
+
 void GameWorld::destroyEntity(Entity e, EntityDestroyMode destroyMode) {
     if (e.hasComponent<Component::Children>()) {
         std::vector<Entity> children = e.getComponent<Component::Children>().entities;
@@ -49,7 +238,9 @@ void GameWorld::destroyEntity(Entity e, EntityDestroyMode destroyMode) {
             }
         }
     }
-    if (e.hasComponent<Component::Parent>()) clearParent(e);
+    // Not clearParent(), the entity doesn't need moving to the top level on its way out
+    if (e.hasComponent<Component::Parent>()) unsetParent(e);
+    if (const auto* pNode = m_registry.try_get<Component::HierarchyNode>(e.id)) removeNode(pNode->index);
     m_registry.destroy(e.id);
 }
 
@@ -57,11 +248,11 @@ bool GameWorld::isEntityValid(Entity e) const {
     return m_registry.valid(e.id);
 }
 
-static void unsetParent(Entity e) {
-    Entity parent = e.getComponent<Component::Parent>().entity;
-    std::vector<Entity>& pchildren = parent.getComponent<Component::Children>().entities;
-    pchildren.erase(std::find(pchildren.begin(), pchildren.end(), e));
-    if (pchildren.empty()) parent.removeComponent<Component::Children>();
+void GameWorld::setJobScheduler(JobScheduler* pScheduler) {
+    if (pScheduler != m_pScheduler) {
+        m_pScheduler = pScheduler;
+        m_jobCounter = pScheduler ? pScheduler->getFreeCounter() : JobScheduler::COUNTER_NULL;
+    }
 }
 
 void GameWorld::setParent(Entity e, Entity parent) {
@@ -74,7 +265,9 @@ void GameWorld::setParent(Entity e, Entity parent) {
             if (pentity.hasComponent<Component::Parent>())
                 pparent = pentity.getComponent<Component::Parent>().entity;
             if (pentity == e) {
-                for (Entity child : e.getComponent<Component::Children>().entities) {
+                // A copy, moving the children away removes them from the component
+                std::vector<Entity> children = e.getComponent<Component::Children>().entities;
+                for (Entity child : children) {
                     if (pparent.isValid()) setParent(child, pparent);
                     else clearParent(child);
                 }
@@ -93,110 +286,631 @@ void GameWorld::setParent(Entity e, Entity parent) {
     if (!parent.hasComponent<Component::Children>())
         parent.addComponent<Component::Children>();
     parent.getComponent<Component::Children>().entities.push_back(e);
-    if (e.hasComponent<Component::Transform>())
-        e.addComponent<Component::Transform::DirtyFlag>();
+    // Marks the node dirty, no need for the DirtyFlag
+    reparentNode(e.id, parent.id);
 }
 
 void GameWorld::clearParent(Entity e) {
     unsetParent(e);
     e.removeComponent<Component::Parent>();
     e.addComponent<Component::TopLevel>();
-    if (e.hasComponent<Component::Transform>())
-        e.addComponent<Component::Transform::DirtyFlag>();
+    // Marks the node dirty, no need for the DirtyFlag
+    reparentNode(e.id, entt::null);
+}
+
+EntityCommandBuffer& GameWorld::getCommandBuffer() {
+    CommandBufferCache& cache = getCommandBufferCache();
+    if (cache.worldID == m_worldID) {
+        return *cache.pBuffer;
+    }
+
+    std::lock_guard<std::mutex> lock(m_commandBuffersMtx);
+
+    std::thread::id threadID = std::this_thread::get_id();
+    auto it = std::find_if(m_commandBuffers.begin(), m_commandBuffers.end(), [threadID] (const auto& pBuffer) {
+        return pBuffer->m_threadID == threadID;
+    });
+
+    EntityCommandBuffer* pBuffer;
+    if (it != m_commandBuffers.end()) {
+        pBuffer = it->get();
+    } else {
+        m_commandBuffers.push_back(std::make_unique<EntityCommandBuffer>());
+        pBuffer = m_commandBuffers.back().get();
+        pBuffer->m_threadID = threadID;
+        pBuffer->m_index = static_cast<uint32_t>(m_commandBuffers.size() - 1);
+    }
+
+    cache.worldID = m_worldID;
+    cache.pBuffer = pBuffer;
+    return *pBuffer;
 }
 
-static void recUpdateTransform(Entity e, glm::mat4 ptfm, bool dirty) {
-    if (e.hasComponent<Component::Transform>()) {
-        Component::Transform& tfm = e.getComponent<Component::Transform>();
-        tfm.lastWorld = tfm.world;
-        if (e.hasComponent<Component::Transform::DirtyFlag>()) {
-            e.removeComponent<Component::Transform::DirtyFlag>();
-            dirty = true;
+void GameWorld::playbackCommands() {
+    typedef EntityCommandBuffer::EntityRef EntityRef;
+
+    std::lock_guard<std::mutex> lock(m_commandBuffersMtx);
+
+    // Create all the new entities at once, numbered by buffer
+    uint32_t numCreated = 0;
+    for (auto& pBuffer : m_commandBuffers) {
+        pBuffer->m_firstCreated = numCreated;
+        numCreated += pBuffer->m_numCreated;
+    }
+    if (numCreated > 0) {
+        m_createdEntities.resize(numCreated);
+        m_registry.create(m_createdEntities.begin(), m_createdEntities.end());
+        m_registry.insert<Component::TopLevel>(m_createdEntities.begin(), m_createdEntities.end());
+        for (entt::entity e : m_createdEntities) {
+            insertNode(e, entt::null);
+        }
+    }
+
+    // null if the entity no longer exists
+    auto resolve = [this] (const EntityRef& ref) -> entt::entity {
+        entt::entity id = ref.m_id;
+        if (ref.m_buffer != EntityRef::NONE) {
+            id = m_createdEntities[m_commandBuffers[ref.m_buffer]->m_firstCreated + ref.m_created];
         }
-        if (dirty) {
-            ptfm *= tfm.local;
-            tfm.world = ptfm;
-        } else {
-            ptfm = tfm.world;
+        return m_registry.valid(id) ? id : entt::null;
+    };
+
+    for (auto& pBuffer : m_commandBuffers) {
+        for (const EntityCommandBuffer::Command& command : pBuffer->m_commands) {
+            entt::entity id = resolve(command.entity);
+            if (id == entt::null) continue;
+
+            switch (command.type) {
+            case EntityCommandBuffer::COMMAND_CREATE:
+                break;
+            case EntityCommandBuffer::COMMAND_DESTROY:
+                m_destroyedEntities.emplace_back(id, static_cast<EntityDestroyMode>(command.param));
+                break;
+            case EntityCommandBuffer::COMMAND_COMPONENT:
+                pBuffer->m_componentOps[command.param](m_registry, id);
+                break;
+            case EntityCommandBuffer::COMMAND_SET_PARENT: {
+                entt::entity parent = resolve(command.parent);
+                if (parent != entt::null) setParent({id, this}, {parent, this});
+                break;
+            }
+            case EntityCommandBuffer::COMMAND_CLEAR_PARENT:
+                if (m_registry.all_of<Component::Parent>(id)) clearParent({id, this});
+                break;
+            }
         }
+        pBuffer->clear();
     }
-    if (e.hasComponent<Component::Children>()) {
-        for (Entity& c : e.getComponent<Component::Children>().entities)
-            recUpdateTransform(c, ptfm, dirty);
+
+    // Destroying a hierarchy may already have destroyed later entities in the list
+    for (auto [id, destroyMode] : m_destroyedEntities) {
+        if (m_registry.valid(id)) destroyEntity({id, this}, destroyMode);
+    }
+
+    m_createdEntities.clear();
+    m_destroyedEntities.clear();
+}
+
+uint32_t GameWorld::getNodeDepth(uint32_t node) const {
+    return static_cast<uint32_t>(std::upper_bound(m_levelBegin.begin(), m_levelBegin.end(), node) - m_levelBegin.begin()) - 1;
+}
+
+uint32_t GameWorld::getNode(entt::entity e) const {
+    return (e == entt::null) ? 0 : m_registry.get<Component::HierarchyNode>(e).index;
+}
+
+void GameWorld::insertNode(entt::entity e, entt::entity parent) {
+    uint32_t parentNode = getNode(parent);
+    uint32_t depth = getNodeDepth(parentNode) + 1;
+    if (depth == getNumLevels()) {
+        m_levelBegin.push_back(m_levelBegin.back());
+        m_levelDirty.push_back(0);
+        m_levelNumChanged.push_back(0);
+    }
+
+    // Open a slot at the end of the array, then pass it up through the deeper levels by moving each one's first node
+    //   to its end, until it is at the end of our level
+    uint32_t slot = static_cast<uint32_t>(m_nodeEntities.size());
+    m_nodeEntities.push_back(entt::null);
+    m_nodeParents.push_back(0);
+    m_nodeWorlds.emplace_back();
+    m_nodeLastWorlds.emplace_back();
+    m_nodeTranslations.emplace_back();
+    m_nodeRotations.emplace_back();
+    m_nodeScales.emplace_back();
+    m_nodeHasTransform.push_back(0);
+    m_nodeDirty.push_back(0);
+    m_nodeChanged.push_back(0);
+    m_nodeBoundsStale.push_back(0);
+    m_nodePoseVersions.push_back(0);
+    ++m_levelBegin.back();
+
+    for (uint32_t level = getNumLevels() - 1; level > depth; --level) {
+        moveNode(m_levelBegin[level], slot);
+        slot = m_levelBegin[level]++;
+    }
+
+    m_nodeEntities[slot] = e;
+    m_nodeParents[slot] = parentNode;
+    m_nodeWorlds[slot] = m_nodeWorlds[parentNode];
+    m_nodeLastWorlds[slot] = m_nodeWorlds[parentNode];
+    m_nodeTranslations[slot] = glm::vec3(0.0f);
+    m_nodeRotations[slot] = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    m_nodeScales[slot] = glm::vec3(1.0f);
+    m_nodeHasTransform[slot] = m_registry.all_of<Component::Transform>(e);
+    m_nodeDirty[slot] = 1;
+    m_nodeChanged[slot] = 0;
+    m_nodeBoundsStale[slot] = 1;
+    m_nodePoseVersions[slot] = 0;
+    m_levelDirty[depth] = 1;
+    m_registry.get_or_emplace<Component::HierarchyNode>(e).index = slot;
+}
+
+void GameWorld::removeNode(uint32_t node) {
+    m_registry.get<Component::HierarchyNode>(m_nodeEntities[node]).index = NODE_NONE;
+
+    // Fill the gap with the last node of the level, which leaves a gap at the start of the next level to fill the same way
+    uint32_t gap = node;
+    for (uint32_t level = getNodeDepth(node); level < getNumLevels(); ++level) {
+        uint32_t last = --m_levelBegin[level + 1];
+        if (last != gap) moveNode(last, gap);
+        gap = last;
+    }
+
+    m_nodeEntities.pop_back();
+    m_nodeParents.pop_back();
+    m_nodeWorlds.pop_back();
+    m_nodeLastWorlds.pop_back();
+    m_nodeTranslations.pop_back();
+    m_nodeRotations.pop_back();
+    m_nodeScales.pop_back();
+    m_nodeHasTransform.pop_back();
+    m_nodeDirty.pop_back();
+    m_nodeChanged.pop_back();
+    m_nodeBoundsStale.pop_back();
+    m_nodePoseVersions.pop_back();
+
+    while (getNumLevels() > 1 && m_levelBegin[getNumLevels() - 1] == m_levelBegin.back()) {
+        m_levelBegin.pop_back();
+        m_levelDirty.pop_back();
+        m_levelNumChanged.pop_back();
+    }
+}
+
+void GameWorld::moveNode(uint32_t from, uint32_t to) {
+    entt::entity e = m_nodeEntities[from];
+    m_nodeEntities[to] = e;
+    m_nodeParents[to] = m_nodeParents[from];
+    m_nodeWorlds[to] = m_nodeWorlds[from];
+    m_nodeLastWorlds[to] = m_nodeLastWorlds[from];
+    m_nodeTranslations[to] = m_nodeTranslations[from];
+    m_nodeRotations[to] = m_nodeRotations[from];
+    m_nodeScales[to] = m_nodeScales[from];
+    m_nodeHasTransform[to] = m_nodeHasTransform[from];
+    m_nodeDirty[to] = m_nodeDirty[from];
+    m_nodeChanged[to] = m_nodeChanged[from];
+    m_nodeBoundsStale[to] = m_nodeBoundsStale[from];
+    m_nodePoseVersions[to] = m_nodePoseVersions[from];
+    m_registry.get<Component::HierarchyNode>(e).index = to;
+
+    // Children which are out of the hierarchy while their subtree is being moved are skipped, they get a new parent anyway
+    if (const auto* pChildren = m_registry.try_get<Component::Children>(e)) {
+        for (const Entity& child : pChildren->entities) {
+            uint32_t childNode = m_registry.get<Component::HierarchyNode>(child.id).index;
+            if (childNode != NODE_NONE) m_nodeParents[childNode] = to;
+        }
     }
 }
 
+void GameWorld::markNodeDirty(uint32_t node) {
+    m_nodeDirty[node] = 1;
+    m_levelDirty[getNodeDepth(node)] = 1;
+}
+
+void GameWorld::reparentNode(entt::entity e, entt::entity parent) {
+    uint32_t node = getNode(e);
+    uint32_t parentNode = getNode(parent);
+    uint32_t depth = getNodeDepth(node);
+    markNodeDirty(node);
+
+    if (depth == getNodeDepth(parentNode) + 1) {
+        m_nodeParents[node] = parentNode;
+        return;
+    }
+
+    // Changing depth moves the whole subtree to other levels. Take it out deepest first, then put it back in from the top
+    std::vector<entt::entity> subtree = {e};
+    for (size_t i = 0; i < subtree.size(); ++i) {
+        if (const auto* pChildren = m_registry.try_get<Component::Children>(subtree[i])) {
+            for (const Entity& child : pChildren->entities) subtree.push_back(child.id);
+        }
+    }
+
+    // The new nodes start out with an identity transform. Keep the entities' own, and their world transforms so the
+    //   next update knows where they were
+    struct NodeTransform {
+        glm::vec3 translation;
+        glm::quat rotation;
+        glm::vec3 scale;
+        math_util::AffineTransform world;
+    };
+    std::vector<NodeTransform> transforms(subtree.size());
+    for (size_t i = 0; i < subtree.size(); ++i) {
+        uint32_t n = getNode(subtree[i]);
+        transforms[i] = {m_nodeTranslations[n], m_nodeRotations[n], m_nodeScales[n], m_nodeWorlds[n]};
+    }
+
+    for (auto it = subtree.rbegin(); it != subtree.rend(); ++it) {
+        removeNode(getNode(*it));
+    }
+
+    for (size_t i = 0; i < subtree.size(); ++i) {
+        insertNode(subtree[i], (i == 0) ? parent : m_registry.get<Component::Parent>(subtree[i]).entity.id);
+        uint32_t n = getNode(subtree[i]);
+        m_nodeTranslations[n] = transforms[i].translation;
+        m_nodeRotations[n] = transforms[i].rotation;
+        m_nodeScales[n] = transforms[i].scale;
+        m_nodeWorlds[n] = transforms[i].world;
+    }
+}
+
+void GameWorld::setLocalTransform(Entity e, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale) {
+    uint32_t node = getNode(e.id);
+    m_nodeTranslations[node] = translation;
+    m_nodeRotations[node] = rotation;
+    m_nodeScales[node] = scale;
+    markNodeDirty(node);
+}
+
+void GameWorld::setLocalTransform(Entity e, const glm::mat4& local) {
+    uint32_t node = getNode(e.id);
+    math_util::decomposeAffineTransform(local, m_nodeTranslations[node], m_nodeRotations[node], m_nodeScales[node]);
+    markNodeDirty(node);
+}
+
+glm::mat4 GameWorld::getLocalTransform(Entity e) const {
+    uint32_t node = getNode(e.id);
+    math_util::AffineTransform local;
+    math_util::composeAffineTransforms(1, &m_nodeTranslations[node], &m_nodeRotations[node], &m_nodeScales[node], &local);
+    return local.toMat4();
+}
+
+const glm::vec3& GameWorld::getLocalTranslation(Entity e) const {
+    return m_nodeTranslations[getNode(e.id)];
+}
+
+const glm::quat& GameWorld::getLocalRotation(Entity e) const {
+    return m_nodeRotations[getNode(e.id)];
+}
+
+const glm::vec3& GameWorld::getLocalScale(Entity e) const {
+    return m_nodeScales[getNode(e.id)];
+}
+
+glm::mat4 GameWorld::getWorldTransform(Entity e) const {
+    return m_nodeWorlds[getNode(e.id)].toMat4();
+}
+
+glm::mat4 GameWorld::getLastWorldTransform(Entity e) const {
+    return m_nodeLastWorlds[getNode(e.id)].toMat4();
+}
+
 void GameWorld::updateHierarchy() {
-    auto topLevelView = m_registry.view<Component::TopLevel>();
-    for (auto e : topLevelView) recUpdateTransform(Entity{e, this}, glm::mat4(1.0f), false);
+    // Mark the nodes of entities whose Transform changed, and the levels they are in
+    for (auto e : m_registry.view<Component::Transform::DirtyFlag>()) {
+        if (const auto* pNode = m_registry.try_get<Component::HierarchyNode>(e)) markNodeDirty(pNode->index);
+    }
+    m_registry.clear<Component::Transform::DirtyFlag>();
+
+    // Each node is a batched affine product at most, and most are skipped
+    static constexpr uint32_t grainSize = 512;
+
+    for (uint32_t level = 1; level < getNumLevels(); ++level) {
+        // Only a dirty node, a parent that changed, or a node that changed last time and needs its lastWorld caught up
+        //   give a level anything to do. For a static scene that is none of them
+        if (!m_levelDirty[level] && m_levelNumChanged[level - 1] == 0 && m_levelNumChanged[level] == 0) continue;
+
+        uint32_t begin = m_levelBegin[level];
+        uint32_t end = m_levelBegin[level + 1];
+        m_numNodesChanged = 0;
+
+        if (!m_pScheduler || end - begin <= grainSize) {
+            updateHierarchyRange(begin, end, reinterpret_cast<uintptr_t>(this));
+        } else {
+            m_pScheduler->parallelFor(begin, end, grainSize, updateHierarchyRange, reinterpret_cast<uintptr_t>(this), m_jobCounter,
+                                      JobScheduler::JOB_PRIORITY_NORMAL, "UpdateHierarchy");
+            m_pScheduler->waitForCounterAndHelp(m_jobCounter);
+        }
+
+        m_levelDirty[level] = 0;
+        m_levelNumChanged[level] = m_numNodesChanged.load();
+    }
+}
+
+void GameWorld::updateHierarchyRange(uint32_t begin, uint32_t end, uintptr_t param) {
+    GameWorld* pWorld = reinterpret_cast<GameWorld*>(param);
+
+    // Parents are all in the level above, which is finished, so reading them while writing this level is safe
+    const uint32_t* pParents = pWorld->m_nodeParents.data();
+    const glm::vec3* pTranslations = pWorld->m_nodeTranslations.data();
+    const glm::quat* pRotations = pWorld->m_nodeRotations.data();
+    const glm::vec3* pScales = pWorld->m_nodeScales.data();
+    const uint8_t* pHasTransform = pWorld->m_nodeHasTransform.data();
+    math_util::AffineTransform* pWorlds = pWorld->m_nodeWorlds.data();
+    math_util::AffineTransform* pLastWorlds = pWorld->m_nodeLastWorlds.data();
+    uint8_t* pDirty = pWorld->m_nodeDirty.data();
+    uint8_t* pChanged = pWorld->m_nodeChanged.data();
+    uint8_t* pBoundsStale = pWorld->m_nodeBoundsStale.data();
+
+    // Nodes with a Transform are gathered and composed in batches, local transforms and then the products with their
+    //   parents' world transforms
+    static constexpr uint32_t batchSize = 64;
+    uint32_t batchNodes[batchSize];
+    glm::vec3 batchTranslations[batchSize];
+    glm::quat batchRotations[batchSize];
+    glm::vec3 batchScales[batchSize];
+    math_util::AffineTransform batchParents[batchSize];
+    math_util::AffineTransform batchWorlds[batchSize];
+    uint32_t batchCount = 0;
+
+    const auto flushBatch = [&] () {
+        math_util::composeAffineTransforms(batchCount, batchTranslations, batchRotations, batchScales, batchWorlds);
+        math_util::multiplyAffineTransforms(batchCount, batchParents, batchWorlds, batchWorlds);
+        for (uint32_t k = 0; k < batchCount; ++k) pWorlds[batchNodes[k]] = batchWorlds[k];
+        batchCount = 0;
+    };
+
+    uint32_t numChanged = 0;
+    for (uint32_t i = begin; i < end; ++i) {
+        uint32_t parent = pParents[i];
+        if (!(pDirty[i] | pChanged[parent])) {
+            // Unchanged this time. If it changed last time its lastWorld is a frame behind
+            if (pChanged[i]) {
+                pChanged[i] = 0;
+                pLastWorlds[i] = pWorlds[i];
+            }
+            continue;
+        }
+
+        pDirty[i] = 0;
+        pChanged[i] = 1;
+        pBoundsStale[i] = 1;
+        ++numChanged;
+
+        pLastWorlds[i] = pWorlds[i];
+        if (pHasTransform[i]) {
+            batchNodes[batchCount] = i;
+            batchTranslations[batchCount] = pTranslations[i];
+            batchRotations[batchCount] = pRotations[i];
+            batchScales[batchCount] = pScales[i];
+            batchParents[batchCount] = pWorlds[parent];
+            if (++batchCount == batchSize) flushBatch();
+        } else {
+            pWorlds[i] = pWorlds[parent];
+        }
+    }
+
+    flushBatch();
+
+    pWorld->m_numNodesChanged += numChanged;
 }
 
 void GameWorld::updateBoundingSpheres() {
-    auto nonSkeletalView =
-        m_registry.view<Component::Transform,
-                        Component::Renderable>(
-                            entt::exclude<Component::Renderable::SkeletalFlag>);
+    // Most spheres are skipped or batched with others, only skinned ones take much work
+    static constexpr uint32_t grainSize = 256;
+
+    uint32_t count = static_cast<uint32_t>(m_registry.view<Component::Renderable>().size());
+
+    if (!m_pScheduler) {
+        updateBoundingSpheresRange(0, count, reinterpret_cast<uintptr_t>(this));
+    } else {
+        m_pScheduler->parallelFor(0, count, grainSize, updateBoundingSpheresRange, reinterpret_cast<uintptr_t>(this), m_jobCounter,
+                                  JobScheduler::JOB_PRIORITY_NORMAL, "UpdateBoundingSpheres");
+        m_pScheduler->waitForCounterAndHelp(m_jobCounter);
+    }
+
+    updateBVH();
+}
+
+void GameWorld::updateBoundingSpheresRange(uint32_t begin, uint32_t end, uintptr_t param) {
+    GameWorld* pWorld = reinterpret_cast<GameWorld*>(param);
+    entt::registry& registry = pWorld->m_registry;
+
+    auto view = registry.view<const Component::Renderable>();
+    auto skeletalView = registry.view<const Component::Renderable::SkeletalFlag>();
+    auto sphereView = registry.view<BoundingSphere>();
+    auto nodeView = registry.view<const Component::HierarchyNode>();
+
+    const entt::entity* pEntities = view.data();
+
+    // Rigid spheres are gathered and transformed in batches
+    static constexpr uint32_t batchSize = 64;
+    math_util::AffineTransform batchTransforms[batchSize];
+    BoundingSphere batchSpheres[batchSize];
+    BoundingSphere* pBatchOut[batchSize];
+    uint32_t batchCount = 0;
+
+    const auto flushBatch = [&] () {
+        math_util::transformBoundingSpheres(batchCount, batchTransforms, batchSpheres, batchSpheres);
+        for (uint32_t k = 0; k < batchCount; ++k) *pBatchOut[k] = batchSpheres[k];
+        batchCount = 0;
+    };
 
-    for (auto e : nonSkeletalView) {
-        const auto& t = nonSkeletalView.get<Component::Transform>(e);
-        const auto& r = nonSkeletalView.get<Component::Renderable>(e);
+    std::vector<BoundingSphere> jointSpheres;
 
+    // Renderables outside the hierarchy stay at the origin
+    const math_util::AffineTransform identity;
+
+    // Handed over all at once, the BVH is updated on one thread afterwards
+    std::vector<entt::entity> changed;
+
+    for (uint32_t i = begin; i < end; ++i) {
+        entt::entity e = pEntities[i];
+
+        const auto& r = view.get<const Component::Renderable>(e);
         if (!r.pModel) continue;
-        BoundingSphere b = r.pModel->getBoundingSphere();
-        b.position = glm::vec3(t.world * glm::vec4(b.position, 1.0f));
-        glm::mat3 inner(t.world);
-        float scale = std::sqrt(std::max({ glm::dot(inner[0], inner[0]),
-                                           glm::dot(inner[1], inner[1]),
-                                           glm::dot(inner[2], inner[2]) }));
-        b.radius *= scale;
-        m_registry.replace<BoundingSphere>(e, b);
-    }
-
-    auto skeletalView =
-        m_registry.view<Component::Transform,
-                        Component::Renderable,
-                        Component::Renderable::SkeletalFlag>();
-
-    for (auto e : skeletalView) {
-        const auto& t = skeletalView.get<Component::Transform>(e);
-        const auto& r = skeletalView.get<Component::Renderable>(e);
-
-        const auto& jointSpheres = r.pModel->getJointBoundingSpheres();
-        BoundingSphere b;
-        glm::mat3 inner(t.world);
-        float scale = std::sqrt(std::max({ glm::dot(inner[0], inner[0]),
-                                           glm::dot(inner[1], inner[1]),
-                                           glm::dot(inner[2], inner[2]) }));
-        for (auto i = 0u; i < jointSpheres.size(); ++i) {
-            glm::mat4 jointMatrix = t.world * r.pSkeleton->getSkinningMatrices()[i];
-            BoundingSphere b1;
-            b1.position = glm::vec3(jointMatrix * glm::vec4(jointSpheres[i].position, 1.0f));
-            b1.radius = scale * jointSpheres[i].radius;
-            if (i == 0) b = b1;
-            else b.add(b1);
+
+        bool skeletal = skeletalView.contains(e);
+
+        // Each entity has its own node, so its flags can be read and cleared here
+        uint32_t node = nodeView.contains(e) ? nodeView.get<const Component::HierarchyNode>(e).index : NODE_NONE;
+        if (node != NODE_NONE) {
+            bool poseChanged = skeletal && r.pSkeleton->getPoseVersion() != pWorld->m_nodePoseVersions[node];
+            if (!pWorld->m_nodeBoundsStale[node] && !poseChanged) continue;
+
+            pWorld->m_nodeBoundsStale[node] = 0;
+            if (skeletal) pWorld->m_nodePoseVersions[node] = r.pSkeleton->getPoseVersion();
+        }
+
+        const math_util::AffineTransform& world = (node != NODE_NONE) ? pWorld->m_nodeWorlds[node] : identity;
+
+        // Written in place rather than with replace(), there are no listeners and signals aren't safe to publish from several threads
+        BoundingSphere& b = sphereView.get<BoundingSphere>(e);
+        changed.push_back(e);
+
+        if (!skeletal) {
+            batchTransforms[batchCount] = world;
+            batchSpheres[batchCount] = r.pModel->getBoundingSphere();
+            pBatchOut[batchCount] = &b;
+            if (++batchCount == batchSize) flushBatch();
+        } else {
+            // Merged in model space and then transformed once, rather than transforming every joint sphere by the world matrix
+            const auto& modelJointSpheres = r.pModel->getJointBoundingSpheres();
+            int numJoints = static_cast<int>(modelJointSpheres.size());
+            jointSpheres.resize(numJoints);
+            math_util::transformBoundingSpheres(numJoints, r.pSkeleton->getSkinningMatrices().data(), modelJointSpheres.data(),
+                                                jointSpheres.data());
+            BoundingSphere modelSphere = math_util::mergeBoundingSpheres(numJoints, jointSpheres.data());
+            math_util::transformBoundingSpheres(1, &world, &modelSphere, &b);
+        }
+    }
+
+    flushBatch();
+
+    if (!changed.empty()) {
+        std::lock_guard<std::mutex> lock(pWorld->m_boundsChangedMtx);
+        pWorld->m_boundsChanged.insert(pWorld->m_boundsChanged.end(), changed.begin(), changed.end());
+    }
+}
+
+void GameWorld::updateBVH() {
+    // Inserting leaves one at a time makes a worse tree than building it from all of them
+    static constexpr uint32_t minRebuildInserts = 64;
+
+    uint32_t numInserted = 0;
+    for (entt::entity e : m_boundsChanged) {
+        const BoundingSphere& b = m_registry.get<BoundingSphere>(e);
+        if (auto pProxy = m_registry.try_get<Component::BVHProxy>(e)) {
+            m_bvh.update(pProxy->index, b);
+        } else {
+            m_registry.emplace<Component::BVHProxy>(e, m_bvh.insert(b, entt::to_integral(e)));
+            ++numInserted;
         }
-        m_registry.replace<BoundingSphere>(e, b);
+    }
+    m_boundsChanged.clear();
+
+    if (numInserted >= minRebuildInserts && numInserted * 4 >= m_bvh.getNumLeaves()) {
+        m_bvh.rebuild();
+    }
+}
+
+void GameWorld::rebuildBVH() {
+    m_bvh.rebuild();
+}
+
+void GameWorld::queryFrustum(const glm::mat4& frustumMatrix, std::vector<Entity>& results) {
+    std::vector<uint32_t> ids;
+    m_bvh.queryFrustum(math_util::frustumPlanes(frustumMatrix), ids);
+    appendQueryResults(ids, results);
+}
+
+void GameWorld::querySphere(const BoundingSphere& sphere, std::vector<Entity>& results) {
+    std::vector<uint32_t> ids;
+    m_bvh.querySphere(sphere, ids);
+    appendQueryResults(ids, results);
+}
+
+void GameWorld::queryAABB(const glm::vec3& boundsMin, const glm::vec3& boundsMax, std::vector<Entity>& results) {
+    std::vector<uint32_t> ids;
+    m_bvh.queryAABB(boundsMin, boundsMax, ids);
+    appendQueryResults(ids, results);
+}
+
+void GameWorld::queryRay(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, std::vector<Entity>& results) {
+    std::vector<uint32_t> ids;
+    m_bvh.queryRay(origin, direction, maxDistance, ids);
+    appendQueryResults(ids, results);
+}
+
+void GameWorld::appendQueryResults(const std::vector<uint32_t>& ids, std::vector<Entity>& results) {
+    results.reserve(results.size() + ids.size());
+    for (uint32_t id : ids) {
+        results.push_back({static_cast<entt::entity>(id), this});
     }
 }
 
 void GameWorld::postPhysicsUpdate() {
-    m_registry.view<Component::Transform, Component::RigidBodyID>().each(
-        [this] (auto e, auto& tfm, auto& rb) {
-            tfm.local = rb.pPhysics->getRigidBody(rb.id)->getWorldTransform();
-            m_registry.emplace_or_replace<Component::Transform::DirtyFlag>(e);
-        });
+    auto view = m_registry.view<const Component::RigidBodyID, const Component::Transform>();
+    for (auto e : view) {
+        const auto& rb = view.get<const Component::RigidBodyID>(e);
+        setLocalTransform({e, this}, rb.pPhysics->getRigidBody(rb.id)->getWorldTransform());
+    }
 }
 
 void GameWorld::preRenderUpdate(bool doUpdateHierarchy) {
     if (doUpdateHierarchy) updateHierarchy();
 
-    // Sort renderables such that all instances of a given model form a contiguous block
-    // and any instances of a model without a skeleton occur before any instances of that model with a skeleton
-    m_registry.sort<Component::Renderable>(
-        [] (const Component::Renderable& r1, const Component::Renderable& r2) {
-            return r1.pModel < r2.pModel || (r1.pModel == r2.pModel && !r1.pSkeleton && r2.pSkeleton); },
-        entt::insertion_sort {});
+    updateRenderBuckets();
+
+    auto pointLightView = m_registry.view<PointLight, const Component::HierarchyNode, const Component::Transform>();
+    for (auto e : pointLightView) {
+        uint32_t node = pointLightView.get<const Component::HierarchyNode>(e).index;
+        pointLightView.get<PointLight>(e).setPosition(m_nodeWorlds[node].getTranslation());
+    }
+}
+
+void GameWorld::updateRenderBuckets() {
+    for (auto e : m_registry.view<Component::RenderBucketID::DirtyFlag>()) {
+        const Component::Renderable& renderable = m_registry.get<Component::Renderable>(e);
+        uint32_t bucket = getRenderBucket(renderable.pModel, renderable.pSkeleton != nullptr);
+
+        if (auto pBucketID = m_registry.try_get<Component::RenderBucketID>(e)) {
+            if (pBucketID->index == bucket) continue;
+            --m_renderBuckets[pBucketID->index].numRenderables;
+            pBucketID->index = bucket;
+        } else {
+            m_registry.emplace<Component::RenderBucketID>(e, bucket);
+        }
+        ++m_renderBuckets[bucket].numRenderables;
+    }
+    m_registry.clear<Component::RenderBucketID::DirtyFlag>();
+}
+
+uint32_t GameWorld::getRenderBucket(const Model* pModel, bool skinned) {
+    auto [it, inserted] = m_renderBucketIndices.try_emplace({pModel, skinned}, static_cast<uint32_t>(m_renderBuckets.size()));
+    if (inserted) m_renderBuckets.push_back({pModel, skinned, 0});
+    return it->second;
+}
+
+void GameWorld::onConstructTransform(entt::registry& r, entt::entity e) {
+    if (const auto* pNode = r.try_get<Component::HierarchyNode>(e); pNode && pNode->index != NODE_NONE) {
+        m_nodeHasTransform[pNode->index] = 1;
+        markNodeDirty(pNode->index);
+    }
+}
+
+// The node is already gone if the whole entity is being destroyed
+void GameWorld::onDestroyTransform(entt::registry& r, entt::entity e) {
+    if (const auto* pNode = r.try_get<Component::HierarchyNode>(e); pNode && pNode->index != NODE_NONE) {
+        m_nodeHasTransform[pNode->index] = 0;
+        markNodeDirty(pNode->index);
+    }
+}
+
+void GameWorld::onDestroyRenderBucketID(entt::registry& r, entt::entity e) {
+    --m_renderBuckets[r.get<Component::RenderBucketID>(e).index].numRenderables;
+}
 
-    m_registry.view<PointLight, const Component::Transform>().each(
-        [] (auto& pl, auto& tfm) { pl.setPosition(tfm.world[3]); });
+void GameWorld::onDestroyBVHProxy(entt::registry& r, entt::entity e) {
+    m_bvh.remove(r.get<Component::BVHProxy>(e).index);
 }
@@ -1,11 +1,26 @@
 #ifndef GAME_WORLD_H_INCLUDED
 #define GAME_WORLD_H_INCLUDED
 
+#include <atomic>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
 #include <entt/entt.hpp>
+#include <glm/glm.hpp>
+
+#include "core/job_scheduler.h"
+#include "core/scene/dynamic_bvh.h"
+#include "core/util/math_util.h"
 
 //#include "core/physics/physics.h"
 //#include "core/scene/scene.h"
 
+class EntityCommandBuffer;
+class Model;
 struct Entity;
 
 enum EntityDestroyMode { ENTITY_DESTROY_HIERARCHY, ENTITY_DESTROY_REPARENT, ENTITY_DESTROY_CLEAR_PARENT };
@@ -15,20 +30,78 @@ class GameWorld {
     // I don't really want to expose entt directly to all my code
     friend struct Entity;
     friend class EditorGUI;
+    friend class WorldFile;
 
 public:
 
+    // Renderables of the same model, and either all skinned or all not. Buckets are kept once created, even when empty
+    struct RenderBucket {
+        const Model* pModel;
+        bool skinned;
+        uint32_t numRenderables;
+    };
+
     GameWorld();
 
+    ~GameWorld();
+
     Entity createEntity();
 
+    static constexpr uint32_t NO_PARENT = std::numeric_limits<uint32_t>::max();
+
+    // Create count entities at once, as createEntity() and setParent() would one at a time. parents holds each one's
+    //   parent as an index into the new entities, or NO_PARENT, and a parent must come before its children
+    // The hierarchy's arrays are rebuilt once, rather than shuffled for every entity, so this is for loading worlds
+    void createEntities(uint32_t count, const uint32_t* parents, entt::entity* entitiesOut);
+
     void destroyEntity(Entity e, EntityDestroyMode destroyMode = ENTITY_DESTROY_CLEAR_PARENT);
 
     bool isEntityValid(Entity e) const;
 
+    // Used to run per-entity updates in parallel. If no scheduler is set they run on the calling thread
+    void setJobScheduler(JobScheduler* pScheduler);
+
     void setParent(Entity e, Entity parent);
     void clearParent(Entity e);
 
+    // Transforms are kept in the hierarchy's node arrays rather than in Component::Transform, which only marks the
+    //   entities which have their own. The local transform is a translation, rotation and scale, the world transform
+    //   an affine 3x4, so updateHierarchy() builds and composes them in batches, without any 4x4 matrix products
+    // Setting the local transform marks it dirty for the next updateHierarchy(). It is kept while the entity has no
+    //   Transform, but not used, the entity takes its parent's world transform
+    void setLocalTransform(Entity e, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale);
+
+    // The matrix is split into translation, rotation and scale, so any shear is lost
+    void setLocalTransform(Entity e, const glm::mat4& local);
+
+    glm::mat4 getLocalTransform(Entity e) const;
+    const glm::vec3& getLocalTranslation(Entity e) const;
+    const glm::quat& getLocalRotation(Entity e) const;
+    const glm::vec3& getLocalScale(Entity e) const;
+
+    // As of the last updateHierarchy(). The last world transform is the one before the last time it changed
+    glm::mat4 getWorldTransform(Entity e) const;
+    glm::mat4 getLastWorldTransform(Entity e) const;
+
+    // Indexed by Component::HierarchyNode::index, for reading many entities' transforms at once
+    const std::vector<math_util::AffineTransform>& getNodeWorldTransforms() const {
+        return m_nodeWorlds;
+    }
+
+    const std::vector<math_util::AffineTransform>& getNodeLastWorldTransforms() const {
+        return m_nodeLastWorlds;
+    }
+
+    // The calling thread's command buffer, for changing entities from jobs. The changes are made by playbackCommands()
+    // A job which waits on a counter may resume on another thread, so it should get the buffer again afterwards
+    EntityCommandBuffer& getCommandBuffer();
+
+    // Make the changes recorded in every thread's command buffer, and clear them
+    // All the new entities are created first, then each buffer's other commands run in the order they were recorded,
+    //   and the destroyed entities are destroyed last. Commands on entities which no longer exist are skipped
+    // Call where no jobs are using the world or recording commands, e.g. between the update and preRenderUpdate()
+    void playbackCommands();
+
     /*void setScene(Scene* pScene) {
         m_pScene = pScene;
     }
@@ -53,19 +126,49 @@ public:
         return m_pPhysics;
     }*/
 
-    // walk the node hierarchy and update the world transforms based on the local transform
+    // update the world transforms of entities which are dirty, or whose parent's world transform changed, based on the local transform
     // called automatically in preRenderUpdate(), but if world transforms are needed before then it can be called earlier
+    // Each level of the hierarchy is updated in parallel, after the one above it. Levels where nothing changed are skipped
     void updateHierarchy();
 
+    // Recompute the world space bounding sphere of every Renderable from its Transform and Model
+    // Only spheres whose world transform or skeleton pose changed since they were last computed are updated, and then
+    //   moved in the BVH
+    // Blocks until all spheres are updated
     void updateBoundingSpheres();
 
-    // Sync the entities' Transform components with the RigidBody transforms
+    // Rebuild the BVH from scratch. Done automatically when many renderables are added at once, but worth calling
+    //   after a lot of them have moved a long way
+    void rebuildBVH();
+
+    // Renderables whose bounding sphere is in the frustum, touches the sphere or box, or is hit by the ray within
+    //   maxDistance, in units of direction's length. Found with the BVH, so as of the last updateBoundingSpheres()
+    // The entities are appended to results, in no particular order
+    void queryFrustum(const glm::mat4& frustumMatrix, std::vector<Entity>& results);
+    void querySphere(const BoundingSphere& sphere, std::vector<Entity>& results);
+    void queryAABB(const glm::vec3& boundsMin, const glm::vec3& boundsMax, std::vector<Entity>& results);
+    void queryRay(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, std::vector<Entity>& results);
+
+    // Leaves hold the entities' ids as user data
+    const DynamicBVH& getBVH() const {
+        return m_bvh;
+    }
+
+    // Set the local transforms of entities with a Transform to their RigidBody transforms
     void postPhysicsUpdate();
 
+    // Move renderables whose Renderable component was added or updated into the bucket for its model
+    // Called automatically in preRenderUpdate()
+    void updateRenderBuckets();
+
     // Sync the entities' Renderable transforms with the Transform components
     // Set doUpdateHierarchy to false if the hierarchy has been updated manually and is still valid
     void preRenderUpdate(bool doUpdateHierarchy=true);
 
+    const std::vector<RenderBucket>& getRenderBuckets() const {
+        return m_renderBuckets;
+    }
+
     entt::registry& getRegistry() {
         return m_registry;
     }
@@ -78,6 +181,108 @@ private:
 
     entt::registry m_registry;
 
+    JobScheduler* m_pScheduler = nullptr;
+    JobScheduler::CounterHandle m_jobCounter = JobScheduler::COUNTER_NULL;
+
+    // The transform hierarchy flattened into arrays by node, sorted by depth, so a level can be updated in parallel once the
+    //   level above it is done. Node 0 stands in for the parent of the top level entities, at depth 0
+    // Each entity knows its node from its Component::HierarchyNode. Nodes are only ever moved within their own level, so
+    //   adding, removing or reparenting an entity moves at most one node per level below it
+    std::vector<entt::entity> m_nodeEntities;
+    std::vector<uint32_t> m_nodeParents;
+
+    // What the node passes down to its children: its world transform, or its parent's if it has no Transform
+    std::vector<math_util::AffineTransform> m_nodeWorlds;
+    std::vector<math_util::AffineTransform> m_nodeLastWorlds;
+
+    // The local transform, only used if the node's entity has a Transform
+    std::vector<glm::vec3> m_nodeTranslations;
+    std::vector<glm::quat> m_nodeRotations;
+    std::vector<glm::vec3> m_nodeScales;
+    std::vector<uint8_t> m_nodeHasTransform;
+
+    // Dirty nodes need updating. Changed nodes were updated last time, so their children need updating too, and their
+    //   lastWorld needs to catch up if they aren't updated again
+    std::vector<uint8_t> m_nodeDirty;
+    std::vector<uint8_t> m_nodeChanged;
+
+    // For updateBoundingSpheres(). Set when the node's world transform is updated, cleared once its sphere is, and the
+    //   skeleton pose version the sphere was last computed for
+    std::vector<uint8_t> m_nodeBoundsStale;
+    std::vector<uint32_t> m_nodePoseVersions;
+
+    // Index of the first node of each level, plus the node count at the end
+    std::vector<uint32_t> m_levelBegin;
+    std::vector<uint8_t> m_levelDirty;
+    std::vector<uint32_t> m_levelNumChanged;
+
+    // Summed by the jobs updating a level
+    std::atomic<uint32_t> m_numNodesChanged{0};
+
+    static constexpr uint32_t NODE_NONE = std::numeric_limits<uint32_t>::max();
+
+    DynamicBVH m_bvh;
+
+    // Renderables whose bounding sphere changed in updateBoundingSpheres(), appended to by its range jobs
+    std::vector<entt::entity> m_boundsChanged;
+    std::mutex m_boundsChangedMtx;
+
+    std::vector<RenderBucket> m_renderBuckets;
+    std::map<std::pair<const Model*, bool>, uint32_t> m_renderBucketIndices;
+
+    // One per thread which has recorded commands. Threads find theirs through a thread_local cache, as JobTracer does
+    std::vector<std::unique_ptr<EntityCommandBuffer>> m_commandBuffers;
+    std::mutex m_commandBuffersMtx;
+    const uint64_t m_worldID;
+
+    // Reused by playbackCommands()
+    std::vector<entt::entity> m_createdEntities;
+    std::vector<std::pair<entt::entity, EntityDestroyMode>> m_destroyedEntities;
+
+    uint32_t getNumLevels() const {
+        return static_cast<uint32_t>(m_levelBegin.size() - 1);
+    }
+
+    uint32_t getNodeDepth(uint32_t node) const;
+
+    // The node of an entity in the hierarchy, or the root's for the null entity
+    uint32_t getNode(entt::entity e) const;
+
+    // Add a node for an entity which has none as the last child of parent's node. Nodes of deeper levels are moved
+    //   down to make room
+    void insertNode(entt::entity e, entt::entity parent);
+
+    // Remove a node, moving up nodes of deeper levels to fill the gap. Its children must be removed first, or with it
+    void removeNode(uint32_t node);
+
+    void moveNode(uint32_t from, uint32_t to);
+
+    void markNodeDirty(uint32_t node);
+
+    // Give the entity's node a new parent, after its Parent and Children components have been updated
+    void reparentNode(entt::entity e, entt::entity parent);
+
+    // Connected to on_construct and on_destroy of Component::Transform, to mark whether the node uses its local transform
+    void onConstructTransform(entt::registry& r, entt::entity e);
+    void onDestroyTransform(entt::registry& r, entt::entity e);
+
+    uint32_t getRenderBucket(const Model* pModel, bool skinned);
+
+    // Connected to on_destroy of Component::RenderBucketID, which is removed along with the Renderable
+    void onDestroyRenderBucketID(entt::registry& r, entt::entity e);
+
+    // Connected to on_destroy of Component::BVHProxy, which is also removed along with the Renderable
+    void onDestroyBVHProxy(entt::registry& r, entt::entity e);
+
+    // Insert or move the leaves of the renderables in m_boundsChanged
+    void updateBVH();
+
+    void appendQueryResults(const std::vector<uint32_t>& ids, std::vector<Entity>& results);
+
+    static void updateHierarchyRange(uint32_t begin, uint32_t end, uintptr_t param);
+
+    static void updateBoundingSpheresRange(uint32_t begin, uint32_t end, uintptr_t param);
+
     //Scene* m_pScene;
     //PhysicsSystem* m_pPhysics;
 
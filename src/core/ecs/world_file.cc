@@ -0,0 +1,654 @@
+#include "world_file.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include <nlohmann/json.hpp>
+
+#include "components.h"
+
+#include "core/scene/point_light.h"
+#include "core/scene/renderable.h"
+#include "core/util/mapped_file.h"
+
+bool WorldResources::addModel(uint64_t id, Model* pModel) {
+    if (id == ID_NONE || !m_models.try_emplace(id, pModel).second) return false;
+    m_modelIDs.try_emplace(pModel, id);
+    return true;
+}
+
+Model* WorldResources::getModel(uint64_t id) const {
+    auto it = m_models.find(id);
+    return (it != m_models.end()) ? it->second : nullptr;
+}
+
+uint64_t WorldResources::getModelID(const Model* pModel) const {
+    auto it = m_modelIDs.find(pModel);
+    return (it != m_modelIDs.end()) ? it->second : ID_NONE;
+}
+
+uint64_t WorldResources::hashName(const std::string& name) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (char c : name) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3ull;
+    }
+    return (hash != ID_NONE) ? hash : 1;
+}
+
+namespace {
+
+constexpr char MAGIC[8] = {'V', 'K', 'W', 'O', 'R', 'L', 'D', '\0'};
+
+enum SectionType : uint32_t {
+    SECTION_PARENTS = 1,
+    SECTION_TRANSLATIONS,
+    SECTION_ROTATIONS,
+    SECTION_SCALES,
+    SECTION_TRANSFORMS,
+    SECTION_NAMES,
+    SECTION_RENDERABLES,
+    SECTION_POINT_LIGHTS,
+};
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numEntities;
+    uint32_t numSections;
+    uint32_t reserved;
+    uint64_t fileSize;
+};
+
+// Component sections have count entities, listed at entitiesOffset. The dense sections have none, and count is the
+//   number of entities. Names have no fixed element size: their data is count + 1 offsets into the characters after them
+struct SectionHeader {
+    uint32_t type;
+    uint32_t elementSize;
+    uint64_t count;
+    uint64_t entitiesOffset;
+    uint64_t dataOffset;
+    uint64_t dataSize;
+};
+
+enum RenderableFlags : uint32_t { RENDERABLE_SKINNED = 1 };
+
+struct RenderableRecord {
+    uint64_t modelID;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+enum PointLightFlags : uint32_t { POINT_LIGHT_SHADOW_MAP = 1 };
+
+struct PointLightRecord {
+    glm::vec3 position;
+    glm::vec3 intensity;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(FileHeader) == 32, "FileHeader must be packed");
+static_assert(sizeof(SectionHeader) == 40, "SectionHeader must be packed");
+static_assert(sizeof(RenderableRecord) == 16, "RenderableRecord must be packed");
+static_assert(sizeof(PointLightRecord) == 32, "PointLightRecord must be packed");
+static_assert(sizeof(glm::vec3) == 12 && sizeof(glm::vec4) == 16, "glm vectors must be packed floats");
+
+constexpr uint64_t SECTION_ALIGNMENT = 16;
+
+template <typename T>
+struct ComponentArray {
+    uint64_t count = 0;
+    const uint32_t* pEntities = nullptr;
+    const T* pData = nullptr;
+};
+
+}  // namespace
+
+// What a file holds, wherever it is. Binary files are read in place, JSON files are parsed into Buffers first
+// Rotations are (x, y, z, w), whatever glm's quaternion layout is
+struct WorldData::Contents {
+    uint32_t numEntities = 0;
+    const uint32_t* pParents = nullptr;
+    const glm::vec3* pTranslations = nullptr;
+    const glm::vec4* pRotations = nullptr;
+    const glm::vec3* pScales = nullptr;
+
+    ComponentArray<void> transforms;
+
+    ComponentArray<uint32_t> names;
+    const char* pNameChars = nullptr;
+    uint64_t nameCharsSize = 0;
+
+    ComponentArray<RenderableRecord> renderables;
+    ComponentArray<PointLightRecord> pointLights;
+};
+
+struct WorldData::Buffers {
+    std::vector<uint32_t> parents;
+    std::vector<glm::vec3> translations;
+    std::vector<glm::vec4> rotations;
+    std::vector<glm::vec3> scales;
+
+    std::vector<uint32_t> transformEntities;
+
+    std::vector<uint32_t> nameEntities;
+    std::vector<uint32_t> nameOffsets = {0};
+    std::string nameChars;
+
+    std::vector<uint32_t> renderableEntities;
+    std::vector<RenderableRecord> renderables;
+
+    std::vector<uint32_t> pointLightEntities;
+    std::vector<PointLightRecord> pointLights;
+
+    Contents getContents() const {
+        Contents contents;
+        contents.numEntities = static_cast<uint32_t>(parents.size());
+        contents.pParents = parents.data();
+        contents.pTranslations = translations.data();
+        contents.pRotations = rotations.data();
+        contents.pScales = scales.data();
+        contents.transforms = {transformEntities.size(), transformEntities.data(), nullptr};
+        contents.names = {nameEntities.size(), nameEntities.data(), nameOffsets.data()};
+        contents.pNameChars = nameChars.data();
+        contents.nameCharsSize = nameChars.size();
+        contents.renderables = {renderableEntities.size(), renderableEntities.data(), renderables.data()};
+        contents.pointLights = {pointLightEntities.size(), pointLightEntities.data(), pointLights.data()};
+        return contents;
+    }
+};
+
+WorldData::WorldData() {
+}
+
+// Out of line, where MappedFile, Buffers and Contents are complete
+WorldData::~WorldData() {
+}
+
+uint32_t WorldData::getNumEntities() const {
+    return m_pContents->numEntities;
+}
+
+void WorldFile::gather(const GameWorld* pWorld, const WorldResources& resources, WorldData::Buffers& buffers) {
+    const entt::registry& registry = pWorld->m_registry;
+
+    // Node 0 is the root, every other node is an entity. Nodes are sorted by depth, so parents come first
+    uint32_t numEntities = static_cast<uint32_t>(pWorld->m_nodeEntities.size() - 1);
+    buffers.parents.resize(numEntities);
+    buffers.translations.resize(numEntities);
+    buffers.rotations.resize(numEntities);
+    buffers.scales.resize(numEntities);
+
+    for (uint32_t i = 0; i < numEntities; ++i) {
+        uint32_t node = i + 1;
+        entt::entity e = pWorld->m_nodeEntities[node];
+
+        uint32_t parentNode = pWorld->m_nodeParents[node];
+        buffers.parents[i] = (parentNode == 0) ? GameWorld::NO_PARENT : parentNode - 1;
+        buffers.translations[i] = pWorld->m_nodeTranslations[node];
+        const glm::quat& r = pWorld->m_nodeRotations[node];
+        buffers.rotations[i] = glm::vec4(r.x, r.y, r.z, r.w);
+        buffers.scales[i] = pWorld->m_nodeScales[node];
+
+        if (pWorld->m_nodeHasTransform[node]) buffers.transformEntities.push_back(i);
+
+        if (const auto* pName = registry.try_get<Component::Name>(e)) {
+            buffers.nameEntities.push_back(i);
+            buffers.nameChars += pName->str;
+            buffers.nameOffsets.push_back(static_cast<uint32_t>(buffers.nameChars.size()));
+        }
+
+        if (const auto* pRenderable = registry.try_get<Component::Renderable>(e)) {
+            uint64_t modelID = resources.getModelID(pRenderable->pModel);
+            if (pRenderable->pModel && modelID == WorldResources::ID_NONE) {
+                throw std::runtime_error("A renderable's model has no ID in the world resources");
+            }
+            buffers.renderableEntities.push_back(i);
+            buffers.renderables.push_back({modelID, pRenderable->pSkeleton ? RENDERABLE_SKINNED : 0u, 0});
+        }
+
+        if (const auto* pLight = registry.try_get<PointLight>(e)) {
+            buffers.pointLightEntities.push_back(i);
+            buffers.pointLights.push_back({pLight->getPosition(), pLight->getIntensity(),
+                                           pLight->isShadowMapEnabled() ? POINT_LIGHT_SHADOW_MAP : 0u, 0});
+        }
+    }
+}
+
+// Write to a temporary file first, so a failed save doesn't lose the old one
+static void writeFile(const std::string& fileName, const char* data, size_t size) {
+    std::string tempName = fileName + ".tmp";
+    {
+        std::ofstream file(tempName, std::ios::binary | std::ios::trunc);
+        if (!file) throw std::runtime_error("Failed to open " + tempName + " for writing");
+        file.write(data, static_cast<std::streamsize>(size));
+        if (!file) throw std::runtime_error("Failed to write " + tempName);
+    }
+    std::error_code error;
+    std::filesystem::rename(tempName, fileName, error);
+    if (error) throw std::runtime_error("Failed to replace " + fileName + ": " + error.message());
+}
+
+void WorldFile::save(const GameWorld* pWorld, const WorldResources& resources, const std::string& fileName) {
+    WorldData::Buffers buffers;
+    gather(pWorld, resources, buffers);
+    WorldData::Contents contents = buffers.getContents();
+    uint64_t numEntities = contents.numEntities;
+
+    struct Section {
+        SectionType type;
+        uint32_t elementSize;
+        uint64_t count;
+        const void* pEntities;
+        const void* pData;
+        uint64_t dataSize;
+    };
+    const Section sections[] = {
+        {SECTION_PARENTS, sizeof(uint32_t), numEntities, nullptr, contents.pParents, numEntities * sizeof(uint32_t)},
+        {SECTION_TRANSLATIONS, sizeof(glm::vec3), numEntities, nullptr, contents.pTranslations, numEntities * sizeof(glm::vec3)},
+        {SECTION_ROTATIONS, sizeof(glm::vec4), numEntities, nullptr, contents.pRotations, numEntities * sizeof(glm::vec4)},
+        {SECTION_SCALES, sizeof(glm::vec3), numEntities, nullptr, contents.pScales, numEntities * sizeof(glm::vec3)},
+        {SECTION_TRANSFORMS, 0, contents.transforms.count, contents.transforms.pEntities, nullptr, 0},
+        {SECTION_NAMES, 0, contents.names.count, contents.names.pEntities, nullptr, 0},
+        {SECTION_RENDERABLES, sizeof(RenderableRecord), contents.renderables.count, contents.renderables.pEntities,
+            contents.renderables.pData, contents.renderables.count * sizeof(RenderableRecord)},
+        {SECTION_POINT_LIGHTS, sizeof(PointLightRecord), contents.pointLights.count, contents.pointLights.pEntities,
+            contents.pointLights.pData, contents.pointLights.count * sizeof(PointLightRecord)},
+    };
+    constexpr uint32_t numSections = static_cast<uint32_t>(sizeof(sections) / sizeof(sections[0]));
+
+    std::vector<char> bytes(sizeof(FileHeader) + numSections * sizeof(SectionHeader));
+    const auto append = [&bytes] (const void* pData, uint64_t size) -> uint64_t {
+        bytes.resize((bytes.size() + SECTION_ALIGNMENT - 1) & ~(SECTION_ALIGNMENT - 1));
+        uint64_t offset = bytes.size();
+        bytes.insert(bytes.end(), static_cast<const char*>(pData), static_cast<const char*>(pData) + size);
+        return offset;
+    };
+
+    SectionHeader sectionHeaders[numSections];
+    for (uint32_t i = 0; i < numSections; ++i) {
+        const Section& section = sections[i];
+        SectionHeader& header = sectionHeaders[i];
+        header = {section.type, section.elementSize, section.count, 0, 0, 0};
+        if (section.pEntities) header.entitiesOffset = append(section.pEntities, section.count * sizeof(uint32_t));
+
+        if (section.type == SECTION_NAMES) {
+            // The offsets and the characters in one piece
+            header.dataOffset = append(buffers.nameOffsets.data(), buffers.nameOffsets.size() * sizeof(uint32_t));
+            append(buffers.nameChars.data(), buffers.nameChars.size());
+            header.dataSize = bytes.size() - header.dataOffset;
+        } else if (section.dataSize > 0) {
+            header.dataOffset = append(section.pData, section.dataSize);
+            header.dataSize = section.dataSize;
+        }
+    }
+
+    FileHeader fileHeader;
+    std::memcpy(fileHeader.magic, MAGIC, sizeof(MAGIC));
+    fileHeader.version = VERSION;
+    fileHeader.numEntities = contents.numEntities;
+    fileHeader.numSections = numSections;
+    fileHeader.reserved = 0;
+    fileHeader.fileSize = bytes.size();
+
+    std::memcpy(bytes.data(), &fileHeader, sizeof(fileHeader));
+    std::memcpy(bytes.data() + sizeof(fileHeader), sectionHeaders, sizeof(sectionHeaders));
+
+    writeFile(fileName, bytes.data(), bytes.size());
+}
+
+std::unique_ptr<WorldData> WorldFile::read(const std::string& fileName) {
+    std::unique_ptr<WorldData> pData(new WorldData());
+    pData->m_fileName = fileName;
+    pData->m_pFile.reset(new MappedFile(fileName));
+    pData->m_pContents.reset(new WorldData::Contents());
+
+    const uint8_t* pFile = pData->m_pFile->data();
+    uint64_t fileSize = pData->m_pFile->size();
+    pData->m_size = fileSize;
+
+    const auto fail = [&fileName] (const std::string& what) {
+        throw std::runtime_error(fileName + ": " + what);
+    };
+
+    if (fileSize < sizeof(FileHeader)) fail("too small to be a world file");
+    FileHeader header;
+    std::memcpy(&header, pFile, sizeof(header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) fail("not a world file");
+    if (header.version != VERSION) fail("unsupported version " + std::to_string(header.version));
+    if (header.fileSize != fileSize) fail("truncated");
+    if (sizeof(FileHeader) + uint64_t(header.numSections) * sizeof(SectionHeader) > fileSize) fail("truncated section table");
+
+    // Offsets are checked to be aligned and in the file, so the arrays can be used where they are
+    const auto getRange = [&] (uint64_t offset, uint64_t size) -> const uint8_t* {
+        if (offset % SECTION_ALIGNMENT != 0 || offset > fileSize || size > fileSize - offset) fail("section out of bounds");
+        return pFile + offset;
+    };
+
+    WorldData::Contents& contents = *pData->m_pContents;
+    contents.numEntities = header.numEntities;
+
+    const SectionHeader* pSections = reinterpret_cast<const SectionHeader*>(pFile + sizeof(FileHeader));
+    for (uint32_t i = 0; i < header.numSections; ++i) {
+        const SectionHeader& section = pSections[i];
+
+        const auto getDense = [&] (uint32_t elementSize) -> const void* {
+            if (section.elementSize != elementSize || section.count != header.numEntities) fail("bad section size");
+            return getRange(section.dataOffset, section.count * elementSize);
+        };
+        const auto getEntities = [&] () -> const uint32_t* {
+            if (section.count > header.numEntities) fail("bad section size");
+            return reinterpret_cast<const uint32_t*>(getRange(section.entitiesOffset, section.count * sizeof(uint32_t)));
+        };
+        const auto getSparse = [&] (auto& array, uint32_t elementSize) {
+            if (section.elementSize != elementSize) fail("bad section size");
+            array.count = section.count;
+            array.pEntities = getEntities();
+            array.pData = reinterpret_cast<decltype(array.pData)>(getRange(section.dataOffset, section.count * elementSize));
+        };
+
+        switch (section.type) {
+        case SECTION_PARENTS:
+            contents.pParents = static_cast<const uint32_t*>(getDense(sizeof(uint32_t)));
+            break;
+        case SECTION_TRANSLATIONS:
+            contents.pTranslations = static_cast<const glm::vec3*>(getDense(sizeof(glm::vec3)));
+            break;
+        case SECTION_ROTATIONS:
+            contents.pRotations = static_cast<const glm::vec4*>(getDense(sizeof(glm::vec4)));
+            break;
+        case SECTION_SCALES:
+            contents.pScales = static_cast<const glm::vec3*>(getDense(sizeof(glm::vec3)));
+            break;
+        case SECTION_TRANSFORMS:
+            contents.transforms.count = section.count;
+            contents.transforms.pEntities = getEntities();
+            break;
+        case SECTION_NAMES: {
+            contents.names.count = section.count;
+            contents.names.pEntities = getEntities();
+            uint64_t offsetsSize = (section.count + 1) * sizeof(uint32_t);
+            if (section.dataSize < offsetsSize) fail("bad section size");
+            const uint8_t* pNames = getRange(section.dataOffset, section.dataSize);
+            contents.names.pData = reinterpret_cast<const uint32_t*>(pNames);
+            contents.pNameChars = reinterpret_cast<const char*>(pNames + offsetsSize);
+            contents.nameCharsSize = section.dataSize - offsetsSize;
+            break;
+        }
+        case SECTION_RENDERABLES:
+            getSparse(contents.renderables, sizeof(RenderableRecord));
+            break;
+        case SECTION_POINT_LIGHTS:
+            getSparse(contents.pointLights, sizeof(PointLightRecord));
+            break;
+        default:
+            // From a newer writer, and not needed to load what we know about
+            break;
+        }
+    }
+
+    validate(*pData);
+    return pData;
+}
+
+void WorldFile::validate(const WorldData& data) {
+    const std::string& fileName = data.m_fileName;
+    const auto fail = [&fileName] (const std::string& what) {
+        throw std::runtime_error(fileName + ": " + what);
+    };
+
+    const WorldData::Contents& contents = *data.m_pContents;
+    uint32_t numEntities = contents.numEntities;
+
+    if (contents.pParents) {
+        for (uint32_t i = 0; i < numEntities; ++i) {
+            if (contents.pParents[i] != GameWorld::NO_PARENT && contents.pParents[i] >= i) fail("entity parent out of order");
+        }
+    }
+    // Strictly increasing, so no entity is given the same component twice
+    const auto checkEntities = [&] (uint64_t count, const uint32_t* pEntities) {
+        for (uint64_t k = 0; k < count; ++k) {
+            if (pEntities[k] >= numEntities) fail("component of an entity which doesn't exist");
+            if (k > 0 && pEntities[k] <= pEntities[k - 1]) fail("component entities out of order");
+        }
+    };
+    checkEntities(contents.transforms.count, contents.transforms.pEntities);
+    checkEntities(contents.names.count, contents.names.pEntities);
+    checkEntities(contents.renderables.count, contents.renderables.pEntities);
+    checkEntities(contents.pointLights.count, contents.pointLights.pEntities);
+
+    for (uint64_t k = 0; k < contents.names.count; ++k) {
+        const uint32_t* pOffsets = contents.names.pData;
+        if (pOffsets[k] > pOffsets[k + 1] || pOffsets[k + 1] > contents.nameCharsSize) fail("name out of bounds");
+    }
+}
+
+std::vector<Entity> WorldFile::load(GameWorld* pWorld, const WorldResources& resources, const std::string& fileName) {
+    return instantiate(pWorld, resources, *read(fileName));
+}
+
+std::vector<Entity> WorldFile::instantiate(GameWorld* pWorld, const WorldResources& resources, const WorldData& data) {
+    const WorldData::Contents& contents = *data.m_pContents;
+    uint32_t numEntities = contents.numEntities;
+
+    // The rest was checked by read(), so a bad file leaves the world as it was
+    for (uint64_t k = 0; k < contents.renderables.count; ++k) {
+        if (!resources.hasModel(contents.renderables.pData[k].modelID)) {
+            throw std::runtime_error(data.m_fileName + ": renderable's model isn't in the world resources");
+        }
+    }
+
+    std::vector<entt::entity> ids(numEntities);
+    if (contents.pParents) {
+        pWorld->createEntities(numEntities, contents.pParents, ids.data());
+    } else {
+        std::vector<uint32_t> parents(numEntities, GameWorld::NO_PARENT);
+        pWorld->createEntities(numEntities, parents.data(), ids.data());
+    }
+
+    entt::registry& registry = pWorld->m_registry;
+
+    // Local transforms go straight into the new nodes
+    if (contents.pTranslations || contents.pRotations || contents.pScales) {
+        for (uint32_t i = 0; i < numEntities; ++i) {
+            uint32_t node = registry.get<Component::HierarchyNode>(ids[i]).index;
+            if (contents.pTranslations) pWorld->m_nodeTranslations[node] = contents.pTranslations[i];
+            if (contents.pRotations) {
+                const glm::vec4& r = contents.pRotations[i];
+                pWorld->m_nodeRotations[node] = glm::quat(r.w, r.x, r.y, r.z);
+            }
+            if (contents.pScales) pWorld->m_nodeScales[node] = contents.pScales[i];
+        }
+    }
+
+    // Each component is added to all its entities at once, default constructed and then filled in
+    std::vector<entt::entity> componentEntities;
+    const auto getEntities = [&] (uint64_t count, const uint32_t* pEntities) -> const std::vector<entt::entity>& {
+        componentEntities.resize(count);
+        for (uint64_t k = 0; k < count; ++k) componentEntities[k] = ids[pEntities[k]];
+        return componentEntities;
+    };
+
+    {
+        const auto& entities = getEntities(contents.transforms.count, contents.transforms.pEntities);
+        registry.insert<Component::Transform>(entities.begin(), entities.end());
+    }
+
+    {
+        const auto& entities = getEntities(contents.names.count, contents.names.pEntities);
+        registry.insert<Component::Name>(entities.begin(), entities.end());
+        const uint32_t* pOffsets = contents.names.pData;
+        for (uint64_t k = 0; k < contents.names.count; ++k) {
+            registry.get<Component::Name>(entities[k]).str.assign(contents.pNameChars + pOffsets[k], pOffsets[k + 1] - pOffsets[k]);
+        }
+    }
+
+    {
+        const auto& entities = getEntities(contents.renderables.count, contents.renderables.pEntities);
+        registry.insert<Component::Renderable>(entities.begin(), entities.end(), Component::Renderable{nullptr, nullptr});
+        std::vector<entt::entity> skeletal;
+        for (uint64_t k = 0; k < contents.renderables.count; ++k) {
+            const RenderableRecord& record = contents.renderables.pData[k];
+            Component::Renderable& r = registry.get<Component::Renderable>(entities[k]);
+            r.pModel = resources.getModel(record.modelID);
+            if ((record.flags & RENDERABLE_SKINNED) && r.pModel && r.pModel->getSkeletonDescription()) {
+                r.pSkeleton = resources.createSkeleton(r.pModel->getSkeletonDescription());
+                if (r.pSkeleton) skeletal.push_back(entities[k]);
+            }
+        }
+        registry.insert<Component::Renderable::SkeletalFlag>(skeletal.begin(), skeletal.end());
+    }
+
+    {
+        const auto& entities = getEntities(contents.pointLights.count, contents.pointLights.pEntities);
+        registry.insert<PointLight>(entities.begin(), entities.end());
+        for (uint64_t k = 0; k < contents.pointLights.count; ++k) {
+            const PointLightRecord& record = contents.pointLights.pData[k];
+            registry.get<PointLight>(entities[k])
+                .setPosition(record.position)
+                .setIntensity(record.intensity)
+                .setShadowMapEnabled(record.flags & POINT_LIGHT_SHADOW_MAP);
+        }
+    }
+
+    std::vector<Entity> entities(numEntities);
+    for (uint32_t i = 0; i < numEntities; ++i) entities[i] = {ids[i], pWorld};
+    return entities;
+}
+
+static nlohmann::json vectorToJSON(const float* v, int n) {
+    return nlohmann::json(std::vector<float>(v, v + n));
+}
+
+template <typename V>
+static V vectorFromJSON(const nlohmann::json& js, const V& defaultValue) {
+    V v = defaultValue;
+    if (js.is_array()) {
+        for (int i = 0; i < static_cast<int>(std::min(js.size(), size_t(V::length()))); ++i) v[i] = js[i].get<float>();
+    }
+    return v;
+}
+
+static std::string modelIDToString(uint64_t id) {
+    char str[17];
+    std::snprintf(str, sizeof(str), "%016llx", static_cast<unsigned long long>(id));
+    return str;
+}
+
+void WorldFile::saveJSON(const GameWorld* pWorld, const WorldResources& resources, const std::string& fileName) {
+    using json = nlohmann::json;
+
+    WorldData::Buffers buffers;
+    gather(pWorld, resources, buffers);
+    uint32_t numEntities = static_cast<uint32_t>(buffers.parents.size());
+
+    json entitiesJS = json::array();
+    for (uint32_t i = 0; i < numEntities; ++i) {
+        json entityJS = json::object();
+        if (buffers.parents[i] != GameWorld::NO_PARENT) entityJS["parent"] = buffers.parents[i];
+        entityJS["translation"] = vectorToJSON(&buffers.translations[i].x, 3);
+        entityJS["rotation"] = vectorToJSON(&buffers.rotations[i].x, 4);
+        entityJS["scale"] = vectorToJSON(&buffers.scales[i].x, 3);
+        entitiesJS.push_back(std::move(entityJS));
+    }
+
+    for (uint32_t i : buffers.transformEntities) entitiesJS[i]["transform"] = true;
+    for (size_t k = 0; k < buffers.nameEntities.size(); ++k) {
+        entitiesJS[buffers.nameEntities[k]]["name"] =
+            buffers.nameChars.substr(buffers.nameOffsets[k], buffers.nameOffsets[k + 1] - buffers.nameOffsets[k]);
+    }
+    for (size_t k = 0; k < buffers.renderableEntities.size(); ++k) {
+        const RenderableRecord& record = buffers.renderables[k];
+        entitiesJS[buffers.renderableEntities[k]]["renderable"] = {
+            {"model", modelIDToString(record.modelID)},
+            {"skinned", (record.flags & RENDERABLE_SKINNED) != 0},
+        };
+    }
+    for (size_t k = 0; k < buffers.pointLightEntities.size(); ++k) {
+        const PointLightRecord& record = buffers.pointLights[k];
+        entitiesJS[buffers.pointLightEntities[k]]["pointLight"] = {
+            {"position", vectorToJSON(&record.position.x, 3)},
+            {"intensity", vectorToJSON(&record.intensity.x, 3)},
+            {"shadowMap", (record.flags & POINT_LIGHT_SHADOW_MAP) != 0},
+        };
+    }
+
+    json worldJS = {
+        {"version", VERSION},
+        {"entities", std::move(entitiesJS)},
+    };
+    std::string str = worldJS.dump(4);
+    writeFile(fileName, str.data(), str.size());
+}
+
+std::unique_ptr<WorldData> WorldFile::readJSON(const std::string& fileName) {
+    using json = nlohmann::json;
+
+    std::unique_ptr<WorldData> pData(new WorldData());
+    pData->m_fileName = fileName;
+    pData->m_pBuffers.reset(new WorldData::Buffers());
+    WorldData::Buffers& buffers = *pData->m_pBuffers;
+    try {
+        std::ifstream file(fileName);
+        if (!file) throw std::runtime_error("Failed to open " + fileName);
+        json worldJS = json::parse(file);
+
+        uint32_t version = worldJS.value("version", 0u);
+        if (version != VERSION) throw std::runtime_error(fileName + ": unsupported version " + std::to_string(version));
+
+        const json& entitiesJS = worldJS.at("entities");
+        for (uint32_t i = 0; i < static_cast<uint32_t>(entitiesJS.size()); ++i) {
+            const json& entityJS = entitiesJS[i];
+            buffers.parents.push_back(entityJS.value("parent", GameWorld::NO_PARENT));
+            buffers.translations.push_back(vectorFromJSON(entityJS.value("translation", json()), glm::vec3(0.0f)));
+            buffers.rotations.push_back(vectorFromJSON(entityJS.value("rotation", json()), glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+            buffers.scales.push_back(vectorFromJSON(entityJS.value("scale", json()), glm::vec3(1.0f)));
+
+            if (entityJS.value("transform", false)) buffers.transformEntities.push_back(i);
+
+            if (auto it = entityJS.find("name"); it != entityJS.end()) {
+                buffers.nameEntities.push_back(i);
+                buffers.nameChars += it->get<std::string>();
+                buffers.nameOffsets.push_back(static_cast<uint32_t>(buffers.nameChars.size()));
+            }
+
+            if (auto it = entityJS.find("renderable"); it != entityJS.end()) {
+                uint64_t modelID = std::stoull(it->value("model", std::string("0")), nullptr, 16);
+                buffers.renderableEntities.push_back(i);
+                buffers.renderables.push_back({modelID, it->value("skinned", false) ? RENDERABLE_SKINNED : 0u, 0});
+            }
+
+            if (auto it = entityJS.find("pointLight"); it != entityJS.end()) {
+                buffers.pointLightEntities.push_back(i);
+                buffers.pointLights.push_back({vectorFromJSON(it->value("position", json()), glm::vec3(0.0f)),
+                                               vectorFromJSON(it->value("intensity", json()), glm::vec3(1.0f)),
+                                               it->value("shadowMap", false) ? POINT_LIGHT_SHADOW_MAP : 0u, 0});
+            }
+        }
+    } catch (const json::exception& e) {
+        throw std::runtime_error(fileName + ": " + e.what());
+    } catch (const std::logic_error&) {
+        // From std::stoull
+        throw std::runtime_error(fileName + ": bad model ID");
+    }
+
+    pData->m_pContents.reset(new WorldData::Contents(buffers.getContents()));
+    uint64_t numEntities = buffers.parents.size();
+    pData->m_size = numEntities * (sizeof(uint32_t) + 2 * sizeof(glm::vec3) + sizeof(glm::vec4)) +
+                    (buffers.transformEntities.size() + buffers.nameEntities.size() + buffers.nameOffsets.size() +
+                     buffers.renderableEntities.size() + buffers.pointLightEntities.size()) * sizeof(uint32_t) +
+                    buffers.nameChars.size() + buffers.renderables.size() * sizeof(RenderableRecord) +
+                    buffers.pointLights.size() * sizeof(PointLightRecord);
+
+    validate(*pData);
+    return pData;
+}
+
+std::vector<Entity> WorldFile::loadJSON(GameWorld* pWorld, const WorldResources& resources, const std::string& fileName) {
+    return instantiate(pWorld, resources, *readJSON(fileName));
+}
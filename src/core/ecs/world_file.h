@@ -0,0 +1,161 @@
+#ifndef WORLD_FILE_H_INCLUDED
+#define WORLD_FILE_H_INCLUDED
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "entity.h"
+
+class MappedFile;
+class Model;
+class Skeleton;
+class SkeletonDescription;
+
+// The resources a world file refers to, by IDs which are the same from run to run, e.g. hashes of their names,
+//   rather than by pointers or their order in the ResourceManager
+class WorldResources {
+
+public:
+
+    static constexpr uint64_t ID_NONE = 0;
+
+    // False if the ID is ID_NONE or already taken by another model
+    bool addModel(uint64_t id, Model* pModel);
+
+    // nullptr if no model has the ID
+    Model* getModel(uint64_t id) const;
+
+    // ID_NONE for nullptr or a model which hasn't been added
+    uint64_t getModelID(const Model* pModel) const;
+
+    bool hasModel(uint64_t id) const {
+        return id == ID_NONE || m_models.count(id) > 0;
+    }
+
+    // Skinned renderables get a new skeleton for their model when loaded. Without a factory they're loaded unskinned
+    void setSkeletonFactory(std::function<Skeleton*(const SkeletonDescription*)> factory) {
+        m_skeletonFactory = std::move(factory);
+    }
+
+    Skeleton* createSkeleton(const SkeletonDescription* pDescription) const {
+        return m_skeletonFactory ? m_skeletonFactory(pDescription) : nullptr;
+    }
+
+    // For skeletons from the factory which are no longer used, e.g. by WorldStreamer once a cell is unloaded. Without a
+    //   destroyer they're left to whoever the factory made them for
+    void setSkeletonDestroyer(std::function<void(Skeleton*)> destroyer) {
+        m_skeletonDestroyer = std::move(destroyer);
+    }
+
+    void destroySkeleton(Skeleton* pSkeleton) const {
+        if (m_skeletonDestroyer) m_skeletonDestroyer(pSkeleton);
+    }
+
+    // 64-bit FNV-1a, never ID_NONE
+    static uint64_t hashName(const std::string& name);
+
+private:
+
+    std::unordered_map<uint64_t, Model*> m_models;
+    std::unordered_map<const Model*, uint64_t> m_modelIDs;
+
+    std::function<Skeleton*(const SkeletonDescription*)> m_skeletonFactory;
+    std::function<void(Skeleton*)> m_skeletonDestroyer;
+
+};
+
+// A world file read into memory and checked, but not yet added to a world. Reading a file touches no GameWorld, so it
+//   can be done by a background job, leaving only WorldFile::instantiate() to the thread which owns the world
+class WorldData {
+
+public:
+
+    WorldData();
+    ~WorldData();
+
+    WorldData(const WorldData&) = delete;
+    WorldData& operator=(const WorldData&) = delete;
+
+    const std::string& getFileName() const {
+        return m_fileName;
+    }
+
+    uint32_t getNumEntities() const;
+
+    // Bytes of memory held, which for a binary file is the file's size
+    size_t getSize() const {
+        return m_size;
+    }
+
+private:
+
+    friend class WorldFile;
+
+    struct Contents;
+    struct Buffers;
+
+    std::string m_fileName;
+
+    // A binary file is used in place, a JSON file is parsed into buffers
+    std::unique_ptr<MappedFile> m_pFile;
+    std::unique_ptr<Buffers> m_pBuffers;
+    std::unique_ptr<Contents> m_pContents;
+
+    size_t m_size = 0;
+
+};
+
+/** Saves a GameWorld's entities to a file, and loads them back into a GameWorld
+ *  Saved are the entities in the world's hierarchy, i.e. all those made through it, with their parents, local
+ *    transforms and their Transform, Name, Renderable and PointLight components. Rigid bodies and animation state
+ *    belong to their systems, and aren't saved
+ *  In the file, entities are numbered in hierarchy order, parents before children, and refer to each other by number
+ *
+ *  The binary format is made to be read in place from a mapping of the file: a header, a table of sections, then the
+ *    sections, each an array of one kind of data, 16 byte aligned. Sections which cover every entity (parents and the
+ *    local transform) have an element per entity in order. Component sections have an element per entity with the
+ *    component, and the list of those entities' numbers, in increasing order. Everything is little-endian, and
+ *    sections of types a reader doesn't know are skipped, so sections can be added without a new version
+ *  Loading maps the file, checks all of it, then creates the entities and each kind of component in bulk
+ *
+ *  The JSON format has the same contents, one object per entity. It is much slower, but can be diffed and edited
+ *  All of these throw std::runtime_error on failure. Loading fails before creating anything if the file is invalid or
+ *    refers to a model the resources don't have
+ **/
+class WorldFile {
+
+public:
+
+    static constexpr uint32_t VERSION = 1;
+
+    static void save(const GameWorld* pWorld, const WorldResources& resources, const std::string& fileName);
+
+    // Add the file's entities to the world, which needn't be empty. They are returned in file order
+    // The same as instantiate(read()), for when there is nothing to gain from reading the file on another thread
+    static std::vector<Entity> load(GameWorld* pWorld, const WorldResources& resources, const std::string& fileName);
+
+    static void saveJSON(const GameWorld* pWorld, const WorldResources& resources, const std::string& fileName);
+
+    static std::vector<Entity> loadJSON(GameWorld* pWorld, const WorldResources& resources, const std::string& fileName);
+
+    // Map and check a binary file, or parse and check a JSON one. Safe to call from any thread
+    static std::unique_ptr<WorldData> read(const std::string& fileName);
+    static std::unique_ptr<WorldData> readJSON(const std::string& fileName);
+
+    // Add what was read to the world. Only the model IDs are left to check, against the resources
+    static std::vector<Entity> instantiate(GameWorld* pWorld, const WorldResources& resources, const WorldData& data);
+
+private:
+
+    static void gather(const GameWorld* pWorld, const WorldResources& resources, WorldData::Buffers& buffers);
+
+    // Check the references between entities, and within the names, which read() and readJSON() have in common
+    static void validate(const WorldData& data);
+
+};
+
+#endif // WORLD_FILE_H_INCLUDED
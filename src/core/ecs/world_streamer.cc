@@ -0,0 +1,266 @@
+#include "world_streamer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+
+#include "components.h"
+
+// Entities destroyed between checks of the time budget
+static constexpr size_t UNLOAD_BATCH_SIZE = 256;
+
+static bool isJSONFile(const std::string& fileName) {
+    std::string extension = std::filesystem::path(fileName).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [] (unsigned char c) { return std::tolower(c); });
+    return extension == ".json";
+}
+
+WorldStreamer::WorldStreamer(GameWorld* pWorld, const WorldResources* pResources, JobScheduler* pScheduler,
+                             Parameters parameters) :
+        m_pWorld(pWorld),
+        m_pResources(pResources),
+        m_pScheduler(pScheduler),
+        m_parameters(parameters) {
+    if (m_pScheduler) m_readCounter = m_pScheduler->getFreeCounter();
+}
+
+WorldStreamer::~WorldStreamer() {
+    if (m_pScheduler) {
+        m_pScheduler->waitForCounter(m_readCounter);
+        m_pScheduler->freeCounter(m_readCounter);
+    }
+}
+
+WorldStreamer::CellID WorldStreamer::addCell(int32_t x, int32_t z, const std::string& fileName, size_t memorySize) {
+    CellID id = static_cast<CellID>(m_cells.size());
+    if (!m_cellsByCoordinates.try_emplace({x, z}, id).second) {
+        throw std::runtime_error("There is already a cell at " + std::to_string(x) + ", " + std::to_string(z));
+    }
+
+    if (memorySize == 0) {
+        std::error_code error;
+        uintmax_t fileSize = std::filesystem::file_size(fileName, error);
+        if (!error) memorySize = static_cast<size_t>(fileSize);
+    }
+
+    Cell& cell = m_cells.emplace_back();
+    cell.x = x;
+    cell.z = z;
+    cell.fileName = fileName;
+    cell.memorySize = memorySize;
+    return id;
+}
+
+WorldStreamer::CellID WorldStreamer::findCell(int32_t x, int32_t z) const {
+    auto it = m_cellsByCoordinates.find({x, z});
+    return (it != m_cellsByCoordinates.end()) ? it->second : CELL_NONE;
+}
+
+float WorldStreamer::getCellDistance(const Cell& cell, const glm::vec3& position) const {
+    float size = m_parameters.cellSize;
+    glm::vec2 boundsMin = glm::vec2(cell.x, cell.z) * size;
+    glm::vec2 p(position.x, position.z);
+    return glm::length(glm::max(glm::max(boundsMin - p, p - (boundsMin + size)), glm::vec2(0.0f)));
+}
+
+void WorldStreamer::update(const glm::vec3& cameraPosition) {
+    pollReads();
+
+    m_wantedCells.clear();
+    m_residentCells.clear();
+    for (CellID id = 0; id < m_cells.size(); ++id) {
+        Cell& cell = m_cells[id];
+        float distance = getCellDistance(cell, cameraPosition);
+        switch (cell.state) {
+        case CELL_UNLOADED:
+            if (distance <= m_parameters.loadDistance) m_wantedCells.emplace_back(distance, id);
+            break;
+        case CELL_READING:
+            if (distance > m_parameters.unloadDistance) {
+                startUnload(id);
+            } else if (distance <= m_parameters.loadDistance) {
+                cell.cancelled = false;
+            }
+            break;
+        case CELL_READ:
+        case CELL_LOADED:
+            if (distance > m_parameters.unloadDistance) {
+                startUnload(id);
+            } else {
+                m_residentCells.emplace_back(distance, id);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Nearest first, and farthest first for making room
+    std::sort(m_wantedCells.begin(), m_wantedCells.end());
+    std::sort(m_residentCells.begin(), m_residentCells.end(), std::greater<std::pair<float, CellID>>());
+
+    size_t numEvicted = 0;
+    for (const auto& [distance, id] : m_wantedCells) {
+        if (m_numReading >= m_parameters.maxConcurrentReads) break;
+
+        size_t memorySize = m_cells[id].memorySize;
+        while (m_memoryUsed + memorySize > m_parameters.memoryBudget && numEvicted < m_residentCells.size() &&
+               m_residentCells[numEvicted].first > distance) {
+            startUnload(m_residentCells[numEvicted++].second);
+        }
+        // Farther cells won't fit either, unless they are smaller, but they shouldn't go ahead of this one
+        if (m_memoryUsed + memorySize > m_parameters.memoryBudget) break;
+
+        startRead(id);
+    }
+
+    // Without a scheduler the reads are already done
+    if (!m_pScheduler) pollReads();
+
+    // Make room first, then add the cells nearest the camera
+    m_readCells.clear();
+    for (CellID id = 0; id < m_cells.size(); ++id) {
+        if (m_cells[id].state == CELL_READ) m_readCells.push_back(id);
+    }
+    std::sort(m_readCells.begin(), m_readCells.end(), [this, &cameraPosition] (CellID lhs, CellID rhs) {
+        return getCellDistance(m_cells[lhs], cameraPosition) < getCellDistance(m_cells[rhs], cameraPosition);
+    });
+
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(m_parameters.timeBudget));
+    bool didWork = false;
+    const auto hasTime = [&didWork, &deadline] {
+        return !didWork || Clock::now() < deadline;
+    };
+
+    for (CellID id = 0; id < m_cells.size() && hasTime(); ++id) {
+        while (m_cells[id].state == CELL_UNLOADING && hasTime()) {
+            continueUnload(id, UNLOAD_BATCH_SIZE);
+            didWork = true;
+        }
+    }
+
+    for (size_t i = 0; i < m_readCells.size() && hasTime(); ++i) {
+        Cell& cell = m_cells[m_readCells[i]];
+        try {
+            cell.entities = WorldFile::instantiate(m_pWorld, *m_pResources, *cell.pData);
+            cell.state = CELL_LOADED;
+            for (Entity& entity : cell.entities) {
+                if (!entity.hasComponent<Component::Renderable>()) continue;
+                if (Skeleton* pSkeleton = entity.getComponent<Component::Renderable>().pSkeleton) {
+                    cell.skeletons.push_back(pSkeleton);
+                }
+            }
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Failed to load world cell " << cell.x << ", " << cell.z << ": " << e.what() << std::endl;
+            cell.state = CELL_FAILED;
+            m_memoryUsed -= cell.memorySize;
+        }
+        cell.pData.reset();
+        didWork = true;
+    }
+}
+
+void WorldStreamer::unloadAll() {
+    if (m_pScheduler) m_pScheduler->waitForCounter(m_readCounter);
+    pollReads();
+
+    for (CellID id = 0; id < m_cells.size(); ++id) {
+        if (m_cells[id].state == CELL_READ || m_cells[id].state == CELL_LOADED) startUnload(id);
+        if (m_cells[id].state == CELL_UNLOADING) continueUnload(id, m_cells[id].numEntitiesLeft);
+    }
+}
+
+void WorldStreamer::startRead(CellID id) {
+    Cell& cell = m_cells[id];
+    cell.state = CELL_READING;
+    cell.cancelled = false;
+    cell.readDone.store(false, std::memory_order_relaxed);
+    m_memoryUsed += cell.memorySize;
+    ++m_numReading;
+
+    if (m_pScheduler) {
+        JobScheduler::JobDeclaration decl;
+        decl.name = "ReadWorldCell";
+        decl.setClosure([pCell = &cell] {
+            readCell(pCell);
+        });
+        decl.background = true;
+        decl.signalCounters[decl.numSignalCounters++] = m_readCounter;
+        m_pScheduler->enqueueJob(decl);
+    } else {
+        readCell(&cell);
+    }
+}
+
+void WorldStreamer::readCell(Cell* pCell) {
+    try {
+        pCell->pData = isJSONFile(pCell->fileName) ? WorldFile::readJSON(pCell->fileName) : WorldFile::read(pCell->fileName);
+    } catch (const std::exception& e) {
+        pCell->error = e.what();
+    }
+    pCell->readDone.store(true, std::memory_order_release);
+}
+
+void WorldStreamer::pollReads() {
+    for (CellID id = 0; id < m_cells.size() && m_numReading > 0; ++id) {
+        Cell& cell = m_cells[id];
+        if (cell.state != CELL_READING || !cell.readDone.load(std::memory_order_acquire)) continue;
+        --m_numReading;
+
+        if (!cell.pData) {
+            std::cerr << "Failed to read world cell " << cell.x << ", " << cell.z << ": " << cell.error << std::endl;
+            cell.state = CELL_FAILED;
+            m_memoryUsed -= cell.memorySize;
+        } else if (cell.cancelled) {
+            cell.pData.reset();
+            cell.state = CELL_UNLOADED;
+            m_memoryUsed -= cell.memorySize;
+        } else {
+            cell.state = CELL_READ;
+        }
+    }
+}
+
+void WorldStreamer::startUnload(CellID id) {
+    Cell& cell = m_cells[id];
+    switch (cell.state) {
+    case CELL_READING:
+        cell.cancelled = true;
+        break;
+    case CELL_READ:
+        cell.pData.reset();
+        cell.state = CELL_UNLOADED;
+        m_memoryUsed -= cell.memorySize;
+        break;
+    case CELL_LOADED:
+        cell.numEntitiesLeft = cell.entities.size();
+        cell.state = CELL_UNLOADING;
+        m_memoryUsed -= cell.memorySize;
+        break;
+    default:
+        break;
+    }
+}
+
+void WorldStreamer::continueUnload(CellID id, size_t maxEntities) {
+    Cell& cell = m_cells[id];
+    size_t end = cell.numEntitiesLeft - std::min(maxEntities, cell.numEntitiesLeft);
+    // Entities may have been destroyed by other means since, in which case their IDs are no longer valid
+    for (size_t i = cell.numEntitiesLeft; i > end; --i) {
+        if (m_pWorld->isEntityValid(cell.entities[i - 1])) m_pWorld->destroyEntity(cell.entities[i - 1]);
+    }
+    cell.numEntitiesLeft = end;
+
+    if (cell.numEntitiesLeft == 0) {
+        cell.entities.clear();
+        for (Skeleton* pSkeleton : cell.skeletons) m_pResources->destroySkeleton(pSkeleton);
+        cell.skeletons.clear();
+        cell.state = CELL_UNLOADED;
+    }
+}
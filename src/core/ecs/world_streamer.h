@@ -0,0 +1,174 @@
+#ifndef WORLD_STREAMER_H_INCLUDED
+#define WORLD_STREAMER_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "core/job_scheduler.h"
+#include "entity.h"
+#include "world_file.h"
+
+/** Keeps the parts of a world near the camera in a GameWorld, for worlds too large to load all at once
+ *  The world is split into square cells on the XZ plane, each a world file (see WorldFile) of the entities in it,
+ *    and each update():
+ *  - Loaded cells farther than unloadDistance from the camera are unloaded. It is larger than loadDistance, so cells
+ *    near the edge aren't loaded and unloaded over and over
+ *  - Cells within loadDistance start loading, nearest first, while there is room in the memory budget. To make room
+ *    for a cell, cells farther from the camera than it are unloaded, farthest first
+ *  - Files are read and checked by jobs on the scheduler's background threads, at most maxConcurrentReads at once
+ *  - Cells which have been read are added to the world, and unloaded cells' entities destroyed, until timeBudget is
+ *    used up. A cell is added all at once, so cells should be small enough to be added well within a frame
+ *  A cell's memory is its file's size, or the size given to addCell(), which is roughly what its entities take once
+ *    loaded too. Cells count against the budget from when they start loading until they start unloading
+ *  Models are shared by all cells, and found by ID in the WorldResources, which must have them all. A cell which fails
+ *    to load is reported on std::cerr and not tried again
+ *  Skeletons for a cell's skinned renderables are made by the resources' skeleton factory as it is added, and belong
+ *    to the cell: once its last entity is destroyed they are given to the resources' skeleton destroyer, so nothing
+ *    else may keep them. Cells still loaded when the streamer is destroyed leave theirs with their entities
+ **/
+class WorldStreamer {
+
+public:
+
+    typedef uint32_t CellID;
+
+    enum CellState {
+        CELL_UNLOADED,
+        CELL_READING,
+        CELL_READ,
+        CELL_LOADED,
+        CELL_UNLOADING,
+        CELL_FAILED
+    };
+
+    struct Parameters {
+        float cellSize = 64.0f;
+        float loadDistance = 128.0f;
+        float unloadDistance = 160.0f;
+
+        size_t memoryBudget = size_t(256) << 20;
+
+        uint32_t maxConcurrentReads = 4;
+
+        // Seconds per update() spent adding and destroying entities. At least one cell or batch of entities is done
+        //   every update, however long it takes
+        double timeBudget = 0.002;
+
+        Parameters() {}
+    };
+
+    // Without a scheduler, files are read by update() itself
+    WorldStreamer(GameWorld* pWorld, const WorldResources* pResources, JobScheduler* pScheduler,
+                  Parameters parameters = Parameters());
+
+    // Waits for reads in progress. The loaded cells' entities are left in the world
+    ~WorldStreamer();
+
+    WorldStreamer(const WorldStreamer&) = delete;
+    WorldStreamer& operator=(const WorldStreamer&) = delete;
+
+    // The cell covering [x, x+1) * cellSize by [z, z+1) * cellSize. Files ending in .json are read as JSON
+    // memorySize of 0 means to use the file's size
+    CellID addCell(int32_t x, int32_t z, const std::string& fileName, size_t memorySize = 0);
+
+    // Call once per frame, where nothing else is using the world, e.g. as an exclusive system
+    void update(const glm::vec3& cameraPosition);
+
+    // Unload every cell, right away, e.g. before the world or the resources are destroyed
+    void unloadAll();
+
+    CellState getCellState(CellID cell) const {
+        return m_cells[cell].state;
+    }
+
+    // Empty unless the cell is loaded
+    const std::vector<Entity>& getCellEntities(CellID cell) const {
+        return m_cells[cell].entities;
+    }
+
+    CellID findCell(int32_t x, int32_t z) const;
+
+    static constexpr CellID CELL_NONE = std::numeric_limits<CellID>::max();
+
+    size_t getMemoryUsed() const {
+        return m_memoryUsed;
+    }
+
+    const Parameters& getParameters() const {
+        return m_parameters;
+    }
+
+private:
+
+    struct Cell {
+        int32_t x;
+        int32_t z;
+        std::string fileName;
+        size_t memorySize;
+
+        CellState state = CELL_UNLOADED;
+
+        // Set by the read job, which owns pData and error until it sets readDone
+        std::unique_ptr<WorldData> pData;
+        std::string error;
+        std::atomic<bool> readDone{false};
+
+        // Still to be destroyed if unloading, entities.size() once loaded
+        std::vector<Entity> entities;
+        size_t numEntitiesLeft = 0;
+
+        // Made for the cell's entities when it was added, destroyed after them
+        std::vector<Skeleton*> skeletons;
+
+        // No longer wanted by the time its read finishes
+        bool cancelled = false;
+    };
+
+    GameWorld* m_pWorld;
+    const WorldResources* m_pResources;
+    JobScheduler* m_pScheduler;
+    Parameters m_parameters;
+
+    // Jobs keep pointers to their cells, so cells must stay put as more are added
+    std::deque<Cell> m_cells;
+    std::map<std::pair<int32_t, int32_t>, CellID> m_cellsByCoordinates;
+
+    size_t m_memoryUsed = 0;
+    uint32_t m_numReading = 0;
+
+    // Signalled by the read jobs
+    JobScheduler::CounterHandle m_readCounter = JobScheduler::COUNTER_NULL;
+
+    // Reused by update()
+    std::vector<std::pair<float, CellID>> m_wantedCells;
+    std::vector<std::pair<float, CellID>> m_residentCells;
+    std::vector<CellID> m_readCells;
+
+    float getCellDistance(const Cell& cell, const glm::vec3& position) const;
+
+    void startRead(CellID cell);
+
+    static void readCell(Cell* pCell);
+
+    // Move cells whose reads are done on to CELL_READ, or drop them if they failed or were cancelled
+    void pollReads();
+
+    // Cancel a read, drop a cell which is read but not yet added, or start unloading a loaded one. Its memory is
+    //   counted as free from here, except for a read still in progress
+    void startUnload(CellID cell);
+
+    // Destroy up to maxEntities of the cell's entities, last first, so children go before their parents
+    void continueUnload(CellID cell, size_t maxEntities);
+
+};
+
+#endif // WORLD_STREAMER_H_INCLUDED
@@ -1,5 +1,8 @@
 #include "job_scheduler.h"
 
+#include "core/util/futex.h"
+
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 
@@ -10,83 +13,684 @@
 #include <iostream>
 #include <random>
 
+#if defined(__unix__) || defined(__APPLE__)
+#define VKJOB_FIBERS_SUPPORTED
+#include <ucontext.h>
+#endif
+
+// Hint to the core that we're spinning, to save power and give the other hardware thread on the core more time
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define VKJ_CPU_RELAX() _mm_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define VKJ_CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define VKJ_CPU_RELAX()
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define VKJ_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define VKJ_NOINLINE __declspec(noinline)
+#else
+#define VKJ_NOINLINE
+#endif
+
 //#define VKJOB_DEBUG
 #ifdef VKJOB_DEBUG
 #include <sstream>
 #define VKJ_DEBUG_PRINT(x) {std::stringstream buf; buf << "(" << threadID << "): " << x << std::endl; std::cout << buf.str();}
+#define VKJ_COUNTER_NAME(h) (getCounter(h).hasID ? getCounter(h).id : std::to_string(h))
 #else
 #define VKJ_DEBUG_PRINT(x)
 #endif // SHEDULER_DEBUG
 
 static thread_local uint32_t threadID;
+static thread_local const JobScheduler* pThreadScheduler = nullptr;
+
+struct JobScheduler::Fiber {
+#ifdef VKJOB_FIBERS_SUPPORTED
+    ucontext_t context;
+#endif
+    std::unique_ptr<char[]> stack;
+
+    // Priority and name of the job currently running on the fiber, which it is resumed with after waiting
+    PriorityLevel jobPriority = JOB_PRIORITY_NORMAL;
+    const char* jobName = nullptr;
+};
+
+enum FiberPostSwitchAction {
+    FIBER_POST_SWITCH_NONE,
+    FIBER_POST_SWITCH_RELEASE,  // return the previous fiber to the free list
+    FIBER_POST_SWITCH_WAIT      // add the job resuming the previous fiber to a counter's wait list
+};
+
+struct JobScheduler::FiberThreadState {
+    Fiber* pCurrentFiber = nullptr;
+
+    // Represents the thread's original stack, which is returned to when the scheduler terminates
+    Fiber* pThreadFiber = nullptr;
+
+    // A fiber can't make itself available to other threads before it has been switched away from, since another
+    //   thread could then try to resume it while it is still running. The switching fiber leaves these for the
+    //   fiber it switched to, which acts on them as soon as it is running
+    FiberPostSwitchAction postSwitchAction = FIBER_POST_SWITCH_NONE;
+    Fiber* pPostSwitchFiber = nullptr;
+    Job* pPostSwitchJob = nullptr;
+    CounterHandle postSwitchCounter = COUNTER_NULL;
+};
+
+VKJ_NOINLINE JobScheduler::FiberThreadState& JobScheduler::getFiberThreadState() {
+    static thread_local FiberThreadState state;
+    // The volatile read stops the compiler treating this as a constant it could reuse across a fiber switch
+    FiberThreadState* volatile pState = &state;
+    return *pState;
+}
 
-void JobScheduler::workerThreadMain(JobScheduler* pScheduler, uint32_t id) {
-    threadID = id;
-    while (!pScheduler->m_programTerminated) {
-        int priority = JOB_PRIORITY_HIGH;
-        JobDeclaration decl;
+JobScheduler::Job* JobScheduler::JobPool::allocate() {
+    uint64_t head = m_freeHead.load(std::memory_order_acquire);
+    while ((head & 0xffffffffu) != 0) {
+        Job* pJob = getJob(static_cast<uint32_t>(head & 0xffffffffu) - 1);
+        uint64_t next = (((head >> 32) + 1) << 32) | pJob->next.load(std::memory_order_relaxed);
+        if (m_freeHead.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire)) {
+            return pJob;
+        }
+    }
+    return grow();
+}
+
+void JobScheduler::JobPool::free(Job* pJob) {
+    pushFreeList(pJob, pJob);
+}
+
+void JobScheduler::JobPool::pushFreeList(Job* pFirst, Job* pLast) {
+    uint64_t head = m_freeHead.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+        pLast->next.store(static_cast<uint32_t>(head & 0xffffffffu), std::memory_order_relaxed);
+        next = (((head >> 32) + 1) << 32) | (pFirst->poolIndex + 1);
+    } while (!m_freeHead.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+}
+
+JobScheduler::Job* JobScheduler::JobPool::grow() {
+    std::lock_guard<std::mutex> lock(m_growMtx);
+    if (m_numBlocks == MAX_BLOCKS) {
+        throw std::runtime_error("Job pool exhausted.");
+    }
+
+    uint32_t block = m_numBlocks;
+    m_blocks[block].reset(new Job[BLOCK_SIZE]);
+    for (uint32_t i = 0; i < BLOCK_SIZE; ++i) {
+        Job& job = m_blocks[block][i];
+        job.poolIndex = block * BLOCK_SIZE + i;
+        job.next.store(job.poolIndex + 2, std::memory_order_relaxed);
+    }
+    ++m_numBlocks;
+
+    // Keep the first job for the caller, the rest go on the free list
+    pushFreeList(&m_blocks[block][1], &m_blocks[block][BLOCK_SIZE-1]);
+    return &m_blocks[block][0];
+}
+
+VKJ_NOINLINE uint32_t JobScheduler::getCurrentWorkerIndex() const {
+    return (pThreadScheduler == this) ? threadID : static_cast<uint32_t>(m_workers.size());
+}
+
+void JobScheduler::runJob(Job* pJob) {
+    uint64_t traceFlow = pJob->traceFlow;
+    pJob->traceFlow = 0;
+
+    if (pJob->pResumeFiber) {
+        Fiber* pFiber = pJob->pResumeFiber;
+        pJob->pResumeFiber = nullptr;
+        m_jobPool.free(pJob);
+
+        // The job's slice was closed when it was suspended, it continues in a new one on this thread
+        m_tracer.record(JobTracer::EVENT_BEGIN, pFiber->jobName, traceFlow);
+
+        // This fiber is only running the worker loop, so it can go back to the free list once we are off it
+        FiberThreadState& state = getFiberThreadState();
+        state.postSwitchAction = FIBER_POST_SWITCH_RELEASE;
+        state.pPostSwitchFiber = state.pCurrentFiber;
+        switchToFiber(pFiber);
+        return;
+    }
+
+    const JobDeclaration& decl = pJob->decl;
+    const char* name = decl.name ? decl.name : (pJob->pRangeFunction ? "parallelFor" : nullptr);
 
-        {
-            std::unique_lock<std::mutex> lock(pScheduler->m_threadJobQueues[id].mtx);
-            while (!pScheduler->m_threadJobQueues[id].workReady) {
+    // Background threads don't run on fibers
+    Fiber* pFiber = m_useFibers ? getFiberThreadState().pCurrentFiber : nullptr;
+    if (pFiber) {
+        pFiber->jobPriority = decl.priority;
+        pFiber->jobName = name;
+    }
 
-                VKJ_DEBUG_PRINT("Going to sleep")
+    m_tracer.record(JobTracer::EVENT_BEGIN, name, traceFlow);
 
-                pScheduler->m_threadJobQueues[id].cv.wait(lock);
+    VKJ_DEBUG_PRINT("Running job:" + ((decl.numSignalCounters > 0) ? " signal counter[0] " + VKJ_COUNTER_NAME(decl.signalCounters[0]) : "" ))
+    if (pJob->pRangeFunction) {
+        runRangeJob(pJob);
+    } else if (decl.pClosureFunction) {
+        decl.pClosureFunction(pJob->decl.closure);
+    } else {
+        assert(decl.pFunction != nullptr);
+        decl.pFunction(decl.param);
+    }
+
+    VKJ_DEBUG_PRINT("Finished job")
+
+    for (int i = 0 ; i < decl.numSignalCounters; ++i) {
+        CounterHandle counter = decl.signalCounters[i];
+        if (counter != COUNTER_NULL) {
+            decrementCounter(counter);
+        }
+    }
 
-                VKJ_DEBUG_PRINT("Woke up")
+    // After signalling, so the trace shows which job released the jobs waiting on its counters
+    m_tracer.record(JobTracer::EVENT_END);
+
+    pJob->pRangeFunction = nullptr;
+    m_jobPool.free(pJob);
+}
+
+void JobScheduler::runRangeJob(Job* pJob) {
+    uint32_t begin = pJob->rangeBegin;
+    uint32_t end = pJob->rangeEnd;
+
+    // Pushing the upper half each time leaves the largest pieces at the top of the deque, where thieves take from
+    while (end - begin > pJob->grain) {
+        uint32_t mid = begin + (end - begin) / 2;
+
+        Job* pSplit = m_jobPool.allocate();
+        pSplit->decl = pJob->decl;
+        pSplit->pRangeFunction = pJob->pRangeFunction;
+        pSplit->rangeBegin = mid;
+        pSplit->rangeEnd = end;
+        pSplit->grain = pJob->grain;
+
+        // The split job will signal the same counters, we still hold ours so they can't reach zero early
+        for (int i = 0; i < pSplit->decl.numSignalCounters; ++i) {
+            if (pSplit->decl.signalCounters[i] != COUNTER_NULL) {
+                incrementCounter(pSplit->decl.signalCounters[i], 1);
+            }
+        }
+
+        scheduleJobs(1, &pSplit);
+        end = mid;
+    }
+
+    pJob->pRangeFunction(begin, end, pJob->decl.param);
+}
+
+JobScheduler::Job* JobScheduler::findJob(uint32_t workerIndex) {
+    uint32_t numWorkers = static_cast<uint32_t>(m_workers.size());
+    uint32_t victimOffset = getRandomThread();
+
+    for (int priority = JOB_PRIORITY_HIGH; priority != JOB_PRIORITY_MAX_ENUM; ++priority) {
+        Job* pJob = nullptr;
+
+        if (workerIndex < numWorkers && m_workers[workerIndex]->deques[priority].pop(pJob)) {
+            return pJob;
+        }
+
+        if (m_numInjectedJobs.load(std::memory_order_acquire) > 0) {
+            std::lock_guard<std::mutex> lock(m_injectedJobsMtx);
+            if (!m_injectedJobs[priority].empty()) {
+                pJob = m_injectedJobs[priority].front();
+                m_injectedJobs[priority].pop();
+                m_numInjectedJobs.fetch_sub(1, std::memory_order_relaxed);
+                return pJob;
             }
+        }
 
-            for (; priority != JOB_PRIORITY_MAX_ENUM; priority++) {
-                if (!pScheduler->m_threadJobQueues[id].priorityLevelQueues[priority].empty()) {
-                    decl = pScheduler->m_threadJobQueues[id].priorityLevelQueues[priority].front();
-                    pScheduler->m_threadJobQueues[id].priorityLevelQueues[priority].pop();
-                    break;
-                }
+        for (uint32_t i = 0; i < numWorkers; ++i) {
+            uint32_t victim = (victimOffset + i) % numWorkers;
+            if (victim == workerIndex) continue;
+            if (m_workers[victim]->deques[priority].steal(pJob)) {
+                VKJ_DEBUG_PRINT("Stole job from thread " << victim)
+                return pJob;
             }
+        }
+    }
 
-            if (priority == JOB_PRIORITY_MAX_ENUM) {
-                VKJ_DEBUG_PRINT("Queue is empty")
+    return nullptr;
+}
 
-                pScheduler->m_threadJobQueues[id].workReady = false;
-                pScheduler->m_threadJobQueues[id].cv.notify_all();
+void JobScheduler::workerLoop() {
+    bool idle = false;
+    while (!m_programTerminated) {
+        // Read the epoch before searching so any work added during the search prevents us from sleeping
+        uint32_t epoch = m_workEpoch.load();
+
+        // Not hoisted out of the loop, the loop may be on a different thread after running a job
+        Job* pJob = findJob(getCurrentWorkerIndex());
+        if (pJob) {
+            if (idle) wakeSpinner();
+            idle = false;
+            runJob(pJob);
+            continue;
+        }
+
+        idleWait(epoch);
+        idle = true;
+    }
+}
+
+void JobScheduler::idleWait(uint32_t epoch, Counter* pCounter, uint32_t counterSequence) {
+    typedef std::chrono::steady_clock Clock;
+
+    IdleCounters& stats = getIdleCounters(getCurrentWorkerIndex());
+    const auto isDone = [&] {
+        return m_workEpoch.load(std::memory_order_acquire) != epoch || m_programTerminated.load(std::memory_order_relaxed)
+            || (pCounter && pCounter->wakeSequence.load(std::memory_order_acquire) != counterSequence);
+    };
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point spinEnd = start + m_idleSpinTime;
+    Clock::time_point yieldEnd = spinEnd + m_idleYieldTime;
+
+    ++m_numSpinning;
+
+    // Reading the clock costs far more than a pause, so only check it every few spins
+    static constexpr uint32_t SPINS_PER_CLOCK_CHECK = 64;
+    uint64_t numSpins = 0;
+    bool done = false;
+    while (!done && Clock::now() < spinEnd) {
+        for (uint32_t i = 0; i < SPINS_PER_CLOCK_CHECK; ++i) {
+            if (isDone()) {
+                done = true;
+                break;
             }
+            VKJ_CPU_RELAX();
+            ++numSpins;
         }
+    }
+    stats.numSpins.fetch_add(numSpins, std::memory_order_relaxed);
+    if (done) {
+        --m_numSpinning;
+        stats.numSpinWakeups.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
 
-        if (priority != JOB_PRIORITY_MAX_ENUM) {
-            //std::cout << "decl: " << (uintptr_t)(decl.pFunction) <<  " " << (uintptr_t)(decl.param) <<  " " << decl.numSignalCounters << std::endl;
+    while (Clock::now() < yieldEnd) {
+        if (isDone()) {
+            --m_numSpinning;
+            stats.numYieldWakeups.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::this_thread::yield();
+    }
 
-            VKJ_DEBUG_PRINT("Running job:" + ((decl.numSignalCounters > 0) ? " signal counter[0] " + (pScheduler->m_counters[decl.signalCounters[0]].hasID ? pScheduler->m_counters[decl.signalCounters[0]].id : std::to_string(decl.signalCounters[0])) : "" ))
-            assert(decl.pFunction != nullptr);
+    --m_numSpinning;
 
-            decl.pFunction(decl.param);
+    // Register before checking again, so whoever adds work either sees us or we see the new epoch
+    ++m_numSleeping;
+    if (pCounter) ++pCounter->numHelpers;
+    if (!isDone()) {
+        VKJ_DEBUG_PRINT("Going to sleep")
+        m_tracer.record(JobTracer::EVENT_IDLE_BEGIN);
+        stats.numSleeps.fetch_add(1, std::memory_order_relaxed);
 
-            VKJ_DEBUG_PRINT("Finished job")
+        futex::wait(m_workEpoch, epoch);
 
-            if (decl.numSignalCounters != 0) {
-                for (int i = 0 ; i < decl.numSignalCounters; ++i) {
-                    CounterHandle counter = decl.signalCounters[i];
-                    if (counter != COUNTER_NULL) {
-                        pScheduler->decrementCounter(counter);
-                    }
-                }
+        m_tracer.record(JobTracer::EVENT_IDLE_END);
+        VKJ_DEBUG_PRINT("Woke up")
+    }
+    if (pCounter) --pCounter->numHelpers;
+    --m_numSleeping;
+}
+
+void JobScheduler::workerThreadMain(JobScheduler* pScheduler, uint32_t id) {
+    threadID = id;
+    pThreadScheduler = pScheduler;
+
+    pScheduler->m_tracer.setThreadName("Worker " + std::to_string(id));
+
+    if (!pScheduler->m_useFibers) {
+        pScheduler->workerLoop();
+    } else {
+        // Only the context is used, the thread keeps its own stack
+        Fiber threadFiber;
+        FiberThreadState& state = getFiberThreadState();
+        state.pThreadFiber = &threadFiber;
+        state.pCurrentFiber = &threadFiber;
+
+        // Returns once the scheduler terminates, see fiberEntry()
+        pScheduler->switchToFiber(pScheduler->acquireFiber());
+    }
+
+    pThreadScheduler = nullptr;
+}
+
+void JobScheduler::backgroundLoop() {
+    std::unique_lock<std::mutex> lock(m_backgroundJobsMtx);
+    while (!m_programTerminated) {
+        Job* pJob = nullptr;
+        for (auto& jobs : m_backgroundJobs) {
+            if (!jobs.empty()) {
+                pJob = jobs.front();
+                jobs.pop();
+                break;
+            }
+        }
+
+        if (!pJob) {
+            m_tracer.record(JobTracer::EVENT_IDLE_BEGIN);
+            m_backgroundCv.wait(lock);
+            m_tracer.record(JobTracer::EVENT_IDLE_END);
+            continue;
+        }
+
+        lock.unlock();
+        runJob(pJob);
+        lock.lock();
+    }
+}
+
+void JobScheduler::backgroundThreadMain(JobScheduler* pScheduler, uint32_t id) {
+    pScheduler->m_tracer.setThreadName("Background " + std::to_string(id));
+    pScheduler->backgroundLoop();
+}
+
+JobScheduler::Fiber* JobScheduler::acquireFiber() {
+    std::lock_guard<std::mutex> lock(m_freeFibersMtx);
+    if (m_freeFibers.empty()) return nullptr;
+    Fiber* pFiber = m_freeFibers.back();
+    m_freeFibers.pop_back();
+    return pFiber;
+}
+
+void JobScheduler::releaseFiber(Fiber* pFiber) {
+    std::lock_guard<std::mutex> lock(m_freeFibersMtx);
+    m_freeFibers.push_back(pFiber);
+}
+
+void JobScheduler::switchToFiber(Fiber* pFiber) {
+#ifdef VKJOB_FIBERS_SUPPORTED
+    FiberThreadState& state = getFiberThreadState();
+    Fiber* pCurrentFiber = state.pCurrentFiber;
+    state.pCurrentFiber = pFiber;
+
+    swapcontext(&pCurrentFiber->context, &pFiber->context);
+
+    // Possibly on another thread now
+    onFiberSwitched();
+#else
+    (void) pFiber;
+#endif
+}
+
+void JobScheduler::onFiberSwitched() {
+    FiberThreadState& state = getFiberThreadState();
+    FiberPostSwitchAction action = state.postSwitchAction;
+    state.postSwitchAction = FIBER_POST_SWITCH_NONE;
+
+    if (action == FIBER_POST_SWITCH_RELEASE) {
+        releaseFiber(state.pPostSwitchFiber);
+    } else if (action == FIBER_POST_SWITCH_WAIT) {
+        Job* pResumeJob = state.pPostSwitchJob;
+        // The counter may have reached zero before the waiting fiber got off its stack, then it can resume right away
+        if (!addWaitingJob(state.postSwitchCounter, pResumeJob)) {
+            scheduleJobs(1, &pResumeJob);
+        }
+    }
+}
+
+void JobScheduler::fiberEntry(uint32_t pointerHigh, uint32_t pointerLow) {
+    // makecontext() only passes int arguments, so the scheduler pointer comes in two halves
+    JobScheduler* pScheduler = reinterpret_cast<JobScheduler*>((static_cast<uintptr_t>(pointerHigh) << 16 << 16) | pointerLow);
+
+    pScheduler->onFiberSwitched();
+    pScheduler->workerLoop();
+
+#ifdef VKJOB_FIBERS_SUPPORTED
+    // Terminated. Return to whichever thread this fiber is on now, the fiber itself is never resumed
+    FiberThreadState& state = getFiberThreadState();
+    state.pCurrentFiber = state.pThreadFiber;
+    setcontext(&state.pThreadFiber->context);
+#endif
+}
+
+void JobScheduler::notifyWorkers(uint32_t count) {
+    ++m_workEpoch;
+    if (m_numSleeping.load() == 0) return;
+
+    // Every spinning worker sees the new epoch. Each one which takes a job wakes a sleeper if no one is left spinning,
+    //   so the rest of the jobs are picked up even if several threads counted on the same spinners
+    uint32_t numSpinning = m_numSpinning.load();
+    if (count <= numSpinning) return;
+
+    getIdleCounters(getCurrentWorkerIndex()).numWakeCalls.fetch_add(1, std::memory_order_relaxed);
+    futex::wake(m_workEpoch, count - numSpinning);
+}
+
+void JobScheduler::wakeSpinner() {
+    if (m_numSpinning.load() == 0 && m_numSleeping.load() > 0) {
+        getIdleCounters(getCurrentWorkerIndex()).numWakeCalls.fetch_add(1, std::memory_order_relaxed);
+        futex::wakeOne(m_workEpoch);
+    }
+}
+
+JobScheduler::IdleStatistics JobScheduler::getIdleStatistics() const {
+    IdleStatistics statistics;
+    for (uint32_t i = 0; i < m_numIdleCounters; ++i) {
+        const IdleCounters& counters = m_idleCounters[i];
+        statistics.numSpinWakeups += counters.numSpinWakeups.load(std::memory_order_relaxed);
+        statistics.numYieldWakeups += counters.numYieldWakeups.load(std::memory_order_relaxed);
+        statistics.numSleeps += counters.numSleeps.load(std::memory_order_relaxed);
+        statistics.numSpins += counters.numSpins.load(std::memory_order_relaxed);
+        statistics.numWakeCalls += counters.numWakeCalls.load(std::memory_order_relaxed);
+    }
+    return statistics;
+}
+
+void JobScheduler::resetIdleStatistics() {
+    for (uint32_t i = 0; i < m_numIdleCounters; ++i) {
+        IdleCounters& counters = m_idleCounters[i];
+        counters.numSpinWakeups.store(0, std::memory_order_relaxed);
+        counters.numYieldWakeups.store(0, std::memory_order_relaxed);
+        counters.numSleeps.store(0, std::memory_order_relaxed);
+        counters.numSpins.store(0, std::memory_order_relaxed);
+        counters.numWakeCalls.store(0, std::memory_order_relaxed);
+    }
+}
+
+bool JobScheduler::scheduleBackgroundJob(Job* pJob) {
+    if (!pJob->decl.background || m_backgroundThreads.empty()) return false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_backgroundJobsMtx);
+        m_backgroundJobs[pJob->decl.priority].push(pJob);
+    }
+    m_backgroundCv.notify_one();
+
+    VKJ_DEBUG_PRINT("Scheduled background job")
+
+    return true;
+}
+
+void JobScheduler::scheduleJobs(uint32_t count, Job* const* ppJobs) {
+    if (count == 0) return;
+
+    uint32_t workerIndex = getCurrentWorkerIndex();
+    uint32_t numScheduled = 0;
+    if (workerIndex < m_workers.size()) {
+        Worker& worker = *m_workers[workerIndex];
+        for (uint32_t i = 0; i < count; ++i) {
+            if (scheduleBackgroundJob(ppJobs[i])) continue;
+            worker.deques[ppJobs[i]->decl.priority].push(ppJobs[i]);
+            ++numScheduled;
+        }
+    } else {
+        std::lock_guard<std::mutex> lock(m_injectedJobsMtx);
+        for (uint32_t i = 0; i < count; ++i) {
+            if (scheduleBackgroundJob(ppJobs[i])) continue;
+            m_injectedJobs[ppJobs[i]->decl.priority].push(ppJobs[i]);
+            ++numScheduled;
+        }
+        m_numInjectedJobs.fetch_add(numScheduled, std::memory_order_release);
+    }
+
+    VKJ_DEBUG_PRINT("Scheduled " << numScheduled << " jobs")
+
+    if (numScheduled > 0) notifyWorkers(numScheduled);
+}
+
+void JobScheduler::scheduleJobList(uint32_t firstLink, uint64_t traceFlow) {
+    if (firstLink == 0) return;
+
+    uint32_t workerIndex = getCurrentWorkerIndex();
+    uint32_t count = 0;
+
+    // Proxies are dropped here, only passing on their dependent if it has nothing left to wait for
+    const auto resolve = [this] (Job* pJob) -> Job* {
+        Job* pDependent = pJob->pDependent;
+        if (!pDependent) return pJob;
+
+        pJob->pDependent = nullptr;
+        m_jobPool.free(pJob);
+        return (pDependent->numDependencies.fetch_sub(1, std::memory_order_acq_rel) == 1) ? pDependent : nullptr;
+    };
+
+    if (workerIndex < m_workers.size()) {
+        Worker& worker = *m_workers[workerIndex];
+        for (uint32_t link = firstLink; link != 0;) {
+            Job* pJob = m_jobPool.getJob(link - 1);
+            link = pJob->next.load(std::memory_order_relaxed);
+            if ((pJob = resolve(pJob))) {
+                pJob->traceFlow = traceFlow;
+                if (scheduleBackgroundJob(pJob)) continue;
+                worker.deques[pJob->decl.priority].push(pJob);
+                ++count;
             }
         }
+    } else {
+        std::lock_guard<std::mutex> lock(m_injectedJobsMtx);
+        for (uint32_t link = firstLink; link != 0;) {
+            Job* pJob = m_jobPool.getJob(link - 1);
+            link = pJob->next.load(std::memory_order_relaxed);
+            if ((pJob = resolve(pJob))) {
+                pJob->traceFlow = traceFlow;
+                if (scheduleBackgroundJob(pJob)) continue;
+                m_injectedJobs[pJob->decl.priority].push(pJob);
+                ++count;
+            }
+        }
+        m_numInjectedJobs.fetch_add(count, std::memory_order_release);
     }
+
+    VKJ_DEBUG_PRINT("Scheduled " << count << " waiting jobs")
+
+    if (count > 0) notifyWorkers(count);
+}
+
+JobScheduler::JobScheduler() :
+    m_workerThreads(),
+    m_workers(),
+    m_injectedJobs(),
+    m_injectedJobsMtx(),
+    m_numInjectedJobs(0),
+    m_jobPool(),
+    m_backgroundThreads(),
+    m_backgroundJobs(),
+    m_backgroundJobsMtx(),
+    m_backgroundCv(),
+    m_numSleeping(0),
+    m_numSpinning(0),
+    m_workEpoch(0),
+    m_idleSpinTime(),
+    m_idleYieldTime(),
+    m_idleCounters(new IdleCounters[1]),
+    m_numIdleCounters(1),
+    m_counterBlocks(),
+    m_numCounters(0),
+    m_freeCounters(),
+    m_countersByHashID(),
+    m_freeCounterMtx(),
+    m_countersMapMtx(),
+    m_fibers(),
+    m_freeFibers(),
+    m_freeFibersMtx(),
+    m_useFibers(false),
+    m_programTerminated(false),
+    m_tracer()
+{
+
 }
 
-void JobScheduler::spawnThreads() {
-    auto nThreads = std::thread::hardware_concurrency();
+JobScheduler::~JobScheduler() {
+
+}
+
+void JobScheduler::spawnThreads(InitParameters parameters) {
+    uint32_t nThreads = parameters.numWorkers;
+    if (nThreads == 0) {
+        // Keep at least one worker however many threads are reserved. If the count can't be detected this stays 0
+        uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        nThreads = (hardwareThreads > parameters.numReservedThreads) ? hardwareThreads - parameters.numReservedThreads
+                                                                     : std::min(hardwareThreads, 1u);
+    }
 
     m_programTerminated = false;
+
+    // Spinning only pays off if whoever adds the work can run at the same time
+    m_idleSpinTime = std::chrono::microseconds(std::thread::hardware_concurrency() > 1 ? parameters.idleSpinMicroseconds : 0);
+    m_idleYieldTime = std::chrono::microseconds(parameters.idleYieldMicroseconds);
+
+    m_tracer.setEventsPerThread(parameters.traceEventsPerThread);
+    if (parameters.enableTracing) m_tracer.setEnabled(true);
+
     if (nThreads > 0) {
-        m_threadJobQueues.resize(nThreads);
-
-        std::cout << "Spawning " << nThreads << " worker threads." << std::endl;
+        if (parameters.useFibers) {
+#ifdef VKJOB_FIBERS_SUPPORTED
+            // Every worker needs one fiber to run on, plus some to switch to when a job waits
+            uint32_t numFibers = std::max(parameters.numFibers, 2 * nThreads);
+
+            std::cout << "Creating " << numFibers << " job fibers." << std::endl;
+
+            uintptr_t schedulerPointer = reinterpret_cast<uintptr_t>(this);
+            for (uint32_t i = 0; i < numFibers; ++i) {
+                auto pFiber = std::make_unique<Fiber>();
+                pFiber->stack.reset(new char[parameters.fiberStackSize]);
+
+                getcontext(&pFiber->context);
+                pFiber->context.uc_stack.ss_sp = pFiber->stack.get();
+                pFiber->context.uc_stack.ss_size = parameters.fiberStackSize;
+                pFiber->context.uc_link = nullptr;
+                makecontext(&pFiber->context, reinterpret_cast<void (*)()>(fiberEntry), 2,
+                            static_cast<uint32_t>(schedulerPointer >> 16 >> 16), static_cast<uint32_t>(schedulerPointer));
+
+                m_freeFibers.push_back(pFiber.get());
+                m_fibers.push_back(std::move(pFiber));
+            }
+            m_useFibers = true;
+#else
+            throw std::runtime_error("Job fibers are not supported on this platform.");
+#endif
+        }
+
+        // Workers must all exist before any thread starts stealing
+        for (uint32_t i = 0; i < nThreads; ++i) {
+            m_workers.push_back(std::make_unique<Worker>());
+        }
+
+        m_idleCounters.reset(new IdleCounters[nThreads + 1]);
+        m_numIdleCounters = nThreads + 1;
+
+        std::cout << "Spawning " << nThreads << " worker threads." << std::endl;
 
         for (uint32_t i = 0; i < nThreads; ++i) {
             m_workerThreads.push_back(std::thread(workerThreadMain, this, i));
         }
+
+        if (parameters.numBackgroundThreads > 0) {
+            std::cout << "Spawning " << parameters.numBackgroundThreads << " background threads." << std::endl;
+        }
+
+        for (uint32_t i = 0; i < parameters.numBackgroundThreads; ++i) {
+            m_backgroundThreads.push_back(std::thread(backgroundThreadMain, this, i));
+        }
     } else {
         throw std::runtime_error("Unable to detect hardware thread count.");
     }
@@ -95,45 +699,157 @@ void JobScheduler::spawnThreads() {
 
 void JobScheduler::joinThreads() {
     std::cout << "Joining worker threads" << std::endl;
+    // Sleeping workers check for termination after registering, so they either see it or see the epoch change
     m_programTerminated = true;
+    ++m_workEpoch;
+    futex::wakeAll(m_workEpoch);
     for (uint32_t i = 0; i < m_workerThreads.size(); ++i) {
-        {
-            std::lock_guard<std::mutex> lock(m_threadJobQueues[i].mtx);
-            m_threadJobQueues[i].workReady = true;  // well... not really lol
-            m_threadJobQueues[i].cv.notify_all();
-        }
         m_workerThreads[i].join();
 
         VKJ_DEBUG_PRINT("worker thread " << i << " joined")
 
     }
 
+    {
+        // Background threads check for termination while holding their lock, so they are either waiting or will see it
+        std::lock_guard<std::mutex> lock(m_backgroundJobsMtx);
+        m_backgroundCv.notify_all();
+    }
+    for (auto& thread : m_backgroundThreads) {
+        thread.join();
+    }
+
     std::cout << "Job Scheduler terminated" << std::endl;
 }
 
-/*
-void JobScheduler::waitForQueues() {
-    std::cout << "Waiting for queues" << std::endl;
-    for (uint32_t i = 0; i < m_threadJobQueues.size(); ++i) {
-        std::unique_lock<std::mutex> lock(m_threadJobQueues[i].mtx);
-        while (m_threadJobQueues[i].workReady)
-            m_threadJobQueues[i].cv.wait(lock);
-        std::cout << "Queue " << i << " finished" << std::endl;
+void JobScheduler::waitForCounter(JobScheduler::CounterHandle handle) {
+    Counter& counter = getCounter(handle);
+
+    if (m_useFibers && getCurrentWorkerIndex() < m_workers.size() && (counter.state.load() >> 32) != 0) {
+        Fiber* pNextFiber = acquireFiber();
+        if (pNextFiber) {
+            FiberThreadState& state = getFiberThreadState();
+
+            Job* pResumeJob = m_jobPool.allocate();
+            pResumeJob->decl = JobDeclaration();
+            pResumeJob->decl.priority = state.pCurrentFiber->jobPriority;
+            pResumeJob->pResumeFiber = state.pCurrentFiber;
+
+            state.postSwitchAction = FIBER_POST_SWITCH_WAIT;
+            state.pPostSwitchJob = pResumeJob;
+            state.postSwitchCounter = handle;
+
+            VKJ_DEBUG_PRINT("Suspending job to wait for counter " << VKJ_COUNTER_NAME(handle))
+
+            // The worker goes on to other jobs, so the job's slice ends here and a new one begins when it resumes
+            m_tracer.record(JobTracer::EVENT_END);
+
+            switchToFiber(pNextFiber);
+            return;
+        }
+        // Out of fibers, block the worker instead
+    }
+
+    bool blocked = false;
+    while (true) {
+        // Read the sequence before the count, so a decrement to zero in between changes it and the futex won't sleep
+        uint32_t sequence = counter.wakeSequence.load();
+        if ((counter.state.load() >> 32) == 0) break;
+
+        if (!blocked) {
+            m_tracer.record(JobTracer::EVENT_WAIT_BEGIN, nullptr, 0, handle);
+            blocked = true;
+        }
+
+        // Register before checking again, so whoever brings the count to zero either sees us or we see it happened
+        ++counter.numSleepers;
+        if (counter.wakeSequence.load() == sequence && (counter.state.load() >> 32) != 0) {
+            futex::wait(counter.wakeSequence, sequence);
+        }
+        --counter.numSleepers;
+    }
+
+    if (blocked) {
+        m_tracer.record(JobTracer::EVENT_WAIT_END, nullptr, makeTraceFlow(handle, counter.wakeSequence.load()), handle);
     }
-    std::cout << "All queues finished" << std::endl;
 }
-*/
-
-void JobScheduler::waitForCounter(JobScheduler::CounterHandle handle) {
-    std::unique_lock<std::mutex> lock(m_counters[handle].mtx);
-    while (m_counters[handle].count > 0) {
-        m_counters[handle].cv.wait(lock);
-    }
+
+void JobScheduler::waitForCounterAndHelp(JobScheduler::CounterHandle handle) {
+    uint32_t workerIndex = getCurrentWorkerIndex();
+    if (m_useFibers) {
+        waitForCounter(handle);
+        return;
+    }
+    if (workerIndex < m_workers.size()) {
+        // What is left was stolen by other workers, or is waiting on other counters
+        runOwnJobsSignalling(workerIndex, handle);
+        waitForCounter(handle);
+        return;
+    }
+
+    Counter& counter = getCounter(handle);
+    bool idle = false;
+
+    while (true) {
+        // As in workerLoop(), read these before searching so we can tell if anything happened while we were
+        uint32_t epoch = m_workEpoch.load();
+        uint32_t sequence = counter.wakeSequence.load();
+        if ((counter.state.load() >> 32) == 0) {
+            // We may have been the spinner a new job was left for, pass it on
+            if (idle) wakeSpinner();
+            return;
+        }
+
+        Job* pJob = findJob(workerIndex);
+        if (pJob) {
+            if (idle) wakeSpinner();
+            idle = false;
+            runJob(pJob);
+            continue;
+        }
+
+        // Idle with the workers, so new jobs wake us as well as the count reaching zero
+        m_tracer.record(JobTracer::EVENT_WAIT_BEGIN, nullptr, 0, handle);
+        idleWait(epoch, &counter, sequence);
+        m_tracer.record(JobTracer::EVENT_WAIT_END);
+        idle = true;
+    }
+}
+
+void JobScheduler::runOwnJobsSignalling(uint32_t workerIndex, JobScheduler::CounterHandle handle) {
+    Worker& worker = *m_workers[workerIndex];
+    Counter& counter = getCounter(handle);
+
+    const auto signals = [handle] (const Job* pJob) {
+        for (int i = 0; i < pJob->decl.numSignalCounters; ++i) {
+            if (pJob->decl.signalCounters[i] == handle) return true;
+        }
+        return false;
+    };
+
+    while ((counter.state.load() >> 32) != 0) {
+        Job* pJob = nullptr;
+        for (int priority = JOB_PRIORITY_HIGH; priority != JOB_PRIORITY_MAX_ENUM && !pJob; ++priority) {
+            if (!worker.deques[priority].pop(pJob)) continue;
+            if (!signals(pJob)) {
+                // Back where it was, for the worker loop to get to once this job is done
+                worker.deques[priority].push(pJob);
+                pJob = nullptr;
+            }
+        }
+        if (!pJob) return;
+
+        runJob(pJob);
+    }
+}
+
+bool JobScheduler::isCounterZero(JobScheduler::CounterHandle handle) {
+    return (getCounter(handle).state.load(std::memory_order_acquire) >> 32) == 0;
 }
 
 uint32_t JobScheduler::getRandomThread() const {
     static thread_local std::mt19937 generator((uint_fast32_t) (std::hash<std::thread::id>{}(std::this_thread::get_id())));
-    std::uniform_int_distribution<uint32_t> dist(0, m_workerThreads.size()-1);
+    std::uniform_int_distribution<uint32_t> dist(0, m_workers.size()-1);
     return dist(generator);
 }
 
@@ -146,69 +862,63 @@ void JobScheduler::enqueueJob(JobScheduler::JobDeclaration decl) {
 
         sstr << "  Signal Counters: ";
         for (auto j = 0; j < decl.numSignalCounters; ++j)
-            sstr << (m_counters[decl.signalCounters[j]].hasID ?
-                     m_counters[decl.signalCounters[j]].id :
-                     std::to_string(decl.signalCounters[j])) << " ";
+            sstr << VKJ_COUNTER_NAME(decl.signalCounters[j]) << " ";
         sstr << std::endl;
 
-        sstr << "  Wait Counter: " << ((decl.waitCounter != COUNTER_NULL) ?
-                                      (m_counters[decl.waitCounter].hasID ? m_counters[decl.waitCounter].id : std::to_string(decl.waitCounter)) :
-                                      "NULL") << std::endl;
+        sstr << "  Wait Counters: ";
+        for (auto j = 0; j < decl.numWaitCounters; ++j)
+            sstr << VKJ_COUNTER_NAME(decl.waitCounters[j]) << " ";
+        sstr << std::endl;
         sstr << "  Param (uintptr_t): " << decl.param << std::endl;
         sstr << "  Function (addr): " << (uintptr_t) decl.pFunction << std::endl;
 
     VKJ_DEBUG_PRINT(sstr.str());
     #endif // VKJOB_DEBUG
 
+    // Signal counters must be incremented before the job can possibly run
+    incrementSignalCounters(1, &decl);
 
-    bool wait = false;
-    if (decl.waitCounter != COUNTER_NULL) {
-        std::shared_lock<std::shared_mutex> slock(m_allCountersMtx);
-        std::lock_guard<std::mutex> lock(m_counters[decl.waitCounter].mtx);
-        std::lock_guard<std::shared_mutex> wlock(m_waitListsMtx);
-        if (m_counters[decl.waitCounter].count > 0) {
-            m_counterWaitLists[decl.waitCounter].push_front(decl);
-            wait = true;
-        }
-    }
-
-    if (wait) VKJ_DEBUG_PRINT(" Job waiting for counter ");
-
-    if (decl.numSignalCounters > 0) {
-        std::shared_lock<std::shared_mutex> slock(m_allCountersMtx);
-        for (int i = 0; i < decl.numSignalCounters; ++i) {
-            CounterHandle counter = decl.signalCounters[i];
-            if (counter != COUNTER_NULL) {
-                std::lock_guard<std::mutex> lock(m_counters[counter].mtx);
-                ++m_counters[counter].count;
+    Job* pJob = m_jobPool.allocate();
+    pJob->decl = decl;
 
-                VKJ_DEBUG_PRINT("Counter " << (m_counters[counter].hasID ? m_counters[counter].id : std::to_string(counter)) << " incremented. Value: " << m_counters[counter].count)
-
-            }
-        }
+    if (addWaitingJobToCounters(pJob)) {
+        VKJ_DEBUG_PRINT(" Job waiting for counter ");
+        return;
     }
 
-    if (wait) return;
-
-    //if (decl.pFunction == nullptr) std::cout << "Howdy!" << msg << std::endl;
-
-    uint32_t thread = getRandomThread();
-
-    std::lock_guard<std::mutex> lock(m_threadJobQueues[thread].mtx);
-
-    VKJ_DEBUG_PRINT("adding job to thread " << thread << " q " << decl.priority)
+    scheduleJobs(1, &pJob);
+}
 
-    m_threadJobQueues[thread].priorityLevelQueues[decl.priority].push(decl);
-    m_threadJobQueues[thread].workReady = true;
-    m_threadJobQueues[thread].cv.notify_all();
+void JobScheduler::parallelFor(uint32_t begin, uint32_t end, uint32_t grain, RangeFunction* pFunction, uintptr_t param,
+                               CounterHandle signalCounter, PriorityLevel priority, const char* name) {
+    if (end <= begin) return;
+
+    uint32_t count = end - begin;
+    // At least one split, for a scheduler without workers whose jobs are run by threads waiting on counters
+    uint32_t maxSplits = static_cast<uint32_t>(std::max<size_t>(1, m_workers.size() * PARALLEL_FOR_SPLITS_PER_WORKER));
+    uint32_t autoGrain = (count + maxSplits - 1) / maxSplits;
+
+    Job* pJob = m_jobPool.allocate();
+    pJob->decl = JobDeclaration();
+    pJob->decl.name = name;
+    pJob->decl.param = param;
+    pJob->decl.priority = priority;
+    if (signalCounter != COUNTER_NULL) {
+        pJob->decl.signalCounters[0] = signalCounter;
+        pJob->decl.numSignalCounters = 1;
+        incrementCounter(signalCounter, 1);
+    }
+    pJob->pRangeFunction = pFunction;
+    pJob->rangeBegin = begin;
+    pJob->rangeEnd = end;
+    pJob->grain = std::max({grain, autoGrain, 1u});
 
-    VKJ_DEBUG_PRINT("Thread " << thread << " notified")
+    VKJ_DEBUG_PRINT("Parallel for over " << count << " elements, grain " << pJob->grain)
 
+    scheduleJobs(1, &pJob);
 }
 
 void JobScheduler::enqueueJobs(uint32_t count, JobScheduler::JobDeclaration* pDecls, bool ignoreSignals) {
-    uint32_t startThread = getRandomThread();
-
     #ifdef VKJOB_DEBUG
     std::stringstream sstr;
     sstr << "Enqueueing Jobs:" << std::endl;
@@ -219,111 +929,47 @@ void JobScheduler::enqueueJobs(uint32_t count, JobScheduler::JobDeclaration* pDe
 
         sstr << "  Signal Counters: ";
         for (auto j = 0; j < pDecls[i].numSignalCounters; ++j)
-            sstr << (m_counters[decl.signalCounters[j]].hasID ?
-                     m_counters[decl.signalCounters[j]].id :
-                     std::to_string(decl.signalCounters[j])) << " ";
+            sstr << VKJ_COUNTER_NAME(decl.signalCounters[j]) << " ";
         sstr << std::endl;
 
-        sstr << "  Wait Counter: " << ((decl.waitCounter != COUNTER_NULL) ?
-                                      (m_counters[decl.waitCounter].hasID ? m_counters[decl.waitCounter].id : std::to_string(decl.waitCounter)) :
-                                      "NULL") << std::endl;
+        sstr << "  Wait Counters: ";
+        for (auto j = 0; j < decl.numWaitCounters; ++j)
+            sstr << VKJ_COUNTER_NAME(decl.waitCounters[j]) << " ";
+        sstr << std::endl;
         sstr << "  Param (uintptr_t): " << decl.param << std::endl;
         sstr << "  Function (addr): " << (uintptr_t) decl.pFunction << std::endl;
     }
     VKJ_DEBUG_PRINT(sstr.str());
     #endif // VKJOB_DEBUG
 
-    // Determine which jobs need to wait
-    // These jobs will be added to the central wait lists and not enqueued
-    std::map<CounterHandle, std::forward_list<uint32_t>> waitLists;
+    // Signal all the counters for jobs that are being enqueued
+    if (!ignoreSignals) incrementSignalCounters(count, pDecls);
 
-    std::vector<std::forward_list<CounterHandle>> waitCounters(count);
+    // Jobs which don't need to wait are scheduled in batches, so a large fan-out doesn't need a temporary allocation
+    static constexpr uint32_t batchSize = 64;
+    std::array<Job*, batchSize> batch;
+    uint32_t batchCount = 0;
+    uint32_t waitCount = 0;
 
     for (uint32_t i = 0; i < count; ++i) {
-        if (pDecls[i].waitCounter != COUNTER_NULL) {
-            waitLists[pDecls[i].waitCounter].push_front(i);
-        }
-    }
-
-    std::vector<bool> isWaiting(count, false);
-    uint32_t waitCount = 0;
+        Job* pJob = m_jobPool.allocate();
+        pJob->decl = pDecls[i];
 
-    {
-        std::shared_lock<std::shared_mutex> slock(m_allCountersMtx);
-        for (auto kv : waitLists) {
-            std::lock_guard<std::mutex> lock(m_counters[kv.first].mtx);
-            std::lock_guard<std::shared_mutex> wlock(m_waitListsMtx);
-            if (m_counters[kv.first].count > 0) {
-                int dctr = 0;
-                for (auto ind : kv.second) {
-                    isWaiting[ind] = true;
-                    m_counterWaitLists[kv.first].push_front(pDecls[ind]);
-                    ++waitCount;
-                    ++dctr;
-                }
-                VKJ_DEBUG_PRINT( dctr << " jobs waiting for counter " << (m_counters[kv.first].hasID ? m_counters[kv.first].id : std::to_string(kv.first)) );
-            }
+        if (addWaitingJobToCounters(pJob)) {
+            ++waitCount;
+            continue;
         }
-    }
-    VKJ_DEBUG_PRINT( waitCount << " jobs waiting" );
 
-
-    // Signal all the counters for jobs that are being enqueued
-    // Sort the declarations by counter, since in some cases many may all share the same counter(s)
-    if (!ignoreSignals) {
-        std::map<CounterHandle, uint32_t> signalCounts;
-
-        for (uint32_t i = 0; i < count; ++i) {
-            if (/* !isWaiting[i] && */pDecls[i].numSignalCounters > 0) {
-                for (int j = 0; j < pDecls[i].numSignalCounters; ++j) {
-                    CounterHandle counter = pDecls[i].signalCounters[j];
-                    ++signalCounts[counter];
-                }
-            }
-        }
-
-        {
-            std::shared_lock<std::shared_mutex> slock(m_allCountersMtx);
-            for (auto kv : signalCounts) {
-                std::lock_guard<std::mutex> lock(m_counters[kv.first].mtx);
-                m_counters[kv.first].count += kv.second;
-
-                VKJ_DEBUG_PRINT("Counter " << (m_counters[kv.first].hasID ? m_counters[kv.first].id : std::to_string(kv.first)) << " incremented by:" << kv.second << " to: " << m_counters[kv.first].count)
-
-            }
+        batch[batchCount++] = pJob;
+        if (batchCount == batchSize) {
+            scheduleJobs(batchCount, batch.data());
+            batchCount = 0;
         }
     }
 
-    // Enqueue all non-waiting jobs by splitting between all worker threads
-    uint32_t ind = 0;
-    uint32_t fnum = (count - waitCount > m_workerThreads.size()) ? (uint32_t) (count - waitCount) / m_workerThreads.size() : 0u;
-    uint32_t remainder = (count - waitCount) - (m_workerThreads.size() * fnum);
-    for (uint32_t i = 0; i < m_workerThreads.size(); ++i) {
-        uint32_t thread = (startThread + i) % m_workerThreads.size();
+    scheduleJobs(batchCount, batch.data());
 
-        uint32_t num = fnum;
-        if (i < remainder) ++num;
-
-        //if ((i+1) * num > count - waitCount) num = (count - waitCount) - i * num;
-        if (num == 0) break;
-
-        VKJ_DEBUG_PRINT("Thread " << thread << " gets " << num << " jobs")
-
-        std::lock_guard<std::mutex> lock(m_threadJobQueues[thread].mtx);
-        for (uint32_t cct = 0; ind < count && cct < num; ++ind) {
-            if (isWaiting[ind]) continue;
-            m_threadJobQueues[thread].priorityLevelQueues[pDecls[ind].priority].push(pDecls[ind]);
-            ++cct;
-        }
-
-        m_threadJobQueues[thread].workReady = true;
-        m_threadJobQueues[thread].cv.notify_all();
-
-        //ind += num;
-        if (ind >= count) break;
-    }
-
-    VKJ_DEBUG_PRINT("Assigned " << ind << " out of " << count << " jobs. " << waitCount << " are supposed to wait")
+    VKJ_DEBUG_PRINT("Scheduled " << (count - waitCount) << " out of " << count << " jobs. " << waitCount << " are waiting")
 
 }
 
@@ -334,11 +980,9 @@ JobScheduler::CounterHandle JobScheduler::getCounterByID(std::string id) {
         return it->second;
     } else {
         CounterHandle handle = getFreeCounter();
-        std::shared_lock<std::shared_mutex> slock(m_allCountersMtx);
-        std::lock_guard<std::mutex> lock(m_counters[handle].mtx);
-        m_counters[handle].hasID = true;
+        getCounter(handle).hasID = true;
+        getCounter(handle).id = id;
         m_countersByHashID[idHash] = handle;
-        m_counters[handle].id = id;
 
         //std::cout << id << " " << handle << std::endl;
 
@@ -347,50 +991,149 @@ JobScheduler::CounterHandle JobScheduler::getCounterByID(std::string id) {
 }
 
 JobScheduler::CounterHandle JobScheduler::getFreeCounter() {
-    {
-        std::lock_guard<std::mutex> lock(m_freeCounterMtx);
-        if (!m_freeCounters.empty()) {
-            CounterHandle handle = m_freeCounters.front();
-            m_freeCounters.pop_front();
-            return handle;
-        }
+    std::lock_guard<std::mutex> lock(m_freeCounterMtx);
+    if (!m_freeCounters.empty()) {
+        CounterHandle handle = m_freeCounters.front();
+        m_freeCounters.pop_front();
+        return handle;
     }
 
-    std::lock_guard<std::shared_mutex> lock(m_allCountersMtx);
-    CounterHandle handle = m_counters.size();
-    m_counters.emplace_back();
-    m_counters.back().handle = handle;
+    CounterHandle handle = m_numCounters;
+    uint32_t block = handle / COUNTER_BLOCK_SIZE;
+    if (block == MAX_COUNTER_BLOCKS) {
+        throw std::runtime_error("Too many job counters.");
+    }
+    if (!m_counterBlocks[block]) {
+        m_counterBlocks[block].reset(new Counter[COUNTER_BLOCK_SIZE]);
+    }
+    ++m_numCounters;
     return handle;
 }
 
-void JobScheduler::decrementCounter(JobScheduler::CounterHandle handle) {
-    std::vector<JobDeclaration> waitJobs;
-    {
-        std::shared_lock<std::shared_mutex> slock(m_allCountersMtx);
-        std::lock_guard<std::mutex> lock(m_counters[handle].mtx);
-        if ((--m_counters[handle].count) == 0) {
-            m_counters[handle].cv.notify_all();
-            std::shared_lock<std::shared_mutex> wlock(m_waitListsMtx);
-            if (auto kv = m_counterWaitLists.find(handle); kv != m_counterWaitLists.end()) {
-                waitJobs.assign(kv->second.begin(), kv->second.end());
-                kv->second.clear();
+void JobScheduler::incrementCounter(JobScheduler::CounterHandle handle, uint32_t count) {
+    uint64_t state = getCounter(handle).state.fetch_add(static_cast<uint64_t>(count) << 32, std::memory_order_relaxed);
+
+    VKJ_DEBUG_PRINT("Counter " << VKJ_COUNTER_NAME(handle) << " incremented by:" << count << " to: " << ((state >> 32) + count))
+    (void) state;
+}
+
+void JobScheduler::incrementSignalCounters(uint32_t count, const JobScheduler::JobDeclaration* pDecls) {
+    // Most fan-outs share a few counters, so accumulate into a small table and flush it when full
+    static constexpr uint32_t maxPending = 8;
+    std::array<std::pair<CounterHandle, uint32_t>, maxPending> pending;
+    uint32_t numPending = 0;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        for (int j = 0; j < pDecls[i].numSignalCounters; ++j) {
+            CounterHandle handle = pDecls[i].signalCounters[j];
+            if (handle == COUNTER_NULL) continue;
+
+            uint32_t k = 0;
+            while (k < numPending && pending[k].first != handle) ++k;
+            if (k < numPending) {
+                ++pending[k].second;
+                continue;
             }
 
-            VKJ_DEBUG_PRINT("Counter " << (m_counters[handle].hasID ? m_counters[handle].id : std::to_string((int)handle)) << " hit zero. Enqueuing " << waitJobs.size() << " jobs.")
-        } else {
-            VKJ_DEBUG_PRINT("Counter " << (m_counters[handle].hasID ? m_counters[handle].id : std::to_string((int)handle)) << " decremented. Value: " << m_counters[handle].count)
+            if (numPending == maxPending) {
+                for (uint32_t p = 0; p < numPending; ++p) incrementCounter(pending[p].first, pending[p].second);
+                numPending = 0;
+            }
+            pending[numPending++] = {handle, 1};
         }
     }
-    if (!waitJobs.empty()) enqueueJobs(waitJobs.size(), waitJobs.data(), true);
+
+    for (uint32_t p = 0; p < numPending; ++p) incrementCounter(pending[p].first, pending[p].second);
+}
+
+bool JobScheduler::addWaitingJob(JobScheduler::CounterHandle handle, Job* pJob) {
+    Counter& counter = getCounter(handle);
+    uint64_t state = counter.state.load(std::memory_order_acquire);
+    uint64_t newState;
+    do {
+        if ((state >> 32) == 0) return false;
+        pJob->next.store(static_cast<uint32_t>(state & 0xffffffffu), std::memory_order_relaxed);
+        newState = (state & 0xffffffff00000000u) | (pJob->poolIndex + 1);
+    } while (!counter.state.compare_exchange_weak(state, newState, std::memory_order_acq_rel, std::memory_order_acquire));
+    return true;
+}
+
+bool JobScheduler::addWaitingJobToCounters(Job* pJob) {
+    const JobDeclaration& decl = pJob->decl;
+
+    if (decl.numWaitCounters == 0) return false;
+
+    if (decl.numWaitCounters == 1) {
+        return decl.waitCounters[0] != COUNTER_NULL && addWaitingJob(decl.waitCounters[0], pJob);
+    }
+
+    // The count starts one higher than the number of counters and that last one is only taken once every proxy
+    //   has been added, so the job can't be scheduled while we are still looking at it
+    pJob->numDependencies.store(decl.numWaitCounters + 1, std::memory_order_relaxed);
+
+    for (int i = 0; i < decl.numWaitCounters; ++i) {
+        if (decl.waitCounters[i] != COUNTER_NULL) {
+            Job* pProxy = m_jobPool.allocate();
+            pProxy->pDependent = pJob;
+            if (addWaitingJob(decl.waitCounters[i], pProxy)) continue;
+
+            pProxy->pDependent = nullptr;
+            m_jobPool.free(pProxy);
+        }
+        pJob->numDependencies.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    return pJob->numDependencies.fetch_sub(1, std::memory_order_acq_rel) != 1;
+}
+
+void JobScheduler::decrementCounter(JobScheduler::CounterHandle handle) {
+    Counter& counter = getCounter(handle);
+    uint64_t state = counter.state.load(std::memory_order_relaxed);
+    uint64_t newState;
+    do {
+        assert((state >> 32) > 0);
+        // Reaching zero takes the wait list along with it
+        newState = ((state >> 32) == 1) ? 0 : state - (uint64_t(1) << 32);
+    } while (!counter.state.compare_exchange_weak(state, newState, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+    if (newState != 0) {
+        VKJ_DEBUG_PRINT("Counter " << VKJ_COUNTER_NAME(handle) << " decremented. Value: " << (newState >> 32))
+        return;
+    }
+
+    VKJ_DEBUG_PRINT("Counter " << VKJ_COUNTER_NAME(handle) << " hit zero.")
+
+    uint64_t traceFlow = makeTraceFlow(handle, ++counter.wakeSequence);
+    m_tracer.record(JobTracer::EVENT_COUNTER_SIGNAL, nullptr, traceFlow, handle);
+
+    if (counter.numSleepers.load() > 0) {
+        futex::wakeAll(counter.wakeSequence);
+    }
+    if (counter.numHelpers.load() > 0) {
+        // Helpers sleep on the work epoch, and check the sequence after registering so they either see it changed or
+        //   are woken here. This also wakes the sleeping workers, which go back to sleep if they find nothing
+        ++m_workEpoch;
+        futex::wakeAll(m_workEpoch);
+    }
+
+    scheduleJobList(static_cast<uint32_t>(state & 0xffffffffu), traceFlow);
 }
 
 void JobScheduler::freeCounter(JobScheduler::CounterHandle handle) {
-    std::shared_lock<std::shared_mutex> slock(m_allCountersMtx);
-    if (handle < m_counters.size()) {
-        std::lock_guard<std::mutex> lock(m_counters[handle].mtx);
-        std::lock_guard<std::mutex> freeListLock(m_freeCounterMtx);
+    std::lock_guard<std::mutex> freeListLock(m_freeCounterMtx);
+    if (handle < m_numCounters) {
+        Counter& counter = getCounter(handle);
+        assert((counter.state.load() & 0xffffffffu) == 0);
+        counter.state = 0;
+        counter.hasID = false;
         m_freeCounters.push_front(handle);
-        m_counters[handle].count = 0;
-        m_counters[handle].hasID = false;
     }
 }
+
+void JobScheduler::writeTrace(std::ostream& out, uint32_t numFrames) {
+    m_tracer.writeChromeTrace(out, numFrames, [this] (uint32_t handle) {
+        std::lock_guard<std::mutex> lock(m_countersMapMtx);
+        const Counter& counter = getCounter(handle);
+        return counter.hasID ? counter.id : std::to_string(handle);
+    });
+}
@@ -1,28 +1,46 @@
 #ifndef JOB_SCHEDULER_H_
 #define JOB_SCHEDULER_H_
 
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <forward_list>
 #include <map>
+#include <memory>
 #include <mutex>
-#include <shared_mutex>
+#include <new>
 #include <queue>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
+#include "core/job_tracer.h"
+#include "core/util/work_stealing_deque.h"
+
 /**
- * Basic implementation of a work-sharing scheduler
- * Tasks in the form of JobDeclarations may be enqueued by any thread and will be assigned to a random thread's work pool
+ * Basic implementation of a work-stealing scheduler
+ * Tasks in the form of JobDeclarations may be enqueued by any thread
+ * Each worker thread owns one Chase-Lev deque per priority level. Jobs enqueued from a worker go to the bottom of its own deque,
+ *   jobs enqueued from any other thread go to a shared injection queue. Workers pop their own deques LIFO, and when those run dry
+ *   they take from the injection queue and then steal FIFO from the other workers before going to sleep
  * Tasks may indicate zero or more counters to signal when they complete
- * Tasks may also indicate one counter to wait for before being scheduled
+ * Tasks may also indicate zero or more counters to wait for, and are scheduled once all of them have reached zero
+ * Counters are lock-free: the count and the list of jobs waiting for it to reach zero share a single atomic word, the list
+ *   being linked through the jobs themselves. Threads calling waitForCounter() sleep on a futex
+ * Jobs which take long or block, like file I/O, can be run on a separate pool of background threads with its own queue
+ *   (see JobDeclaration::background), so they don't hold up the workers the frame's jobs need. Counters work the same
+ *   across both, so frame jobs can wait on background jobs and the other way around
+ * Optionally jobs run on fibers (see InitParameters::useFibers). A job calling waitForCounter() is then suspended and its
+ *   worker picks up other jobs in the meantime. The job resumes, possibly on another worker, once the counter reaches zero
  * A task's job function can be any function of type void(uintptr_t).
  * When called, a user-provided parameter (stored in JobDeclaration) will be passed to the function, allowing arbitrary parameters
- *   in the form of pointer-to-structs.
+ *   in the form of pointer-to-structs. Alternatively a small closure can be stored in the JobDeclaration itself, see setClosure()
  * Note that the lifetime of objects pointed to as parameters must be managed by the user, to ensure stale pointers are not
  *   dereferenced when the job function executes at a later time, when the calling scope may have ended. Signal counters can help with this.
+ * What the workers are doing can be traced with getTracer(), and written out with writeTrace()
 **/
 class JobScheduler {
 
@@ -37,117 +55,406 @@ public:
 
     typedef void JobFunction (uintptr_t);
 
+    // Called by parallelFor() with a sub-range [begin, end) of the full range
+    typedef void RangeFunction (uint32_t begin, uint32_t end, uintptr_t param);
+
     typedef uint32_t CounterHandle;
     static constexpr CounterHandle COUNTER_NULL = std::numeric_limits<uint32_t>::max();
 
     static constexpr int MAX_COUNTERS = 4;
 
+    // Called with the closure storage of a JobDeclaration, see JobDeclaration::setClosure()
+    typedef void ClosureFunction (void*);
+
+    static constexpr size_t MAX_CLOSURE_SIZE = 64;
+
     struct JobDeclaration {
+        // Shown in traces. Not copied, so it must outlive the scheduler
+        const char* name = nullptr;
         JobFunction* pFunction = nullptr;
         uintptr_t param = 0;
+
+        // Used instead of pFunction and param when set
+        ClosureFunction* pClosureFunction = nullptr;
+        alignas(16) unsigned char closure[MAX_CLOSURE_SIZE];
         PriorityLevel priority = JOB_PRIORITY_NORMAL;
-        CounterHandle waitCounter = COUNTER_NULL;
+
+        // Run on the background threads rather than the workers. Ignored if there are no background threads
+        bool background = false;
+
+        CounterHandle waitCounters[MAX_COUNTERS] = {COUNTER_NULL};
+        int numWaitCounters = 0;
         CounterHandle signalCounters[MAX_COUNTERS] = {COUNTER_NULL};
         int numSignalCounters = 0;
 
         JobDeclaration() {}
+
+        // Run a copy of f rather than pFunction. f is stored inline, so the job needs no parameter struct that
+        //   outlives the call to enqueue it, and nothing is allocated
+        // f must be trivially copyable (e.g. a lambda capturing only pointers and plain values) and fit in MAX_CLOSURE_SIZE
+        template <typename F>
+        void setClosure(const F& f) {
+            static_assert(std::is_trivially_copyable<F>::value, "Job closures must be trivially copyable");
+            static_assert(sizeof(F) <= MAX_CLOSURE_SIZE, "Job closure is too large");
+            static_assert(alignof(F) <= 16, "Job closure is over-aligned");
+
+            new (closure) F(f);
+            pClosureFunction = [] (void* pClosure) {
+                (*static_cast<F*>(pClosure))();
+            };
+        }
     };
 
-    JobScheduler() :
-        m_workerThreads(),
-        m_threadJobQueues(),
-        m_counters(),
-        m_freeCounters(),
-        m_countersByHashID(),
-        m_allCountersMtx(),
-        m_freeCounterMtx(),
-        m_countersMapMtx(),
-        m_waitListsMtx(),
-        m_counterWaitLists(),
-        m_programTerminated(false)
-    {
+    struct InitParameters {
+        // Number of worker threads. 0 to use one per hardware thread, less numReservedThreads
+        uint32_t numWorkers = 0;
 
-    }
+        // Hardware threads left to threads outside the scheduler when numWorkers is 0, so workers don't compete with them
+        //   for cores. Usually one for the main thread, which can still run jobs while it waits with waitForCounterAndHelp()
+        uint32_t numReservedThreads = 1;
+
+        // Threads running background jobs. Not counted against the hardware threads, since they are expected to spend
+        //   most of their time sleeping or blocked on I/O
+        uint32_t numBackgroundThreads = 1;
 
-    void spawnThreads();
+        // Run jobs on fibers, so waitForCounter() from within a job suspends the job rather than blocking its worker
+        // A suspended job may resume on a different thread, so it must not rely on thread-bound state (like a current
+        //   GL context) across a wait
+        bool useFibers = false;
+
+        // Fibers are shared by all workers. If none are free, waitForCounter() falls back to blocking the worker
+        uint32_t numFibers = 128;
+        size_t fiberStackSize = 256 * 1024;
+
+        // A worker which runs out of jobs first spins for this long, checking for new ones, then yields its time slice
+        //   until idleYieldMicroseconds have also passed, and only then goes to sleep. Spinning keeps the wake-up latency
+        //   for a burst of small jobs to well under a microsecond, at the cost of burning the core meanwhile
+        // Tune with getIdleStatistics(). 0 for both sleeps right away. Spinning is skipped on single core machines
+        uint32_t idleSpinMicroseconds = 20;
+        uint32_t idleYieldMicroseconds = 100;
+
+        // Start recording a trace right away. Tracing can also be turned on and off later with getTracer().setEnabled()
+        bool enableTracing = false;
+        uint32_t traceEventsPerThread = 1 << 16;
+
+        InitParameters() {}
+    };
+
+    // Both out of line since Fiber is only defined in the source file
+    JobScheduler();
+    ~JobScheduler();
+
+    void spawnThreads(InitParameters parameters = InitParameters());
 
     void joinThreads();
 
-    // Doesn't really work
-    //void waitForQueues();
-
+    uint32_t getNumWorkers() const {
+        return static_cast<uint32_t>(m_workers.size());
+    }
+
+    // Returns once the counter is zero
+    // Called from a job in fiber mode, the job is suspended until then. Otherwise the calling thread sleeps
     void waitForCounter(CounterHandle handle);
 
+    // Returns once the counter is zero, running queued jobs on the calling thread in the meantime and only sleeping while
+    //   there are none. Meant for threads which are not workers, like the main thread waiting for the frame's jobs
+    // A worker only runs the jobs on top of its own deque which signal the counter, e.g. the pieces of a parallelFor()
+    //   it just started, then waits as waitForCounter() does. Any other job could be one which has to wait for the job
+    //   the worker is inside of. In fiber mode this is the same as waitForCounter(), which frees the worker anyway
+    void waitForCounterAndHelp(CounterHandle handle);
+
+    // Without waiting, e.g. for a frame job to check whether a background job has finished yet
+    bool isCounterZero(CounterHandle handle);
+
     void enqueueJob(JobDeclaration decl);
 
     void enqueueJobs(uint32_t count, JobDeclaration* pDecls, bool ignoreSignals = false);
 
+    // Run pFunction over [begin, end), split into sub-ranges which are executed in parallel
+    // The range is split recursively in halves, each half becoming a new job that idle workers may steal, until
+    //   sub-ranges are no larger than the grain size. The grain is raised if needed so that the range is split into
+    //   at most a few sub-ranges per worker; a grain of 0 means to only use this automatic grain size
+    // signalCounter is held until every sub-range has completed, so other jobs can wait on it as with enqueueJob().
+    //   The counter may be the one the calling job is itself signalling, in which case dependents of the calling job
+    //   will also wait for the parallel loop
+    // Returns immediately, pFunction may be called from any worker thread
+    // name is used for each sub-range in traces, as JobDeclaration::name
+    void parallelFor(uint32_t begin, uint32_t end, uint32_t grain, RangeFunction* pFunction, uintptr_t param,
+                     CounterHandle signalCounter = COUNTER_NULL, PriorityLevel priority = JOB_PRIORITY_NORMAL,
+                     const char* name = nullptr);
+
     CounterHandle getCounterByID(std::string id);
 
     CounterHandle getFreeCounter();
 
     void freeCounter(CounterHandle handle);
 
+    // Records jobs, counter signals and waits, and idle workers while enabled. Call its markFrame() once per frame
+    JobTracer& getTracer() {
+        return m_tracer;
+    }
+
+    // Write the last numFrames frames recorded by the tracer as Chrome trace JSON, with counters named by their IDs
+    void writeTrace(std::ostream& out, uint32_t numFrames);
+
+    // How idle workers, and threads in waitForCounterAndHelp(), found work again. Summed over all threads
+    struct IdleStatistics {
+        // Idle periods which ended while spinning, while yielding, or by going to sleep
+        uint64_t numSpinWakeups = 0;
+        uint64_t numYieldWakeups = 0;
+        uint64_t numSleeps = 0;
+
+        // Pause instructions executed while spinning
+        uint64_t numSpins = 0;
+
+        // Futex wake calls made to wake sleeping threads when adding work
+        uint64_t numWakeCalls = 0;
+    };
+
+    // Mostly sleeps means idleSpinMicroseconds and idleYieldMicroseconds could be raised, if the cores can be spared.
+    //   Mostly spin wake-ups with many spins each means they could be lowered
+    IdleStatistics getIdleStatistics() const;
+    void resetIdleStatistics();
+
 private:
 
-    struct JobQueue {
-        std::array<std::queue<JobDeclaration>, JOB_PRIORITY_MAX_ENUM> priorityLevelQueues;
-        std::mutex mtx;
-        std::condition_variable cv;
-        bool workReady;
+    // A job which has been handed to the scheduler
+    // Jobs are allocated from the JobPool so that the deques only need to pass pointers around
+    // Range jobs created by parallelFor() set pRangeFunction and call it instead of decl.pFunction
+    // In fiber mode, a job which sets pResumeFiber is not a real job but stands for a suspended fiber, running it switches to that fiber
+    // next links the job into either the pool's free list or a counter's wait list, as (pool index + 1), 0 ending the list
+    // A job waiting on several counters can't be in all of their lists at once, so it is represented in each by a proxy job
+    //   setting pDependent. Each proxy takes one from the dependent's numDependencies when its counter reaches zero,
+    //   and the last one schedules the dependent
+    // traceFlow is the trace flow of the counter signal which scheduled the job, if it waited on one
+    struct Fiber;
+    struct Job {
+        JobDeclaration decl;
+        Fiber* pResumeFiber = nullptr;
+        Job* pDependent = nullptr;
+        std::atomic<uint32_t> numDependencies{0};
+        RangeFunction* pRangeFunction = nullptr;
+        uint32_t rangeBegin = 0;
+        uint32_t rangeEnd = 0;
+        uint32_t grain = 1;
+        uint32_t poolIndex = 0;
+        std::atomic<uint32_t> next{0};
+        uint64_t traceFlow = 0;
+    };
 
-        JobQueue() : priorityLevelQueues(), mtx(), cv(), workReady(false) {}
+    // The automatic grain size splits a range into at most this many sub-ranges per worker
+    static constexpr uint32_t PARALLEL_FOR_SPLITS_PER_WORKER = 4;
 
-        JobQueue(JobQueue&& j) {
-            std::lock_guard<std::mutex> olock(j.mtx);
-            std::lock_guard<std::mutex> mlock(mtx);
-            priorityLevelQueues = std::move(j.priorityLevelQueues);
-            workReady = std::move(j.workReady);
+    // Jobs are allocated in fixed-size blocks which are never moved or freed until the scheduler is destroyed,
+    //   so Job pointers can be handed between threads without locking
+    // Free jobs are kept on a lock-free stack. Links are pool indices rather than pointers so that the stack head
+    //   has room for a tag to avoid the ABA problem
+    class JobPool {
+
+    public:
+
+        static constexpr uint32_t BLOCK_SIZE = 1024;
+        static constexpr uint32_t MAX_BLOCKS = 1024;
+
+        JobPool() : m_blocks(), m_numBlocks(0), m_freeHead(0), m_growMtx() {}
+
+        Job* allocate();
+
+        void free(Job* pJob);
+
+        Job* getJob(uint32_t index) {
+            return &m_blocks[index / BLOCK_SIZE][index % BLOCK_SIZE];
         }
+
+    private:
+
+        std::array<std::unique_ptr<Job[]>, MAX_BLOCKS> m_blocks;
+        uint32_t m_numBlocks;
+
+        // low 32 bits: (index + 1) of the first free job, 0 if empty. high 32 bits: ABA tag
+        std::atomic<uint64_t> m_freeHead;
+
+        std::mutex m_growMtx;
+
+        void pushFreeList(Job* pFirst, Job* pLast);
+
+        Job* grow();
+    };
+
+    struct Worker {
+        std::array<WorkStealingDeque<Job*>, JOB_PRIORITY_MAX_ENUM> deques;
     };
 
     struct Counter {
-        std::mutex mtx;
-        std::condition_variable cv;
-        CounterHandle handle;
+        // high 32 bits: count, low 32 bits: (pool index + 1) of the first job waiting for the count to reach zero, 0 if none
+        // Jobs are only added while the count is non-zero, and the whole list is taken by whoever brings the count to zero
+        std::atomic<uint64_t> state{0};
+
+        // Bumped each time the count reaches zero. Threads in waitForCounter() sleep on its address
+        std::atomic<uint32_t> wakeSequence{0};
+        std::atomic<uint32_t> numSleepers{0};
+
+        // Threads in waitForCounterAndHelp() sleep with the workers, on the work epoch, and need waking when the count
+        //   reaches zero
+        std::atomic<uint32_t> numHelpers{0};
+
         std::string id;
-        uint32_t count;
-        bool hasID;
-
-        Counter() : mtx(), handle(0), id(), count(0), hasID(false) {}
-
-        Counter(Counter&& c) {
-            std::lock_guard<std::mutex> olock(c.mtx);
-            std::lock_guard<std::mutex> mlock(mtx);
-            handle = std::move(c.handle);
-            count = std::move(c.count);
-            hasID = std::move(c.hasID);
-            id = std::move(c.id);
-        }
+        bool hasID = false;
     };
 
+    // Counters live in fixed blocks so a handle can be resolved without locking, even while new counters are added
+    static constexpr uint32_t COUNTER_BLOCK_SIZE = 256;
+    static constexpr uint32_t MAX_COUNTER_BLOCKS = 256;
+
     std::vector<std::thread> m_workerThreads;
-    std::vector<JobQueue> m_threadJobQueues;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    // Jobs enqueued from threads which are not workers of this scheduler
+    std::array<std::queue<Job*>, JOB_PRIORITY_MAX_ENUM> m_injectedJobs;
+    std::mutex m_injectedJobsMtx;
+    std::atomic<uint32_t> m_numInjectedJobs;
+
+    JobPool m_jobPool;
+
+    // Background jobs have a single queue per priority, shared by the background threads
+    std::vector<std::thread> m_backgroundThreads;
+    std::array<std::queue<Job*>, JOB_PRIORITY_MAX_ENUM> m_backgroundJobs;
+    std::mutex m_backgroundJobsMtx;
+    std::condition_variable m_backgroundCv;
+
+    // m_workEpoch is bumped whenever work is added, so an idle worker can tell if anything arrived since its last search
+    // Idle workers spin and then sleep on its address. Adding work only needs to wake sleepers if there are more jobs
+    //   than spinning workers to take them
+    std::atomic<uint32_t> m_numSleeping;
+    std::atomic<uint32_t> m_numSpinning;
+    std::atomic<uint32_t> m_workEpoch;
+    std::chrono::steady_clock::duration m_idleSpinTime;
+    std::chrono::steady_clock::duration m_idleYieldTime;
+
+    // One per worker, and a last one shared by all other threads. Each on its own cache line, since they're written
+    //   often by idle threads
+    struct alignas(64) IdleCounters {
+        std::atomic<uint64_t> numSpinWakeups{0};
+        std::atomic<uint64_t> numYieldWakeups{0};
+        std::atomic<uint64_t> numSleeps{0};
+        std::atomic<uint64_t> numSpins{0};
+        std::atomic<uint64_t> numWakeCalls{0};
+    };
+    std::unique_ptr<IdleCounters[]> m_idleCounters;
+    uint32_t m_numIdleCounters;
 
-    std::vector<Counter> m_counters;
+    std::array<std::unique_ptr<Counter[]>, MAX_COUNTER_BLOCKS> m_counterBlocks;
+    uint32_t m_numCounters;
     std::forward_list<CounterHandle> m_freeCounters;
     std::map<size_t, CounterHandle> m_countersByHashID;
 
-    std::shared_mutex m_allCountersMtx;
+    // Only needed to create counters, not to use them
     std::mutex m_freeCounterMtx;
     std::mutex m_countersMapMtx;
-    std::shared_mutex m_waitListsMtx;
 
-    std::map<CounterHandle, std::forward_list<JobDeclaration>> m_counterWaitLists;
+    // Defined in the source file, since the context type is platform specific
+    struct FiberThreadState;
+
+    std::vector<std::unique_ptr<Fiber>> m_fibers;
+    std::vector<Fiber*> m_freeFibers;
+    std::mutex m_freeFibersMtx;
+    bool m_useFibers;
 
     std::atomic_bool m_programTerminated;
 
+    JobTracer m_tracer;
+
+    Counter& getCounter(CounterHandle handle) {
+        return m_counterBlocks[handle / COUNTER_BLOCK_SIZE][handle % COUNTER_BLOCK_SIZE];
+    }
+
+    void incrementCounter(CounterHandle handle, uint32_t count);
+
+    // Increment every signal counter of each declaration, batching repeated counters into a single update
+    void incrementSignalCounters(uint32_t count, const JobDeclaration* pDecls);
+
+    // Schedules the jobs that were waiting if the count reaches zero
     void decrementCounter(CounterHandle handle);
 
+    // Add the job to the counter's wait list. Returns false without adding it if the count is already zero
+    bool addWaitingJob(CounterHandle handle, Job* pJob);
+
+    // Add the job to the wait lists of each of its wait counters. Returns false if none of them need to be waited on,
+    //   in which case the job must be scheduled by the caller
+    bool addWaitingJobToCounters(Job* pJob);
+
     uint32_t getRandomThread() const;
 
+    // The index of the calling thread if it is one of this scheduler's workers, otherwise m_workers.size()
+    uint32_t getCurrentWorkerIndex() const;
+
+    // Hand runnable jobs to the calling worker's deques, or to the injection queue from any other thread, and wake sleepers
+    void scheduleJobs(uint32_t count, Job* const* ppJobs);
+
+    // Queue a job for the background threads, if it is a background job and there are any. Returns false otherwise
+    bool scheduleBackgroundJob(Job* pJob);
+
+    // As scheduleJobs(), for a list linked through Job::next. traceFlow is passed on to the jobs which become runnable
+    void scheduleJobList(uint32_t firstLink, uint64_t traceFlow);
+
+    // Search for work in priority order: own deque, then the injection queue, then steal from other workers
+    Job* findJob(uint32_t workerIndex);
+
+    void runJob(Job* pJob);
+
+    // For waitForCounterAndHelp() on a worker, run the jobs popped from its deques for as long as they signal the
+    //   counter and it isn't zero
+    void runOwnJobsSignalling(uint32_t workerIndex, CounterHandle handle);
+
+    // Flows link a counter reaching zero to the jobs and threads it released in traces
+    static uint64_t makeTraceFlow(CounterHandle handle, uint32_t wakeSequence) {
+        return (static_cast<uint64_t>(handle) << 32) | wakeSequence;
+    }
+
+    // Split off the upper halves of the range as new jobs until it fits the grain, then run the rest
+    void runRangeJob(Job* pJob);
+
+    // Bump the work epoch and wake sleeping workers if the spinning ones can't take count new jobs between them
+    void notifyWorkers(uint32_t count);
+
+    // Wake one sleeping worker if none are spinning. Called by a thread which found a job after being idle, since it
+    //   may have been the spinner that notifyWorkers() counted on to take some other job
+    void wakeSpinner();
+
+    // Called after finding no work since reading epoch. Spins, then yields, then sleeps until the epoch changes
+    // Helpers pass the counter they wait for, whose count reaching zero also ends the wait
+    void idleWait(uint32_t epoch, Counter* pCounter = nullptr, uint32_t counterSequence = 0);
+
+    IdleCounters& getIdleCounters(uint32_t workerIndex) {
+        return m_idleCounters[std::min(workerIndex, m_numIdleCounters - 1)];
+    }
+
+    // Find and run jobs, sleeping when there are none, until the scheduler is terminated
+    // In fiber mode this runs on a fiber, which may be moved to another thread while a job it is running waits
+    void workerLoop();
+
+    // Fibers which are free are always parked in workerLoop(), so switching to one picks up the loop where it left off
+    Fiber* acquireFiber();
+    void releaseFiber(Fiber* pFiber);
+
+    // Switches the calling thread from its current fiber to pFiber, returns when some thread switches back
+    void switchToFiber(Fiber* pFiber);
+
+    // Carry out what the fiber we switched away from asked for once it was safely off the stack
+    void onFiberSwitched();
+
+    // Fibers may move between threads, so per-thread state must never be cached across a switch. Always go through this
+    static FiberThreadState& getFiberThreadState();
+
+    static void fiberEntry(uint32_t pointerHigh, uint32_t pointerLow);
+
     static void workerThreadMain(JobScheduler* pScheduler, uint32_t id);
 
+    // Run background jobs, sleeping when there are none, until the scheduler is terminated
+    void backgroundLoop();
+
+    static void backgroundThreadMain(JobScheduler* pScheduler, uint32_t id);
+
 };
 
 #endif // JOB_SCHEDULER_H_
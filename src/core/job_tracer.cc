@@ -0,0 +1,281 @@
+#include "job_tracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define VKJ_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define VKJ_NOINLINE __declspec(noinline)
+#else
+#define VKJ_NOINLINE
+#endif
+
+struct JobTracer::ThreadBuffer {
+    std::thread::id threadID;
+    std::string name;
+
+    // Allocated by the owning thread while holding m_threadBuffersMtx, so writeChromeTrace() can check it under the lock
+    std::unique_ptr<Event[]> events;
+    uint32_t capacity = 0;
+
+    // Only written by the owning thread. numStarted is bumped before an event's slot is written and numWritten after,
+    //   so a reader can tell which of the slots it copied may have been reused in the meantime
+    std::atomic<uint64_t> numStarted{0};
+    std::atomic<uint64_t> numWritten{0};
+};
+
+struct JobTracer::ThreadCache {
+    uint64_t tracerID = 0;
+    ThreadBuffer* pBuffer = nullptr;
+};
+
+namespace {
+
+std::atomic<uint64_t> nextTracerID{1};
+
+uint64_t getTimeNanoseconds() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void writeString(std::ostream& out, const std::string& str) {
+    out << '"';
+    for (char c : str) {
+        if (c == '"' || c == '\\') out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20) out << ' ';
+        else out << c;
+    }
+    out << '"';
+}
+
+// Trace timestamps are in microseconds
+void writeTimestamp(std::ostream& out, uint64_t nanoseconds) {
+    uint64_t fraction = nanoseconds % 1000;
+    out << (nanoseconds / 1000) << '.' << (fraction / 100) << ((fraction / 10) % 10) << (fraction % 10);
+}
+
+} // namespace
+
+JobTracer::JobTracer() :
+    m_enabled(false),
+    m_threadBuffers(),
+    m_threadBuffersMtx(),
+    m_eventsPerThread(1 << 16),
+    m_frameIndex(0),
+    m_tracerID(nextTracerID.fetch_add(1))
+{
+
+}
+
+JobTracer::~JobTracer() {
+
+}
+
+void JobTracer::setEventsPerThread(uint32_t count) {
+    std::lock_guard<std::mutex> lock(m_threadBuffersMtx);
+    m_eventsPerThread = std::max(count, 1u);
+}
+
+void JobTracer::setThreadName(const std::string& name) {
+    ThreadBuffer* pBuffer = getThreadBuffer(false);
+    std::lock_guard<std::mutex> lock(m_threadBuffersMtx);
+    pBuffer->name = name;
+}
+
+void JobTracer::markFrame() {
+    if (isEnabled()) recordEvent(EVENT_FRAME, nullptr, m_frameIndex.fetch_add(1, std::memory_order_relaxed), NO_COUNTER);
+}
+
+VKJ_NOINLINE JobTracer::ThreadCache& JobTracer::getThreadCache() {
+    static thread_local ThreadCache cache;
+    // As JobScheduler::getFiberThreadState(), the volatile read stops the address being reused across a fiber switch
+    ThreadCache* volatile pCache = &cache;
+    return *pCache;
+}
+
+JobTracer::ThreadBuffer* JobTracer::getThreadBuffer(bool allocateEvents) {
+    ThreadCache& cache = getThreadCache();
+    if (cache.tracerID == m_tracerID && (!allocateEvents || cache.pBuffer->events)) {
+        return cache.pBuffer;
+    }
+
+    std::lock_guard<std::mutex> lock(m_threadBuffersMtx);
+
+    std::thread::id threadID = std::this_thread::get_id();
+    auto it = std::find_if(m_threadBuffers.begin(), m_threadBuffers.end(), [threadID] (const auto& pBuffer) {
+        return pBuffer->threadID == threadID;
+    });
+
+    ThreadBuffer* pBuffer;
+    if (it != m_threadBuffers.end()) {
+        pBuffer = it->get();
+    } else {
+        m_threadBuffers.push_back(std::make_unique<ThreadBuffer>());
+        pBuffer = m_threadBuffers.back().get();
+        pBuffer->threadID = threadID;
+    }
+
+    if (allocateEvents && !pBuffer->events) {
+        pBuffer->events.reset(new Event[m_eventsPerThread]);
+        pBuffer->capacity = m_eventsPerThread;
+    }
+
+    cache.tracerID = m_tracerID;
+    cache.pBuffer = pBuffer;
+    return pBuffer;
+}
+
+void JobTracer::recordEvent(EventType type, const char* name, uint64_t id, uint32_t counter) {
+    ThreadBuffer* pBuffer = getThreadBuffer(true);
+
+    uint64_t index = pBuffer->numStarted.load(std::memory_order_relaxed);
+    pBuffer->numStarted.store(index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    Event& event = pBuffer->events[index % pBuffer->capacity];
+    event.time = getTimeNanoseconds();
+    event.name = name;
+    event.id = id;
+    event.counter = counter;
+    event.type = type;
+
+    pBuffer->numWritten.store(index + 1, std::memory_order_release);
+}
+
+void JobTracer::writeChromeTrace(std::ostream& out, uint32_t numFrames, const CounterNameFunction& counterName) const {
+    struct ThreadEvents {
+        std::string name;
+        std::vector<Event> events;
+    };
+
+    std::vector<ThreadEvents> threads;
+    {
+        std::lock_guard<std::mutex> lock(m_threadBuffersMtx);
+        threads.resize(m_threadBuffers.size());
+        for (size_t i = 0; i < m_threadBuffers.size(); ++i) {
+            const ThreadBuffer& buffer = *m_threadBuffers[i];
+            threads[i].name = buffer.name.empty() ? "Thread " + std::to_string(i) : buffer.name;
+            if (!buffer.events) continue;
+
+            uint64_t end = buffer.numWritten.load(std::memory_order_acquire);
+            uint64_t begin = (end > buffer.capacity) ? end - buffer.capacity : 0;
+            for (uint64_t j = begin; j < end; ++j) {
+                threads[i].events.push_back(buffer.events[j % buffer.capacity]);
+            }
+
+            // Drop the oldest events if the thread has since started writing over their slots
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t started = buffer.numStarted.load(std::memory_order_relaxed);
+            if (started > begin + buffer.capacity) {
+                uint64_t numOverwritten = std::min(started - buffer.capacity - begin, end - begin);
+                threads[i].events.erase(threads[i].events.begin(), threads[i].events.begin() + numOverwritten);
+            }
+        }
+    }
+
+    // Each thread's events are in order, so only the frame boundaries need sorting
+    std::vector<uint64_t> frameTimes;
+    uint64_t windowBegin = std::numeric_limits<uint64_t>::max();
+    uint64_t windowEnd = 0;
+    for (const ThreadEvents& thread : threads) {
+        if (thread.events.empty()) continue;
+        windowBegin = std::min(windowBegin, thread.events.front().time);
+        windowEnd = std::max(windowEnd, thread.events.back().time);
+        for (const Event& event : thread.events) {
+            if (event.type == EVENT_FRAME) frameTimes.push_back(event.time);
+        }
+    }
+    std::sort(frameTimes.begin(), frameTimes.end());
+
+    if (numFrames > 0 && frameTimes.size() > numFrames) {
+        windowBegin = frameTimes[frameTimes.size() - 1 - numFrames];
+        windowEnd = frameTimes.back();
+    }
+
+    bool firstEvent = true;
+    const auto beginEvent = [&] (const char* phase, uint64_t time, size_t tid) {
+        out << (firstEvent ? "\n" : ",\n") << "{\"ph\":\"" << phase << "\",\"pid\":0,\"tid\":" << tid << ",\"ts\":";
+        writeTimestamp(out, time - windowBegin);
+        firstEvent = false;
+    };
+    const auto writeFlow = [&] (const char* phase, uint64_t time, size_t tid, uint64_t id) {
+        beginEvent(phase, time, tid);
+        out << ",\"name\":\"signal\",\"cat\":\"flow\",\"id\":" << id;
+        if (phase[0] == 'f') out << ",\"bp\":\"e\"";
+        out << "}";
+    };
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    for (size_t tid = 0; tid < threads.size(); ++tid) {
+        out << (firstEvent ? "\n" : ",\n") << "{\"ph\":\"M\",\"pid\":0,\"tid\":" << tid << ",\"name\":\"thread_name\",\"args\":{\"name\":";
+        writeString(out, threads[tid].name);
+        out << "}}";
+        firstEvent = false;
+
+        // Slices cut off by the start of the window are dropped, those cut off by its end are closed at the end
+        uint32_t depth = 0;
+        for (const Event& event : threads[tid].events) {
+            if (event.time < windowBegin) continue;
+            if (event.time > windowEnd) break;
+
+            switch (event.type) {
+                case EVENT_BEGIN:
+                    beginEvent("B", event.time, tid);
+                    out << ",\"name\":";
+                    writeString(out, event.name ? event.name : "job");
+                    out << ",\"cat\":\"job\"";
+                    if (event.id != 0) {
+                        out << ",\"args\":{\"released by\":";
+                        writeString(out, counterName(static_cast<uint32_t>(event.id >> 32)));
+                        out << "}";
+                    }
+                    out << "}";
+                    if (event.id != 0) writeFlow("f", event.time, tid, event.id);
+                    ++depth;
+                    break;
+                case EVENT_WAIT_BEGIN:
+                    beginEvent("B", event.time, tid);
+                    out << ",\"name\":";
+                    writeString(out, "wait " + counterName(event.counter));
+                    out << ",\"cat\":\"wait\"}";
+                    ++depth;
+                    break;
+                case EVENT_IDLE_BEGIN:
+                    beginEvent("B", event.time, tid);
+                    out << ",\"name\":\"idle\",\"cat\":\"idle\"}";
+                    ++depth;
+                    break;
+                case EVENT_END:
+                case EVENT_WAIT_END:
+                case EVENT_IDLE_END:
+                    if (depth == 0) break;
+                    if (event.type == EVENT_WAIT_END && event.id != 0) writeFlow("f", event.time, tid, event.id);
+                    beginEvent("E", event.time, tid);
+                    out << "}";
+                    --depth;
+                    break;
+                case EVENT_COUNTER_SIGNAL:
+                    beginEvent("i", event.time, tid);
+                    out << ",\"name\":";
+                    writeString(out, "signal " + counterName(event.counter));
+                    out << ",\"cat\":\"counter\",\"s\":\"t\"}";
+                    writeFlow("s", event.time, tid, event.id);
+                    break;
+                case EVENT_FRAME:
+                    beginEvent("i", event.time, tid);
+                    out << ",\"name\":\"frame\",\"cat\":\"frame\",\"s\":\"g\",\"args\":{\"index\":" << event.id << "}}";
+                    break;
+            }
+        }
+
+        for (; depth > 0; --depth) {
+            beginEvent("E", windowEnd, tid);
+            out << "}";
+        }
+    }
+
+    out << "\n]}" << std::endl;
+}
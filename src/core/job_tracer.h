@@ -0,0 +1,141 @@
+#ifndef JOB_TRACER_H_
+#define JOB_TRACER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Records what the threads of a JobScheduler spend their time on, to find out where a slow frame went
+ * Each thread writes timestamped events to its own ring buffer, so recording never takes a lock. Once a buffer is full
+ *   its oldest events are overwritten, so only the last few frames are kept
+ * Always compiled in but off until setEnabled(true). While off, recording an event is a single relaxed load.
+ *   While on it is a clock read and a few stores
+ * The scheduler records jobs, counters reaching zero, threads waiting on counters and workers sleeping. Other code
+ *   can add its own named scopes, e.g. around a lock it may block on
+ * writeChromeTrace() writes the last frames recorded in the Chrome trace event format, which can be opened with
+ *   chrome://tracing or ui.perfetto.dev
+**/
+class JobTracer {
+
+public:
+
+    enum EventType : uint8_t {
+        EVENT_BEGIN,            // start of a job or scope. id is the flow which released the job, if any
+        EVENT_END,
+        EVENT_COUNTER_SIGNAL,   // counter reached zero. id is the flow to the jobs and threads it released
+        EVENT_WAIT_BEGIN,       // the thread blocked on counter
+        EVENT_WAIT_END,         // id as EVENT_BEGIN
+        EVENT_IDLE_BEGIN,       // a worker went to sleep for lack of jobs
+        EVENT_IDLE_END,
+        EVENT_FRAME             // end of a frame, id is its index
+    };
+
+    static constexpr uint32_t NO_COUNTER = std::numeric_limits<uint32_t>::max();
+
+    struct Event {
+        uint64_t time;
+        const char* name;
+        uint64_t id;
+        uint32_t counter;
+        EventType type;
+    };
+
+    // Returns the name to show for a counter
+    typedef std::function<std::string(uint32_t)> CounterNameFunction;
+
+    // Opens a scope on construction and closes it when destroyed
+    class Scope {
+    public:
+        Scope(JobTracer& tracer, const char* name) : m_tracer(tracer) {
+            m_tracer.beginScope(name);
+        }
+
+        ~Scope() {
+            m_tracer.endScope();
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        JobTracer& m_tracer;
+    };
+
+    JobTracer();
+
+    ~JobTracer();
+
+    JobTracer(const JobTracer&) = delete;
+    JobTracer& operator=(const JobTracer&) = delete;
+
+    void setEnabled(bool enabled) {
+        m_enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool isEnabled() const {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    // Number of events kept per thread. Only applies to threads which have not recorded anything yet
+    void setEventsPerThread(uint32_t count);
+
+    // Name shown for the calling thread. Does not allocate the thread's buffer until it records something
+    void setThreadName(const std::string& name);
+
+    // name and the names of all other events must outlive the tracer, so string literals are best
+    void record(EventType type, const char* name = nullptr, uint64_t id = 0, uint32_t counter = NO_COUNTER) {
+        if (isEnabled()) recordEvent(type, name, id, counter);
+    }
+
+    void beginScope(const char* name) {
+        record(EVENT_BEGIN, name);
+    }
+
+    void endScope() {
+        record(EVENT_END);
+    }
+
+    // Call once at the end of each frame, from any one thread
+    void markFrame();
+
+    // Write the last numFrames complete frames, or everything still in the buffers if fewer frames were marked
+    // Safe to call while other threads are recording. Events overwritten while they are being copied are left out
+    void writeChromeTrace(std::ostream& out, uint32_t numFrames, const CounterNameFunction& counterName) const;
+
+private:
+
+    struct ThreadBuffer;
+
+    // Defined in the source file, caches the calling thread's buffer
+    struct ThreadCache;
+
+    std::atomic_bool m_enabled;
+
+    std::vector<std::unique_ptr<ThreadBuffer>> m_threadBuffers;
+    mutable std::mutex m_threadBuffersMtx;
+
+    uint32_t m_eventsPerThread;
+
+    std::atomic<uint64_t> m_frameIndex;
+
+    // Distinguishes tracers in the thread caches, even if one is created where another was destroyed
+    uint64_t m_tracerID;
+
+    void recordEvent(EventType type, const char* name, uint64_t id, uint32_t counter);
+
+    // The calling thread's buffer, created if it doesn't exist yet. Events are only allocated if allocateEvents is set
+    ThreadBuffer* getThreadBuffer(bool allocateEvents);
+
+    // Jobs may move between threads when running on fibers, so this must not be inlined into a caller which could cache it
+    static ThreadCache& getThreadCache();
+
+};
+
+#endif // JOB_TRACER_H_
@@ -14,21 +14,19 @@ void FrustumCuller::initForScheduler(JobScheduler* pScheduler) {
 }
 
 size_t FrustumCuller::cullSpheres(const BoundingSphere* pBoundingSpheres, size_t count, const glm::mat4& frustumMatrix) {
-    std::array<math_util::Plane, 6> frustumPlanes = math_util::frustumPlanes(frustumMatrix);
+    m_sphereArrays.resize(count);
+    for (size_t i = 0; i < count; ++i) m_sphereArrays.set(i, pBoundingSpheres[i]);
 
-    m_numToRender = count;
-    m_cullResults.resize(count);
+    m_visibleIndices.resize(count);
+    m_visibleIndices.resize(math_util::frustumCullSpheres(math_util::frustumPlanes(frustumMatrix), static_cast<uint32_t>(count),
+                                                          m_sphereArrays.x.data(), m_sphereArrays.y.data(),
+                                                          m_sphereArrays.z.data(), m_sphereArrays.radii.data(),
+                                                          m_visibleIndices.data()));
 
-    std::transform(pBoundingSpheres, pBoundingSpheres+count, m_cullResults.begin(),
-        [&] (const BoundingSphere& b) {
-            for (const auto& p : frustumPlanes)
-                if (glm::dot(p.normal, b.position) + p.offset < -b.radius) {
-                    --m_numToRender;
-                    return false;
-                }
-            return true;
-        });
+    m_cullResults.assign(count, 0);
+    for (uint32_t i : m_visibleIndices) m_cullResults[i] = 1;
 
+    m_numToRender = m_visibleIndices.size();
     m_cullResultsForFrame = Timer::getCurrentFrame();
 
     return m_numToRender;
@@ -39,27 +37,11 @@ size_t FrustumCuller::cullSceneRenderables(const Scene* pScene, const glm::mat4&
    return cullSpheres(pScene->getRenderableBoundingSpheres().data(), pScene->getNumRenderableIDs(), frustumMatrix);
 }
 
-size_t FrustumCuller::cullEntitySpheres(const GameWorld* pGameWorld, const glm::mat4& frustumMatrix) {
-    std::array<math_util::Plane, 6> frustumPlanes = math_util::frustumPlanes(frustumMatrix);
-
-    auto view = pGameWorld->getRegistry().view<const Component::Renderable>();
-
-    m_numToRender = view.size();
-    m_cullResults.resize(view.size());
-
-    auto pack = view | pGameWorld->getRegistry().view<const BoundingSphere>();
-
-    std::transform(pack.begin(), pack.end(), m_cullResults.begin(),
-        [&] (const entt::entity e) {
-            const BoundingSphere& b = pack.get<const BoundingSphere>(e);
-            for (const auto& p : frustumPlanes)
-                if (glm::dot(p.normal, b.position) + p.offset < -b.radius) {
-                    --m_numToRender;
-                    return false;
-                }
-            return true;
-        });
+size_t FrustumCuller::cullEntitySpheres(const RenderSnapshot* pSnapshot, const glm::mat4& frustumMatrix) {
+    m_visibleIndices.clear();
+    pSnapshot->getBVH().queryFrustum(math_util::frustumPlanes(frustumMatrix), m_visibleIndices);
 
+    m_numToRender = m_visibleIndices.size();
     m_cullResultsForFrame = Timer::getCurrentFrame();
 
     return m_numToRender;
@@ -78,8 +60,3 @@ void FrustumCuller::cullSceneRenderablesJob(uintptr_t param) {
     CullSceneParam* pParam = reinterpret_cast<CullSceneParam*>(param);
     pParam->pCuller->cullSceneRenderables(pParam->pScene, pParam->frustumMatrix);
 }
-
-void FrustumCuller::cullEntitySpheresJob(uintptr_t param) {
-    CullEntitiesParam* pParam = reinterpret_cast<CullEntitiesParam*>(param);
-    pParam->pCuller->cullEntitySpheres(pParam->pGameWorld, pParam->frustumMatrix);
-}
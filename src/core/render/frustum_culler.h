@@ -1,6 +1,7 @@
 #ifndef FRUSTUM_CULLER_H_
 #define FRUSTUM_CULLER_H_
 
+#include <atomic>
 #include <vector>
 
 #include <glm/glm.hpp>
@@ -8,30 +9,59 @@
 #include "core/scene/bounding_sphere.h"
 #include "core/job_scheduler.h"
 #include "core/scene/scene.h"
-#include "core/ecs/game_world.h"
+#include "core/render/render_snapshot.h"
+#include "core/util/math_util.h"
 
 class FrustumCuller {
 
     friend class InstanceListBuilder;
+    friend class MultiViewCuller;
 
 public:
 
+    FrustumCuller() {}
+
+    // Needed to keep cullers in a vector
+    FrustumCuller(FrustumCuller&& c) :
+        m_cullResults(std::move(c.m_cullResults)),
+        m_visibleIndices(std::move(c.m_visibleIndices)),
+        m_sphereArrays(std::move(c.m_sphereArrays)),
+        m_numToRender(c.m_numToRender.load()),
+        m_cullResultsForFrame(c.m_cullResultsForFrame),
+        m_pScheduler(c.m_pScheduler),
+        m_resultsReadyCounter(c.m_resultsReadyCounter)
+    {
+
+    }
+
     void initForScheduler(JobScheduler* pScheduler);
 
     size_t cullSpheres(const BoundingSphere* pBoundingSpheres, size_t count, const glm::mat4& frustumMatrix);
 
     size_t cullSceneRenderables(const Scene* pScene, const glm::mat4& frustumMatrix);
 
-    size_t cullEntitySpheres(const GameWorld* pGameWorld, const glm::mat4& frustumMatrix);
+    // Walks the snapshot's BVH, so only the parts of the tree near the frustum are visited. The results are
+    //   getVisibleIndices(), not getCullResults()
+    // The renderer culls all its views at once with a MultiViewCuller instead, which hands each view's results to
+    //   its FrustumCuller
+    size_t cullEntitySpheres(const RenderSnapshot* pSnapshot, const glm::mat4& frustumMatrix);
 
     size_t getNumToRender() const {
         return m_numToRender;
     }
 
-    const std::vector<bool>& getCullResults() const {
+    // Indexed like the spheres culled by cullSpheres() or cullSceneRenderables(), which also give getVisibleIndices()
+    const std::vector<uint8_t>& getCullResults() const {
         return m_cullResults;
     }
 
+    // Indices of the renderables of the RenderSnapshot which passed cullEntitySpheres() or a MultiViewCuller, in the
+    //   same order every time for the same snapshot, or of the spheres which passed cullSpheres() or
+    //   cullSceneRenderables(), in increasing order
+    const std::vector<uint32_t>& getVisibleIndices() const {
+        return m_visibleIndices;
+    }
+
     bool hasCullResultsForFrame() const;
 
     JobScheduler::CounterHandle getResultsReadyCounter() const {
@@ -51,21 +81,18 @@ public:
         glm::mat4 frustumMatrix;
     };
 
-    struct CullEntitiesParam {
-        FrustumCuller* pCuller;
-        const GameWorld* pGameWorld;
-        glm::mat4 frustumMatrix;
-    };
-
     static void cullSpheresJob(uintptr_t param);
     static void cullSceneRenderablesJob(uintptr_t param);
-    static void cullEntitySpheresJob(uintptr_t param);
 
 private:
 
-    std::vector<bool> m_cullResults;
+    std::vector<uint8_t> m_cullResults;
+    std::vector<uint32_t> m_visibleIndices;
+
+    // The spheres given to cullSpheres(), split up for the culling kernel
+    math_util::BoundingSphereArrays m_sphereArrays;
 
-    size_t m_numToRender = 0;
+    std::atomic<size_t> m_numToRender{0};
 
     uint64_t m_cullResultsForFrame = std::numeric_limits<uint64_t>::max();
 
@@ -15,7 +15,9 @@ class InstanceList {
 
     std::vector<glm::mat4> m_instanceTransforms;
     std::vector<glm::mat4> m_lastInstanceTransforms;
-    std::vector<const Skeleton*> m_instanceSkeletons;
+    // Each skinned instance's first skinning matrix, there is one per joint of the model's skeleton
+    std::vector<const glm::mat4*> m_instanceSkinningMatrices;
+    std::vector<const glm::mat4*> m_lastInstanceSkinningMatrices;
 
     size_t m_numInstances;
 
@@ -31,7 +33,7 @@ public:
         m_pModel(std::move(i.m_pModel)),
         m_instanceTransforms(std::move(i.m_instanceTransforms)),
         m_lastInstanceTransforms(std::move(i.m_lastInstanceTransforms)),
-        m_instanceSkeletons(std::move(i.m_instanceSkeletons)),
+        m_instanceSkinningMatrices(std::move(i.m_instanceSkinningMatrices)),
         m_numInstances(std::move(i.m_numInstances)) {
     }
 
@@ -39,7 +41,7 @@ public:
         m_pModel = std::move(i.m_pModel);
         m_instanceTransforms = std::move(i.m_instanceTransforms);
         m_lastInstanceTransforms = std::move(i.m_lastInstanceTransforms);
-        m_instanceSkeletons = std::move(i.m_instanceSkeletons);
+        m_instanceSkinningMatrices = std::move(i.m_instanceSkinningMatrices);
         m_numInstances = std::move(i.m_numInstances);
         return *this;
     }*/
@@ -48,6 +50,7 @@ public:
         return m_pModel;
     }
 
+    // These may hold more than getNumInstances() entries, only the first getNumInstances() are valid
     const std::vector<glm::mat4>& getInstanceTransforms() const {
         return m_instanceTransforms;
     }
@@ -56,8 +59,12 @@ public:
         return m_lastInstanceTransforms;
     }
 
-    const std::vector<const Skeleton*>& getInstanceSkeletons() const {
-        return m_instanceSkeletons;
+    const std::vector<const glm::mat4*>& getInstanceSkinningMatrices() const {
+        return m_instanceSkinningMatrices;
+    }
+
+    const std::vector<const glm::mat4*>& getLastInstanceSkinningMatrices() const {
+        return m_lastInstanceSkinningMatrices;
     }
 
     size_t getNumInstances() const {
@@ -1,5 +1,6 @@
 #include "instance_list_builder.h"
 
+#include <algorithm>
 #include <list>
 #include <map>
 
@@ -8,11 +9,17 @@
 
 #include <glm/glm.hpp>
 
-#include "core/ecs/components.h"
-#include "core/ecs/game_world.h"
+#include "core/animation/skeleton.h"
+#include "core/render/render_snapshot.h"
 #include "core/scene/scene.h"
 
-void InstanceListBuilder::buildInstanceLists(const Scene* pScene, const std::vector<bool>& cullResults, glm::mat4 frustumMatrix, bool (*filterPredicate) (const Model*)) {
+bool InstanceListBuilder::setSkinningMatrices(InstanceList& instanceList, size_t instance, const Skeleton* pSkeleton) {
+    instanceList.m_instanceSkinningMatrices[instance] = pSkeleton ? pSkeleton->getSkinningMatrices().data() : nullptr;
+    instanceList.m_lastInstanceSkinningMatrices[instance] = pSkeleton ? pSkeleton->getLastSkinningMatrices().data() : nullptr;
+    return pSkeleton != nullptr;
+}
+
+void InstanceListBuilder::buildInstanceLists(const Scene* pScene, const std::vector<uint8_t>& cullResults, glm::mat4 frustumMatrix, bool (*filterPredicate) (const Model*)) {
     //m_nonSkinnedInstanceLists.clear();
     //m_skinnedInstanceLists.clear();
 
@@ -63,11 +70,12 @@ void InstanceListBuilder::buildInstanceLists(const Scene* pScene, const std::vec
         instanceList.m_numInstances = j;
 
         if (instanceList.m_pModel->getSkeletonDescription() != nullptr) {
-            instanceList.m_instanceSkeletons.resize(instanceList.m_numInstances);
+            instanceList.m_instanceSkinningMatrices.resize(instanceList.m_numInstances);
+            instanceList.m_lastInstanceSkinningMatrices.resize(instanceList.m_numInstances);
             j = 0;
             for (uint32_t rid : pScene->m_instanceLists[i]) {
                 if (!cullResults[rid]) continue;
-                if (!(instanceList.m_instanceSkeletons[j] = pScene->m_renderables[rid].getSkeleton()))
+                if (!setSkinningMatrices(instanceList, j, pScene->m_renderables[rid].getSkeleton()))
                     ++numMissingSkeletons[c_index-1];
                 if (numMissingSkeletons[c_index-1] > 0) ++numModelsMissingSkeletons;
                 ++j;
@@ -128,10 +136,11 @@ void InstanceListBuilder::buildInstanceLists(const Scene* pScene, const std::vec
             instanceList.m_numInstances = j;
 
             if (instanceList.m_pModel->getSkeletonDescription() != nullptr) {
-                j = instanceList.m_instanceSkeletons.size();
-                instanceList.m_instanceSkeletons.resize(instanceList.m_numInstances);
+                j = instanceList.m_instanceSkinningMatrices.size();
+                instanceList.m_instanceSkinningMatrices.resize(instanceList.m_numInstances);
+                instanceList.m_lastInstanceSkinningMatrices.resize(instanceList.m_numInstances);
                 for (uint32_t rid : lodInstances[level]) {
-                    if (!(instanceList.m_instanceSkeletons[j] = pScene->m_renderables[rid].getSkeleton()))
+                    if (!setSkinningMatrices(instanceList, j, pScene->m_renderables[rid].getSkeleton()))
                         ++numMissingSkeletons[modelIndex];
                     if (numMissingSkeletons[modelIndex] > 0) ++numModelsMissingSkeletons;
                     ++j;
@@ -159,7 +168,8 @@ void InstanceListBuilder::buildInstanceLists(const Scene* pScene, const std::vec
                 m_skinnedInstanceLists[iSkinned] = std::move(instanceLists[i]);
                 m_skinnedInstanceLists[iSkinned].m_instanceTransforms.resize(m_skinnedInstanceLists[iSkinned].m_numInstances);
                 m_skinnedInstanceLists[iSkinned].m_lastInstanceTransforms.resize(m_skinnedInstanceLists[iSkinned].m_numInstances);
-                m_skinnedInstanceLists[iSkinned].m_instanceSkeletons.resize(m_skinnedInstanceLists[iSkinned].m_numInstances);
+                m_skinnedInstanceLists[iSkinned].m_instanceSkinningMatrices.resize(m_skinnedInstanceLists[iSkinned].m_numInstances);
+                m_skinnedInstanceLists[iSkinned].m_lastInstanceSkinningMatrices.resize(m_skinnedInstanceLists[iSkinned].m_numInstances);
                 m_numSkinnedInstances += m_skinnedInstanceLists[iSkinned].m_numInstances;
                 ++iSkinned;
             } else {
@@ -168,17 +178,19 @@ void InstanceListBuilder::buildInstanceLists(const Scene* pScene, const std::vec
                 m_skinnedInstanceLists[iSkinned].m_pModel = pModel;
                 m_skinnedInstanceLists[iSkinned].m_instanceTransforms.resize(instanceLists[i].m_numInstances - numMissingSkeletons[i]);
                 m_skinnedInstanceLists[iSkinned].m_lastInstanceTransforms.resize(instanceLists[i].m_numInstances - numMissingSkeletons[i]);
-                m_skinnedInstanceLists[iSkinned].m_instanceSkeletons.resize(instanceLists[i].m_numInstances - numMissingSkeletons[i]);
+                m_skinnedInstanceLists[iSkinned].m_instanceSkinningMatrices.resize(instanceLists[i].m_numInstances - numMissingSkeletons[i]);
+                m_skinnedInstanceLists[iSkinned].m_lastInstanceSkinningMatrices.resize(instanceLists[i].m_numInstances - numMissingSkeletons[i]);
 
                 m_nonSkinnedInstanceLists[iNonSkinned].m_pModel = pModel;
                 m_nonSkinnedInstanceLists[iNonSkinned].m_instanceTransforms.resize(numMissingSkeletons[i]);
                 m_nonSkinnedInstanceLists[iNonSkinned].m_lastInstanceTransforms.resize(numMissingSkeletons[i]);
 
                 for (auto j = 0u; j < instanceLists[i].m_numInstances; ++j) {
-                    if (instanceLists[i].m_instanceSkeletons[j]) {
+                    if (instanceLists[i].m_instanceSkinningMatrices[j]) {
                         m_skinnedInstanceLists[iSkinned].m_instanceTransforms[iiSkinned] = instanceLists[i].m_instanceTransforms[j];
                         m_skinnedInstanceLists[iSkinned].m_lastInstanceTransforms[iiSkinned] = instanceLists[i].m_lastInstanceTransforms[j];
-                        m_skinnedInstanceLists[iSkinned].m_instanceSkeletons[iiSkinned] = instanceLists[i].m_instanceSkeletons[j];
+                        m_skinnedInstanceLists[iSkinned].m_instanceSkinningMatrices[iiSkinned] = instanceLists[i].m_instanceSkinningMatrices[j];
+                        m_skinnedInstanceLists[iSkinned].m_lastInstanceSkinningMatrices[iiSkinned] = instanceLists[i].m_lastInstanceSkinningMatrices[j];
                         ++iiSkinned;
                     } else {
                         m_nonSkinnedInstanceLists[iNonSkinned].m_instanceTransforms[iiNonSkinned] = instanceLists[i].m_instanceTransforms[j];
@@ -213,124 +225,71 @@ void InstanceListBuilder::buildInstanceLists(const Scene* pScene, const std::vec
     //instanceLists.clear();
 }
 
-void InstanceListBuilder::buildInstanceLists(const GameWorld* pGameWorld,
-                                             const std::vector<bool>& cullResults,
+void InstanceListBuilder::buildInstanceLists(const RenderSnapshot* pSnapshot,
+                                             const std::vector<uint32_t>& visibleIndices,
                                              glm::mat4 frustumMatrix,
                                              InstanceListBuilder::filterPredicate predicate,
                                              bool useLastTransforms) {
     m_numNonSkinnedInstances = 0;
     m_numSkinnedInstances = 0;
 
-    std::vector<size_t> modelNumInstances;
-    std::vector<size_t> skinnedModelNumInstances;
-
-    std::vector<size_t> modelFirstIndex;
-    std::vector<size_t> skinnedModelFirstIndex;
-
     size_t numNonSkinnedModels = 0;
     size_t numSkinnedModels = 0;
 
-    const Model* pCModel = nullptr;
-    const Model* pCSkinnedModel = nullptr;
-
-    auto view = pGameWorld->getRegistry().view<const Component::Renderable>();
-
-    auto c_index = 0u;
-    for (const auto &&[e, r] : view.each()) {
-        if (r.pModel && cullResults[c_index] && (!predicate || predicate(r.pModel))) {
-            if (r.pSkeleton) {
-                if (pCSkinnedModel == r.pModel) {
-                    ++skinnedModelNumInstances.back();
-                } else {
-                    pCSkinnedModel = r.pModel;
-                    ++numSkinnedModels;
-                    skinnedModelNumInstances.push_back(1);
-                    skinnedModelFirstIndex.push_back(c_index);
-                }
-                ++m_numSkinnedInstances;
-            } else {
-                if (pCModel == r.pModel) {
-                    ++modelNumInstances.back();
-                } else {
-                    pCModel = r.pModel;
-                    ++numNonSkinnedModels;
-                    modelNumInstances.push_back(1);
-                    modelFirstIndex.push_back(c_index);
-                }
-                ++m_numNonSkinnedInstances;
-            }
-        }
-        ++c_index;
-    }
-
-    m_nonSkinnedInstanceLists.resize(numNonSkinnedModels);
-    m_skinnedInstanceLists.resize(numSkinnedModels);
-
-    if (numNonSkinnedModels == 0 && numSkinnedModels == 0) {
-        clearInstanceLists();
-        return;
-    }
-
-    auto tview = pGameWorld->getRegistry().view<const Component::Transform>();
-    auto pack = view | tview;
+    const std::vector<GameWorld::RenderBucket>& buckets = pSnapshot->getRenderBuckets();
+    const std::vector<uint32_t>& bucketIndices = pSnapshot->getRenderBucketIndices();
+    const std::vector<uint32_t>& skinningOffsets = pSnapshot->getSkinningMatrixOffsets();
 
-    pCModel = pCSkinnedModel = nullptr;
+    m_bucketListIndices.assign(buckets.size(), BUCKET_UNSEEN);
 
-    c_index = 0u;
+    for (uint32_t i : visibleIndices) {
+        if (bucketIndices[i] == RenderSnapshot::NONE) continue;
 
-    auto c_modelIndex = 0u;
-    auto c_skinnedModelIndex = 0u;
+        uint32_t& listIndex = m_bucketListIndices[bucketIndices[i]];
+        if (listIndex == BUCKET_FILTERED) continue;
 
-    auto c_nonSkinnedListIndex = 0u;
-    auto c_skinnedListIndex = 0u;
+        const GameWorld::RenderBucket& bucket = buckets[bucketIndices[i]];
+        std::vector<InstanceList>& lists = bucket.skinned ? m_skinnedInstanceLists : m_nonSkinnedInstanceLists;
 
-    InstanceList* pCInstanceList = nullptr;
-    unsigned int* pCListIndex = nullptr;
-
-    for (const auto &&[e, r, t] : pack.each()) {
-        if (r.pModel && cullResults[c_index] && (!predicate || predicate(r.pModel))) {
-            if (r.pSkeleton) {
-                if (pCSkinnedModel != r.pModel) {
-                    pCSkinnedModel = r.pModel;
-
-                    ++c_skinnedModelIndex;
-
-                    pCInstanceList = &m_skinnedInstanceLists[c_skinnedModelIndex - 1];
-
-                    pCInstanceList->m_pModel = pCSkinnedModel;
-                    pCInstanceList->m_numInstances = skinnedModelNumInstances[c_skinnedModelIndex - 1];
-                    pCInstanceList->m_instanceSkeletons.resize(pCInstanceList->m_numInstances);
-                    pCInstanceList->m_instanceTransforms.resize(pCInstanceList->m_numInstances);
-                    if (useLastTransforms)
-                        pCInstanceList->m_lastInstanceTransforms.resize(pCInstanceList->m_numInstances);
-
-                    pCListIndex = &(c_skinnedListIndex = 0);
-                }
-            } else {
-                if (pCModel != r.pModel) {
-                    pCModel = r.pModel;
-
-                    ++c_modelIndex;
-
-                    pCInstanceList = &m_nonSkinnedInstanceLists[c_modelIndex - 1];
-
-                    pCInstanceList->m_pModel = pCModel;
-                    pCInstanceList->m_numInstances = modelNumInstances[c_modelIndex - 1];
-                    pCInstanceList->m_instanceTransforms.resize(pCInstanceList->m_numInstances);
-                    if (useLastTransforms)
-                        pCInstanceList->m_lastInstanceTransforms.resize(pCInstanceList->m_numInstances);
+        if (listIndex == BUCKET_UNSEEN) {
+            if (!bucket.pModel || (predicate && !predicate(bucket.pModel))) {
+                listIndex = BUCKET_FILTERED;
+                continue;
+            }
 
-                    pCListIndex = &(c_nonSkinnedListIndex = 0);
-                }
+            size_t& numModels = bucket.skinned ? numSkinnedModels : numNonSkinnedModels;
+            if (numModels == lists.size()) lists.emplace_back();
+            listIndex = static_cast<uint32_t>(numModels++);
+
+            // No more of the bucket's renderables can be visible than are in it, so the list doesn't grow while filling
+            InstanceList& list = lists[listIndex];
+            list.m_pModel = bucket.pModel;
+            list.m_numInstances = 0;
+            if (list.m_instanceTransforms.size() < bucket.numRenderables)
+                list.m_instanceTransforms.resize(bucket.numRenderables);
+            if (useLastTransforms && list.m_lastInstanceTransforms.size() < bucket.numRenderables)
+                list.m_lastInstanceTransforms.resize(bucket.numRenderables);
+            if (bucket.skinned && list.m_instanceSkinningMatrices.size() < bucket.numRenderables) {
+                list.m_instanceSkinningMatrices.resize(bucket.numRenderables);
+                list.m_lastInstanceSkinningMatrices.resize(bucket.numRenderables);
             }
-            pCInstanceList->m_instanceTransforms[*pCListIndex] = t.world;
-            if (useLastTransforms)
-                pCInstanceList->m_lastInstanceTransforms[*pCListIndex] = t.lastWorld;
-            if (r.pSkeleton)
-                pCInstanceList->m_instanceSkeletons[*pCListIndex] = r.pSkeleton;
+        }
+
+        InstanceList& list = lists[listIndex];
 
-            ++(*pCListIndex);
+        size_t j = list.m_numInstances++;
+        list.m_instanceTransforms[j] = pSnapshot->getWorldTransforms()[i].toMat4();
+        if (useLastTransforms)
+            list.m_lastInstanceTransforms[j] = pSnapshot->getLastWorldTransforms()[i].toMat4();
+        if (bucket.skinned) {
+            list.m_instanceSkinningMatrices[j] = &pSnapshot->getSkinningMatrices()[skinningOffsets[i]];
+            list.m_lastInstanceSkinningMatrices[j] = &pSnapshot->getLastSkinningMatrices()[skinningOffsets[i]];
+            ++m_numSkinnedInstances;
+        } else {
+            ++m_numNonSkinnedInstances;
         }
-        ++c_index;
     }
+
+    m_nonSkinnedInstanceLists.resize(numNonSkinnedModels);
+    m_skinnedInstanceLists.resize(numSkinnedModels);
 }
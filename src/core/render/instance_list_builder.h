@@ -1,10 +1,14 @@
 #ifndef INSTANCE_LIST_BUILDER_H_
 #define INSTANCE_LIST_BUILDER_H_
 
+#include <cstdint>
+#include <limits>
+
 #include "instance_list.h"
 
+class RenderSnapshot;
 class Scene;
-class GameWorld;
+class Skeleton;
 
 class InstanceListBuilder {
 
@@ -16,6 +20,15 @@ class InstanceListBuilder {
     size_t m_numNonSkinnedInstances;
     size_t m_numSkinnedInstances;
 
+    // For building from a RenderSnapshot: the list each of its render buckets' visible instances go in, or one of the below
+    std::vector<uint32_t> m_bucketListIndices;
+
+    static constexpr uint32_t BUCKET_UNSEEN = std::numeric_limits<uint32_t>::max();
+    static constexpr uint32_t BUCKET_FILTERED = BUCKET_UNSEEN - 1;
+
+    // Point the instance at the skeleton's skinning matrices. Returns false if there is no skeleton
+    static bool setSkinningMatrices(InstanceList& instanceList, size_t instance, const Skeleton* pSkeleton);
+
     //std::vector<InstanceList> m_nonSkinnedShadowCasterInstanceLists;
     //std::vector<InstanceList> m_skinnedShadowCasterInstanceLists;
 
@@ -28,15 +41,19 @@ public:
 
     // Note: frustum matrix only needed for LOD calculations
     // predicate may be null, in which case it acts as if it returns true for every model, i.e., none will be filtered
-    void buildInstanceLists(const Scene* pScene, const std::vector<bool>& cullResults, glm::mat4 frustumMatrix, filterPredicate predicate = nullptr);
+    void buildInstanceLists(const Scene* pScene, const std::vector<uint8_t>& cullResults, glm::mat4 frustumMatrix, filterPredicate predicate = nullptr);
 
 
     // Note: frustum matrix only needed for LOD calculations
     // predicate may be null, in which case it acts as if it returns true for every model, i.e., none will be filtered
-    void buildInstanceLists(const GameWorld* pGameWorld, const std::vector<bool>& cullResults, glm::mat4 frustumMatrix, filterPredicate predicate = nullptr, bool useLastTransforms = false);
+    // visibleIndices are indices of the snapshot's renderables, as from FrustumCuller::getVisibleIndices()
+    // Instances are grouped by the snapshot's render buckets, so only the visible renderables are visited.
+    //   Renderables which had no up to date bucket when captured are left out
+    // The skinned instances point into the snapshot's skinning matrices, so it has to outlive the lists
+    void buildInstanceLists(const RenderSnapshot* pSnapshot, const std::vector<uint32_t>& visibleIndices, glm::mat4 frustumMatrix, filterPredicate predicate = nullptr, bool useLastTransforms = false);
 
     // Filter out instances of Models that are not shadow-casting
-    //void buildShadowMapInstanceLists(const Scene* pScene, const std::vector<bool>& cullResults, glm::mat4 frustumMatrix);
+    //void buildShadowMapInstanceLists(const Scene* pScene, const std::vector<uint8_t>& cullResults, glm::mat4 frustumMatrix);
 
     void clearInstanceLists() {
         //m_nonSkinnedInstanceLists.clear();
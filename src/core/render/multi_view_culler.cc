@@ -0,0 +1,116 @@
+#include "multi_view_culler.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "core/util/timer.h"
+
+void MultiViewCuller::initForScheduler(JobScheduler* pScheduler) {
+    if (pScheduler != m_pScheduler) {
+        m_pScheduler = pScheduler;
+        m_resultsReadyCounter = pScheduler->getFreeCounter();
+        m_chunksCounter = pScheduler->getFreeCounter();
+    }
+}
+
+void MultiViewCuller::clearViews() {
+    m_viewPlanes.clear();
+    m_viewCullers.clear();
+}
+
+uint32_t MultiViewCuller::addView(const glm::mat4& frustumMatrix, FrustumCuller* pCuller) {
+    if (m_viewPlanes.size() >= MAX_VIEWS) {
+        throw std::runtime_error("Too many views to cull at once, at most " + std::to_string(MAX_VIEWS));
+    }
+    m_viewPlanes.push_back(math_util::frustumPlanes(frustumMatrix));
+    m_viewCullers.push_back(pCuller);
+    return static_cast<uint32_t>(m_viewPlanes.size() - 1);
+}
+
+size_t MultiViewCuller::cull(const RenderSnapshot* pSnapshot) {
+    m_visibleIndices.clear();
+    m_visibleViews.clear();
+    pSnapshot->getBVH().queryMultiFrustum(m_viewPlanes.data(), getNumViews(), m_visibleIndices, m_visibleViews);
+
+    for (uint32_t v = 0; v < getNumViews(); ++v) writeViewResults(v);
+
+    return m_visibleIndices.size();
+}
+
+void MultiViewCuller::cullFromJob(const RenderSnapshot* pSnapshot) {
+    m_pChunkSnapshot = pSnapshot;
+    m_chunkTasks.clear();
+    pSnapshot->getBVH().splitMultiFrustumQuery(m_viewPlanes.data(), getNumViews(), CHUNK_HEIGHT, m_chunkTasks);
+
+    // Too little to be worth the jobs
+    if (!m_pScheduler || m_chunkTasks.size() <= 1) {
+        cull(pSnapshot);
+        return;
+    }
+
+    if (m_chunkResults.size() < m_chunkTasks.size()) {
+        m_chunkResults.resize(m_chunkTasks.size());
+        m_chunkResultViews.resize(m_chunkTasks.size());
+    }
+    m_pScheduler->parallelFor(0, static_cast<uint32_t>(m_chunkTasks.size()), 1, cullChunksRange,
+                              reinterpret_cast<uintptr_t>(this), m_chunksCounter, JobScheduler::JOB_PRIORITY_NORMAL,
+                              "MultiViewCullChunks");
+
+    // The join hands out the views' results with jobs of its own, also on the results ready counter, which it holds
+    JobScheduler::JobDeclaration decl;
+    decl.name = "MultiViewCullJoin";
+    decl.setClosure([this] {
+        joinChunkResults();
+        m_pScheduler->parallelFor(0, getNumViews(), 1, writeViewResultsRange, reinterpret_cast<uintptr_t>(this),
+                                  m_resultsReadyCounter, JobScheduler::JOB_PRIORITY_NORMAL, "MultiViewCullWrite");
+    });
+    decl.waitCounters[decl.numWaitCounters++] = m_chunksCounter;
+    decl.signalCounters[decl.numSignalCounters++] = m_resultsReadyCounter;
+    m_pScheduler->enqueueJob(decl);
+}
+
+void MultiViewCuller::cullChunksRange(uint32_t begin, uint32_t end, uintptr_t param) {
+    MultiViewCuller* pCuller = reinterpret_cast<MultiViewCuller*>(param);
+    const DynamicBVH& bvh = pCuller->m_pChunkSnapshot->getBVH();
+    for (uint32_t i = begin; i < end; ++i) {
+        pCuller->m_chunkResults[i].clear();
+        pCuller->m_chunkResultViews[i].clear();
+        bvh.queryMultiFrustum(pCuller->m_viewPlanes.data(), pCuller->getNumViews(), pCuller->m_chunkTasks[i],
+                              pCuller->m_chunkResults[i], pCuller->m_chunkResultViews[i]);
+    }
+}
+
+void MultiViewCuller::joinChunkResults() {
+    size_t numChunks = m_chunkTasks.size();
+    size_t count = 0;
+    for (size_t i = 0; i < numChunks; ++i) count += m_chunkResults[i].size();
+
+    m_visibleIndices.resize(count);
+    m_visibleViews.resize(count);
+    auto itIndices = m_visibleIndices.begin();
+    auto itViews = m_visibleViews.begin();
+    for (size_t i = 0; i < numChunks; ++i) {
+        itIndices = std::copy(m_chunkResults[i].begin(), m_chunkResults[i].end(), itIndices);
+        itViews = std::copy(m_chunkResultViews[i].begin(), m_chunkResultViews[i].end(), itViews);
+    }
+}
+
+void MultiViewCuller::writeViewResultsRange(uint32_t begin, uint32_t end, uintptr_t param) {
+    MultiViewCuller* pCuller = reinterpret_cast<MultiViewCuller*>(param);
+    for (uint32_t v = begin; v < end; ++v) pCuller->writeViewResults(v);
+}
+
+void MultiViewCuller::writeViewResults(uint32_t view) {
+    FrustumCuller* pCuller = m_viewCullers[view];
+    if (!pCuller) return;
+
+    std::vector<uint32_t>& indices = pCuller->m_visibleIndices;
+    indices.clear();
+    for (size_t i = 0; i < m_visibleIndices.size(); ++i) {
+        if ((m_visibleViews[i] >> view) & 1u) indices.push_back(m_visibleIndices[i]);
+    }
+
+    pCuller->m_numToRender = indices.size();
+    pCuller->m_cullResultsForFrame = Timer::getCurrentFrame();
+}
@@ -0,0 +1,90 @@
+#ifndef MULTI_VIEW_CULLER_H_
+#define MULTI_VIEW_CULLER_H_
+
+#include <array>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "core/job_scheduler.h"
+#include "core/render/frustum_culler.h"
+#include "core/render/render_snapshot.h"
+#include "core/scene/dynamic_bvh.h"
+#include "core/util/math_util.h"
+
+// Culls a RenderSnapshot's renderables for every view of a frame, e.g. the camera, each shadow cascade and each face
+//   of each point shadow map, in a single walk of the BVH. Every node and sphere is loaded once and tested against
+//   all the views it may be visible in, rather than once per view
+// Each view's results are handed to the FrustumCuller it was added with, so passes take them from their cullers as
+//   before. They come in the same order every time for the same snapshot and views
+class MultiViewCuller {
+
+public:
+
+    static constexpr uint32_t MAX_VIEWS = DynamicBVH::MAX_QUERY_FRUSTUMS;
+
+    // The BVH is split into subtrees of at most 2^CHUNK_HEIGHT leaves, searched by separate jobs
+    static constexpr uint32_t CHUNK_HEIGHT = 10;
+
+    void initForScheduler(JobScheduler* pScheduler);
+
+    // Views are added anew each frame, once their matrices are known
+    void clearViews();
+
+    // Returns the view's index, its bit in getVisibleViews(). pCuller may be nullptr if only the masks are wanted
+    uint32_t addView(const glm::mat4& frustumMatrix, FrustumCuller* pCuller);
+
+    uint32_t getNumViews() const {
+        return static_cast<uint32_t>(m_viewPlanes.size());
+    }
+
+    size_t cull(const RenderSnapshot* pSnapshot);
+
+    // For use from a job scheduled to signal the results ready counter, so the results, including those of each
+    //   view's FrustumCuller, are ready once that counter reaches zero
+    void cullFromJob(const RenderSnapshot* pSnapshot);
+
+    // Indices of the renderables of the RenderSnapshot visible in any of the views
+    const std::vector<uint32_t>& getVisibleIndices() const {
+        return m_visibleIndices;
+    }
+
+    // For each of getVisibleIndices(), the views it is visible in, bit i for the view with index i
+    const std::vector<uint64_t>& getVisibleViews() const {
+        return m_visibleViews;
+    }
+
+    JobScheduler::CounterHandle getResultsReadyCounter() const {
+        return m_resultsReadyCounter;
+    }
+
+private:
+
+    std::vector<std::array<math_util::Plane, 6>> m_viewPlanes;
+    std::vector<FrustumCuller*> m_viewCullers;
+
+    std::vector<uint32_t> m_visibleIndices;
+    std::vector<uint64_t> m_visibleViews;
+
+    JobScheduler* m_pScheduler = nullptr;
+    JobScheduler::CounterHandle m_resultsReadyCounter = JobScheduler::COUNTER_NULL;
+
+    // For cullFromJob(), the query it is running, and the results of each of its parts
+    const RenderSnapshot* m_pChunkSnapshot = nullptr;
+    std::vector<DynamicBVH::MultiFrustumQueryTask> m_chunkTasks;
+    std::vector<std::vector<uint32_t>> m_chunkResults;
+    std::vector<std::vector<uint64_t>> m_chunkResultViews;
+    JobScheduler::CounterHandle m_chunksCounter = JobScheduler::COUNTER_NULL;
+
+    static void cullChunksRange(uint32_t begin, uint32_t end, uintptr_t param);
+
+    void joinChunkResults();
+
+    static void writeViewResultsRange(uint32_t begin, uint32_t end, uintptr_t param);
+
+    // Pick the view's renderables out of the combined results, into its FrustumCuller
+    void writeViewResults(uint32_t view);
+
+};
+
+#endif // MULTI_VIEW_CULLER_H_
@@ -16,11 +16,6 @@ void GeometryRenderPass::init() {
     m_ownsShaders = loadShaders();
     initRenderTargets();
 
-    m_buildListsParam.pListBuilder = &m_listBuilder;
-    m_buildListsParam.predicate    = getFilterPredicate();
-    m_buildListsParam.pUser = this;
-    m_buildListsParam.useLastTransforms = useLastFrameMatrix();
-
     m_fillDefaultBucketParam.pBucket             = &m_defaultCallBucket;
     m_fillDefaultBucketParam.useLastFrameMatrix  = useLastFrameMatrix();
     m_fillDefaultBucketParam.useNormalsMatrix    = useNormalsMatrix();
@@ -93,13 +88,7 @@ void GeometryRenderPass::cleanup() {
 
 
 void GeometryRenderPass::initForScheduler(JobScheduler* pScheduler) {
-    if (m_pScheduler != pScheduler) {
-        m_pScheduler = pScheduler;
-        static int i = 0;
-        std::string counterID = "GRP" + std::to_string(i++);
-        //std::cout << this << " " << counterID << std::endl;
-        m_buildListsJobCounter = pScheduler->getCounterByID(counterID); //pScheduler->getFreeCounter();
-    }
+    m_pScheduler = pScheduler;
 }
 
 void GeometryRenderPass::updateInstanceBuffers() {
@@ -118,55 +107,61 @@ void GeometryRenderPass::updateInstanceBuffers() {
     }
 }
 
-void GeometryRenderPass::updateInstanceListsJob(uintptr_t param) {
-    UpdateParam* pParam = reinterpret_cast<UpdateParam*>(param);
-
-    GeometryRenderPass* pPass = pParam->pPass;
-
-    if (pParam->pCuller->getNumToRender() == 0) {
-        pPass->m_listBuilder.clearInstanceLists();
-        pPass->m_defaultCallBucket.numInstances = 0;
-        pPass->m_skinnedCallBucket.numInstances = 0;
+void GeometryRenderPass::updateInstanceLists(const UpdateParam& param) {
+    if (param.pCuller->getNumToRender() == 0) {
+        m_listBuilder.clearInstanceLists();
+        m_defaultCallBucket.numInstances = 0;
+        m_skinnedCallBucket.numInstances = 0;
         return;
     }
 
-    BuildInstanceListsParam& buildListsParam = pPass->m_buildListsParam;
-    buildListsParam.frustumMatrix = pParam->globalMatrix;
-    buildListsParam.pCuller       = pParam->pCuller;
-    //buildListsParam.pScene        = pParam->pScene;
-    buildListsParam.pGameWorld    = pParam->pGameWorld;
+    m_listBuilder.buildInstanceLists(param.pSnapshot, param.pCuller->getVisibleIndices(), param.globalMatrix,
+                                     getFilterPredicate(), useLastFrameMatrix());
 
-    JobScheduler::JobDeclaration buildListsDecl;
-    buildListsDecl.param             = reinterpret_cast<uintptr_t>(&pPass->m_buildListsParam);
-    buildListsDecl.numSignalCounters = 1;
-    buildListsDecl.signalCounters[0] = pPass->m_buildListsJobCounter;
-    buildListsDecl.pFunction         = buildInstanceListsJob;
+    // Each fill lays out its calls here and hands the instances to a parallelFor() holding param.signalCounter,
+    //   so this returns as soon as both are dispatched
+    FillCallBucketParam* fillBucketParams[] {
+        &m_fillDefaultBucketParam,
+        &m_fillSkinnedBucketParam };
 
-    pPass->m_pScheduler->enqueueJob(buildListsDecl);
+    const std::vector<InstanceList>* instanceLists[] {
+        &m_listBuilder.getNonSkinnedInstanceLists(),
+        &m_listBuilder.getSkinnedInstanceLists() };
 
-    JobScheduler::JobDeclaration dispatchDecl;
-    dispatchDecl.numSignalCounters = 1;
-    dispatchDecl.signalCounters[0] = pParam->signalCounter;
-    dispatchDecl.waitCounter = pPass->m_buildListsJobCounter;
-    dispatchDecl.param = param;
-    dispatchDecl.pFunction = GeometryRenderPass::dispatchCallBucketsJob;
+    size_t numInstances[] {
+        m_listBuilder.getNumNonSkinnedInstances(),
+        m_listBuilder.getNumSkinnedInstances() };
 
-    pPass->m_pScheduler->enqueueJob(dispatchDecl);
-}
+    for (int i = 0; i < 2; ++i) {
+        if (numInstances[i] == 0) {
+            fillBucketParams[i]->pBucket->numInstances = 0;
+            continue;
+        }
 
-void GeometryRenderPass::fillCallBucketJob(uintptr_t param) {
-    FillCallBucketParam* pParam = reinterpret_cast<FillCallBucketParam*>(param);
+        fillBucketParams[i]->pInstanceLists   = instanceLists[i];
+        fillBucketParams[i]->numInstances     = numInstances[i];
+        fillBucketParams[i]->globalMatrix     = param.globalMatrix;
+        fillBucketParams[i]->lastGlobalMatrix = param.lastGlobalMatrix;
+        fillBucketParams[i]->normalsMatrix    = param.normalsMatrix;
+        fillBucketParams[i]->pScheduler       = m_pScheduler;
+        fillBucketParams[i]->signalCounter    = param.signalCounter;
+
+        fillCallBucket(fillBucketParams[i]);
+    }
+}
 
+void GeometryRenderPass::fillCallBucket(FillCallBucketParam* pParam) {
     CallBucket& bucket = *pParam->pBucket;
     const std::vector<InstanceList>& instanceLists = *pParam->pInstanceLists;
     size_t numInstances = pParam->numInstances;
-    glm::mat4 globalMatrix = pParam->globalMatrix;
     bool useNormalsMatrix = pParam->useNormalsMatrix;
     bool useSkinningMatrices = pParam->useSkinningMatrices;
 
     if (bucket.callInfos.size() < instanceLists.size()) {
         bucket.callInfos.resize(instanceLists.size());
         bucket.usageFlags.resize(instanceLists.size());
+        bucket.listFirstInstances.resize(instanceLists.size());
+        bucket.listFloatOffsets.resize(instanceLists.size());
     }
     bucket.usageFlags.assign(bucket.usageFlags.size(), false);
 
@@ -184,8 +179,9 @@ void GeometryRenderPass::fillCallBucketJob(uintptr_t param) {
     bucket.instanceTransformFloats.resize(numInstanceTransforms * transformSize);
     bucket.numInstances = numInstances;
 
+    // Lay out the calls first, so that each instance knows where its transforms go
     size_t transformBufferOffset = 0;
-    size_t floatBufferOffset = 0;
+    size_t firstInstance = 0;
     for (size_t i = 0; i < instanceLists.size(); ++i) {
         const Model* pModel = instanceLists[i].getModel();
 
@@ -201,130 +197,78 @@ void GeometryRenderPass::fillCallBucketJob(uintptr_t param) {
 
         bucket.callInfos[i] = callInfo;
         bucket.usageFlags[i] = true;
+        bucket.listFirstInstances[i] = firstInstance;
+        bucket.listFloatOffsets[i] = transformBufferOffset * transformSize;
 
-        for (size_t j = 0; j < instanceLists[i].getNumInstances(); ++j) {
-            glm::mat4 worldMatrix = instanceLists[i].getInstanceTransforms()[j];
-            glm::mat4 worldGlobalMatrix = globalMatrix * worldMatrix;
-            glm::mat4 worldGlobalNormalsMatrix;
-            glm::mat4 lastWorldGlobalMatrix;
-            if (pParam->useNormalsMatrix) worldGlobalNormalsMatrix = pParam->normalsMatrix * glm::inverseTranspose(worldMatrix);
-            if (pParam->useLastFrameMatrix) lastWorldGlobalMatrix = pParam->lastGlobalMatrix * instanceLists[i].getLastInstanceTransforms()[j];
-
-            if (!useSkinningMatrices) {
-                memcpy(&bucket.instanceTransformFloats[floatBufferOffset], &worldGlobalMatrix[0][0], 16*sizeof(float));
-                floatBufferOffset += 16;
-                if (useNormalsMatrix) {
-                    memcpy(&bucket.instanceTransformFloats[floatBufferOffset], &worldGlobalNormalsMatrix[0][0], 16*sizeof(float));
-                    floatBufferOffset += 16;
-                }
-                if (pParam->useLastFrameMatrix) {
-                    memcpy(&bucket.instanceTransformFloats[floatBufferOffset], &lastWorldGlobalMatrix[0][0], 16*sizeof(float));
-                    floatBufferOffset += 16;
-                }
-            } else {
-                const Skeleton* pSkeleton = instanceLists[i].getInstanceSkeletons()[j];
-                //assert(pSkeleton);
-
-                size_t numJoints = header.pSkeletonDesc->getNumJoints();
-                assert(pSkeleton->getSkinningMatrices().size() == numJoints);
-                std::vector<glm::mat4> skinningMatrices((useNormalsMatrix ? 2 * numJoints : numJoints) + (pParam->useLastFrameMatrix ? numJoints : 0));
-                if (!useNormalsMatrix && !pParam->useLastFrameMatrix) {
-                    std::transform(pSkeleton->getSkinningMatrices().begin(), pSkeleton->getSkinningMatrices().end(),
-                               skinningMatrices.begin(),
-                               [&] (const glm::mat4& m) { return worldGlobalMatrix * m; });
-                } else {
-                    if (pParam->useLastFrameMatrix) {
-                        if (useNormalsMatrix) {
-                            for (size_t k = 0; k < numJoints; ++k) {
-                                glm::mat4 skinningMatrix = pSkeleton->getSkinningMatrices()[k];
-                                skinningMatrices[3*k] = worldGlobalMatrix * skinningMatrix;
-                                skinningMatrices[3*k+1] = worldGlobalNormalsMatrix * glm::inverseTranspose(skinningMatrix);
-                                skinningMatrices[3*k+2] = lastWorldGlobalMatrix * pSkeleton->getLastSkinningMatrices()[k];
-                            }
-                        } else {
-                            for (size_t k = 0; k < numJoints; ++k) {
-                                skinningMatrices[2*k] = worldGlobalMatrix * pSkeleton->getSkinningMatrices()[k];
-                                skinningMatrices[2*k+1] = lastWorldGlobalMatrix * pSkeleton->getLastSkinningMatrices()[k];
-                            }
-                        }
-                    } else {
-                        for (size_t k = 0; k < numJoints; ++k) {
-                            glm::mat4 skinningMatrix = pSkeleton->getSkinningMatrices()[k];
-                            skinningMatrices[2*k] = worldGlobalMatrix * skinningMatrix;
-                            skinningMatrices[2*k+1] = worldGlobalNormalsMatrix * glm::inverseTranspose(skinningMatrix);
-                        }
-                    }
-                }
-
-                size_t numFloats = 16 * skinningMatrices.size();
-                memcpy(&bucket.instanceTransformFloats[floatBufferOffset], skinningMatrices.data(), numFloats * sizeof(float));
-                floatBufferOffset += numFloats;
-            }
-        }
+        firstInstance += instanceLists[i].getNumInstances();
         if (!useSkinningMatrices) {
             transformBufferOffset += instanceLists[i].getNumInstances();
         } else {
             transformBufferOffset += instanceLists[i].getNumInstances() * header.pSkeletonDesc->getNumJoints();
         }
     }
-}
 
-void GeometryRenderPass::dispatchCallBucketsJob(uintptr_t param) {
-    UpdateParam* pParam = reinterpret_cast<UpdateParam*>(param);
+    // Skinned instances each have a full set of joint matrices to transform, so they are split much finer
+    uint32_t grainSize = useSkinningMatrices ? 4 : 64;
+    pParam->pScheduler->parallelFor(0, static_cast<uint32_t>(numInstances), grainSize, fillCallBucketRange, reinterpret_cast<uintptr_t>(pParam), pParam->signalCounter,
+                                    JobScheduler::JOB_PRIORITY_NORMAL, "FillCallBucket");
+}
 
-    GeometryRenderPass* pPass = pParam->pPass;
+void GeometryRenderPass::fillCallBucketRange(uint32_t begin, uint32_t end, uintptr_t param) {
+    FillCallBucketParam* pParam = reinterpret_cast<FillCallBucketParam*>(param);
 
-    FillCallBucketParam* fillBucketParams[] {
-        &pPass->m_fillDefaultBucketParam,
-        &pPass->m_fillSkinnedBucketParam };
+    CallBucket& bucket = *pParam->pBucket;
+    const std::vector<InstanceList>& instanceLists = *pParam->pInstanceLists;
 
-    int pindex[2];
-    int ndecl = 0;
+    size_t transformSize = (pParam->useNormalsMatrix ? 32 : 16) + (pParam->useLastFrameMatrix ? 16 : 0);
 
-    if (pPass->m_listBuilder.hasNonSkinnedInstances()) {
-        fillBucketParams[0]->pInstanceLists   = &pPass->m_listBuilder.getNonSkinnedInstanceLists();
-        fillBucketParams[0]->numInstances     = pPass->m_listBuilder.getNumNonSkinnedInstances();
-        fillBucketParams[0]->globalMatrix     = pParam->globalMatrix;
-        fillBucketParams[0]->lastGlobalMatrix = pParam->lastGlobalMatrix;
-        fillBucketParams[0]->normalsMatrix    = pParam->normalsMatrix;
+    // Find the last list starting at or before begin, empty lists share their first instance with the next list
+    auto firstInstancesEnd = bucket.listFirstInstances.begin() + instanceLists.size();
+    size_t i = std::upper_bound(bucket.listFirstInstances.begin(), firstInstancesEnd, size_t(begin)) - bucket.listFirstInstances.begin() - 1;
 
-        pindex[ndecl++] = 0;
-    } else {
-        pPass->m_defaultCallBucket.numInstances = 0;
-    }
+    for (size_t instance = begin; instance < end; ++instance) {
+        while (instance >= bucket.listFirstInstances[i] + instanceLists[i].getNumInstances()) ++i;
 
-    if (pPass->m_listBuilder.hasSkinnedInstances()) {
-        fillBucketParams[1]->pInstanceLists   = &pPass->m_listBuilder.getSkinnedInstanceLists();
-        fillBucketParams[1]->numInstances     = pPass->m_listBuilder.getNumSkinnedInstances();
-        fillBucketParams[1]->globalMatrix     = pParam->globalMatrix;
-        fillBucketParams[1]->lastGlobalMatrix = pParam->lastGlobalMatrix;
-        fillBucketParams[1]->normalsMatrix    = pParam->normalsMatrix;
+        size_t j = instance - bucket.listFirstInstances[i];
+        size_t instanceSize = transformSize;
+        if (pParam->useSkinningMatrices) instanceSize *= instanceLists[i].getModel()->getSkeletonDescription()->getNumJoints();
 
-        pindex[ndecl++] = 1;
-    } else {
-        pPass->m_skinnedCallBucket.numInstances = 0;
+        writeInstanceTransforms(pParam, instanceLists[i], j, &bucket.instanceTransformFloats[bucket.listFloatOffsets[i] + j * instanceSize]);
     }
+}
 
-    if (ndecl == 0) return;
+void GeometryRenderPass::writeInstanceTransforms(const FillCallBucketParam* pParam, const InstanceList& instanceList, size_t instance, float* pOut) {
+    const auto put = [&pOut] (const glm::mat4& m) {
+        memcpy(pOut, &m[0][0], 16*sizeof(float));
+        pOut += 16;
+    };
+
+    bool useNormalsMatrix = pParam->useNormalsMatrix;
 
-    JobScheduler::JobDeclaration callBucketDecls[2];
-    for (int i = 0; i < ndecl; ++i) {
-        callBucketDecls[i].param = reinterpret_cast<uintptr_t>(fillBucketParams[pindex[i]]);
-        callBucketDecls[i].numSignalCounters = 1;
-        callBucketDecls[i].signalCounters[0] = pParam->signalCounter;
-        callBucketDecls[i].pFunction = fillCallBucketJob;
+    glm::mat4 worldMatrix = instanceList.getInstanceTransforms()[instance];
+    glm::mat4 worldGlobalMatrix = pParam->globalMatrix * worldMatrix;
+    glm::mat4 worldGlobalNormalsMatrix;
+    glm::mat4 lastWorldGlobalMatrix;
+    if (useNormalsMatrix) worldGlobalNormalsMatrix = pParam->normalsMatrix * glm::inverseTranspose(worldMatrix);
+    if (pParam->useLastFrameMatrix) lastWorldGlobalMatrix = pParam->lastGlobalMatrix * instanceList.getLastInstanceTransforms()[instance];
+
+    if (!pParam->useSkinningMatrices) {
+        put(worldGlobalMatrix);
+        if (useNormalsMatrix) put(worldGlobalNormalsMatrix);
+        if (pParam->useLastFrameMatrix) put(lastWorldGlobalMatrix);
+        return;
     }
 
-    pPass->m_pScheduler->enqueueJobs(ndecl, callBucketDecls);
-}
+    const glm::mat4* pSkinningMatrices = instanceList.getInstanceSkinningMatrices()[instance];
+    const glm::mat4* pLastSkinningMatrices = instanceList.getLastInstanceSkinningMatrices()[instance];
+    //assert(pSkinningMatrices);
 
-void GeometryRenderPass::buildInstanceListsJob(uintptr_t param) {
-    BuildInstanceListsParam* pParam = reinterpret_cast<BuildInstanceListsParam*>(param);
+    size_t numJoints = instanceList.getModel()->getSkeletonDescription()->getNumJoints();
 
-    if (pParam->pCuller->getNumToRender() > 0) {
-//        pParam->pListBuilder->buildInstanceLists(pParam->pScene, pParam->pCuller->getCullResults(), pParam->frustumMatrix, pParam->predicate);
-        pParam->pListBuilder->buildInstanceLists(pParam->pGameWorld, pParam->pCuller->getCullResults(), pParam->frustumMatrix, pParam->predicate, pParam->useLastTransforms);
-    } else {
-        pParam->pListBuilder->clearInstanceLists();
+    for (size_t k = 0; k < numJoints; ++k) {
+        glm::mat4 skinningMatrix = pSkinningMatrices[k];
+        put(worldGlobalMatrix * skinningMatrix);
+        if (useNormalsMatrix) put(worldGlobalNormalsMatrix * glm::inverseTranspose(skinningMatrix));
+        if (pParam->useLastFrameMatrix) put(lastWorldGlobalMatrix * pLastSkinningMatrices[k]);
     }
 }
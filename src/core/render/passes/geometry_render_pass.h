@@ -8,6 +8,7 @@
 
 #include "core/render/frustum_culler.h"
 #include "core/render/instance_list_builder.h"
+#include "core/render/render_snapshot.h"
 #include "core/render/render_pass.h"
 #include "core/render/shader.h"
 
@@ -17,8 +18,8 @@
 // A framework is implemented for automatically building and rendering CallBuckets,
 // customized by overriding the hooks getFilterPredicate(), useNormalsMatrix(), and useLastFrameMatrix()
 // It is intended that Renderer code will call initForScheduler() along with init()
-// and will schedule updateInstanceListsJob every frame prior to rendering.
-// updateInstanceListsJob does not depend on the GL context so it is safe to schedule concurrently for each
+// and will call updateInstanceLists() from a job every frame prior to rendering.
+// updateInstanceLists() does not depend on the GL context so it is safe to run concurrently for each
 // GeometryRenderPass the Renderer is using.
 
 class GeometryRenderPass : public RenderPass {
@@ -34,7 +35,7 @@ public:
     // calls cleanupRenderTargets() and frees CallBucket instance buffers
     void cleanup() override;
 
-    // obtains a valid CounterHandle for synchronizing internal jobs
+    // sets the scheduler used for internal parallel loops
     void initForScheduler(JobScheduler* pScheduler);
 
     // copies data from the CallBuckets to a GPU buffer, initializing if necessary. Requires current GL context
@@ -52,12 +53,10 @@ public:
         m_ownsShaders = false;
     }
 
-    // parameter structure to be passed into updateInstanceListsJob()
+    // parameters for updateInstanceLists(), only needed for the duration of the call
     struct UpdateParam {
-        GeometryRenderPass* pPass;   // the current pass
-
         //const Scene* pScene;         // the active scene, whose geometry will be rendered
-        const GameWorld* pGameWorld;
+        const RenderSnapshot* pSnapshot;  // the frame's renderables, must stay alive until the pass has rendered
 
         FrustumCuller* pCuller;      // contains current frame data for each renderable in the scene
 
@@ -65,12 +64,12 @@ public:
         glm::mat4 lastGlobalMatrix;  // previous frame's globalMatrix (only needed when useLastFrameMatrix() returns true)
         glm::mat4 normalsMatrix;     // a version of the global matrix which will be multiplied with each vertex' normal/tangent frame in the VS
 
-        JobScheduler::CounterHandle signalCounter;  // the counter updateInstanceListsJob() was scheduled to signal,
+        JobScheduler::CounterHandle signalCounter;  // a counter the calling job was scheduled to signal,
                                                     // will be passed into internal jobs to allow synchronization with the calling code
     };
 
-    // should be scheduled each frame prior to rendering, after culling scene renderables
-    static void updateInstanceListsJob(uintptr_t);
+    // should be called from a job each frame prior to rendering, after culling scene renderables
+    void updateInstanceLists(const UpdateParam& param);
 
 protected:
 
@@ -142,6 +141,10 @@ private:
         std::vector<float> instanceTransformFloats;
         std::vector<bool> usageFlags;
 
+        // Per instance list, the index of its first instance and where its transforms start in instanceTransformFloats
+        std::vector<size_t> listFirstInstances;
+        std::vector<size_t> listFloatOffsets;
+
         uint32_t numInstances = 0;
 
         GLuint instanceTransformBuffer;
@@ -161,17 +164,10 @@ private:
         bool useLastFrameMatrix;
         bool useNormalsMatrix;
         bool useSkinningMatrices;
-    };
 
-    struct BuildInstanceListsParam {
-        const void* pUser = nullptr;
-        InstanceListBuilder* pListBuilder = nullptr;
-        FrustumCuller* pCuller;
-        //const Scene* pScene;
-        const GameWorld* pGameWorld;
-        glm::mat4 frustumMatrix;
-        InstanceListBuilder::filterPredicate predicate = nullptr;
-        bool useLastTransforms = false;
+        // instances are filled by a parallelFor() which holds the signal counter
+        JobScheduler* pScheduler;
+        JobScheduler::CounterHandle signalCounter;
     };
 
     // Members
@@ -181,24 +177,22 @@ private:
 
     InstanceListBuilder m_listBuilder;
 
-    BuildInstanceListsParam m_buildListsParam;
     FillCallBucketParam m_fillDefaultBucketParam,
                         m_fillSkinnedBucketParam;
 
-    JobScheduler::CounterHandle m_buildListsJobCounter;
-
     JobScheduler* m_pScheduler = nullptr;
 
     bool m_ownsShaders = false;
 
     // Methods
 
-    static void fillCallBucketJob(uintptr_t param);
-
-    static void dispatchCallBucketsJob(uintptr_t param);
+    // lays out the bucket's calls for the instance lists, then fills the instance transforms in a parallelFor()
+    static void fillCallBucket(FillCallBucketParam* pParam);
 
-    static void buildInstanceListsJob(uintptr_t param);
+    static void fillCallBucketRange(uint32_t begin, uint32_t end, uintptr_t param);
 
+    // writes the transforms of one instance, as many floats as the bucket uses per instance of the list's model
+    static void writeInstanceTransforms(const FillCallBucketParam* pParam, const InstanceList& instanceList, size_t instance, float* pOut);
 
 };
 
@@ -133,24 +133,15 @@ void MotionVectorsPass::setMatrices(const glm::mat4& lastViewProj, const glm::ma
     m_viewProjInverse = inverseViewProj;
 }
 
-void MotionVectorsPass::preRenderJob(uintptr_t param) {
-    PreRenderParam* pParam = reinterpret_cast<PreRenderParam*>(param);
-    MotionVectorsPass* pPass = pParam->pPass;
-
-    pPass->m_objectPassUpdateParam.pPass = &pPass->m_objectPass;
-//    pPass->m_objectPassUpdateParam.pScene = pParam->pScene;
-    pPass->m_objectPassUpdateParam.pGameWorld = pParam->pGameWorld;
-    pPass->m_objectPassUpdateParam.pCuller = pParam->pCuller;
-    pPass->m_objectPassUpdateParam.globalMatrix = pParam->cameraMatrix;
-    pPass->m_objectPassUpdateParam.lastGlobalMatrix = pParam->lastCameraMatrix;
-    pPass->m_objectPassUpdateParam.signalCounter = pParam->signalCounter;
-
-    JobScheduler::JobDeclaration decl;
-    decl.numSignalCounters = 1;
-    decl.signalCounters[0] = pParam->signalCounter;
-    decl.param = reinterpret_cast<uintptr_t>(&pPass->m_objectPassUpdateParam);
-    decl.waitCounter = pParam->pCuller->getResultsReadyCounter();
-    decl.pFunction = GeometryRenderPass::updateInstanceListsJob;
-
-    pPass->m_pScheduler->enqueueJob(decl);
+void MotionVectorsPass::preRender(const RenderSnapshot* pSnapshot, FrustumCuller* pCuller,
+                                  const glm::mat4& cameraMatrix, const glm::mat4& lastCameraMatrix,
+                                  JobScheduler::CounterHandle signalCounter) {
+    GeometryRenderPass::UpdateParam param;
+    param.pSnapshot = pSnapshot;
+    param.pCuller = pCuller;
+    param.globalMatrix = cameraMatrix;
+    param.lastGlobalMatrix = lastCameraMatrix;
+    param.signalCounter = signalCounter;
+
+    m_objectPass.updateInstanceLists(param);
 }
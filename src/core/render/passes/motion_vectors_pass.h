@@ -35,19 +35,11 @@ public:
         return &m_motionBuffer;
     }
 
-    struct PreRenderParam {
-        MotionVectorsPass* pPass;
-        //const Scene* pScene;
-        const GameWorld* pGameWorld;
-        FrustumCuller* pCuller;
-
-        glm::mat4 cameraMatrix;
-        glm::mat4 lastCameraMatrix;
-
-        JobScheduler::CounterHandle signalCounter;
-    };
-
-    static void preRenderJob(uintptr_t param);
+    // Updates the object pass's instance lists from the camera's cull results
+    // To be called from a job once pCuller's results are ready, internal jobs signal signalCounter
+    void preRender(const RenderSnapshot* pSnapshot, FrustumCuller* pCuller,
+                   const glm::mat4& cameraMatrix, const glm::mat4& lastCameraMatrix,
+                   JobScheduler::CounterHandle signalCounter);
 
 private:
 
@@ -59,7 +51,6 @@ private:
     Shader m_cameraMotionShader;
 
     ObjectMotionVectorsPass m_objectPass;
-    GeometryRenderPass::UpdateParam m_objectPassUpdateParam;
 
     BackgroundMotionVectorsPass* m_pBackgroundPass = nullptr;
     Texture* m_pGBufferDepthTexture = nullptr;
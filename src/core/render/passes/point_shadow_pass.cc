@@ -9,7 +9,6 @@ void PointShadowPass::initForScheduler(JobScheduler* pScheduler) {
     if (pScheduler != m_pScheduler) {
         m_pScheduler = pScheduler;
         for (auto i = 0u; i < 6*m_maxPointShadowMaps; ++i) {
-            m_frustumCullers[i].initForScheduler(pScheduler);
             m_facePasses[i].initForScheduler(pScheduler);
         }
     }
@@ -54,10 +53,8 @@ void PointShadowPass::init() {
     m_inUsePointShadowMaps = 0;
 
     m_frustumCullers.resize(6 * m_maxPointShadowMaps);
-    m_frustumCullerJobParams.resize(6 * m_maxPointShadowMaps);
 
     m_facePasses.resize(6 * m_maxPointShadowMaps);
-    m_facePassUpdateParams.resize(6 * m_maxPointShadowMaps);
 
     m_faceMatrices.resize(6 * m_maxPointShadowMaps);
 
@@ -174,10 +171,7 @@ void PointShadowPass::setPointLights(const PointLight* pPointLights, size_t numP
     m_numPointLights = numPointLights;
 }
 
-void PointShadowPass::preRenderJob(uintptr_t param) {
-    PreRenderParam* pParam = reinterpret_cast<PreRenderParam*>(param);
-    PointShadowPass* pPass = pParam->pPass;
-
+void PointShadowPass::addCullViews(MultiViewCuller* pCuller) {
 //    const std::vector<PointLight>& lights = pParam->pScene->getPointLights();
    // auto lightsView = pParam->pGameWorld->getRegistry().view<const PointLight>();
     //auto iLightsView = lightsView.each();
@@ -187,9 +181,9 @@ void PointShadowPass::preRenderJob(uintptr_t param) {
     //std::vector<BoundingSphere> boundingSpheres(lightsView.size());
 
     size_t numVisibleLights = 0;
-    pPass->m_inUsePointShadowMaps = 0;
-    const PointLight* pLights = pPass->m_pPointLights;
-    size_t numLights = pPass->m_numPointLights;
+    m_inUsePointShadowMaps = 0;
+    const PointLight* pLights = m_pPointLights;
+    size_t numLights = m_numPointLights;
     if (numLights > 0) {
         std::vector<BoundingSphere> boundingSpheres(numLights);
         std::transform(pLights, pLights+numLights, boundingSpheres.begin(),
@@ -197,20 +191,20 @@ void PointShadowPass::preRenderJob(uintptr_t param) {
                 return BoundingSphere{light.getPosition(), light.getBoundingSphereRadius()};
             });
 
-        numVisibleLights = pPass->m_lightSpheresCuller.cullSpheres(
-            boundingSpheres.data(), boundingSpheres.size(), pPass->m_cameraFrustumMatrix);
+        numVisibleLights = m_lightSpheresCuller.cullSpheres(
+            boundingSpheres.data(), boundingSpheres.size(), m_cameraFrustumMatrix);
 
-        pPass->m_lightShadowMapIndices.assign(numLights, -1);
+        m_lightShadowMapIndices.assign(numLights, -1);
     }
 
     if (numVisibleLights > 0) {
         // Sort the lights based on a key which approximates the importance of each light
         std::vector<float> keys(numLights);
         std::transform(pLights, pLights+numLights,
-            pPass->m_lightSpheresCuller.getCullResults().begin(), keys.begin(),
-            [&pPass] (const PointLight& light, bool cullResult) {
+            m_lightSpheresCuller.getCullResults().begin(), keys.begin(),
+            [this] (const PointLight& light, bool cullResult) {
                 if (!cullResult || !light.isShadowMapEnabled()) return -1.0f;
-                glm::vec4 viewPos = pPass->m_cameraViewMatrix * glm::vec4(light.getPosition(), 1.0f);
+                glm::vec4 viewPos = m_cameraViewMatrix * glm::vec4(light.getPosition(), 1.0f);
                 float key = light.getBoundingSphereRadius();
                 key = key * key / glm::length(glm::vec3(viewPos));
                 return key;
@@ -222,12 +216,12 @@ void PointShadowPass::preRenderJob(uintptr_t param) {
                 return keys[i0] > keys[i1];
             });
 
-        for (auto i = 0u; i < std::min((uint32_t)indices.size(), pPass->m_maxPointShadowMaps); ++i) {
+        for (auto i = 0u; i < std::min((uint32_t)indices.size(), m_maxPointShadowMaps); ++i) {
             const PointLight& light = pLights[indices[i]];
             if (!light.isShadowMapEnabled()) break;
-            pPass->m_lightIndices[i] = indices[i];
-            pPass->m_lightShadowMapIndices[indices[i]] = (int) i;
-            ++pPass->m_inUsePointShadowMaps;
+            m_lightIndices[i] = indices[i];
+            m_lightShadowMapIndices[indices[i]] = (int) i;
+            ++m_inUsePointShadowMaps;
         }
 
         static const glm::vec3 directions[] = {
@@ -237,48 +231,38 @@ void PointShadowPass::preRenderJob(uintptr_t param) {
             {0, -1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}, {0, -1, 0}, {0, -1, 0}
         };
 
-        for (auto i = 0u; i < pPass->m_inUsePointShadowMaps; ++i) {
-            uint32_t lightIndex = pPass->m_lightIndices[i];
+        for (auto i = 0u; i < m_inUsePointShadowMaps; ++i) {
+            uint32_t lightIndex = m_lightIndices[i];
 
             glm::mat4 proj = glm::perspective((float) M_PI/2.0f, 1.0f, 0.1f, pLights[lightIndex].getBoundingSphereRadius());
             glm::vec3 lightPos = pLights[lightIndex].getPosition();
             for(auto j = 0u; j < 6u; ++j) {
-                pPass->m_faceMatrices[i*6u+j] = proj * glm::lookAt(lightPos, lightPos+directions[j], upDirs[j]);
+                m_faceMatrices[i*6u+j] = proj * glm::lookAt(lightPos, lightPos+directions[j], upDirs[j]);
             }
         }
     }
 
-    if (pPass->m_inUsePointShadowMaps > 0) {
-        std::vector<JobScheduler::JobDeclaration> cullDecls(6 * pPass->m_inUsePointShadowMaps);
-        for (auto i = 0u; i < cullDecls.size(); ++i) {
-            pPass->m_frustumCullerJobParams[i].frustumMatrix = pPass->m_faceMatrices[i];
-            pPass->m_frustumCullerJobParams[i].pCuller       = &pPass->m_frustumCullers[i];
-            //pPass->m_frustumCullerJobParams[i].pScene        = pParam->pScene;
-            pPass->m_frustumCullerJobParams[i].pGameWorld    = pParam->pGameWorld;
-
-            cullDecls[i].numSignalCounters = 1;
-            cullDecls[i].signalCounters[0] = pPass->m_frustumCullers[i].getResultsReadyCounter();
-            cullDecls[i].param = reinterpret_cast<uintptr_t>(&pPass->m_frustumCullerJobParams[i]);
-            //cullDecls[i].pFunction = FrustumCuller::cullSceneRenderablesJob;
-            cullDecls[i].pFunction = FrustumCuller::cullEntitySpheresJob;
-        }
-        pPass->m_pScheduler->enqueueJobs((uint32_t) cullDecls.size(), cullDecls.data());
+    for (auto i = 0u; i < 6 * m_inUsePointShadowMaps; ++i) {
+        pCuller->addView(m_faceMatrices[i], &m_frustumCullers[i]);
+    }
+}
 
-        std::vector<JobScheduler::JobDeclaration> updateDecls(6 * pPass->m_inUsePointShadowMaps);
+void PointShadowPass::preRender(const RenderSnapshot* pSnapshot, JobScheduler::CounterHandle signalCounter) {
+    if (m_inUsePointShadowMaps > 0) {
+        std::vector<JobScheduler::JobDeclaration> updateDecls(6 * m_inUsePointShadowMaps);
         for (auto i = 0u; i < updateDecls.size(); ++i) {
-            pPass->m_facePassUpdateParams[i].globalMatrix  = pPass->m_faceMatrices[i];
-            pPass->m_facePassUpdateParams[i].pCuller       = &pPass->m_frustumCullers[i];
-            pPass->m_facePassUpdateParams[i].pPass         = &pPass->m_facePasses[i];
-            //pPass->m_facePassUpdateParams[i].pScene        = pParam->pScene;
-            pPass->m_facePassUpdateParams[i].pGameWorld    = pParam->pGameWorld;
-            pPass->m_facePassUpdateParams[i].signalCounter = pParam->signalCounter;
-
+            updateDecls[i].name = "PointShadowUpdate";
             updateDecls[i].numSignalCounters = 1;
-            updateDecls[i].signalCounters[0] = pParam->signalCounter;
-            updateDecls[i].param = reinterpret_cast<uintptr_t>(&pPass->m_facePassUpdateParams[i]);
-            updateDecls[i].pFunction = GeometryRenderPass::updateInstanceListsJob;
-            updateDecls[i].waitCounter = pPass->m_frustumCullers[i].getResultsReadyCounter();
+            updateDecls[i].signalCounters[0] = signalCounter;
+            updateDecls[i].setClosure([this, i, pSnapshot, signalCounter] {
+                GeometryRenderPass::UpdateParam param;
+                param.pSnapshot     = pSnapshot;
+                param.pCuller       = &m_frustumCullers[i];
+                param.globalMatrix  = m_faceMatrices[i];
+                param.signalCounter = signalCounter;
+                m_facePasses[i].updateInstanceLists(param);
+            });
         }
-        pPass->m_pScheduler->enqueueJobs((uint32_t) updateDecls.size(), updateDecls.data());
+        m_pScheduler->enqueueJobs((uint32_t) updateDecls.size(), updateDecls.data());
     }
 }
@@ -3,6 +3,7 @@
 
 #include <vector>
 
+#include "core/render/multi_view_culler.h"
 #include "core/render/render_pass.h"
 #include "core/render/shader.h"
 
@@ -31,15 +32,12 @@ public:
     void setCameraFrustumMatrix(const glm::mat4& cameraFrustumMatrix);
     void setPointLights(const PointLight* pPointLights, size_t numPointLights);
 
-    struct PreRenderParam {
-        PointShadowPass* pPass;
-        //const Scene* pScene;
-        const GameWorld* pGameWorld;
+    // Picks the lights to render shadow maps for, and adds a view for each face to be culled along with the others
+    void addCullViews(MultiViewCuller* pCuller);
 
-        JobScheduler::CounterHandle signalCounter;
-    };
-
-    static void preRenderJob(uintptr_t param);
+    // Schedules the instance list updates for each face, once the views added by addCullViews() are culled
+    // To be called from a job, the scheduled jobs signal signalCounter
+    void preRender(const RenderSnapshot* pSnapshot, JobScheduler::CounterHandle signalCounter);
 
 private:
 
@@ -53,11 +51,8 @@ private:
     FrustumCuller m_lightSpheresCuller;
 
     std::vector<FrustumCuller> m_frustumCullers;
-    //std::vector<FrustumCuller::CullSceneParam> m_frustumCullerJobParams;
-    std::vector<FrustumCuller::CullEntitiesParam> m_frustumCullerJobParams;
 
     std::vector<PointShadowFacePass> m_facePasses;
-    std::vector<GeometryRenderPass::UpdateParam> m_facePassUpdateParams;
 
     std::vector<glm::mat4> m_faceMatrices;
 
@@ -9,7 +9,6 @@ void ShadowMapPass::initForScheduler(JobScheduler* pScheduler) {
     if (m_pScheduler != pScheduler) {
         m_pScheduler = pScheduler;
         for (auto i = 0u; i < m_numCascades; ++i) {
-            m_cascadeFrustumCullers[i].initForScheduler(pScheduler);
             m_cascadePasses[i].initForScheduler(pScheduler);
         }
     }
@@ -111,8 +110,6 @@ void ShadowMapPass::init() {
     // Allocate per-cascade members
     m_cascadePasses.resize(m_numCascades);
     m_cascadeFrustumCullers.resize(m_numCascades);
-    m_frustumCullerJobParams.resize(m_numCascades);
-    m_cascadePassUpdateParams.resize(m_numCascades);
     m_cascadeMatrices.resize(m_numCascades);
     m_viewCascadeMatrices.resize(m_numCascades);
     m_cascadeSplitDepths.resize(m_numCascades);
@@ -256,7 +253,6 @@ void ShadowMapPass::cleanup() {
     }
 
     m_cascadePasses.clear();
-    m_cascadePassUpdateParams.clear();
     m_cascadeFrustumCullers.clear();
     m_cascadeBlurRanges.clear();
     m_cascadeSplitDepths.clear();
@@ -297,59 +293,30 @@ void ShadowMapPass::setMatrices(const glm::mat4& cameraViewInverse, const glm::m
     m_lightViewMatrix = lightViewMatrix;
 }
 
-void ShadowMapPass::preRenderJob(uintptr_t param) {
-    PreRenderParam* pParam = reinterpret_cast<PreRenderParam*>(param);
+void ShadowMapPass::addCullViews(const RenderSnapshot* pSnapshot, const Camera* pCamera, MultiViewCuller* pCuller) {
+    computeMatrices(pSnapshot->getBoundsMin(), pSnapshot->getBoundsMax(), pCamera);
 
-    ShadowMapPass* pPass = pParam->pPass;
-
-    //pPass->computeMatrices(pParam->pScene);
-
-    glm::vec3 AABBMin(std::numeric_limits<float>::max()),
-              AABBMax(std::numeric_limits<float>::min());
-
-    pParam->pGameWorld->getRegistry().view<const Component::Renderable, const BoundingSphere>().each(
-        [&] (const auto& r, const auto& b) {
-            AABBMin = glm::min(AABBMin, b.position - b.radius);
-            AABBMax = glm::max(AABBMax, b.position + b.radius);
-        });
-
-    pPass->computeMatrices(AABBMin, AABBMax, pParam->pCamera);
-
-    std::vector<JobScheduler::JobDeclaration> cullDecls(pPass->m_numCascades);
-    for (auto i = 0u; i < cullDecls.size(); ++i) {
-        pPass->m_frustumCullerJobParams[i].frustumMatrix = pPass->m_cascadeMatrices[i];
-        pPass->m_frustumCullerJobParams[i].pCuller       = &pPass->m_cascadeFrustumCullers[i];
-        //pPass->m_frustumCullerJobParams[i].pScene        = pParam->pScene;
-        pPass->m_frustumCullerJobParams[i].pGameWorld    = pParam->pGameWorld;
-
-        cullDecls[i].numSignalCounters = 1;
-        cullDecls[i].signalCounters[0] = pPass->m_cascadeFrustumCullers[i].getResultsReadyCounter(); // pPass->m_pScheduler->getCounterByID("SMFC"); //
-        cullDecls[i].param = reinterpret_cast<uintptr_t>(&pPass->m_frustumCullerJobParams[i]);
-        cullDecls[i].pFunction = FrustumCuller::cullEntitySpheresJob;
-
-        //pPass->m_pScheduler->enqueueJob(cullDecls[i]);
+    for (auto i = 0u; i < m_numCascades; ++i) {
+        pCuller->addView(m_cascadeMatrices[i], &m_cascadeFrustumCullers[i]);
     }
-    pPass->m_pScheduler->enqueueJobs((uint32_t) cullDecls.size(), cullDecls.data());
+}
 
-    std::vector<JobScheduler::JobDeclaration> updateDecls(pPass->m_numCascades);
+void ShadowMapPass::preRender(const RenderSnapshot* pSnapshot, JobScheduler::CounterHandle signalCounter) {
+    std::vector<JobScheduler::JobDeclaration> updateDecls(m_numCascades);
     for (auto i = 0u; i < updateDecls.size(); ++i) {
-        pPass->m_cascadePassUpdateParams[i].globalMatrix  = pPass->m_cascadeMatrices[i];
-        pPass->m_cascadePassUpdateParams[i].pCuller       = &pPass->m_cascadeFrustumCullers[i];
-        pPass->m_cascadePassUpdateParams[i].pPass         = &pPass->m_cascadePasses[i];
-        //pPass->m_cascadePassUpdateParams[i].pScene        = pParam->pScene;
-        pPass->m_cascadePassUpdateParams[i].pGameWorld    = pParam->pGameWorld;
-        pPass->m_cascadePassUpdateParams[i].signalCounter = pParam->signalCounter;
-
+        updateDecls[i].name = "ShadowCascadeUpdate";
         updateDecls[i].numSignalCounters = 1;
-        updateDecls[i].signalCounters[0] = pParam->signalCounter;
-        updateDecls[i].param = reinterpret_cast<uintptr_t>(&pPass->m_cascadePassUpdateParams[i]);
-        updateDecls[i].pFunction = GeometryRenderPass::updateInstanceListsJob;
-        updateDecls[i].waitCounter = pPass->m_cascadeFrustumCullers[i].getResultsReadyCounter();  // pPass->m_pScheduler->getCounterByID("SMFC"); //
-
-
-        //pPass->m_pScheduler->enqueueJob(updateDecls[i]);
+        updateDecls[i].signalCounters[0] = signalCounter;
+        updateDecls[i].setClosure([this, i, pSnapshot, signalCounter] {
+            GeometryRenderPass::UpdateParam param;
+            param.pSnapshot     = pSnapshot;
+            param.pCuller       = &m_cascadeFrustumCullers[i];
+            param.globalMatrix  = m_cascadeMatrices[i];
+            param.signalCounter = signalCounter;
+            m_cascadePasses[i].updateInstanceLists(param);
+        });
     }
-    pPass->m_pScheduler->enqueueJobs((uint32_t) updateDecls.size(), updateDecls.data());
+    m_pScheduler->enqueueJobs((uint32_t) updateDecls.size(), updateDecls.data());
 }
 
 void ShadowMapPass::computeMatrices(const glm::vec3& sceneAABBMin, const glm::vec3& sceneAABBMax, const Camera* pCamera) {
@@ -6,6 +6,7 @@
 #include <glm/glm.hpp>
 
 #include "core/render/render_pass.h"
+#include "core/render/multi_view_culler.h"
 #include "core/render/render_layer.h"
 
 #include "shadow_cascade_pass.h"
@@ -37,16 +38,12 @@ public:
     // Call every frame
     void setMatrices(const glm::mat4& cameraViewInverse, const glm::mat4& lightViewMatrix);
 
-    struct PreRenderParam {
-        ShadowMapPass* pPass;
-        //const Scene* pScene;
-        const GameWorld* pGameWorld;
-        const Camera* pCamera;
+    // Fits the cascades to the scene and camera, and adds a view for each cascade to be culled along with the others
+    void addCullViews(const RenderSnapshot* pSnapshot, const Camera* pCamera, MultiViewCuller* pCuller);
 
-        JobScheduler::CounterHandle signalCounter;
-    };
-
-    static void preRenderJob(uintptr_t param);
+    // Schedules the instance list updates for each cascade, once the views added by addCullViews() are culled
+    // To be called from a job, the scheduled jobs signal signalCounter
+    void preRender(const RenderSnapshot* pSnapshot, JobScheduler::CounterHandle signalCounter);
 
 private:
 
@@ -69,11 +66,8 @@ private:
     uint32_t m_numCascades;
 
     std::vector<FrustumCuller> m_cascadeFrustumCullers;
-    //std::vector<FrustumCuller::CullSceneParam> m_frustumCullerJobParams;
-    std::vector<FrustumCuller::CullEntitiesParam> m_frustumCullerJobParams;
 
     std::vector<ShadowCascadePass> m_cascadePasses;
-    std::vector<GeometryRenderPass::UpdateParam> m_cascadePassUpdateParams;
 
     std::vector<glm::mat4> m_cascadeMatrices;
     std::vector<glm::mat4> m_viewCascadeMatrices;
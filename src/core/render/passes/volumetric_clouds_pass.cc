@@ -218,79 +218,94 @@ void VolumetricCloudsPass::init() {
     m_historyTextures[0].setParameters(params);
     m_historyTextures[1].setParameters(params);
 
-    bool needGenNoise = false;
+    // The noise textures are kept from an earlier init(), their data is freed once uploaded
+}
+
+void VolumetricCloudsPass::initForScheduler(JobScheduler* pScheduler) {
+    if (pScheduler == m_pScheduler) return;
+    m_pScheduler = pScheduler;
+    m_noiseCounter = pScheduler->getFreeCounter();
+
+    if (m_noiseTexturesReady) return;
+
+    // Generating the noise takes seconds, and even reading it is file I/O, so keep it off the frame's workers
+    JobScheduler::JobDeclaration decl;
+    decl.name = "LoadCloudNoise";
+    decl.background = true;
+    decl.signalCounters[0] = m_noiseCounter;
+    decl.numSignalCounters = 1;
+    decl.setClosure([this] {
+        loadNoise();
+    });
+    pScheduler->enqueueJob(decl);
+}
+
+void VolumetricCloudsPass::loadNoise() {
+    size_t baseNoiseRawSize = baseNoiseTextureSize *
+                              baseNoiseTextureSize *
+                              baseNoiseTextureSize *
+                              baseNoiseTextureChannels;
+    size_t detailNoiseRawSize = detailNoiseTextureSize *
+                                detailNoiseTextureSize *
+                                detailNoiseTextureSize *
+                                detailNoiseTextureChannels;
+
     std::ifstream filestr("data/cloudnoise.bin", std::ios::binary);
     if (filestr.is_open()) {
         std::vector<unsigned char> raw(std::istreambuf_iterator<char>(filestr), {});
 
-        size_t baseNoiseRawSize = baseNoiseTextureSize *
-                                  baseNoiseTextureSize *
-                                  baseNoiseTextureSize *
-                                  baseNoiseTextureChannels;
-        size_t detailNoiseRawSize = detailNoiseTextureSize *
-                                    detailNoiseTextureSize *
-                                    detailNoiseTextureSize *
-                                    detailNoiseTextureChannels;
-
         if (raw.size() == baseNoiseRawSize + detailNoiseRawSize) {
-            TextureParameters param = {};
-            param.is3D = true;
-            param.useLinearFiltering = true;
-
-            param.width = baseNoiseTextureSize;
-            param.height = baseNoiseTextureSize;
-            param.arrayLayers = baseNoiseTextureSize;
-            param.numComponents = baseNoiseTextureChannels;
-
-            m_baseNoiseTexture.setParameters(param);
-            m_baseNoiseTexture.allocateData(&raw[0]);
-
-            param.width = detailNoiseTextureSize;
-            param.height = detailNoiseTextureSize;
-            param.arrayLayers = detailNoiseTextureSize;
-            param.numComponents = detailNoiseTextureChannels;
-
-            m_detailNoiseTexture.setParameters(param);
-            m_detailNoiseTexture.allocateData(&raw[baseNoiseRawSize]);
-        } else {
-            needGenNoise = true;
+            m_baseNoise.assign(raw.begin(), raw.begin() + baseNoiseRawSize);
+            m_detailNoise.assign(raw.begin() + baseNoiseRawSize, raw.end());
+            return;
         }
-    } else {
-        needGenNoise = true;
     }
-    if (needGenNoise) {
-        std::vector<unsigned char> baseNoise, detailNoise;
-        createNoiseTextures(baseNoiseTextureSize, baseNoiseTextureChannels,
-                            detailNoiseTextureSize, detailNoiseTextureChannels,
-                            baseNoiseOctaves, baseNoiseFrequency, baseNoiseWorleyPoints,
-                            detailNoiseOctaves, detailNoiseFrequency,
-                            baseNoise, detailNoise);
-
-        TextureParameters param = {};
-        param.is3D = true;
-        param.useLinearFiltering = true;
-
-        param.width = baseNoiseTextureSize;
-        param.height = baseNoiseTextureSize;
-        param.arrayLayers = baseNoiseTextureSize;
-        param.numComponents = baseNoiseTextureChannels;
-
-        m_baseNoiseTexture.setParameters(param);
-        m_baseNoiseTexture.allocateData(baseNoise.data());
-
-        param.width = detailNoiseTextureSize;
-        param.height = detailNoiseTextureSize;
-        param.arrayLayers = detailNoiseTextureSize;
-        param.numComponents = detailNoiseTextureChannels;
-
-        m_detailNoiseTexture.setParameters(param);
-        m_detailNoiseTexture.allocateData(detailNoise.data());
-
-        std::ofstream filestr("data/cloudnoise.bin", std::ios::binary|std::ios::trunc);
-        filestr.write((const char*)baseNoise.data(), baseNoise.size());
-        filestr.write((const char*)detailNoise.data(), detailNoise.size());
+
+    createNoiseTextures(baseNoiseTextureSize, baseNoiseTextureChannels,
+                        detailNoiseTextureSize, detailNoiseTextureChannels,
+                        baseNoiseOctaves, baseNoiseFrequency, baseNoiseWorleyPoints,
+                        detailNoiseOctaves, detailNoiseFrequency,
+                        m_baseNoise, m_detailNoise);
+
+    std::ofstream outstr("data/cloudnoise.bin", std::ios::binary|std::ios::trunc);
+    outstr.write((const char*)m_baseNoise.data(), m_baseNoise.size());
+    outstr.write((const char*)m_detailNoise.data(), m_detailNoise.size());
+}
+
+bool VolumetricCloudsPass::updateNoiseTextures() {
+    if (m_noiseTexturesReady) return true;
+
+    if (!m_pScheduler) {
+        loadNoise();
+    } else if (!m_pScheduler->isCounterZero(m_noiseCounter)) {
+        return false;
     }
 
+    TextureParameters param = {};
+    param.is3D = true;
+    param.useLinearFiltering = true;
+
+    param.width = baseNoiseTextureSize;
+    param.height = baseNoiseTextureSize;
+    param.arrayLayers = baseNoiseTextureSize;
+    param.numComponents = baseNoiseTextureChannels;
+
+    m_baseNoiseTexture.setParameters(param);
+    m_baseNoiseTexture.allocateData(m_baseNoise.data());
+
+    param.width = detailNoiseTextureSize;
+    param.height = detailNoiseTextureSize;
+    param.arrayLayers = detailNoiseTextureSize;
+    param.numComponents = detailNoiseTextureChannels;
+
+    m_detailNoiseTexture.setParameters(param);
+    m_detailNoiseTexture.allocateData(m_detailNoise.data());
+
+    m_baseNoise = std::vector<unsigned char>();
+    m_detailNoise = std::vector<unsigned char>();
+
+    m_noiseTexturesReady = true;
+    return true;
 }
 
 void VolumetricCloudsPass::onViewportResize(uint32_t width, uint32_t height) {
@@ -345,6 +360,8 @@ void VolumetricCloudsPass::render() {
         {0, 1}, {2, 3}, {2, 1}, {0, 3}
     };
 
+    if (!updateNoiseTextures()) return;
+
     m_cloudsShader.bind();
     m_cloudsShader.setUniform("halfScreenSize", m_cameraHalfScreenSize);
     m_cloudsShader.setUniform("inverseView", m_viewInverse);
@@ -428,6 +445,12 @@ void VolumetricCloudsPass::render() {
 void VolumetricCloudsPass::cleanup() {
     m_pMotionBuffer = nullptr;
     m_pOutputRenderLayer = nullptr;
+
+    // The scheduler's threads have been joined by now, so the noise job is either done or will never run
+    if (m_pScheduler) {
+        m_pScheduler->freeCounter(m_noiseCounter);
+        m_pScheduler = nullptr;
+    }
 }
 
 void VolumetricCloudsPass::setDirectionalLight(const glm::vec3& intensity, const glm::vec3& direction) {
@@ -1,8 +1,11 @@
 #ifndef VOLUMETRIC_CLOUDS_PASS_H_INCLUDED
 #define VOLUMETRIC_CLOUDS_PASS_H_INCLUDED
 
+#include <vector>
+
 #include <glm/glm.hpp>
 
+#include "core/job_scheduler.h"
 #include "core/render/render_layer.h"
 #include "core/render/render_pass.h"
 #include "core/render/shader.h"
@@ -13,6 +16,10 @@ class VolumetricCloudsPass : public RenderPass {
 
 public:
 
+    // Loads or generates the noise textures in a background job rather than on the first frame
+    // The clouds are not drawn until the noise is ready
+    void initForScheduler(JobScheduler* pScheduler);
+
     void init() override;
 
     void onViewportResize(uint32_t width, uint32_t height) override;
@@ -75,6 +82,13 @@ private:
 
     Texture m_baseNoiseTexture, m_detailNoiseTexture;
 
+    // Noise data loaded for the textures, only kept until it is uploaded
+    std::vector<unsigned char> m_baseNoise, m_detailNoise;
+    bool m_noiseTexturesReady = false;
+
+    JobScheduler* m_pScheduler = nullptr;
+    JobScheduler::CounterHandle m_noiseCounter = JobScheduler::COUNTER_NULL;
+
     Texture* m_pMotionBuffer = nullptr;
 
     uint32_t m_renderTextureWidth, m_renderTextureHeight;
@@ -89,6 +103,14 @@ private:
 
     bool m_historyValid = false;
 
+    // Read the noise from data/cloudnoise.bin, or generate it and save it there if the file doesn't match the noise parameters
+    // Doesn't touch GL, so it can run on any thread
+    void loadNoise();
+
+    // Upload the noise textures once the noise is loaded. Loads it right away if there is no scheduler to do it
+    // Returns whether the textures are ready
+    bool updateNoiseTextures();
+
 };
 
 #endif // VOLUMETRIC_CLOUDS_PASS_H_INCLUDED
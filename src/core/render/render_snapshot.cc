@@ -0,0 +1,91 @@
+#include "render_snapshot.h"
+
+#include <cassert>
+
+#include "core/animation/skeleton.h"
+#include "core/ecs/components.h"
+#include "core/resources/skeleton_description.h"
+#include "core/scene/renderable.h"
+
+void RenderSnapshot::capture(const GameWorld* pGameWorld,
+                             const Camera* pCamera,
+                             const DirectionalLight* pDirectionalLight,
+                             const glm::vec3& ambientLightIntensity) {
+    const entt::registry& registry = pGameWorld->getRegistry();
+    auto view = registry.view<const Component::Renderable>();
+
+    size_t count = view.size();
+    m_models.resize(count);
+    m_worldTransforms.resize(count);
+    m_lastWorldTransforms.resize(count);
+    m_boundingSpheres.resize(count);
+    m_renderBucketIndices.resize(count);
+    m_skinningMatrixOffsets.resize(count);
+
+    m_renderBuckets = pGameWorld->getRenderBuckets();
+
+    // Copying the nodes is cheaper than building a tree, and the leaves are relabelled below
+    m_bvh = pGameWorld->getBVH();
+
+    m_skinningMatrices.clear();
+    m_lastSkinningMatrices.clear();
+
+    const std::vector<math_util::AffineTransform>& nodeWorlds = pGameWorld->getNodeWorldTransforms();
+    const std::vector<math_util::AffineTransform>& nodeLastWorlds = pGameWorld->getNodeLastWorldTransforms();
+
+    // The root's box already holds every bounding sphere
+    if (!m_bvh.getBounds(m_boundsMin, m_boundsMax)) {
+        m_boundsMin = glm::vec3(std::numeric_limits<float>::max());
+        m_boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+    }
+
+    size_t i = 0;
+    for (auto e : view) {
+        const Component::Renderable& r = view.get<const Component::Renderable>(e);
+        const BoundingSphere& b = registry.get<BoundingSphere>(e);
+
+        m_models[i] = r.pModel;
+        if (auto pNode = registry.try_get<Component::HierarchyNode>(e)) {
+            m_worldTransforms[i] = nodeWorlds[pNode->index];
+            m_lastWorldTransforms[i] = nodeLastWorlds[pNode->index];
+        } else {
+            m_worldTransforms[i] = m_lastWorldTransforms[i] = math_util::AffineTransform();
+        }
+        m_boundingSpheres[i] = b;
+
+        if (auto pProxy = registry.try_get<Component::BVHProxy>(e)) m_bvh.setUserData(pProxy->index, static_cast<uint32_t>(i));
+
+        // Renderables changed in place since the buckets were last updated are left out until they are
+        uint32_t bucket = NONE;
+        if (auto pBucketID = registry.try_get<Component::RenderBucketID>(e)) {
+            const GameWorld::RenderBucket& info = m_renderBuckets[pBucketID->index];
+            if (info.pModel == r.pModel && info.skinned == (r.pSkeleton != nullptr)) bucket = pBucketID->index;
+        }
+        m_renderBucketIndices[i] = bucket;
+
+        if (r.pSkeleton) {
+            const std::vector<glm::mat4>& skinningMatrices = r.pSkeleton->getSkinningMatrices();
+            const std::vector<glm::mat4>& lastSkinningMatrices = r.pSkeleton->getLastSkinningMatrices();
+            assert(!r.pModel || !r.pModel->getSkeletonDescription() ||
+                   skinningMatrices.size() == r.pModel->getSkeletonDescription()->getNumJoints());
+
+            m_skinningMatrixOffsets[i] = static_cast<uint32_t>(m_skinningMatrices.size());
+            m_skinningMatrices.insert(m_skinningMatrices.end(), skinningMatrices.begin(), skinningMatrices.end());
+            m_lastSkinningMatrices.insert(m_lastSkinningMatrices.end(), lastSkinningMatrices.begin(), lastSkinningMatrices.end());
+            // Kept in step with the current matrices, so both can be found at the same offset
+            m_lastSkinningMatrices.resize(m_skinningMatrices.size(), glm::mat4(1.0f));
+        } else {
+            m_skinningMatrixOffsets[i] = NONE;
+        }
+
+        ++i;
+    }
+
+    auto pointLightsView = registry.view<const PointLight>();
+    m_pointLights.assign(pointLightsView.empty() ? nullptr : *pointLightsView.raw(),
+                         pointLightsView.empty() ? nullptr : *pointLightsView.raw() + pointLightsView.size());
+
+    m_camera = *pCamera;
+    m_directionalLight = *pDirectionalLight;
+    m_ambientLightIntensity = ambientLightIntensity;
+}
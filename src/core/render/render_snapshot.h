@@ -0,0 +1,141 @@
+#ifndef RENDER_SNAPSHOT_H_
+#define RENDER_SNAPSHOT_H_
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "core/ecs/game_world.h"
+#include "core/scene/bounding_sphere.h"
+#include "core/scene/camera.h"
+#include "core/scene/dynamic_bvh.h"
+#include "core/scene/directional_light.h"
+#include "core/scene/point_light.h"
+#include "core/util/math_util.h"
+
+class Model;
+
+// Everything the render passes read from the GameWorld and Scene for one frame, copied out once the frame has been
+//   simulated. The render jobs only read the snapshot, so the next frame can be simulated while this one renders
+// Renderables are stored by index, in the iteration order of a view of Component::Renderable at the time of capture,
+//   which is also the order of the frustum cullers' results
+// Models, meshes and materials are shared with the simulation, not copied
+class RenderSnapshot {
+
+public:
+
+    static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+    // Copy the renderables, point lights and view. The world's hierarchy, bounding spheres and render buckets must be
+    //   up to date, i.e. call after GameWorld::preRenderUpdate() and GameWorld::updateBoundingSpheres()
+    void capture(const GameWorld* pGameWorld,
+                 const Camera* pCamera,
+                 const DirectionalLight* pDirectionalLight,
+                 const glm::vec3& ambientLightIntensity);
+
+    size_t getNumRenderables() const {
+        return m_models.size();
+    }
+
+    const std::vector<const Model*>& getModels() const {
+        return m_models;
+    }
+
+    // Kept as affine 3x4s, as the world has them. Expand with toMat4() where a full matrix is needed
+    const std::vector<math_util::AffineTransform>& getWorldTransforms() const {
+        return m_worldTransforms;
+    }
+
+    const std::vector<math_util::AffineTransform>& getLastWorldTransforms() const {
+        return m_lastWorldTransforms;
+    }
+
+    const std::vector<BoundingSphere>& getBoundingSpheres() const {
+        return m_boundingSpheres;
+    }
+
+    // A copy of the world's BVH, with each leaf's user data changed to the index of its renderable
+    // Renderables which have no leaf yet, because their sphere hasn't been computed, are never found by its queries
+    const DynamicBVH& getBVH() const {
+        return m_bvh;
+    }
+
+    // A box holding all the bounding spheres, as min and max corners: the BVH's root, so a little larger than their
+    //   union
+    const glm::vec3& getBoundsMin() const {
+        return m_boundsMin;
+    }
+
+    const glm::vec3& getBoundsMax() const {
+        return m_boundsMax;
+    }
+
+    // Index of each renderable's bucket in getRenderBuckets(), or NONE if it had none when captured
+    const std::vector<uint32_t>& getRenderBucketIndices() const {
+        return m_renderBucketIndices;
+    }
+
+    const std::vector<GameWorld::RenderBucket>& getRenderBuckets() const {
+        return m_renderBuckets;
+    }
+
+    // Where each renderable's skinning matrices start in getSkinningMatrices() and getLastSkinningMatrices(), or NONE
+    //   if it has no skeleton
+    const std::vector<uint32_t>& getSkinningMatrixOffsets() const {
+        return m_skinningMatrixOffsets;
+    }
+
+    const std::vector<glm::mat4>& getSkinningMatrices() const {
+        return m_skinningMatrices;
+    }
+
+    const std::vector<glm::mat4>& getLastSkinningMatrices() const {
+        return m_lastSkinningMatrices;
+    }
+
+    const std::vector<PointLight>& getPointLights() const {
+        return m_pointLights;
+    }
+
+    const Camera& getCamera() const {
+        return m_camera;
+    }
+
+    const DirectionalLight& getDirectionalLight() const {
+        return m_directionalLight;
+    }
+
+    const glm::vec3& getAmbientLightIntensity() const {
+        return m_ambientLightIntensity;
+    }
+
+private:
+
+    std::vector<const Model*> m_models;
+    std::vector<math_util::AffineTransform> m_worldTransforms;
+    std::vector<math_util::AffineTransform> m_lastWorldTransforms;
+    std::vector<BoundingSphere> m_boundingSpheres;
+    std::vector<uint32_t> m_renderBucketIndices;
+    std::vector<uint32_t> m_skinningMatrixOffsets;
+
+    DynamicBVH m_bvh;
+
+    glm::vec3 m_boundsMin = glm::vec3(0.0f);
+    glm::vec3 m_boundsMax = glm::vec3(0.0f);
+
+    std::vector<GameWorld::RenderBucket> m_renderBuckets;
+
+    std::vector<glm::mat4> m_skinningMatrices;
+    std::vector<glm::mat4> m_lastSkinningMatrices;
+
+    std::vector<PointLight> m_pointLights;
+
+    Camera m_camera;
+    DirectionalLight m_directionalLight;
+    glm::vec3 m_ambientLightIntensity = glm::vec3(0.0f);
+
+};
+
+#endif // RENDER_SNAPSHOT_H_
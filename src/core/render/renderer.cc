@@ -45,13 +45,16 @@ void Renderer::init(uint32_t width, uint32_t height) {
     m_volumetricCloudsPass.init();
 
     // Initialize jobs
-    m_frustumCuller.initForScheduler(m_pScheduler);
+    m_multiViewCuller.initForScheduler(m_pScheduler);
 
     m_gBufferPass.initForScheduler(m_pScheduler);
     m_motionVectorsPass.initForScheduler(m_pScheduler);
     m_pointShadowPass.initForScheduler(m_pScheduler);
     m_shadowMapPass.initForScheduler(m_pScheduler);
     m_transparencyPass.initForScheduler(m_pScheduler);
+    m_volumetricCloudsPass.initForScheduler(m_pScheduler);
+
+    initPreRenderGraph();
 
     // Set pass dependencies
     m_bloomPass.setSceneRenderLayer(m_deferredPass.getSceneRenderLayer(),
@@ -142,6 +145,8 @@ void Renderer::cleanup() {
     m_transparencyCompositePass.cleanup();
     m_volumetricCloudsPass.cleanup();
 
+    m_preRenderGraph.clear();
+
     if (m_pRenderTexture) {
         delete m_pRenderTexture;
         m_pRenderTexture = nullptr;
@@ -190,7 +195,11 @@ void Renderer::setViewport(uint32_t width, uint32_t height) {
 void Renderer::renderJob(uintptr_t param) {
     RendererJobParam* pParam = reinterpret_cast<RendererJobParam*>(param);
 
-    pParam->pWindow->acquireContext();
+    {
+        // Other jobs hold the context too, this can take a while
+        JobTracer::Scope scope(pParam->pScheduler->getTracer(), "AcquireContext");
+        pParam->pWindow->acquireContext();
+    }
 
     pParam->pRenderer->render();
 
@@ -307,9 +316,8 @@ void Renderer::preRenderJob(uintptr_t param) {
 
     Renderer* pRenderer = pParam->pRenderer;
 //    const Scene* pScene = pParam->pScene;
-    const GameWorld* pGameWorld = pParam->pGameWorld;
-    const Camera* pCamera = pParam->pCamera;
-    JobScheduler* pScheduler = pParam->pScheduler;
+    const RenderSnapshot* pSnapshot = pParam->pSnapshot;
+    const Camera* pCamera = &pSnapshot->getCamera();
 
     assert(pRenderer->m_initialized);
     assert(pRenderer->m_viewportInitialized);
@@ -319,110 +327,67 @@ void Renderer::preRenderJob(uintptr_t param) {
     pRenderer->computeMatrices(pCamera);
 
 //    pRenderer->updatePasses(pScene);
-    auto pointLightsView = pGameWorld->getRegistry().view<const PointLight>();
-    pRenderer->updatePasses(pCamera, pParam->pDirectionalLight, pParam->ambientLightIntensity,
-                            pointLightsView.empty() ? nullptr : *pointLightsView.raw(), pointLightsView.size());
-
-    // Dispatch culling job
-    /*pRenderer->m_cullSceneParam.frustumMatrix = pRenderer->m_viewProj;
-    pRenderer->m_cullSceneParam.pCuller = &pRenderer->m_frustumCuller;
-    pRenderer->m_cullSceneParam.pScene = pScene;*/
-    pRenderer->m_cullParam.frustumMatrix = pRenderer->m_viewProj;
-    pRenderer->m_cullParam.pCuller = &pRenderer->m_frustumCuller;
-    pRenderer->m_cullParam.pGameWorld = pGameWorld;
-
-    JobScheduler::JobDeclaration cullDecl;
-    cullDecl.numSignalCounters = 1;
-    cullDecl.signalCounters[0] = pRenderer->m_frustumCuller.getResultsReadyCounter();
-    cullDecl.param = reinterpret_cast<uintptr_t>(&pRenderer->m_cullParam);
-    cullDecl.pFunction = FrustumCuller::cullEntitySpheresJob;
-
-    pScheduler->enqueueJob(cullDecl);
-
-    JobScheduler::JobDeclaration decl;
-
-    // Update point shadows pass
-    pRenderer->m_pointShadowsPreRenderParam.pPass = &pRenderer->m_pointShadowPass;
-//    pRenderer->m_pointShadowsPreRenderParam.pScene = pScene;
-    pRenderer->m_pointShadowsPreRenderParam.pGameWorld = pGameWorld;
-    pRenderer->m_pointShadowsPreRenderParam.signalCounter = pParam->signalCounterHandle;
-
-    decl = JobScheduler::JobDeclaration();
-    decl.numSignalCounters = 1;
-    decl.signalCounters[0] = pParam->signalCounterHandle;
-    decl.param = reinterpret_cast<uintptr_t>(&pRenderer->m_pointShadowsPreRenderParam);
-    decl.pFunction = PointShadowPass::preRenderJob;
-
-    pScheduler->enqueueJob(decl);
-
-    // Update directional shadows pass
-    pRenderer->m_shadowMapPreRenderParam.pPass = &pRenderer->m_shadowMapPass;
-    //pRenderer->m_shadowMapPreRenderParam.pScene = pScene;
-    pRenderer->m_shadowMapPreRenderParam.pGameWorld = pGameWorld;
-    pRenderer->m_shadowMapPreRenderParam.pCamera = pCamera;
-    pRenderer->m_shadowMapPreRenderParam.signalCounter = pParam->signalCounterHandle;
-
-    decl = JobScheduler::JobDeclaration();
-    decl.numSignalCounters = 1;
-    decl.signalCounters[0] = pParam->signalCounterHandle;
-    decl.param = reinterpret_cast<uintptr_t>(&pRenderer->m_shadowMapPreRenderParam);
-    decl.pFunction = ShadowMapPass::preRenderJob;
-
-    pScheduler->enqueueJob(decl);
-
-    // Update Motion Vectors Pass
-    pRenderer->m_motionVectorsPreRenderParam.cameraMatrix = pRenderer->m_viewProj;
-    pRenderer->m_motionVectorsPreRenderParam.lastCameraMatrix = pRenderer->m_lastViewProj;
-    pRenderer->m_motionVectorsPreRenderParam.pCuller = &pRenderer->m_frustumCuller;
-    pRenderer->m_motionVectorsPreRenderParam.pPass = &pRenderer->m_motionVectorsPass;
-    //pRenderer->m_motionVectorsPreRenderParam.pScene = pScene;
-    pRenderer->m_motionVectorsPreRenderParam.pGameWorld = pGameWorld;
-    pRenderer->m_motionVectorsPreRenderParam.signalCounter = pParam->signalCounterHandle;
-
-    decl = JobScheduler::JobDeclaration();
-    decl.numSignalCounters = 1;
-    decl.signalCounters[0] = pParam->signalCounterHandle;
-    decl.waitCounter = cullDecl.signalCounters[0];
-    decl.param = reinterpret_cast<uintptr_t>(&pRenderer->m_motionVectorsPreRenderParam);
-    decl.pFunction = MotionVectorsPass::preRenderJob;
-
-    pScheduler->enqueueJob(decl);
-
-    // Update GBuffer Pass
-    pRenderer->m_gBufferUpdateParam.globalMatrix = pRenderer->m_viewProj;
-    pRenderer->m_gBufferUpdateParam.normalsMatrix = pRenderer->m_viewNormals;
-    pRenderer->m_gBufferUpdateParam.pCuller = &pRenderer->m_frustumCuller;
-    pRenderer->m_gBufferUpdateParam.pPass = &pRenderer->m_gBufferPass;
-    //pRenderer->m_gBufferUpdateParam.pScene = pScene;
-    pRenderer->m_gBufferUpdateParam.pGameWorld = pGameWorld;
-    pRenderer->m_gBufferUpdateParam.signalCounter = pParam->signalCounterHandle;
-
-    decl = JobScheduler::JobDeclaration();
-    decl.numSignalCounters = 1;
-    decl.signalCounters[0] = pParam->signalCounterHandle;
-    decl.waitCounter = cullDecl.signalCounters[0];
-    decl.param = reinterpret_cast<uintptr_t>(&pRenderer->m_gBufferUpdateParam);
-    decl.pFunction = GeometryRenderPass::updateInstanceListsJob;
-
-    pScheduler->enqueueJob(decl);
-
-    // Update Transparency Pass
-    pRenderer->m_transparencyUpdateParam.globalMatrix = pRenderer->m_viewProj;
-    pRenderer->m_transparencyUpdateParam.normalsMatrix = pRenderer->m_viewNormals;
-    pRenderer->m_transparencyUpdateParam.pCuller = &pRenderer->m_frustumCuller;
-    pRenderer->m_transparencyUpdateParam.pPass = &pRenderer->m_transparencyPass;
-    //pRenderer->m_transparencyUpdateParam.pScene = pScene;
-    pRenderer->m_transparencyUpdateParam.pGameWorld = pGameWorld;
-    pRenderer->m_transparencyUpdateParam.signalCounter = pParam->signalCounterHandle;
-
-    decl = JobScheduler::JobDeclaration();
-    decl.numSignalCounters = 1;
-    decl.signalCounters[0] = pParam->signalCounterHandle;
-    decl.waitCounter = cullDecl.signalCounters[0];
-    decl.param = reinterpret_cast<uintptr_t>(&pRenderer->m_transparencyUpdateParam);
-    decl.pFunction = GeometryRenderPass::updateInstanceListsJob;
-
-    pScheduler->enqueueJob(decl);
+    const std::vector<PointLight>& pointLights = pSnapshot->getPointLights();
+    pRenderer->updatePasses(pCamera, &pSnapshot->getDirectionalLight(), pSnapshot->getAmbientLightIntensity(),
+                            pointLights.empty() ? nullptr : pointLights.data(), pointLights.size());
+
+    pRenderer->m_preRenderGraph.submit(pParam->signalCounterHandle, param);
+}
+
+void Renderer::initPreRenderGraph() {
+    m_preRenderGraph.clear();
+
+    // The camera, every shadow cascade and every point shadow face are culled together in one walk of the BVH. The
+    //   culling job's parallel loops and the job joining their results hold the culler's counter, so the passes
+    //   using the results wait on them
+    TaskGraph::NodeHandle cull = m_preRenderGraph.addNode("Cull", [this] (uintptr_t param) {
+            const RendererJobParam* pParam = reinterpret_cast<const RendererJobParam*>(param);
+            m_multiViewCuller.clearViews();
+            m_multiViewCuller.addView(m_viewProj, &m_frustumCuller);
+            m_shadowMapPass.addCullViews(pParam->pSnapshot, &pParam->pSnapshot->getCamera(), &m_multiViewCuller);
+            m_pointShadowPass.addCullViews(&m_multiViewCuller);
+            m_multiViewCuller.cullFromJob(pParam->pSnapshot);
+        }, m_multiViewCuller.getResultsReadyCounter());
+
+    TaskGraph::NodeHandle pointShadows = m_preRenderGraph.addNode("PointShadows", [this] (uintptr_t param) {
+            const RendererJobParam* pParam = reinterpret_cast<const RendererJobParam*>(param);
+            m_pointShadowPass.preRender(pParam->pSnapshot, pParam->signalCounterHandle);
+        });
+    TaskGraph::NodeHandle shadowMap = m_preRenderGraph.addNode("ShadowMap", [this] (uintptr_t param) {
+            const RendererJobParam* pParam = reinterpret_cast<const RendererJobParam*>(param);
+            m_shadowMapPass.preRender(pParam->pSnapshot, pParam->signalCounterHandle);
+        });
+
+    TaskGraph::NodeHandle motionVectors = m_preRenderGraph.addNode("MotionVectors", [this] (uintptr_t param) {
+            const RendererJobParam* pParam = reinterpret_cast<const RendererJobParam*>(param);
+            m_motionVectorsPass.preRender(pParam->pSnapshot, &m_frustumCuller, m_viewProj, m_lastViewProj,
+                                          pParam->signalCounterHandle);
+        });
+    TaskGraph::NodeHandle gBuffer = m_preRenderGraph.addNode("GBuffer", [this] (uintptr_t param) {
+            updateCameraPassInstanceLists(&m_gBufferPass, reinterpret_cast<const RendererJobParam*>(param));
+        });
+    TaskGraph::NodeHandle transparency = m_preRenderGraph.addNode("Transparency", [this] (uintptr_t param) {
+            updateCameraPassInstanceLists(&m_transparencyPass, reinterpret_cast<const RendererJobParam*>(param));
+        });
+
+    m_preRenderGraph.addDependency(pointShadows, cull);
+    m_preRenderGraph.addDependency(shadowMap, cull);
+    m_preRenderGraph.addDependency(motionVectors, cull);
+    m_preRenderGraph.addDependency(gBuffer, cull);
+    m_preRenderGraph.addDependency(transparency, cull);
+
+    m_preRenderGraph.compile(m_pScheduler);
+}
+
+void Renderer::updateCameraPassInstanceLists(GeometryRenderPass* pPass, const RendererJobParam* pParam) {
+    GeometryRenderPass::UpdateParam param;
+    param.pSnapshot = pParam->pSnapshot;
+    param.pCuller = &m_frustumCuller;
+    param.globalMatrix = m_viewProj;
+    param.normalsMatrix = m_viewNormals;
+    param.signalCounter = pParam->signalCounterHandle;
+
+    pPass->updateInstanceLists(param);
 }
 
 //void Renderer::updatePasses(const Scene* pScene) {
@@ -9,9 +9,12 @@
 
 #include "core/app/window.h"
 #include "core/job_scheduler.h"
+#include "core/task_graph.h"
 #include "core/scene/scene.h"
 
+#include "core/render/multi_view_culler.h"
 #include "core/render/render_pass.h"
+#include "core/render/render_snapshot.h"
 #include "core/render/passes/background_motion_vectors_pass.h"
 #include "core/render/passes/bloom_pass.h"
 #include "core/render/passes/deferred_pass.h"
@@ -54,11 +57,9 @@ class Renderer {
     struct RendererJobParam {
         Renderer* pRenderer;
         //const Scene* pScene;
-        const GameWorld* pGameWorld;
-        const Camera* pCamera;
-
-        const DirectionalLight* pDirectionalLight;
-        glm::vec3 ambientLightIntensity;
+        // The frame to render: its renderables, lights and camera. Must not be changed until the frame's render jobs
+        //   are done, so the simulation captures the next frame into another one
+        const RenderSnapshot* pSnapshot;
 
         AppWindow* pWindow;
         JobScheduler* pScheduler;
@@ -86,19 +87,19 @@ class Renderer {
     TransparencyCompositePass m_transparencyCompositePass;
     VolumetricCloudsPass m_volumetricCloudsPass;
 
-    GeometryRenderPass::UpdateParam m_gBufferUpdateParam,
-                       m_transparencyUpdateParam;
-    MotionVectorsPass::PreRenderParam m_motionVectorsPreRenderParam;
-    PointShadowPass::PreRenderParam m_pointShadowsPreRenderParam;
-    ShadowMapPass::PreRenderParam m_shadowMapPreRenderParam;
+    // Culling and the per-pass updates which depend on it, submitted by preRenderJob() each frame with the frame's
+    //   RendererJobParam, which its jobs take their inputs from
+    TaskGraph m_preRenderGraph;
 
     Texture* m_pRenderTexture = nullptr;
     RenderLayer m_renderToTextureLayer;
 
     // Used by GBuffer, transparency, motion vectors passes
     FrustumCuller m_frustumCuller;
+
+    // Culls the camera's and the shadow passes' views together, into their FrustumCullers
+    MultiViewCuller m_multiViewCuller;
     //FrustumCuller::CullSceneParam m_cullSceneParam;
-    FrustumCuller::CullEntitiesParam m_cullParam;
 
     glm::mat4 m_cameraViewMatrix;
     glm::mat4 m_cameraProjectionMatrix;
@@ -130,6 +131,12 @@ class Renderer {
 
     void computeMatrices(const Camera* pCamera);
 
+    // Declare the jobs preRenderJob() runs each frame. Called from init() once the passes have their counters
+    void initPreRenderGraph();
+
+    // Update a GeometryRenderPass from the camera's cull results, for the current frame
+    void updateCameraPassInstanceLists(GeometryRenderPass* pPass, const RendererJobParam* pParam);
+
 };
 
 #endif // RENDERER_H_
@@ -0,0 +1,664 @@
+#include "dynamic_bvh.h"
+
+#include <algorithm>
+#include <cassert>
+
+// Half the surface area, which is all the comparisons need
+static float surfaceArea(const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+    glm::vec3 d = boundsMax - boundsMin;
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+static float unionArea(const glm::vec3& min0, const glm::vec3& max0, const glm::vec3& min1, const glm::vec3& max1) {
+    return surfaceArea(glm::min(min0, min1), glm::max(max0, max1));
+}
+
+static float squaredDistanceToBox(const glm::vec3& point, const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+    glm::vec3 d = point - glm::clamp(point, boundsMin, boundsMax);
+    return glm::dot(d, d);
+}
+
+static bool boxesOverlap(const glm::vec3& min0, const glm::vec3& max0, const glm::vec3& min1, const glm::vec3& max1) {
+    return glm::all(glm::lessThanEqual(min0, max1)) && glm::all(glm::lessThanEqual(min1, max0));
+}
+
+uint32_t DynamicBVH::insert(const BoundingSphere& sphere, uint32_t userData) {
+    uint32_t leaf = allocateNode();
+
+    Node& n = m_nodes[leaf];
+    float margin = MARGIN * sphere.radius;
+    n.boundsMin = sphere.position - sphere.radius - margin;
+    n.boundsMax = sphere.position + sphere.radius + margin;
+    n.userData = userData;
+    n.sphere = sphere;
+
+    ++m_numLeaves;
+    insertLeaf(leaf);
+    return leaf;
+}
+
+void DynamicBVH::remove(uint32_t proxy) {
+    removeLeaf(proxy);
+    freeNode(proxy);
+    --m_numLeaves;
+}
+
+bool DynamicBVH::update(uint32_t proxy, const BoundingSphere& sphere) {
+    Node& n = m_nodes[proxy];
+    n.sphere = sphere;
+
+    glm::vec3 sphereMin = sphere.position - sphere.radius;
+    glm::vec3 sphereMax = sphere.position + sphere.radius;
+    if (glm::all(glm::greaterThanEqual(sphereMin, n.boundsMin)) && glm::all(glm::lessThanEqual(sphereMax, n.boundsMax))) {
+        return false;
+    }
+
+    // Refitting in place after a jump would stretch every box up to where the leaf now is
+    bool jumped = !boxesOverlap(sphereMin, sphereMax, n.boundsMin, n.boundsMax);
+
+    float margin = MARGIN * sphere.radius;
+    n.boundsMin = sphereMin - margin;
+    n.boundsMax = sphereMax + margin;
+
+    if (jumped) {
+        removeLeaf(proxy);
+        insertLeaf(proxy);
+    } else if (n.parent != NONE) {
+        refit(n.parent);
+    }
+
+    return true;
+}
+
+void DynamicBVH::rebuild() {
+    if (m_root == NONE) return;
+
+    // Collect the leaves and free everything else, the leaves keep their indices
+    m_buildLeaves.clear();
+    std::vector<uint32_t> stack { m_root };
+    while (!stack.empty()) {
+        uint32_t node = stack.back();
+        stack.pop_back();
+        if (m_nodes[node].isLeaf()) {
+            m_buildLeaves.push_back(node);
+        } else {
+            stack.push_back(m_nodes[node].children[0]);
+            stack.push_back(m_nodes[node].children[1]);
+            freeNode(node);
+        }
+    }
+
+    m_root = buildRange(0, static_cast<uint32_t>(m_buildLeaves.size()));
+    m_nodes[m_root].parent = NONE;
+}
+
+void DynamicBVH::clear() {
+    m_nodes.clear();
+    m_root = NONE;
+    m_freeList = NONE;
+    m_numLeaves = 0;
+}
+
+bool DynamicBVH::getBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const {
+    if (m_root == NONE) return false;
+    boundsMin = m_nodes[m_root].boundsMin;
+    boundsMax = m_nodes[m_root].boundsMax;
+    return true;
+}
+
+float DynamicBVH::getCost() const {
+    if (m_root == NONE || m_nodes[m_root].isLeaf()) return 0.0f;
+
+    float totalArea = 0.0f;
+    std::vector<uint32_t> stack { m_root };
+    while (!stack.empty()) {
+        const Node& n = m_nodes[stack.back()];
+        stack.pop_back();
+        if (n.isLeaf()) continue;
+        totalArea += surfaceArea(n.boundsMin, n.boundsMax);
+        stack.push_back(n.children[0]);
+        stack.push_back(n.children[1]);
+    }
+
+    float rootArea = surfaceArea(m_nodes[m_root].boundsMin, m_nodes[m_root].boundsMax);
+    return rootArea > 0.0f ? totalArea / rootArea : 0.0f;
+}
+
+// False if the box is entirely behind one of the planes in planeMask. Otherwise the planes it is entirely in front of
+//   are taken out of planeMask, to be left out of the tests for its children. Once none are left, all the leaves below
+//   are visible
+static bool testBoxPlanes(const std::array<math_util::Plane, 6>& frustumPlanes, const glm::vec3& boundsMin,
+                          const glm::vec3& boundsMax, uint32_t& planeMask) {
+    for (uint32_t p = 0; p < 6; ++p) {
+        if (!(planeMask & (1u << p))) continue;
+        const math_util::Plane& plane = frustumPlanes[p];
+        // The corners furthest in front of and behind the plane
+        glm::vec3 front = glm::mix(boundsMin, boundsMax, glm::greaterThanEqual(plane.normal, glm::vec3(0.0f)));
+        glm::vec3 back = glm::mix(boundsMax, boundsMin, glm::greaterThanEqual(plane.normal, glm::vec3(0.0f)));
+        if (glm::dot(plane.normal, front) + plane.offset < 0.0f) return false;
+        if (glm::dot(plane.normal, back) + plane.offset >= 0.0f) planeMask &= ~(1u << p);
+    }
+    return true;
+}
+
+void DynamicBVH::queryFrustum(const std::array<math_util::Plane, 6>& frustumPlanes, std::vector<uint32_t>& results) const {
+    if (m_root == NONE) return;
+
+    // Subtrees still to be searched, and the planes they aren't known to be in front of
+    struct Entry {
+        uint32_t node;
+        uint32_t planeMask;
+    };
+    std::vector<Entry> stack { {m_root, ALL_PLANES} };
+
+    // Leaves which still need testing are collected and tested a batch at a time, several at once, against all the
+    //   planes. Those their parents are entirely in front of pass anyway
+    constexpr uint32_t LEAF_BATCH_SIZE = 64;
+    float leafX[LEAF_BATCH_SIZE], leafY[LEAF_BATCH_SIZE], leafZ[LEAF_BATCH_SIZE], leafRadii[LEAF_BATCH_SIZE];
+    uint32_t leafUserData[LEAF_BATCH_SIZE];
+    uint32_t visibleLeaves[LEAF_BATCH_SIZE];
+    uint32_t numLeaves = 0;
+
+    const auto testLeaves = [&] () {
+        uint32_t numVisible = math_util::frustumCullSpheres(frustumPlanes, numLeaves, leafX, leafY, leafZ, leafRadii,
+                                                            visibleLeaves);
+        for (uint32_t i = 0; i < numVisible; ++i) results.push_back(leafUserData[visibleLeaves[i]]);
+        numLeaves = 0;
+    };
+
+    while (!stack.empty()) {
+        Entry entry = stack.back();
+        stack.pop_back();
+
+        const Node& n = m_nodes[entry.node];
+        uint32_t planeMask = entry.planeMask;
+
+        if (n.isLeaf()) {
+            if (planeMask == 0) {
+                results.push_back(n.userData);
+                continue;
+            }
+            leafX[numLeaves] = n.sphere.position.x;
+            leafY[numLeaves] = n.sphere.position.y;
+            leafZ[numLeaves] = n.sphere.position.z;
+            leafRadii[numLeaves] = n.sphere.radius;
+            leafUserData[numLeaves] = n.userData;
+            if (++numLeaves == LEAF_BATCH_SIZE) testLeaves();
+            continue;
+        }
+
+        if (!testBoxPlanes(frustumPlanes, n.boundsMin, n.boundsMax, planeMask)) continue;
+
+        if (planeMask == 0) {
+            appendLeaves(entry.node, results);
+        } else {
+            stack.push_back({n.children[0], planeMask});
+            stack.push_back({n.children[1], planeMask});
+        }
+    }
+
+    testLeaves();
+}
+
+// Drop the views whose frustums the box is entirely outside of, and move those it is entirely inside of to insideViews
+static void testBoxViews(const std::array<math_util::Plane, 6>* frustumPlanes, uint32_t numFrustums,
+                         const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+                         uint64_t& partialViews, uint64_t& insideViews) {
+    for (uint32_t v = 0; v < numFrustums; ++v) {
+        uint64_t bit = uint64_t(1) << v;
+        if (!(partialViews & bit)) continue;
+        uint32_t planeMask = DynamicBVH::ALL_PLANES;
+        if (!testBoxPlanes(frustumPlanes[v], boundsMin, boundsMax, planeMask)) {
+            partialViews &= ~bit;
+        } else if (planeMask == 0) {
+            partialViews &= ~bit;
+            insideViews |= bit;
+        }
+    }
+}
+
+static uint64_t allViews(uint32_t numFrustums) {
+    assert(numFrustums <= DynamicBVH::MAX_QUERY_FRUSTUMS);
+    return numFrustums < 64 ? (uint64_t(1) << numFrustums) - 1 : ~uint64_t(0);
+}
+
+void DynamicBVH::queryMultiFrustum(const std::array<math_util::Plane, 6>* frustumPlanes, uint32_t numFrustums,
+                                   std::vector<uint32_t>& results, std::vector<uint64_t>& resultViews) const {
+    if (m_root == NONE || numFrustums == 0) return;
+    queryMultiFrustum(frustumPlanes, numFrustums, {m_root, allViews(numFrustums), 0}, results, resultViews);
+}
+
+void DynamicBVH::splitMultiFrustumQuery(const std::array<math_util::Plane, 6>* frustumPlanes, uint32_t numFrustums,
+                                        uint32_t maxHeight, std::vector<MultiFrustumQueryTask>& tasks) const {
+    if (m_root == NONE || numFrustums == 0) return;
+
+    std::vector<MultiFrustumQueryTask> stack { {m_root, allViews(numFrustums), 0} };
+    while (!stack.empty()) {
+        MultiFrustumQueryTask task = stack.back();
+        stack.pop_back();
+
+        const Node& n = m_nodes[task.node];
+        if (n.height <= maxHeight) {
+            tasks.push_back(task);
+            continue;
+        }
+
+        testBoxViews(frustumPlanes, numFrustums, n.boundsMin, n.boundsMax, task.partialViews, task.insideViews);
+        if (task.partialViews == 0 && task.insideViews == 0) continue;
+        stack.push_back({n.children[1], task.partialViews, task.insideViews});
+        stack.push_back({n.children[0], task.partialViews, task.insideViews});
+    }
+}
+
+void DynamicBVH::queryMultiFrustum(const std::array<math_util::Plane, 6>* frustumPlanes, uint32_t numFrustums,
+                                   const MultiFrustumQueryTask& task, std::vector<uint32_t>& results,
+                                   std::vector<uint64_t>& resultViews) const {
+    std::vector<MultiFrustumQueryTask> stack { task };
+
+    // As in queryFrustum(), leaves are tested a batch at a time, each against all the frustums any leaf of the batch
+    //   needs testing for. Results for frustums a leaf's parents were already inside of are taken from the parents
+    constexpr uint32_t LEAF_BATCH_SIZE = 64;
+    float leafX[LEAF_BATCH_SIZE], leafY[LEAF_BATCH_SIZE], leafZ[LEAF_BATCH_SIZE], leafRadii[LEAF_BATCH_SIZE];
+    uint32_t leafUserData[LEAF_BATCH_SIZE];
+    uint64_t leafPartialViews[LEAF_BATCH_SIZE], leafInsideViews[LEAF_BATCH_SIZE];
+    uint64_t visibleViews[LEAF_BATCH_SIZE];
+    uint64_t batchViews = 0;
+    uint32_t numLeaves = 0;
+
+    const auto testLeaves = [&] () {
+        math_util::frustumCullSpheresMultiView(frustumPlanes, numFrustums, batchViews, numLeaves,
+                                               leafX, leafY, leafZ, leafRadii, visibleViews);
+        for (uint32_t i = 0; i < numLeaves; ++i) {
+            uint64_t views = leafInsideViews[i] | (visibleViews[i] & leafPartialViews[i]);
+            if (views == 0) continue;
+            results.push_back(leafUserData[i]);
+            resultViews.push_back(views);
+        }
+        numLeaves = 0;
+        batchViews = 0;
+    };
+
+    while (!stack.empty()) {
+        MultiFrustumQueryTask entry = stack.back();
+        stack.pop_back();
+
+        const Node& n = m_nodes[entry.node];
+        uint64_t partialViews = entry.partialViews;
+        uint64_t insideViews = entry.insideViews;
+
+        if (n.isLeaf()) {
+            if (partialViews == 0) {
+                results.push_back(n.userData);
+                resultViews.push_back(insideViews);
+                continue;
+            }
+            leafX[numLeaves] = n.sphere.position.x;
+            leafY[numLeaves] = n.sphere.position.y;
+            leafZ[numLeaves] = n.sphere.position.z;
+            leafRadii[numLeaves] = n.sphere.radius;
+            leafUserData[numLeaves] = n.userData;
+            leafPartialViews[numLeaves] = partialViews;
+            leafInsideViews[numLeaves] = insideViews;
+            batchViews |= partialViews;
+            if (++numLeaves == LEAF_BATCH_SIZE) testLeaves();
+            continue;
+        }
+
+        testBoxViews(frustumPlanes, numFrustums, n.boundsMin, n.boundsMax, partialViews, insideViews);
+
+        if (partialViews == 0) {
+            if (insideViews == 0) continue;
+            appendLeaves(entry.node, results);
+            resultViews.resize(results.size(), insideViews);
+        } else {
+            stack.push_back({n.children[0], partialViews, insideViews});
+            stack.push_back({n.children[1], partialViews, insideViews});
+        }
+    }
+
+    testLeaves();
+}
+
+void DynamicBVH::querySphere(const BoundingSphere& sphere, std::vector<uint32_t>& results) const {
+    if (m_root == NONE) return;
+
+    float radiusSquared = sphere.radius * sphere.radius;
+    std::vector<uint32_t> stack { m_root };
+    while (!stack.empty()) {
+        const Node& n = m_nodes[stack.back()];
+        stack.pop_back();
+
+        if (squaredDistanceToBox(sphere.position, n.boundsMin, n.boundsMax) > radiusSquared) continue;
+
+        if (n.isLeaf()) {
+            float d = sphere.radius + n.sphere.radius;
+            glm::vec3 v = n.sphere.position - sphere.position;
+            if (glm::dot(v, v) <= d * d) results.push_back(n.userData);
+        } else {
+            stack.push_back(n.children[0]);
+            stack.push_back(n.children[1]);
+        }
+    }
+}
+
+void DynamicBVH::queryAABB(const glm::vec3& boundsMin, const glm::vec3& boundsMax, std::vector<uint32_t>& results) const {
+    if (m_root == NONE) return;
+
+    std::vector<uint32_t> stack { m_root };
+    while (!stack.empty()) {
+        const Node& n = m_nodes[stack.back()];
+        stack.pop_back();
+
+        if (!boxesOverlap(boundsMin, boundsMax, n.boundsMin, n.boundsMax)) continue;
+
+        if (n.isLeaf()) {
+            if (squaredDistanceToBox(n.sphere.position, boundsMin, boundsMax) <= n.sphere.radius * n.sphere.radius)
+                results.push_back(n.userData);
+        } else {
+            stack.push_back(n.children[0]);
+            stack.push_back(n.children[1]);
+        }
+    }
+}
+
+void DynamicBVH::queryRay(const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+                          std::vector<uint32_t>& results) const {
+    if (m_root == NONE) return;
+
+    glm::vec3 inverseDirection = 1.0f / direction;
+    float directionLengthSquared = glm::dot(direction, direction);
+
+    std::vector<uint32_t> stack { m_root };
+    while (!stack.empty()) {
+        const Node& n = m_nodes[stack.back()];
+        stack.pop_back();
+
+        // Slab test
+        glm::vec3 t0 = (n.boundsMin - origin) * inverseDirection;
+        glm::vec3 t1 = (n.boundsMax - origin) * inverseDirection;
+        glm::vec3 tNear = glm::min(t0, t1);
+        glm::vec3 tFar = glm::max(t0, t1);
+        float tEnter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+        if (tEnter > tExit) continue;
+
+        if (n.isLeaf()) {
+            // Closest point on the segment to the center
+            float t = glm::clamp(glm::dot(n.sphere.position - origin, direction) / directionLengthSquared, 0.0f, maxDistance);
+            glm::vec3 v = origin + t * direction - n.sphere.position;
+            if (glm::dot(v, v) <= n.sphere.radius * n.sphere.radius) results.push_back(n.userData);
+        } else {
+            stack.push_back(n.children[0]);
+            stack.push_back(n.children[1]);
+        }
+    }
+}
+
+uint32_t DynamicBVH::allocateNode() {
+    uint32_t node;
+    if (m_freeList != NONE) {
+        node = m_freeList;
+        m_freeList = m_nodes[node].parent;
+    } else {
+        node = static_cast<uint32_t>(m_nodes.size());
+        m_nodes.emplace_back();
+    }
+
+    Node& n = m_nodes[node];
+    n.parent = NONE;
+    n.userData = NONE;
+    n.children[0] = NONE;
+    n.children[1] = NONE;
+    n.height = 0;
+    return node;
+}
+
+void DynamicBVH::freeNode(uint32_t node) {
+    m_nodes[node].parent = m_freeList;
+    m_freeList = node;
+}
+
+void DynamicBVH::insertLeaf(uint32_t leaf) {
+    if (m_root == NONE) {
+        m_root = leaf;
+        m_nodes[leaf].parent = NONE;
+        return;
+    }
+
+    glm::vec3 leafMin = m_nodes[leaf].boundsMin;
+    glm::vec3 leafMax = m_nodes[leaf].boundsMax;
+
+    // Walk down to the sibling which adds the least area: making a new parent here costs the combined area, and
+    //   every ancestor of the new parent grows by the same amount, which is inherited by both children
+    uint32_t index = m_root;
+    while (!m_nodes[index].isLeaf()) {
+        const Node& n = m_nodes[index];
+
+        float area = surfaceArea(n.boundsMin, n.boundsMax);
+        float combinedArea = unionArea(n.boundsMin, n.boundsMax, leafMin, leafMax);
+
+        float cost = 2.0f * combinedArea;
+        float inheritedCost = 2.0f * (combinedArea - area);
+
+        float childCosts[2];
+        for (uint32_t i = 0; i < 2; ++i) {
+            const Node& c = m_nodes[n.children[i]];
+            childCosts[i] = unionArea(c.boundsMin, c.boundsMax, leafMin, leafMax) + inheritedCost;
+            if (!c.isLeaf()) childCosts[i] -= surfaceArea(c.boundsMin, c.boundsMax);
+        }
+
+        if (cost < childCosts[0] && cost < childCosts[1]) break;
+
+        index = childCosts[0] < childCosts[1] ? n.children[0] : n.children[1];
+    }
+
+    uint32_t sibling = index;
+    uint32_t oldParent = m_nodes[sibling].parent;
+    uint32_t newParent = allocateNode();
+
+    Node& p = m_nodes[newParent];
+    p.parent = oldParent;
+    p.children[0] = sibling;
+    p.children[1] = leaf;
+    m_nodes[sibling].parent = newParent;
+    m_nodes[leaf].parent = newParent;
+
+    if (oldParent == NONE) {
+        m_root = newParent;
+    } else {
+        Node& op = m_nodes[oldParent];
+        op.children[op.children[0] == sibling ? 0 : 1] = newParent;
+    }
+
+    refit(newParent);
+}
+
+void DynamicBVH::removeLeaf(uint32_t leaf) {
+    if (leaf == m_root) {
+        m_root = NONE;
+        return;
+    }
+
+    uint32_t parent = m_nodes[leaf].parent;
+    uint32_t grandParent = m_nodes[parent].parent;
+    uint32_t sibling = m_nodes[parent].children[m_nodes[parent].children[0] == leaf ? 1 : 0];
+
+    if (grandParent == NONE) {
+        m_root = sibling;
+        m_nodes[sibling].parent = NONE;
+        freeNode(parent);
+    } else {
+        Node& gp = m_nodes[grandParent];
+        gp.children[gp.children[0] == parent ? 0 : 1] = sibling;
+        m_nodes[sibling].parent = grandParent;
+        freeNode(parent);
+        refit(grandParent);
+    }
+}
+
+void DynamicBVH::refit(uint32_t node) {
+    while (node != NONE) {
+        Node& n = m_nodes[node];
+        const Node& c0 = m_nodes[n.children[0]];
+        const Node& c1 = m_nodes[n.children[1]];
+        n.boundsMin = glm::min(c0.boundsMin, c1.boundsMin);
+        n.boundsMax = glm::max(c0.boundsMax, c1.boundsMax);
+        n.height = 1 + std::max(c0.height, c1.height);
+
+        rotate(node);
+
+        node = m_nodes[node].parent;
+    }
+}
+
+void DynamicBVH::rotate(uint32_t node) {
+    Node& a = m_nodes[node];
+
+    // Swapping a child with one of its sibling's children leaves this node's bounds the same, but changes the
+    //   sibling's. Take the swap which shrinks it the most, if any
+    float bestDelta = 0.0f;
+    uint32_t bestChild = NONE;
+    uint32_t bestGrandChild = NONE;
+    for (uint32_t i = 0; i < 2; ++i) {
+        const Node& x = m_nodes[a.children[i]];
+        const Node& z = m_nodes[a.children[1 - i]];
+        if (z.isLeaf()) continue;
+
+        float area = surfaceArea(z.boundsMin, z.boundsMax);
+        for (uint32_t j = 0; j < 2; ++j) {
+            const Node& kept = m_nodes[z.children[1 - j]];
+            float delta = unionArea(x.boundsMin, x.boundsMax, kept.boundsMin, kept.boundsMax) - area;
+            if (delta < bestDelta) {
+                bestDelta = delta;
+                bestChild = i;
+                bestGrandChild = j;
+            }
+        }
+    }
+
+    if (bestChild == NONE) return;
+
+    uint32_t x = a.children[bestChild];
+    uint32_t z = a.children[1 - bestChild];
+    Node& zn = m_nodes[z];
+    uint32_t y = zn.children[bestGrandChild];
+    uint32_t kept = zn.children[1 - bestGrandChild];
+
+    a.children[bestChild] = y;
+    m_nodes[y].parent = node;
+    zn.children[bestGrandChild] = x;
+    m_nodes[x].parent = z;
+
+    zn.boundsMin = glm::min(m_nodes[x].boundsMin, m_nodes[kept].boundsMin);
+    zn.boundsMax = glm::max(m_nodes[x].boundsMax, m_nodes[kept].boundsMax);
+    zn.height = 1 + std::max(m_nodes[x].height, m_nodes[kept].height);
+    a.height = 1 + std::max(m_nodes[y].height, zn.height);
+}
+
+uint32_t DynamicBVH::buildRange(uint32_t begin, uint32_t end) {
+    if (end - begin == 1) return m_buildLeaves[begin];
+
+    // Binned surface area heuristic over the leaves' centers
+    static constexpr uint32_t numBins = 16;
+
+    glm::vec3 centerMin(std::numeric_limits<float>::max());
+    glm::vec3 centerMax(std::numeric_limits<float>::lowest());
+    for (uint32_t i = begin; i < end; ++i) {
+        const glm::vec3& c = m_nodes[m_buildLeaves[i]].sphere.position;
+        centerMin = glm::min(centerMin, c);
+        centerMax = glm::max(centerMax, c);
+    }
+    glm::vec3 extent = centerMax - centerMin;
+
+    float bestCost = std::numeric_limits<float>::max();
+    int bestAxis = -1;
+    uint32_t bestSplit = 0;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        if (extent[axis] <= 0.0f) continue;
+        float binScale = numBins / extent[axis];
+
+        glm::vec3 binMin[numBins], binMax[numBins];
+        uint32_t binCount[numBins] = {};
+        std::fill(binMin, binMin + numBins, glm::vec3(std::numeric_limits<float>::max()));
+        std::fill(binMax, binMax + numBins, glm::vec3(std::numeric_limits<float>::lowest()));
+
+        for (uint32_t i = begin; i < end; ++i) {
+            const Node& n = m_nodes[m_buildLeaves[i]];
+            uint32_t bin = std::min(static_cast<uint32_t>((n.sphere.position[axis] - centerMin[axis]) * binScale), numBins - 1);
+            binMin[bin] = glm::min(binMin[bin], n.boundsMin);
+            binMax[bin] = glm::max(binMax[bin], n.boundsMax);
+            ++binCount[bin];
+        }
+
+        // Cost of splitting after each bin, summed from the right and then swept from the left
+        float rightCost[numBins];
+        glm::vec3 sweepMin(std::numeric_limits<float>::max()), sweepMax(std::numeric_limits<float>::lowest());
+        uint32_t sweepCount = 0;
+        for (uint32_t b = numBins - 1; b > 0; --b) {
+            sweepMin = glm::min(sweepMin, binMin[b]);
+            sweepMax = glm::max(sweepMax, binMax[b]);
+            sweepCount += binCount[b];
+            rightCost[b - 1] = sweepCount ? sweepCount * surfaceArea(sweepMin, sweepMax) : 0.0f;
+        }
+
+        sweepMin = glm::vec3(std::numeric_limits<float>::max());
+        sweepMax = glm::vec3(std::numeric_limits<float>::lowest());
+        sweepCount = 0;
+        for (uint32_t b = 0; b < numBins - 1; ++b) {
+            sweepMin = glm::min(sweepMin, binMin[b]);
+            sweepMax = glm::max(sweepMax, binMax[b]);
+            sweepCount += binCount[b];
+            if (sweepCount == 0 || sweepCount == end - begin) continue;
+            float cost = sweepCount * surfaceArea(sweepMin, sweepMax) + rightCost[b];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = b;
+            }
+        }
+    }
+
+    uint32_t* pBegin = m_buildLeaves.data() + begin;
+    uint32_t* pEnd = m_buildLeaves.data() + end;
+    uint32_t* pMid;
+    if (bestAxis >= 0) {
+        float binScale = numBins / extent[bestAxis];
+        pMid = std::partition(pBegin, pEnd, [&] (uint32_t leaf) {
+            float c = m_nodes[leaf].sphere.position[bestAxis];
+            return std::min(static_cast<uint32_t>((c - centerMin[bestAxis]) * binScale), numBins - 1) <= bestSplit;
+        });
+    } else {
+        // All at the same point, any split will do
+        pMid = pBegin + (end - begin) / 2;
+    }
+    uint32_t mid = static_cast<uint32_t>(pMid - m_buildLeaves.data());
+
+    uint32_t node = allocateNode();
+    uint32_t c0 = buildRange(begin, mid);
+    uint32_t c1 = buildRange(mid, end);
+
+    Node& n = m_nodes[node];
+    n.children[0] = c0;
+    n.children[1] = c1;
+    m_nodes[c0].parent = node;
+    m_nodes[c1].parent = node;
+    n.boundsMin = glm::min(m_nodes[c0].boundsMin, m_nodes[c1].boundsMin);
+    n.boundsMax = glm::max(m_nodes[c0].boundsMax, m_nodes[c1].boundsMax);
+    n.height = 1 + std::max(m_nodes[c0].height, m_nodes[c1].height);
+    return node;
+}
+
+void DynamicBVH::appendLeaves(uint32_t node, std::vector<uint32_t>& results) const {
+    std::vector<uint32_t> stack { node };
+    while (!stack.empty()) {
+        const Node& n = m_nodes[stack.back()];
+        stack.pop_back();
+        if (n.isLeaf()) {
+            results.push_back(n.userData);
+        } else {
+            stack.push_back(n.children[0]);
+            stack.push_back(n.children[1]);
+        }
+    }
+}
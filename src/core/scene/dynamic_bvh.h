@@ -0,0 +1,149 @@
+#ifndef DYNAMIC_BVH_H_
+#define DYNAMIC_BVH_H_
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "core/scene/bounding_sphere.h"
+#include "core/util/math_util.h"
+
+// A bounding volume hierarchy of spheres, kept up to date as they are added, moved and removed
+// Leaves store the sphere and an AABB around it, grown by a margin so small movements don't change the tree.
+//   Internal nodes store the AABB of their children. When a leaf leaves its box, it is refit in place, and tree
+//   rotations on the way up keep the total surface area of the tree low. rebuild() builds a new tree with the
+//   surface area heuristic when many leaves have been added at once or the tree has degraded
+// Queries append the user data of every leaf whose sphere passes to the results, in no particular order
+class DynamicBVH {
+
+public:
+
+    static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+    // Returns the leaf's proxy, which stays the same until the leaf is removed, including across rebuild()
+    uint32_t insert(const BoundingSphere& sphere, uint32_t userData);
+
+    void remove(uint32_t proxy);
+
+    // Returns true if the tree had to be refit for the new sphere
+    bool update(uint32_t proxy, const BoundingSphere& sphere);
+
+    void rebuild();
+
+    void clear();
+
+    uint32_t getUserData(uint32_t proxy) const {
+        return m_nodes[proxy].userData;
+    }
+
+    void setUserData(uint32_t proxy, uint32_t userData) {
+        m_nodes[proxy].userData = userData;
+    }
+
+    const BoundingSphere& getSphere(uint32_t proxy) const {
+        return m_nodes[proxy].sphere;
+    }
+
+    uint32_t getNumLeaves() const {
+        return m_numLeaves;
+    }
+
+    bool empty() const {
+        return m_root == NONE;
+    }
+
+    // Bounds of all the leaves' boxes, including their margins. False if the tree is empty
+    bool getBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const;
+
+    // Sum of the surface areas of the internal nodes over that of the root. Lower is better
+    float getCost() const;
+
+    void queryFrustum(const std::array<math_util::Plane, 6>& frustumPlanes, std::vector<uint32_t>& results) const;
+
+    // Bits of the frustum planes, in the order math_util::frustumPlanes() gives them
+    static constexpr uint32_t ALL_PLANES = 0x3Fu;
+
+    // A subtree still to be searched by a query of several frustums at once, with the views (bits indexing the
+    //   frustums) it may be partly inside of, and those it is known to be entirely inside of
+    struct MultiFrustumQueryTask {
+        uint32_t node;
+        uint64_t partialViews;
+        uint64_t insideViews;
+    };
+
+    static constexpr uint32_t MAX_QUERY_FRUSTUMS = 64;
+
+    // Search the tree for several frustums in one walk, so nodes and spheres are loaded once however many frustums
+    //   there are. A subtree outside of a frustum drops it, and one outside of all of them is skipped
+    // Appends each leaf which passes for any of the frustums to results, and to resultViews the bits of those it
+    //   passes for
+    void queryMultiFrustum(const std::array<math_util::Plane, 6>* frustumPlanes, uint32_t numFrustums,
+                           std::vector<uint32_t>& results, std::vector<uint64_t>& resultViews) const;
+
+    // Split a query into the subtrees no taller than maxHeight, i.e. of at most 2^maxHeight leaves, which any of the
+    //   frustums may reach, for queryMultiFrustum() to finish separately, e.g. in parallel
+    // Always the same tasks in the same order for the same tree and frustums, so concatenating their results in order
+    //   gives the same results every time
+    void splitMultiFrustumQuery(const std::array<math_util::Plane, 6>* frustumPlanes, uint32_t numFrustums,
+                                uint32_t maxHeight, std::vector<MultiFrustumQueryTask>& tasks) const;
+
+    void queryMultiFrustum(const std::array<math_util::Plane, 6>* frustumPlanes, uint32_t numFrustums,
+                           const MultiFrustumQueryTask& task, std::vector<uint32_t>& results,
+                           std::vector<uint64_t>& resultViews) const;
+
+    void querySphere(const BoundingSphere& sphere, std::vector<uint32_t>& results) const;
+
+    void queryAABB(const glm::vec3& boundsMin, const glm::vec3& boundsMax, std::vector<uint32_t>& results) const;
+
+    // Spheres hit by the ray within maxDistance of the origin, in units of direction's length
+    void queryRay(const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+                  std::vector<uint32_t>& results) const;
+
+private:
+
+    // 64 bytes. Nodes on the free list link through parent
+    struct Node {
+        glm::vec3 boundsMin;
+        uint32_t parent;
+        glm::vec3 boundsMax;
+        uint32_t userData;
+        uint32_t children[2];
+        uint32_t height;
+        BoundingSphere sphere;
+
+        bool isLeaf() const {
+            return children[0] == NONE;
+        }
+    };
+
+    // Leaf boxes are grown by this fraction of the sphere's radius
+    static constexpr float MARGIN = 0.1f;
+
+    std::vector<Node> m_nodes;
+    uint32_t m_root = NONE;
+    uint32_t m_freeList = NONE;
+    uint32_t m_numLeaves = 0;
+
+    // Scratch for rebuild()
+    std::vector<uint32_t> m_buildLeaves;
+
+    uint32_t allocateNode();
+    void freeNode(uint32_t node);
+
+    void insertLeaf(uint32_t leaf);
+    void removeLeaf(uint32_t leaf);
+
+    // Recompute the bounds and heights of node and its ancestors, rotating each where that reduces its child's area
+    void refit(uint32_t node);
+    void rotate(uint32_t node);
+
+    uint32_t buildRange(uint32_t begin, uint32_t end);
+
+    void appendLeaves(uint32_t node, std::vector<uint32_t>& results) const;
+
+};
+
+#endif // DYNAMIC_BVH_H_
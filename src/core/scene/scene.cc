@@ -1,7 +1,7 @@
 #include "scene.h"
 
-#include <algorithm>
-#include <exception>
+#include <algorithm>
+#include <exception>
 #include <stdexcept>
 
 bool Scene::ModelHasher::operator<(const Scene::ModelHasher& mh) {
@@ -136,6 +136,14 @@ uint32_t Scene::addModel(uint32_t meshID, uint32_t materialID, uint32_t skeleton
     return id;
 }*/
 
+void Scene::removeSkeleton(Skeleton* pSkeleton) {
+    auto it = std::find(m_pSkeletons.begin(), m_pSkeletons.end(), pSkeleton);
+    if (it == m_pSkeletons.end()) return;
+    delete pSkeleton;
+    *it = m_pSkeletons.back();
+    m_pSkeletons.pop_back();
+}
+
 void Scene::removeRenderable(uint32_t renderableID) {
     if (renderableID >= m_renderables.size()) return;
     m_isRenderableIDFree[renderableID] = true;
@@ -152,6 +152,9 @@ public:
         return m_pSkeletons.back();
     }
 
+    // Delete a skeleton from addSkeleton(), which nothing may refer to any more
+    void removeSkeleton(Skeleton* pSkeleton);
+
     //uint32_t addRenderable(uint32_t modelID);
 
 
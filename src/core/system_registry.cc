@@ -0,0 +1,164 @@
+#include "system_registry.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+SystemRegistry::SystemRegistry() {
+    m_resourceIDs.emplace("All", RESOURCE_ALL);
+}
+
+SystemRegistry::ResourceID SystemRegistry::getResourceID(const std::string& name) {
+    auto [it, inserted] = m_resourceIDs.try_emplace(name, m_numResources);
+    if (inserted) ++m_numResources;
+    return it->second;
+}
+
+SystemRegistry::SystemHandle SystemRegistry::addSystem(const char* name, const JobScheduler::JobDeclaration& decl,
+                                                      JobScheduler::CounterHandle signalCounter) {
+    System system;
+    system.name = name;
+    system.decl = decl;
+    system.signalCounter = signalCounter;
+
+    m_systems.push_back(system);
+    m_scheduleValid = false;
+
+    return static_cast<SystemHandle>(m_systems.size() - 1);
+}
+
+void SystemRegistry::addRead(SystemHandle system, ResourceID resource) {
+    if (system >= m_systems.size()) {
+        throw std::runtime_error("Invalid system.");
+    }
+
+    auto& reads = m_systems[system].reads;
+    if (std::find(reads.begin(), reads.end(), resource) == reads.end()) {
+        reads.push_back(resource);
+    }
+    m_scheduleValid = false;
+}
+
+void SystemRegistry::addWrite(SystemHandle system, ResourceID resource) {
+    if (system >= m_systems.size()) {
+        throw std::runtime_error("Invalid system.");
+    }
+
+    auto& writes = m_systems[system].writes;
+    if (std::find(writes.begin(), writes.end(), resource) == writes.end()) {
+        writes.push_back(resource);
+    }
+    m_scheduleValid = false;
+}
+
+void SystemRegistry::setEnabled(SystemHandle system, bool enabled) {
+    if (system >= m_systems.size()) {
+        throw std::runtime_error("Invalid system.");
+    }
+
+    if (m_systems[system].enabled != enabled) {
+        m_systems[system].enabled = enabled;
+        m_scheduleValid = false;
+    }
+}
+
+void SystemRegistry::run(JobScheduler* pScheduler, JobScheduler::CounterHandle signalCounter) {
+    if (!m_scheduleValid || pScheduler != m_pScheduler) {
+        buildSchedule(pScheduler);
+    }
+
+    m_schedule.submit(signalCounter);
+}
+
+void SystemRegistry::buildSchedule(JobScheduler* pScheduler) {
+    m_schedule.clear();
+    m_pScheduler = pScheduler;
+
+    std::vector<uint32_t> enabled;
+    for (uint32_t i = 0; i < m_systems.size(); ++i) {
+        if (m_systems[i].enabled) enabled.push_back(i);
+    }
+    uint32_t numEnabled = static_cast<uint32_t>(enabled.size());
+
+    // By resource, the last system to write it and the systems which have read it since, as indices into enabled
+    static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> lastWriters(m_numResources, NONE);
+    std::vector<std::vector<uint32_t>> readers(m_numResources);
+
+    // Every system each system runs after, directly or not, as bits
+    size_t numWords = (numEnabled + 63) / 64;
+    std::vector<uint64_t> ancestors(numEnabled * numWords, 0);
+    const auto isAncestor = [&] (uint32_t system, uint32_t ancestor) {
+        return (ancestors[system * numWords + ancestor / 64] >> (ancestor % 64)) & 1;
+    };
+
+    std::vector<TaskGraph::NodeHandle> nodes(numEnabled);
+    std::vector<uint32_t> dependencies;
+    std::vector<TaskGraph::NodeHandle> waitNodes;
+
+    for (uint32_t e = 0; e < numEnabled; ++e) {
+        const System& system = m_systems[enabled[e]];
+
+        dependencies.clear();
+        const auto addDependency = [&] (uint32_t dependency) {
+            if (dependency != NONE && std::find(dependencies.begin(), dependencies.end(), dependency) == dependencies.end())
+                dependencies.push_back(dependency);
+        };
+
+        addDependency(lastWriters[RESOURCE_ALL]);
+        for (ResourceID r : system.reads) {
+            addDependency(lastWriters[r]);
+        }
+        for (ResourceID w : system.writes) {
+            addDependency(lastWriters[w]);
+            for (uint32_t reader : readers[w]) addDependency(reader);
+        }
+
+        readers[RESOURCE_ALL].push_back(e);
+        for (ResourceID r : system.reads) {
+            readers[r].push_back(e);
+        }
+        for (ResourceID w : system.writes) {
+            lastWriters[w] = e;
+            readers[w].clear();
+        }
+
+        for (uint32_t dependency : dependencies) {
+            for (size_t k = 0; k < numWords; ++k) {
+                ancestors[e * numWords + k] |= ancestors[dependency * numWords + k];
+            }
+            ancestors[e * numWords + dependency / 64] |= uint64_t(1) << (dependency % 64);
+        }
+
+        // Only wait on the systems which aren't already waited on by another one of them
+        dependencies.erase(std::remove_if(dependencies.begin(), dependencies.end(), [&] (uint32_t dependency) {
+            return std::any_of(dependencies.begin(), dependencies.end(), [&] (uint32_t other) {
+                return other != dependency && isAncestor(other, dependency);
+            });
+        }), dependencies.end());
+
+        nodes[e] = m_schedule.addNode(system.name, system.decl, system.signalCounter);
+
+        waitNodes.clear();
+        for (uint32_t dependency : dependencies) {
+            waitNodes.push_back(nodes[dependency]);
+        }
+
+        // A job can only wait on so many counters, past that they are joined by empty jobs
+        while (waitNodes.size() > JobScheduler::MAX_COUNTERS) {
+            TaskGraph::NodeHandle join = m_schedule.addNode("SystemJoin", [] { });
+            for (int k = 0; k < JobScheduler::MAX_COUNTERS; ++k) {
+                m_schedule.addDependency(join, waitNodes.back());
+                waitNodes.pop_back();
+            }
+            waitNodes.insert(waitNodes.begin(), join);
+        }
+
+        for (TaskGraph::NodeHandle waitNode : waitNodes) {
+            m_schedule.addDependency(nodes[e], waitNode);
+        }
+    }
+
+    m_schedule.compile(pScheduler);
+    m_scheduleValid = true;
+}
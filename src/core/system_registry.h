@@ -0,0 +1,126 @@
+#ifndef SYSTEM_REGISTRY_H_
+#define SYSTEM_REGISTRY_H_
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <typeindex>
+#include <typeinfo>
+#include <vector>
+
+#include "core/job_scheduler.h"
+#include "core/task_graph.h"
+
+/**
+ * Runs the systems which make up a frame's update as jobs, as many at once as their data allows
+ * Each system declares the resources it reads and writes: components by type, and anything else (physics, audio,
+ *   the camera, ...) by name. Two systems conflict if either writes something the other reads or writes, and
+ *   conflicting systems run in the order they were added. Systems which don't conflict may run at the same time
+ * Every system reads RESOURCE_ALL, so one which writes it (see setExclusive()) runs alone, after every system added
+ *   before it and before every system added after it
+ * The schedule is a TaskGraph, rebuilt by run() whenever a system has been added, changed, enabled or disabled since
+ *   the last one, and otherwise submitted as it is
+ * A system is complete when its job returns, unless it is given its own signal counter, as a TaskGraph node
+**/
+class SystemRegistry {
+
+public:
+
+    typedef uint32_t SystemHandle;
+    typedef uint32_t ResourceID;
+
+    static constexpr ResourceID RESOURCE_ALL = 0;
+
+    SystemRegistry();
+
+    SystemRegistry(const SystemRegistry&) = delete;
+    SystemRegistry& operator=(const SystemRegistry&) = delete;
+
+    // The same name always gives the same ID
+    ResourceID getResourceID(const std::string& name);
+
+    template <typename T>
+    ResourceID getComponentID() {
+        auto [it, inserted] = m_componentIDs.try_emplace(std::type_index(typeid(T)), m_numResources);
+        if (inserted) ++m_numResources;
+        return it->second;
+    }
+
+    // f is run as with JobScheduler::JobDeclaration::setClosure(), so it must be trivially copyable and small.
+    //   name is not copied
+    template <typename F>
+    SystemHandle addSystem(const char* name, const F& f,
+                           JobScheduler::CounterHandle signalCounter = JobScheduler::COUNTER_NULL,
+                           JobScheduler::PriorityLevel priority = JobScheduler::JOB_PRIORITY_NORMAL) {
+        JobScheduler::JobDeclaration decl;
+        decl.setClosure(f);
+        decl.priority = priority;
+        return addSystem(name, decl, signalCounter);
+    }
+
+    void addRead(SystemHandle system, ResourceID resource);
+    void addWrite(SystemHandle system, ResourceID resource);
+
+    template <typename ... Components>
+    void addComponentReads(SystemHandle system) {
+        (addRead(system, getComponentID<Components>()), ...);
+    }
+
+    template <typename ... Components>
+    void addComponentWrites(SystemHandle system) {
+        (addWrite(system, getComponentID<Components>()), ...);
+    }
+
+    // For systems which change anything, e.g. by adding and destroying entities
+    void setExclusive(SystemHandle system) {
+        addWrite(system, RESOURCE_ALL);
+    }
+
+    // Disabled systems are left out of the schedule, the others are still ordered as if they weren't there
+    void setEnabled(SystemHandle system, bool enabled);
+
+    bool isEnabled(SystemHandle system) const {
+        return m_systems[system].enabled;
+    }
+
+    // Enqueue every enabled system. They all signal signalCounter, which should be waited on before the next run(),
+    //   or anything else which uses what the systems write
+    void run(JobScheduler* pScheduler, JobScheduler::CounterHandle signalCounter);
+
+    size_t getNumSystems() const {
+        return m_systems.size();
+    }
+
+    // Write the last schedule in Graphviz dot format
+    void printSchedule(std::ostream& out) const {
+        m_schedule.print(out);
+    }
+
+private:
+
+    struct System {
+        const char* name;
+        JobScheduler::JobDeclaration decl;
+        JobScheduler::CounterHandle signalCounter;
+        std::vector<ResourceID> reads;
+        std::vector<ResourceID> writes;
+        bool enabled = true;
+    };
+
+    std::vector<System> m_systems;
+
+    std::map<std::string, ResourceID> m_resourceIDs;
+    std::map<std::type_index, ResourceID> m_componentIDs;
+    ResourceID m_numResources = 1;
+
+    TaskGraph m_schedule;
+    JobScheduler* m_pScheduler = nullptr;
+    bool m_scheduleValid = false;
+
+    SystemHandle addSystem(const char* name, const JobScheduler::JobDeclaration& decl, JobScheduler::CounterHandle signalCounter);
+
+    void buildSchedule(JobScheduler* pScheduler);
+
+};
+
+#endif // SYSTEM_REGISTRY_H_
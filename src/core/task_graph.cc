@@ -0,0 +1,165 @@
+#include "task_graph.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+TaskGraph::~TaskGraph() {
+    freeNodeCounters();
+}
+
+TaskGraph::NodeHandle TaskGraph::addNode(const char* name, JobScheduler::JobFunction* pFunction, uintptr_t param,
+                                         JobScheduler::CounterHandle signalCounter, JobScheduler::PriorityLevel priority) {
+    JobScheduler::JobDeclaration decl;
+    decl.pFunction = pFunction;
+    decl.param = param;
+    decl.priority = priority;
+    return addNode(name, decl, signalCounter);
+}
+
+TaskGraph::NodeHandle TaskGraph::addNode(const char* name, const JobScheduler::JobDeclaration& decl, JobScheduler::CounterHandle signalCounter) {
+    Node node;
+    node.name = name;
+    node.decl = decl;
+    node.decl.name = name;
+    node.signalCounter = signalCounter;
+
+    m_nodes.push_back(node);
+    m_compiled = false;
+
+    return static_cast<NodeHandle>(m_nodes.size() - 1);
+}
+
+void TaskGraph::addDependency(NodeHandle node, NodeHandle dependency) {
+    if (node >= m_nodes.size() || dependency >= m_nodes.size()) {
+        throw std::runtime_error("Invalid task graph node.");
+    }
+
+    auto& dependencies = m_nodes[node].dependencies;
+    if (std::find(dependencies.begin(), dependencies.end(), dependency) == dependencies.end()) {
+        dependencies.push_back(dependency);
+    }
+    m_compiled = false;
+}
+
+void TaskGraph::compile(JobScheduler* pScheduler) {
+    freeNodeCounters();
+    m_pScheduler = pScheduler;
+
+    size_t numNodes = m_nodes.size();
+
+    // Kahn's algorithm, taking ready nodes in the order they were added
+    std::vector<std::vector<NodeHandle>> dependents(numNodes);
+    std::vector<uint32_t> numUnresolved(numNodes);
+    for (NodeHandle i = 0; i < numNodes; ++i) {
+        numUnresolved[i] = m_nodes[i].dependencies.size();
+        for (NodeHandle dependency : m_nodes[i].dependencies) {
+            dependents[dependency].push_back(i);
+        }
+    }
+
+    std::vector<NodeHandle> order;
+    order.reserve(numNodes);
+    for (NodeHandle i = 0; i < numNodes; ++i) {
+        if (numUnresolved[i] == 0) order.push_back(i);
+    }
+    for (size_t next = 0; next < order.size(); ++next) {
+        for (NodeHandle dependent : dependents[order[next]]) {
+            if (--numUnresolved[dependent] == 0) order.push_back(dependent);
+        }
+    }
+
+    if (order.size() != numNodes) {
+        throw std::runtime_error("Task graph has a cycle.");
+    }
+
+    // Dependents wait on a node's own counter, or on one the graph allocates for it
+    std::vector<JobScheduler::CounterHandle> completionCounters(numNodes, JobScheduler::COUNTER_NULL);
+    for (NodeHandle i = 0; i < numNodes; ++i) {
+        if (dependents[i].empty()) continue;
+
+        if (m_nodes[i].signalCounter != JobScheduler::COUNTER_NULL) {
+            completionCounters[i] = m_nodes[i].signalCounter;
+        } else {
+            completionCounters[i] = pScheduler->getFreeCounter();
+            m_nodeCounters.push_back(completionCounters[i]);
+        }
+    }
+
+    m_decls.resize(numNodes);
+    m_numNodeSignalCounters.assign(numNodes, 0);
+    m_declSetSubmitParams.resize(numNodes);
+
+    for (size_t i = 0; i < numNodes; ++i) {
+        const Node& node = m_nodes[order[i]];
+        JobScheduler::JobDeclaration& decl = m_decls[i];
+
+        decl = node.decl;
+        decl.numWaitCounters = 0;
+        decl.numSignalCounters = 0;
+        m_declSetSubmitParams[i] = node.pSetSubmitParam;
+
+        if (node.dependencies.size() > JobScheduler::MAX_COUNTERS) {
+            throw std::runtime_error("Task graph node has too many dependencies.");
+        }
+        for (NodeHandle dependency : node.dependencies) {
+            decl.waitCounters[decl.numWaitCounters++] = completionCounters[dependency];
+        }
+
+        // Nodes without dependents only signal their own counter, if any. The submitted counter goes in the slot after it
+        JobScheduler::CounterHandle nodeCounter = completionCounters[order[i]];
+        if (nodeCounter == JobScheduler::COUNTER_NULL) nodeCounter = node.signalCounter;
+        if (nodeCounter != JobScheduler::COUNTER_NULL) {
+            decl.signalCounters[0] = nodeCounter;
+            m_numNodeSignalCounters[i] = 1;
+        }
+    }
+
+    m_compiled = true;
+}
+
+void TaskGraph::submit(JobScheduler::CounterHandle signalCounter, uintptr_t param) {
+    if (!m_compiled) {
+        throw std::runtime_error("Task graph must be compiled before it is submitted.");
+    }
+
+    if (m_decls.empty()) return;
+
+    for (size_t i = 0; i < m_decls.size(); ++i) {
+        int n = m_numNodeSignalCounters[i];
+        m_decls[i].signalCounters[n] = signalCounter;
+        m_decls[i].numSignalCounters = n + 1;
+        if (m_declSetSubmitParams[i]) m_declSetSubmitParams[i](m_decls[i].closure, param);
+    }
+
+    // Counters are all incremented before any job is scheduled, so no node can miss a dependency
+    m_pScheduler->enqueueJobs(static_cast<uint32_t>(m_decls.size()), m_decls.data());
+}
+
+void TaskGraph::clear() {
+    freeNodeCounters();
+    m_nodes.clear();
+    m_decls.clear();
+    m_numNodeSignalCounters.clear();
+    m_declSetSubmitParams.clear();
+    m_compiled = false;
+}
+
+void TaskGraph::print(std::ostream& out) const {
+    out << "digraph TaskGraph {" << std::endl;
+    for (size_t i = 0; i < m_nodes.size(); ++i) {
+        out << "  n" << i << " [label=\"" << (m_nodes[i].name ? m_nodes[i].name : "") << "\"];" << std::endl;
+    }
+    for (size_t i = 0; i < m_nodes.size(); ++i) {
+        for (NodeHandle dependency : m_nodes[i].dependencies) {
+            out << "  n" << dependency << " -> n" << i << ";" << std::endl;
+        }
+    }
+    out << "}" << std::endl;
+}
+
+void TaskGraph::freeNodeCounters() {
+    for (JobScheduler::CounterHandle counter : m_nodeCounters) {
+        m_pScheduler->freeCounter(counter);
+    }
+    m_nodeCounters.clear();
+}
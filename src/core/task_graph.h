@@ -0,0 +1,131 @@
+#ifndef TASK_GRAPH_H_
+#define TASK_GRAPH_H_
+
+#include <ostream>
+#include <type_traits>
+#include <vector>
+
+#include "core/job_scheduler.h"
+
+/**
+ * A fixed DAG of jobs which is declared once and then submitted as a whole, as often as needed
+ * Nodes are jobs (a function and its parameter, or a closure), edges make a node wait until another has completed
+ * compile() sorts the nodes topologically and resolves the edges to wait counters, building one JobDeclaration per node.
+ *   submit() then only has to enqueue those declarations in a single call, without allocating anything
+ * Parameters and closure captures are fixed when the node is added. Anything which changes between submissions is
+ *   passed to submit() as its parameter, for closures which take one, or reached through them by pointer
+ * A node is complete when its job function returns, unless it is given its own signal counter. That counter is
+ *   signalled by the node's job, so work the job forks onto the same counter (e.g. a parallelFor()) also delays
+ *   the node's dependents
+**/
+class TaskGraph {
+
+public:
+
+    typedef uint32_t NodeHandle;
+
+    TaskGraph() : m_nodes(), m_decls(), m_numNodeSignalCounters(), m_declSetSubmitParams(), m_nodeCounters(), m_pScheduler(nullptr),
+        m_compiled(false) {}
+
+    ~TaskGraph();
+
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+
+    // name is used to describe the graph and names the node's job in traces. It is not copied
+    NodeHandle addNode(const char* name, JobScheduler::JobFunction* pFunction, uintptr_t param,
+                       JobScheduler::CounterHandle signalCounter = JobScheduler::COUNTER_NULL,
+                       JobScheduler::PriorityLevel priority = JobScheduler::JOB_PRIORITY_NORMAL);
+
+    // As above, running a copy of f as with JobScheduler::JobDeclaration::setClosure()
+    // If f takes a uintptr_t, it is called with the parameter of the submit() which enqueued it
+    template <typename F>
+    NodeHandle addNode(const char* name, const F& f,
+                       JobScheduler::CounterHandle signalCounter = JobScheduler::COUNTER_NULL,
+                       JobScheduler::PriorityLevel priority = JobScheduler::JOB_PRIORITY_NORMAL) {
+        JobScheduler::JobDeclaration decl;
+        decl.priority = priority;
+        if constexpr (std::is_invocable<const F&, uintptr_t>::value) {
+            decl.setClosure(SubmitParamClosure<F>{f, 0});
+            NodeHandle node = addNode(name, decl, signalCounter);
+            m_nodes[node].pSetSubmitParam = [] (void* pClosure, uintptr_t param) {
+                static_cast<SubmitParamClosure<F>*>(pClosure)->param = param;
+            };
+            return node;
+        } else {
+            decl.setClosure(f);
+            return addNode(name, decl, signalCounter);
+        }
+    }
+
+    // As above, running decl's function and parameter or closure, at its priority. The rest of decl is ignored
+    NodeHandle addNode(const char* name, const JobScheduler::JobDeclaration& decl,
+                       JobScheduler::CounterHandle signalCounter = JobScheduler::COUNTER_NULL);
+
+    // node will not start until dependency has completed
+    void addDependency(NodeHandle node, NodeHandle dependency);
+
+    // Resolve the graph into job declarations. Must be called after the last change to the graph and before submit()
+    // Throws if the graph has a cycle, or if a node has more dependencies than a job can wait on
+    void compile(JobScheduler* pScheduler);
+
+    // Enqueue every node. Each node also signals signalCounter if it is given, so it can be used to wait for
+    //   the whole graph, including any work the nodes fork onto it. param is passed to the closures which take one
+    // The previous submission must have completed
+    void submit(JobScheduler::CounterHandle signalCounter = JobScheduler::COUNTER_NULL, uintptr_t param = 0);
+
+    // Frees the graph's counters and removes every node
+    void clear();
+
+    size_t getNumNodes() const {
+        return m_nodes.size();
+    }
+
+    // Write the graph in Graphviz dot format
+    void print(std::ostream& out) const;
+
+private:
+
+    // Stores submit()'s parameter in the closure along with f, for f to be called with
+    template <typename F>
+    struct SubmitParamClosure {
+        F f;
+        uintptr_t param;
+
+        void operator()() const {
+            f(param);
+        }
+    };
+
+    typedef void SetSubmitParamFunction (void* pClosure, uintptr_t param);
+
+    struct Node {
+        const char* name;
+        // Only the function, parameter or closure, and priority are used, the rest is filled in by compile()
+        JobScheduler::JobDeclaration decl;
+        JobScheduler::CounterHandle signalCounter;
+        std::vector<NodeHandle> dependencies;
+        // For closures taking submit()'s parameter
+        SetSubmitParamFunction* pSetSubmitParam = nullptr;
+    };
+
+    std::vector<Node> m_nodes;
+
+    // Compiled declarations in topological order, how many of their signal counters belong to the graph, and how to
+    //   give their closures submit()'s parameter. The submitted signal counter goes in the slot after the graph's
+    std::vector<JobScheduler::JobDeclaration> m_decls;
+    std::vector<int> m_numNodeSignalCounters;
+    std::vector<SetSubmitParamFunction*> m_declSetSubmitParams;
+
+    // Counters allocated for nodes which have dependents but no signal counter of their own
+    std::vector<JobScheduler::CounterHandle> m_nodeCounters;
+
+    JobScheduler* m_pScheduler;
+
+    bool m_compiled;
+
+    void freeNodeCounters();
+
+};
+
+#endif // TASK_GRAPH_H_
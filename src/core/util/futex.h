@@ -0,0 +1,68 @@
+#ifndef FUTEX_H_
+#define FUTEX_H_
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Minimal futex-style sleeping on the address of a 32 bit atomic
+ * wait() sleeps only while the word still holds the expected value, so a wake that happens after the caller has
+ *   read the word but before it goes to sleep is never lost. wait() may also return spuriously, callers must re-check
+ *   their condition in a loop
+ * On Linux this uses the futex syscall directly. Elsewhere it falls back to a yield/sleep loop on the value, which
+ *   keeps the same semantics at the cost of latency
+**/
+namespace futex {
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex requires a lock-free 32 bit atomic");
+
+inline void wait(std::atomic<uint32_t>& word, uint32_t expected) {
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+    for (int i = 0; word.load(std::memory_order_acquire) == expected; ++i) {
+        if (i < 64) std::this_thread::yield();
+        else std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+#endif
+}
+
+inline void wakeOne(std::atomic<uint32_t>& word) {
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+    (void) word;
+#endif
+}
+
+// Wake up to count threads
+inline void wake(std::atomic<uint32_t>& word, uint32_t count) {
+#ifdef __linux__
+    int n = (count > static_cast<uint32_t>(INT_MAX)) ? INT_MAX : static_cast<int>(count);
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+#else
+    (void) word;
+    (void) count;
+#endif
+}
+
+inline void wakeAll(std::atomic<uint32_t>& word) {
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+    (void) word;
+#endif
+}
+
+}
+
+#endif // FUTEX_H_
@@ -0,0 +1,79 @@
+#include "mapped_file.h"
+
+#include <stdexcept>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+MappedFile::MappedFile(const std::string& fileName) {
+    HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) throw std::runtime_error("Failed to open " + fileName);
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        throw std::runtime_error("Failed to get the size of " + fileName);
+    }
+    m_size = static_cast<size_t>(size.QuadPart);
+
+    // The mapping keeps the file open
+    if (m_size > 0) {
+        m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_mapping) m_pData = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+    CloseHandle(file);
+
+    if (m_size > 0 && !m_pData) {
+        if (m_mapping) CloseHandle(m_mapping);
+        throw std::runtime_error("Failed to map " + fileName);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (m_pData) UnmapViewOfFile(m_pData);
+    if (m_mapping) CloseHandle(m_mapping);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& fileName) {
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Failed to open " + fileName);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to get the size of " + fileName);
+    }
+    m_size = static_cast<size_t>(st.st_size);
+
+    // The mapping keeps the file open
+    if (m_size > 0) {
+        void* p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Failed to map " + fileName);
+        }
+        // It's all going to be read, so start reading it in now
+        madvise(p, m_size, MADV_WILLNEED);
+        m_pData = static_cast<const uint8_t*>(p);
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (m_pData) munmap(const_cast<uint8_t*>(m_pData), m_size);
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef MAPPED_FILE_H_INCLUDED
+#define MAPPED_FILE_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A whole file mapped read-only into memory, for loading formats which can be read in place
+// Throws std::runtime_error if the file can't be opened or mapped
+class MappedFile {
+
+public:
+
+    explicit MappedFile(const std::string& fileName);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Page aligned. nullptr for an empty file
+    const uint8_t* data() const {
+        return m_pData;
+    }
+
+    size_t size() const {
+        return m_size;
+    }
+
+private:
+
+    const uint8_t* m_pData = nullptr;
+    size_t m_size = 0;
+
+#if defined(_WIN32)
+    void* m_mapping = nullptr;
+#endif
+
+};
+
+#endif // MAPPED_FILE_H_INCLUDED
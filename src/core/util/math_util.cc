@@ -1,10 +1,22 @@
 #include "math_util.h"
 
+#include <algorithm>
+#include <cmath>
 #include <numeric>
 #include <vector>
 
 #include <glm/gtc/matrix_inverse.hpp>
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MATH_UTIL_SSE
+#include <xmmintrin.h>
+#endif
+
+#if defined(__AVX__)
+#define MATH_UTIL_AVX
+#include <immintrin.h>
+#endif
+
 //#include <iostream>
 //#include <glm/gtx/string_cast.hpp>
 
@@ -239,6 +251,406 @@ void frustumCullSpheres(glm::mat4 frustumMatrix, int nSpheresIn, const glm::vec4
     }
 }
 
+uint32_t frustumCullSpheres(const std::array<Plane, 6>& planes, uint32_t count, const float* xIn, const float* yIn,
+                            const float* zIn, const float* radiiIn, uint32_t* visibleIndicesOut) {
+    // Each index is written to the next free slot, which only moves on if the sphere is visible. No branches to
+    //   mispredict, and never past the sphere's own index, so count slots are enough
+    uint32_t numVisible = 0;
+    uint32_t i = 0;
+
+#if defined(MATH_UTIL_AVX)
+    __m256 planeX[6], planeY[6], planeZ[6], planeOffset[6];
+    for (int p = 0; p < 6; ++p) {
+        planeX[p] = _mm256_set1_ps(planes[p].normal.x);
+        planeY[p] = _mm256_set1_ps(planes[p].normal.y);
+        planeZ[p] = _mm256_set1_ps(planes[p].normal.z);
+        planeOffset[p] = _mm256_set1_ps(planes[p].offset);
+    }
+
+    for (; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_loadu_ps(xIn + i);
+        __m256 y = _mm256_loadu_ps(yIn + i);
+        __m256 z = _mm256_loadu_ps(zIn + i);
+        __m256 minDistance = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(radiiIn + i));
+
+        const auto inFront = [&] (int p) {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planeX[p], x), _mm256_mul_ps(planeY[p], y)),
+                                            _mm256_add_ps(_mm256_mul_ps(planeZ[p], z), planeOffset[p]));
+            return _mm256_cmp_ps(distance, minDistance, _CMP_GE_OQ);
+        };
+        __m256 visible = inFront(0);
+        for (int p = 1; p < 6; ++p) visible = _mm256_and_ps(visible, inFront(p));
+
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(visible));
+        for (uint32_t k = 0; k < 8; ++k) {
+            visibleIndicesOut[numVisible] = i + k;
+            numVisible += (mask >> k) & 1u;
+        }
+    }
+#endif
+
+#if defined(MATH_UTIL_SSE)
+    __m128 planeX4[6], planeY4[6], planeZ4[6], planeOffset4[6];
+    for (int p = 0; p < 6; ++p) {
+        planeX4[p] = _mm_set1_ps(planes[p].normal.x);
+        planeY4[p] = _mm_set1_ps(planes[p].normal.y);
+        planeZ4[p] = _mm_set1_ps(planes[p].normal.z);
+        planeOffset4[p] = _mm_set1_ps(planes[p].offset);
+    }
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(xIn + i);
+        __m128 y = _mm_loadu_ps(yIn + i);
+        __m128 z = _mm_loadu_ps(zIn + i);
+        __m128 minDistance = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radiiIn + i));
+
+        const auto inFront = [&] (int p) {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX4[p], x), _mm_mul_ps(planeY4[p], y)),
+                                         _mm_add_ps(_mm_mul_ps(planeZ4[p], z), planeOffset4[p]));
+            return _mm_cmpge_ps(distance, minDistance);
+        };
+        __m128 visible = inFront(0);
+        for (int p = 1; p < 6; ++p) visible = _mm_and_ps(visible, inFront(p));
+
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(visible));
+        for (uint32_t k = 0; k < 4; ++k) {
+            visibleIndicesOut[numVisible] = i + k;
+            numVisible += (mask >> k) & 1u;
+        }
+    }
+#endif
+
+    for (; i < count; ++i) {
+        bool visible = true;
+        for (const Plane& p : planes) {
+            visible &= (p.normal.x * xIn[i] + p.normal.y * yIn[i]) + (p.normal.z * zIn[i] + p.offset) >= -radiiIn[i];
+        }
+        visibleIndicesOut[numVisible] = i;
+        numVisible += visible ? 1 : 0;
+    }
+
+    return numVisible;
+}
+
+void frustumCullSpheresMultiView(const std::array<Plane, 6>* viewPlanes, uint32_t numViews, uint64_t viewMask,
+                                 uint32_t count, const float* xIn, const float* yIn, const float* zIn,
+                                 const float* radiiIn, uint64_t* visibleViewsOut) {
+    std::fill(visibleViewsOut, visibleViewsOut + count, uint64_t(0));
+    uint32_t i = 0;
+
+    // The planes are broadcast from memory as needed, as there are too many to keep in registers
+#if defined(MATH_UTIL_AVX)
+    for (; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_loadu_ps(xIn + i);
+        __m256 y = _mm256_loadu_ps(yIn + i);
+        __m256 z = _mm256_loadu_ps(zIn + i);
+        __m256 minDistance = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(radiiIn + i));
+
+        for (uint32_t v = 0; v < numViews; ++v) {
+            if (!((viewMask >> v) & 1u)) continue;
+            const std::array<Plane, 6>& planes = viewPlanes[v];
+
+            const auto inFront = [&] (int p) {
+                __m256 distance = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(_mm256_broadcast_ss(&planes[p].normal.x), x),
+                                  _mm256_mul_ps(_mm256_broadcast_ss(&planes[p].normal.y), y)),
+                    _mm256_add_ps(_mm256_mul_ps(_mm256_broadcast_ss(&planes[p].normal.z), z),
+                                  _mm256_broadcast_ss(&planes[p].offset)));
+                return _mm256_cmp_ps(distance, minDistance, _CMP_GE_OQ);
+            };
+            __m256 visible = inFront(0);
+            for (int p = 1; p < 6; ++p) visible = _mm256_and_ps(visible, inFront(p));
+
+            uint64_t mask = static_cast<uint64_t>(_mm256_movemask_ps(visible));
+            for (uint32_t k = 0; k < 8; ++k) visibleViewsOut[i + k] |= ((mask >> k) & 1u) << v;
+        }
+    }
+#endif
+
+#if defined(MATH_UTIL_SSE)
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(xIn + i);
+        __m128 y = _mm_loadu_ps(yIn + i);
+        __m128 z = _mm_loadu_ps(zIn + i);
+        __m128 minDistance = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radiiIn + i));
+
+        for (uint32_t v = 0; v < numViews; ++v) {
+            if (!((viewMask >> v) & 1u)) continue;
+            const std::array<Plane, 6>& planes = viewPlanes[v];
+
+            const auto inFront = [&] (int p) {
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load1_ps(&planes[p].normal.x), x),
+                                                        _mm_mul_ps(_mm_load1_ps(&planes[p].normal.y), y)),
+                                             _mm_add_ps(_mm_mul_ps(_mm_load1_ps(&planes[p].normal.z), z),
+                                                        _mm_load1_ps(&planes[p].offset)));
+                return _mm_cmpge_ps(distance, minDistance);
+            };
+            __m128 visible = inFront(0);
+            for (int p = 1; p < 6; ++p) visible = _mm_and_ps(visible, inFront(p));
+
+            uint64_t mask = static_cast<uint64_t>(_mm_movemask_ps(visible));
+            for (uint32_t k = 0; k < 4; ++k) visibleViewsOut[i + k] |= ((mask >> k) & 1u) << v;
+        }
+    }
+#endif
+
+    for (; i < count; ++i) {
+        for (uint32_t v = 0; v < numViews; ++v) {
+            if (!((viewMask >> v) & 1u)) continue;
+            bool visible = true;
+            for (const Plane& p : viewPlanes[v]) {
+                visible &= (p.normal.x * xIn[i] + p.normal.y * yIn[i]) + (p.normal.z * zIn[i] + p.offset) >= -radiiIn[i];
+            }
+            visibleViewsOut[i] |= uint64_t(visible ? 1 : 0) << v;
+        }
+    }
+}
+
+static_assert(sizeof(BoundingSphere) == 4 * sizeof(float), "BoundingSphere must be packed as (x, y, z, radius)");
+static_assert(sizeof(glm::mat4) == 16 * sizeof(float), "glm::mat4 must be 16 packed floats");
+
+static BoundingSphere transformBoundingSphere(const glm::mat4& matrix, const BoundingSphere& sphere) {
+    float scale2 = std::max({ glm::dot(glm::vec3(matrix[0]), glm::vec3(matrix[0])),
+                              glm::dot(glm::vec3(matrix[1]), glm::vec3(matrix[1])),
+                              glm::dot(glm::vec3(matrix[2]), glm::vec3(matrix[2])) });
+    BoundingSphere b;
+    b.position = glm::vec3(matrix * glm::vec4(sphere.position, 1.0f));
+    b.radius = sphere.radius * std::sqrt(scale2);
+    return b;
+}
+
+void transformBoundingSpheres(int nSpheres, const glm::mat4* matricesIn, const BoundingSphere* spheresIn, BoundingSphere* spheresOut) {
+    int i = 0;
+#ifdef MATH_UTIL_SSE
+    for (; i + 4 <= nSpheres; i += 4) {
+        const float* m[4];
+        __m128 spheres[4];
+        for (int k = 0; k < 4; ++k) {
+            m[k] = &matricesIn[i + k][0][0];
+            spheres[k] = _mm_loadu_ps(&spheresIn[i + k].position.x);
+        }
+
+        // Squared lengths of each basis vector, transposed so each vector holds one axis for all four spheres
+        __m128 scale2 = _mm_setzero_ps();
+        for (int axis = 0; axis < 3; ++axis) {
+            __m128 c0 = _mm_loadu_ps(m[0] + 4 * axis);
+            __m128 c1 = _mm_loadu_ps(m[1] + 4 * axis);
+            __m128 c2 = _mm_loadu_ps(m[2] + 4 * axis);
+            __m128 c3 = _mm_loadu_ps(m[3] + 4 * axis);
+            c0 = _mm_mul_ps(c0, c0);
+            c1 = _mm_mul_ps(c1, c1);
+            c2 = _mm_mul_ps(c2, c2);
+            c3 = _mm_mul_ps(c3, c3);
+            _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+            scale2 = _mm_max_ps(scale2, _mm_add_ps(_mm_add_ps(c0, c1), c2));
+        }
+
+        // Radii from the w lane of each sphere, into one vector
+        __m128 r01 = _mm_unpackhi_ps(spheres[0], spheres[1]);
+        __m128 r23 = _mm_unpackhi_ps(spheres[2], spheres[3]);
+        __m128 radii = _mm_mul_ps(_mm_movehl_ps(r23, r01), _mm_sqrt_ps(scale2));
+
+        alignas(16) float radiiOut[4];
+        _mm_store_ps(radiiOut, radii);
+
+        for (int k = 0; k < 4; ++k) {
+            __m128 x = _mm_shuffle_ps(spheres[k], spheres[k], _MM_SHUFFLE(0, 0, 0, 0));
+            __m128 y = _mm_shuffle_ps(spheres[k], spheres[k], _MM_SHUFFLE(1, 1, 1, 1));
+            __m128 z = _mm_shuffle_ps(spheres[k], spheres[k], _MM_SHUFFLE(2, 2, 2, 2));
+            __m128 p = _mm_loadu_ps(m[k] + 12);
+            p = _mm_add_ps(p, _mm_mul_ps(_mm_loadu_ps(m[k]), x));
+            p = _mm_add_ps(p, _mm_mul_ps(_mm_loadu_ps(m[k] + 4), y));
+            p = _mm_add_ps(p, _mm_mul_ps(_mm_loadu_ps(m[k] + 8), z));
+
+            // The w lane holds junk, the radius overwrites it
+            _mm_storeu_ps(&spheresOut[i + k].position.x, p);
+            spheresOut[i + k].radius = radiiOut[k];
+        }
+    }
+#endif
+    for (; i < nSpheres; ++i) {
+        spheresOut[i] = transformBoundingSphere(matricesIn[i], spheresIn[i]);
+    }
+}
+
+static_assert(sizeof(AffineTransform) == 12 * sizeof(float), "AffineTransform must be 12 packed floats");
+
+static BoundingSphere transformBoundingSphere(const AffineTransform& transform, const BoundingSphere& sphere) {
+    const glm::vec4* rows = transform.rows;
+    glm::vec3 scale2 = glm::vec3(rows[0] * rows[0] + rows[1] * rows[1] + rows[2] * rows[2]);
+    glm::vec4 p = glm::vec4(sphere.position, 1.0f);
+    BoundingSphere b;
+    b.position = glm::vec3(glm::dot(rows[0], p), glm::dot(rows[1], p), glm::dot(rows[2], p));
+    b.radius = sphere.radius * std::sqrt(std::max({ scale2.x, scale2.y, scale2.z }));
+    return b;
+}
+
+void transformBoundingSpheres(int nSpheres, const AffineTransform* transformsIn, const BoundingSphere* spheresIn, BoundingSphere* spheresOut) {
+    int i = 0;
+#ifdef MATH_UTIL_SSE
+    for (; i + 4 <= nSpheres; i += 4) {
+        __m128 rows[4][3];
+        __m128 spheres[4];
+        for (int k = 0; k < 4; ++k) {
+            for (int r = 0; r < 3; ++r) rows[k][r] = _mm_loadu_ps(&transformsIn[i + k].rows[r].x);
+            spheres[k] = _mm_loadu_ps(&spheresIn[i + k].position.x);
+        }
+
+        // Squared lengths of the columns of each upper 3x3, transposed so each vector holds one axis for all four spheres
+        __m128 c[4];
+        for (int k = 0; k < 4; ++k) {
+            c[k] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rows[k][0], rows[k][0]), _mm_mul_ps(rows[k][1], rows[k][1])),
+                              _mm_mul_ps(rows[k][2], rows[k][2]));
+        }
+        _MM_TRANSPOSE4_PS(c[0], c[1], c[2], c[3]);
+        __m128 scale2 = _mm_max_ps(_mm_max_ps(c[0], c[1]), c[2]);
+
+        __m128 r01 = _mm_unpackhi_ps(spheres[0], spheres[1]);
+        __m128 r23 = _mm_unpackhi_ps(spheres[2], spheres[3]);
+        __m128 radii = _mm_mul_ps(_mm_movehl_ps(r23, r01), _mm_sqrt_ps(scale2));
+
+        alignas(16) float radiiOut[4];
+        _mm_store_ps(radiiOut, radii);
+
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (int k = 0; k < 4; ++k) {
+            // (x, y, z, 1), then the three row dot products summed by a transpose
+            __m128 p = _mm_movelh_ps(spheres[k], _mm_unpacklo_ps(_mm_movehl_ps(spheres[k], spheres[k]), one));
+            __m128 x = _mm_mul_ps(rows[k][0], p);
+            __m128 y = _mm_mul_ps(rows[k][1], p);
+            __m128 z = _mm_mul_ps(rows[k][2], p);
+            __m128 w = _mm_setzero_ps();
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+
+            _mm_storeu_ps(&spheresOut[i + k].position.x, _mm_add_ps(_mm_add_ps(x, y), _mm_add_ps(z, w)));
+            spheresOut[i + k].radius = radiiOut[k];
+        }
+    }
+#endif
+    for (; i < nSpheres; ++i) {
+        spheresOut[i] = transformBoundingSphere(transformsIn[i], spheresIn[i]);
+    }
+}
+
+static AffineTransform composeAffineTransform(const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale) {
+    glm::mat3 r = glm::mat3_cast(rotation);
+    AffineTransform t;
+    for (int row = 0; row < 3; ++row) {
+        t.rows[row] = glm::vec4(r[0][row] * scale.x, r[1][row] * scale.y, r[2][row] * scale.z, translation[row]);
+    }
+    return t;
+}
+
+void composeAffineTransforms(int nTransforms, const glm::vec3* translationsIn, const glm::quat* rotationsIn, const glm::vec3* scalesIn,
+                             AffineTransform* transformsOut) {
+    int i = 0;
+#ifdef MATH_UTIL_SSE
+    for (; i + 4 <= nTransforms; i += 4) {
+        // Four transforms to a vector, so the quaternion to matrix conversion is done for all of them at once
+        const glm::quat* q = rotationsIn + i;
+        const glm::vec3* t = translationsIn + i;
+        const glm::vec3* s = scalesIn + i;
+        __m128 qx = _mm_setr_ps(q[0].x, q[1].x, q[2].x, q[3].x);
+        __m128 qy = _mm_setr_ps(q[0].y, q[1].y, q[2].y, q[3].y);
+        __m128 qz = _mm_setr_ps(q[0].z, q[1].z, q[2].z, q[3].z);
+        __m128 qw = _mm_setr_ps(q[0].w, q[1].w, q[2].w, q[3].w);
+        __m128 sx = _mm_setr_ps(s[0].x, s[1].x, s[2].x, s[3].x);
+        __m128 sy = _mm_setr_ps(s[0].y, s[1].y, s[2].y, s[3].y);
+        __m128 sz = _mm_setr_ps(s[0].z, s[1].z, s[2].z, s[3].z);
+
+        __m128 x2 = _mm_add_ps(qx, qx);
+        __m128 y2 = _mm_add_ps(qy, qy);
+        __m128 z2 = _mm_add_ps(qz, qz);
+        __m128 xx = _mm_mul_ps(qx, x2), yy = _mm_mul_ps(qy, y2), zz = _mm_mul_ps(qz, z2);
+        __m128 xy = _mm_mul_ps(qx, y2), xz = _mm_mul_ps(qx, z2), yz = _mm_mul_ps(qy, z2);
+        __m128 wx = _mm_mul_ps(qw, x2), wy = _mm_mul_ps(qw, y2), wz = _mm_mul_ps(qw, z2);
+        const __m128 one = _mm_set1_ps(1.0f);
+
+        // Each row for all four transforms, then transposed to the four transforms' rows
+        __m128 m[3][4] = {
+            { _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx), _mm_mul_ps(_mm_sub_ps(xy, wz), sy),
+              _mm_mul_ps(_mm_add_ps(xz, wy), sz), _mm_setr_ps(t[0].x, t[1].x, t[2].x, t[3].x) },
+            { _mm_mul_ps(_mm_add_ps(xy, wz), sx), _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy),
+              _mm_mul_ps(_mm_sub_ps(yz, wx), sz), _mm_setr_ps(t[0].y, t[1].y, t[2].y, t[3].y) },
+            { _mm_mul_ps(_mm_sub_ps(xz, wy), sx), _mm_mul_ps(_mm_add_ps(yz, wx), sy),
+              _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz), _mm_setr_ps(t[0].z, t[1].z, t[2].z, t[3].z) },
+        };
+
+        for (int row = 0; row < 3; ++row) {
+            _MM_TRANSPOSE4_PS(m[row][0], m[row][1], m[row][2], m[row][3]);
+            for (int k = 0; k < 4; ++k) _mm_storeu_ps(&transformsOut[i + k].rows[row].x, m[row][k]);
+        }
+    }
+#endif
+    for (; i < nTransforms; ++i) {
+        transformsOut[i] = composeAffineTransform(translationsIn[i], rotationsIn[i], scalesIn[i]);
+    }
+}
+
+void multiplyAffineTransforms(int nTransforms, const AffineTransform* lhsIn, const AffineTransform* rhsIn, AffineTransform* transformsOut) {
+#ifdef MATH_UTIL_SSE
+    // Each row of the product is the lhs row's weighted sum of the rhs rows, plus its own translation
+    const __m128 w = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+    for (int i = 0; i < nTransforms; ++i) {
+        // All loaded before anything is stored, the output may be an input
+        __m128 a[3], b[3];
+        for (int r = 0; r < 3; ++r) {
+            a[r] = _mm_loadu_ps(&lhsIn[i].rows[r].x);
+            b[r] = _mm_loadu_ps(&rhsIn[i].rows[r].x);
+        }
+        for (int r = 0; r < 3; ++r) {
+            __m128 p = _mm_mul_ps(_mm_shuffle_ps(a[r], a[r], _MM_SHUFFLE(3, 3, 3, 3)), w);
+            p = _mm_add_ps(p, _mm_mul_ps(_mm_shuffle_ps(a[r], a[r], _MM_SHUFFLE(0, 0, 0, 0)), b[0]));
+            p = _mm_add_ps(p, _mm_mul_ps(_mm_shuffle_ps(a[r], a[r], _MM_SHUFFLE(1, 1, 1, 1)), b[1]));
+            p = _mm_add_ps(p, _mm_mul_ps(_mm_shuffle_ps(a[r], a[r], _MM_SHUFFLE(2, 2, 2, 2)), b[2]));
+            _mm_storeu_ps(&transformsOut[i].rows[r].x, p);
+        }
+    }
+#else
+    for (int i = 0; i < nTransforms; ++i) {
+        AffineTransform a = lhsIn[i];
+        AffineTransform b = rhsIn[i];
+        for (int r = 0; r < 3; ++r) {
+            transformsOut[i].rows[r] = a.rows[r].x * b.rows[0] + a.rows[r].y * b.rows[1] + a.rows[r].z * b.rows[2] +
+                                       glm::vec4(0.0f, 0.0f, 0.0f, a.rows[r].w);
+        }
+    }
+#endif
+}
+
+void decomposeAffineTransform(const glm::mat4& matrix, glm::vec3& translation, glm::quat& rotation, glm::vec3& scale) {
+    translation = matrix[3];
+
+    // Gram-Schmidt, so whatever shear there is goes
+    glm::mat3 rotationOnly = glm::mat3(matrix);
+    scale.x = glm::length(rotationOnly[0]);
+    rotationOnly[0] = rotationOnly[0] / scale.x;
+    rotationOnly[1] = rotationOnly[1] - glm::dot(rotationOnly[0], rotationOnly[1]) * rotationOnly[0];
+    scale.y = glm::length(rotationOnly[1]);
+    rotationOnly[1] = rotationOnly[1] / scale.y;
+    rotationOnly[2] = rotationOnly[2] - glm::dot(rotationOnly[0], rotationOnly[2]) * rotationOnly[0];
+    rotationOnly[2] = rotationOnly[2] - glm::dot(rotationOnly[1], rotationOnly[2]) * rotationOnly[1];
+    scale.z = glm::length(rotationOnly[2]);
+    rotationOnly[2] = rotationOnly[2] / scale.z;
+
+    if (glm::determinant(rotationOnly) < 0.0f) {
+        scale.x = -scale.x;
+        rotationOnly[0] = -rotationOnly[0];
+    }
+
+    rotation = glm::normalize(glm::quat_cast(rotationOnly));
+}
+
+BoundingSphere mergeBoundingSpheres(int nSpheres, BoundingSphere* spheres) {
+    if (nSpheres == 0) return BoundingSphere();
+    for (int stride = 1; stride < nSpheres; stride *= 2) {
+        for (int i = 0; i + stride < nSpheres; i += 2 * stride) {
+            spheres[i].add(spheres[i + stride]);
+        }
+    }
+    return spheres[0];
+}
+
 // Build Delaunay triangulation of 2D positions
 // Bowyer-Watson Algorithm
 // https://en.wikipedia.org/wiki/Bowyer%E2%80%93Watson_algorithm
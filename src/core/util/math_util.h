@@ -5,6 +5,9 @@
 #include <vector>
 
 #include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "core/scene/bounding_sphere.h"
 
 namespace math_util {
 
@@ -41,6 +44,88 @@ void frustumCullSpheres(glm::mat4 frustumMatrix, int nSpheresIn, const glm::vec4
 void frustumCullSpheres(glm::mat4 frustumMatrix, int nSpheresIn, const glm::vec4* spheresIn, std::vector<bool>& cullResultsOut, int* numPassed);
 void frustumCullSpheres(glm::mat4 frustumMatrix, int nSpheresIn, const glm::vec4* spheresIn, glm::vec4* cullResultsOut, int* numPassed);
 
+// Spheres split into an array per component, so several can be tested at once with SIMD
+struct BoundingSphereArrays {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> radii;
+
+    size_t size() const {
+        return radii.size();
+    }
+
+    void resize(size_t count) {
+        x.resize(count);
+        y.resize(count);
+        z.resize(count);
+        radii.resize(count);
+    }
+
+    void set(size_t i, const BoundingSphere& sphere) {
+        x[i] = sphere.position.x;
+        y[i] = sphere.position.y;
+        z[i] = sphere.position.z;
+        radii[i] = sphere.radius;
+    }
+};
+
+// Write the indices of the spheres not entirely behind any of the planes to visibleIndicesOut, in increasing order, and
+//   return how many there are. visibleIndicesOut must have room for count indices, all of which may be written to
+// Tests eight spheres at a time with AVX where the compiler targets it, otherwise four with SSE where available
+uint32_t frustumCullSpheres(const std::array<Plane, 6>& planes, uint32_t count, const float* xIn, const float* yIn,
+                            const float* zIn, const float* radiiIn, uint32_t* visibleIndicesOut);
+
+// Test each sphere against several frustums at once, setting bit v of visibleViewsOut[i] if sphere i isn't entirely
+//   behind any of viewPlanes[v], for the views whose bits are set in viewMask. The other bits are left clear
+// Each group of spheres is loaded once and tested against every view before moving on. At most 64 views
+void frustumCullSpheresMultiView(const std::array<Plane, 6>* viewPlanes, uint32_t numViews, uint64_t viewMask,
+                                 uint32_t count, const float* xIn, const float* yIn, const float* zIn,
+                                 const float* radiiIn, uint64_t* visibleViewsOut);
+
+// The top three rows of an affine matrix, whose bottom row is always (0, 0, 0, 1). 48 bytes rather than 64
+// Row-major, unlike glm, so each row is one component of the transformed point and the translation is the w column
+struct AffineTransform {
+    glm::vec4 rows[3] = {glm::vec4(1.0f, 0.0f, 0.0f, 0.0f), glm::vec4(0.0f, 1.0f, 0.0f, 0.0f), glm::vec4(0.0f, 0.0f, 1.0f, 0.0f)};
+
+    AffineTransform() {}
+    explicit AffineTransform(const glm::mat4& matrix) {
+        glm::mat4 transposed = glm::transpose(matrix);
+        rows[0] = transposed[0];
+        rows[1] = transposed[1];
+        rows[2] = transposed[2];
+    }
+
+    glm::mat4 toMat4() const {
+        return glm::transpose(glm::mat4(rows[0], rows[1], rows[2], glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+    }
+
+    glm::vec3 getTranslation() const {
+        return glm::vec3(rows[0].w, rows[1].w, rows[2].w);
+    }
+};
+
+// Each transform as translate(translation) * toMat4(rotation) * scale(scale). The rotations must be normalized
+// Uses SSE four transforms at a time where available
+void composeAffineTransforms(int nTransforms, const glm::vec3* translationsIn, const glm::quat* rotationsIn, const glm::vec3* scalesIn,
+                             AffineTransform* transformsOut);
+
+// transformsOut[i] = lhsIn[i] * rhsIn[i]. transformsOut may be either of the inputs
+void multiplyAffineTransforms(int nTransforms, const AffineTransform* lhsIn, const AffineTransform* rhsIn, AffineTransform* transformsOut);
+
+// Split an affine matrix into translation, rotation and scale. Any shear is lost, a reflection goes in the x scale
+void decomposeAffineTransform(const glm::mat4& matrix, glm::vec3& translation, glm::quat& rotation, glm::vec3& scale);
+
+// Transform each sphere by the matrix at the same index: the center by the whole matrix, the radius by the largest
+//   scale of its upper 3x3. spheresOut may be spheresIn
+// Uses SSE four spheres at a time where available
+void transformBoundingSpheres(int nSpheres, const glm::mat4* matricesIn, const BoundingSphere* spheresIn, BoundingSphere* spheresOut);
+void transformBoundingSpheres(int nSpheres, const AffineTransform* transformsIn, const BoundingSphere* spheresIn, BoundingSphere* spheresOut);
+
+// A sphere containing all of them, merged pairwise in a tree rather than one after the other, so the merges within a
+//   round are independent of each other and errors don't pile up along a chain. Overwrites the spheres
+BoundingSphere mergeBoundingSpheres(int nSpheres, BoundingSphere* spheres);
+
 // Build Delaunay triangulation of 2D positions
 // Bowyer-Watson Algorithm
 // https://en.wikipedia.org/wiki/Bowyer%E2%80%93Watson_algorithm
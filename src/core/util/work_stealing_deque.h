@@ -0,0 +1,138 @@
+#ifndef WORK_STEALING_DEQUE_H_
+#define WORK_STEALING_DEQUE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * Chase-Lev work-stealing deque
+ * The owning thread pushes and pops at the bottom (LIFO), any other thread may steal from the top (FIFO).
+ * Implementation follows Le, Pop, Cohen and Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak Memory Models" (PPoPP 2013)
+ * T must be trivially copyable and lock-free as a std::atomic<T>; in practice it is used with pointers.
+ * The ring buffer grows when full. Old buffers may still be read by in-flight thieves, so they are retired rather than
+ *   freed, and only released when the deque is destroyed.
+**/
+template <typename T>
+class WorkStealingDeque {
+
+public:
+
+    explicit WorkStealingDeque(int64_t initialCapacity = 256) :
+        m_top(0),
+        m_bottom(0),
+        m_pArray(new Array(initialCapacity)),
+        m_retiredArrays()
+    {
+
+    }
+
+    ~WorkStealingDeque() {
+        delete m_pArray.load(std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // Owner thread only
+    void push(T item) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+        Array* pArray = m_pArray.load(std::memory_order_relaxed);
+        if (b - t > pArray->capacity - 1) {
+            pArray = grow(pArray, b, t);
+        }
+        pArray->put(b, item);
+        m_bottom.store(b + 1, std::memory_order_release);
+    }
+
+    // Owner thread only
+    bool pop(T& item) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        Array* pArray = m_pArray.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            // Empty
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        item = pArray->get(b);
+        if (t == b) {
+            // Last item, race against thieves for it
+            bool won = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Any thread
+    // May fail spuriously when racing another thief or the owner for the same item
+    bool steal(T& item) {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+
+        if (t >= b) return false;
+
+        Array* pArray = m_pArray.load(std::memory_order_acquire);
+        item = pArray->get(t);
+        return m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    // Approximate when called from any thread other than the owner
+    bool empty() const {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        return b <= t;
+    }
+
+private:
+
+    struct Array {
+        int64_t capacity;
+        int64_t mask;
+        std::unique_ptr<std::atomic<T>[]> items;
+
+        explicit Array(int64_t capacity) :
+            capacity(capacity),
+            mask(capacity - 1),
+            items(new std::atomic<T>[capacity])
+        {
+
+        }
+
+        T get(int64_t i) const {
+            return items[i & mask].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t i, T item) {
+            items[i & mask].store(item, std::memory_order_relaxed);
+        }
+    };
+
+    // Keep top and bottom on separate cache lines, since thieves hammer top while the owner works on bottom
+    alignas(64) std::atomic<int64_t> m_top;
+    alignas(64) std::atomic<int64_t> m_bottom;
+    alignas(64) std::atomic<Array*> m_pArray;
+
+    std::vector<std::unique_ptr<Array>> m_retiredArrays;
+
+    Array* grow(Array* pArray, int64_t bottom, int64_t top) {
+        Array* pNewArray = new Array(pArray->capacity * 2);
+        for (int64_t i = top; i != bottom; ++i) {
+            pNewArray->put(i, pArray->get(i));
+        }
+        m_retiredArrays.emplace_back(pArray);
+        m_pArray.store(pNewArray, std::memory_order_release);
+        return pNewArray;
+    }
+
+};
+
+#endif // WORK_STEALING_DEQUE_H_
@@ -31,14 +31,27 @@ class FileDialog {
 public:
 
     static bool open(std::string& fileName, AppWindow* pWindow) {
+        return run(fileName, pWindow, false);
+    }
+
+    // Asks before overwriting an existing file
+    static bool save(std::string& fileName, AppWindow* pWindow) {
+        return run(fileName, pWindow, true);
+    }
+
+private:
+
+    static bool run(std::string& fileName, AppWindow* pWindow, bool saving) {
         bool hasFile = false;
 
         #if defined(__linux__)
         static Gtk::Main gtkMain;
-        Gtk::FileChooserDialog fileDialog("Import");
+        Gtk::FileChooserDialog fileDialog(saving ? "Save" : "Import",
+                                          saving ? Gtk::FILE_CHOOSER_ACTION_SAVE : Gtk::FILE_CHOOSER_ACTION_OPEN);
 
         fileDialog.add_button("Cancel", GTK_RESPONSE_CLOSE);
-        fileDialog.add_button("Open", GTK_RESPONSE_OK);
+        fileDialog.add_button(saving ? "Save" : "Open", GTK_RESPONSE_OK);
+        if (saving) fileDialog.set_do_overwrite_confirmation(true);
 
         struct FileDialogAction {
             Gtk::FileChooserDialog& fileDialog;
@@ -147,6 +160,9 @@ EditorGUI::EditorGUI() :
 }
 
 EditorGUI::~EditorGUI() {
+    for (auto& drawLists : m_frameDrawLists) {
+        for (ImDrawList* pDrawList : drawLists) IM_DELETE(pDrawList);
+    }
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext(ImGui::GetCurrentContext());
@@ -303,9 +319,7 @@ void EditorGUI::drawTransformGizmo() {
 
         if (m_selectedEntity.hasComponent<Component::Parent>()) {
             Entity parent = m_selectedEntity.getComponent<Component::Parent>().entity;
-            if (parent.hasComponent<Component::Transform>()) {
-                worldMatrix = parent.getComponent<Component::Transform>().world;
-            }
+            worldMatrix = parent.getWorldTransform();
         }
 
         if (m_transformInputGizmo == 0) {
@@ -412,24 +426,9 @@ void EditorGUI::updateEntityTransform() {
         return;
     }
 
-    glm::mat4& localTfm = m_selectedEntity.getComponent<Component::Transform>().local;
-
-    m_entityTransform.position = localTfm[3];
-
-    glm::vec3& scale = m_entityTransform.scale;
-
-    glm::mat3 rotationOnly = glm::mat3(localTfm);
-    scale.x = glm::length(rotationOnly[0]);
-    rotationOnly[0] = rotationOnly[0] / scale.x;
-    rotationOnly[1] = rotationOnly[1] - glm::dot(rotationOnly[0], rotationOnly[1]) * rotationOnly[0];
-    scale.y = glm::length(rotationOnly[1]);
-    rotationOnly[1] = rotationOnly[1] / scale.y;
-    rotationOnly[2] = rotationOnly[2] - glm::dot(rotationOnly[0], rotationOnly[2]) * rotationOnly[0];
-    rotationOnly[2] = rotationOnly[2] - glm::dot(rotationOnly[1], rotationOnly[2]) * rotationOnly[1];
-    scale.z = glm::length(rotationOnly[2]);
-    rotationOnly[2] = rotationOnly[2] / scale.z;
-
-    m_entityTransform.rotation = glm::toQuat(rotationOnly);
+    m_entityTransform.position = m_selectedEntity.getLocalTranslation();
+    m_entityTransform.rotation = m_selectedEntity.getLocalRotation();
+    m_entityTransform.scale = m_selectedEntity.getLocalScale();
     m_entityTransform.rotationEuler = glm::degrees(glm::eulerAngles(m_entityTransform.rotation));
 
     m_entityTransform.entity = m_selectedEntity;
@@ -440,11 +439,7 @@ void EditorGUI::updateEntityTransform() {
 void EditorGUI::applyEntityTransform() {
     if (m_entityTransform.entity != m_selectedEntity) return;
 
-    m_selectedEntity.getComponent<Component::Transform>().local =
-        glm::translate(glm::mat4(1.0f), m_entityTransform.position) *
-        glm::toMat4(m_entityTransform.rotation) *
-        glm::scale(glm::mat4(1.0f), m_entityTransform.scale);
-    m_selectedEntity.addComponent<Component::Transform::DirtyFlag>();
+    m_selectedEntity.setLocalTransform(m_entityTransform.position, m_entityTransform.rotation, m_entityTransform.scale);
 }
 
 void EditorGUI::drawEntityInfo() {
@@ -511,6 +506,7 @@ void EditorGUI::drawEntityInfo() {
                     m_pWindow->releaseContext();
                     //entity.getComponent<Component::RenderableID>().id = m_pScene->addRenderable(Renderable().setModel(pModel));
                     rc.pModel = pModel.get();
+                    entity.markComponentUpdated<Component::Renderable>();
                     m_pSelectedModel = pModel.get();
                 }
             }
@@ -520,11 +516,13 @@ void EditorGUI::drawEntityInfo() {
                     if (modelName.empty()) modelName = "Untitled model";
                     if (ImGui::MenuItem(modelName.c_str(), nullptr, (rc.pModel == pModel.get()))) {
                         rc.pModel = pModel.get();
+                        entity.markComponentUpdated<Component::Renderable>();
                         m_pSelectedModel = pModel.get();
                     }
                 }
                 if (ImGui::MenuItem("None", nullptr, !rc.pModel)) {
                     rc.pModel = nullptr;
+                    entity.markComponentUpdated<Component::Renderable>();
                     m_pSelectedModel = nullptr;
                 }
                 ImGui::EndPopup();
@@ -929,7 +927,8 @@ static bool drawMeshBuilderNodes(MeshBuilderNodes& nodes) {
 
 static Entity instantiateAssetNode(const Asset::Node* pNode, GameWorld* pGameWorld, Scene* pScene, std::unordered_map<const SkeletonDescription*, Skeleton*>& pSkeletonMap) {
     Entity entity = pGameWorld->createEntity();
-    entity.addComponent<Component::Transform>().local = pNode->transform;
+    entity.addComponent<Component::Transform>();
+    entity.setLocalTransform(pNode->transform);
     entity.addComponent<Component::Name>().str = pNode->name;
     if (pNode->pModel) {
         Skeleton* pSkeleton = nullptr;
@@ -967,18 +966,8 @@ static Entity duplicateEntity(const Entity entity, GameWorld* pGameWorld, Scene*
             entity.getComponent<Component::Name>().str + " duplicate";
     }
     if (entity.hasComponent<Component::Transform>()) {
-        // Cache the transform because for some reason the line:
-        // e.addComponent<Component::Transform>().local = entity.getComponent<Component::Transform>().local
-        // Was causing heap-use-after-free corruption
-        // I can't say for sure why but one guess is the compiler decided to grab a reference to
-        // entity.getComponent() before calling e.addComponent() (which eventually calls vector::emplace and potentially reallocates the heap buffer)
-        // and didn't realize the pointer would be invalidated by reallocation
-        // Maybe as an optimization it was able to get the reference and hang onto it when determining if the component exists?
-        // I don't know if this makes sense also I find it suspicious this part only seems to break while similar lines (see the Name section above)
-        // continue to work. Also, this definitely used to work at one point so I'm double suspicious. Might actually be memory corruption elsewhere
-        // Anyway the way you see here has been working and does the same thing, soo..
-        glm::mat4 local = entity.getComponent<Component::Transform>().local;
-        e.addComponent<Component::Transform>().local = local;
+        e.addComponent<Component::Transform>();
+        e.setLocalTransform(entity.getLocalTranslation(), entity.getLocalRotation(), entity.getLocalScale());
     }
     if (entity.hasComponent<Component::Renderable>()) {
         Component::Renderable& new_rc = e.addComponent<Component::Renderable>();
@@ -1010,10 +999,37 @@ static Entity duplicateEntity(const Entity entity, GameWorld* pGameWorld, Scene*
     return duplicateEntity(entity, pGameWorld, pScene, skeletonMap);
 }
 
+static bool isJSONFile(const std::string& fileName) {
+    std::string extStr(std::filesystem::path(fileName).extension());
+    std::transform(extStr.begin(), extStr.end(), extStr.begin(), [] (auto c) { return std::tolower(c); });
+    return extStr == ".json";
+}
+
+// Models are identified in world files by their mesh's name. Same-named ones are told apart by their order
+WorldResources EditorGUI::getWorldResources() {
+    WorldResources resources;
+    for (auto& pModel : m_pResManager->pModels) {
+        std::string name = pModel->getMesh() ? pModel->getMesh()->getName() : "";
+        uint64_t id = WorldResources::hashName(name);
+        for (int k = 1; !resources.addModel(id, pModel.get()); ++k) {
+            id = WorldResources::hashName(name + "#" + std::to_string(k));
+        }
+    }
+    Scene* pScene = m_pScene;
+    resources.setSkeletonFactory([pScene] (const SkeletonDescription* pDescription) {
+        return pScene->addSkeleton(pDescription);
+    });
+    resources.setSkeletonDestroyer([pScene] (Skeleton* pSkeleton) {
+        pScene->removeSkeleton(pSkeleton);
+    });
+    return resources;
+}
+
 void EditorGUI::update() {
     float menuHeight = 0.0f;
 
     bool importError = false;
+    bool worldFileError = false;
     if (ImGui::BeginMainMenuBar()) {
         menuHeight = ImGui::GetWindowHeight();
         if (ImGui::BeginMenu("File")) {
@@ -1051,6 +1067,39 @@ void EditorGUI::update() {
                     importError = (loadAnimationStateGraph(fileName, m_pResManager) == nullptr);
                 }
             }
+            ImGui::Separator();
+            if (ImGui::MenuItem("Open World")) {
+                std::string fileName;
+                if (FileDialog::open(fileName, m_pWindow)) {
+                    WorldResources resources = getWorldResources();
+                    try {
+                        if (isJSONFile(fileName)) {
+                            WorldFile::loadJSON(m_pGameWorld, resources, fileName);
+                        } else {
+                            WorldFile::load(m_pGameWorld, resources, fileName);
+                        }
+                    } catch (const std::runtime_error& e) {
+                        std::cerr << e.what() << std::endl;
+                        worldFileError = true;
+                    }
+                }
+            }
+            if (ImGui::MenuItem("Save World")) {
+                std::string fileName;
+                if (FileDialog::save(fileName, m_pWindow)) {
+                    WorldResources resources = getWorldResources();
+                    try {
+                        if (isJSONFile(fileName)) {
+                            WorldFile::saveJSON(m_pGameWorld, resources, fileName);
+                        } else {
+                            WorldFile::save(m_pGameWorld, resources, fileName);
+                        }
+                    } catch (const std::runtime_error& e) {
+                        std::cerr << e.what() << std::endl;
+                        worldFileError = true;
+                    }
+                }
+            }
             ImGui::EndMenu();
         }
         ImGui::EndMainMenuBar();
@@ -1066,6 +1115,17 @@ void EditorGUI::update() {
         }
         ImGui::EndPopup();
     }
+    if (worldFileError) ImGui::OpenPopup("World File Error");
+    if (ImGui::BeginPopupModal("World File Error", nullptr,
+                               ImGuiWindowFlags_AlwaysAutoResize |
+                               ImGuiWindowFlags_NoResize |
+                               ImGuiWindowFlags_NoMove)) {
+        ImGui::Text("Failed to open or save the world. See the log for details.");
+        if (ImGui::Button("Bummer")) {
+            ImGui::CloseCurrentPopup();
+        }
+        ImGui::EndPopup();
+    }
 
     ImGuiWindowFlags metaWindowFlags =
         //ImGuiWindowFlags_NoBackground |
@@ -1107,15 +1167,53 @@ void EditorGUI::update() {
 
     //ImGui::ShowDemoWindow();
 
+    copyDrawData();
+}
+
+void EditorGUI::copyDrawData() {
+    ImGui::Render();
+    const ImDrawData* pDrawData = ImGui::GetDrawData();
+
+    uint32_t frame = m_numFramesUpdated % 2;
+    std::vector<ImDrawList*>& drawLists = m_frameDrawLists[frame];
+    for (ImDrawList* pDrawList : drawLists) IM_DELETE(pDrawList);
+    drawLists.clear();
+    for (int i = 0; i < pDrawData->CmdListsCount; ++i) {
+        drawLists.push_back(pDrawData->CmdLists[i]->CloneOutput());
+    }
+
+    if (!m_pFrameDrawData[frame]) m_pFrameDrawData[frame] = std::make_unique<ImDrawData>();
+    *m_pFrameDrawData[frame] = *pDrawData;
+    m_pFrameDrawData[frame]->CmdLists = drawLists.data();
+
+    ++m_numFramesUpdated;
 }
 
 void EditorGUI::render() {
+    // Each update() is followed by one render(), though the next update() may come first
+    ImDrawData* pDrawData = m_pFrameDrawData[m_numFramesRendered % 2].get();
+    ++m_numFramesRendered;
+    if (!pDrawData) return;
+
     m_pWindow->acquireContext();
-    ImGui::Render();
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    ImGui_ImplOpenGL3_RenderDrawData(pDrawData);
     m_pWindow->releaseContext();
 }
 
+void EditorGUI::applyRenderChanges() {
+    if (m_viewportWidth > 0.0f && m_viewportHeight > 0.0f) {
+        m_pRenderer->setViewport(static_cast<uint32_t>(m_viewportWidth), static_cast<uint32_t>(m_viewportHeight));
+    }
+
+    if (m_pEditedMaterial) {
+        *m_pEditedMaterial = m_editedMaterial;
+        m_pEditedMaterial = nullptr;
+    }
+
+    for (auto& change : m_renderChanges) change();
+    m_renderChanges.clear();
+}
+
 void EditorGUI::initialize() {
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -1420,9 +1518,9 @@ void EditorGUI::centerPanel() {
         }
     }
 
-    m_pWindow->acquireContext();
-    m_pRenderer->setViewport(windowSize.x, windowSize.y);
-    m_pWindow->releaseContext();
+    // The last frame may still be rendering, so the renderer is resized before the next, in applyRenderChanges()
+    m_viewportWidth = windowSize.x;
+    m_viewportHeight = windowSize.y;
     m_pScene->getActiveCamera()->setAspectRatio(windowSize.x / windowSize.y);
 
     ImGui::Image((void*)(uintptr_t)m_pRenderer->getRenderTexture()->getHandle(), windowSize, ImVec2(0, 1), ImVec2(1, 0));
@@ -1513,12 +1611,12 @@ void EditorGUI::rightPanel() {
                     if (drawMeshBuilderNodes(m_modelMeshBuilderNodes[pModel])) {
                         mb.clear();
                         mb.executeNodes(m_modelMeshBuilderNodes[pModel]);
-                        m_pWindow->acquireContext();
-                        pModel->getMesh()->createFromMeshData(mb.getExternMeshData());
+                        m_renderChanges.push_back([pModel, &mb] {
+                            pModel->getMesh()->createFromMeshData(mb.getExternMeshData());
+                        });
                         pModel->setBoundingSphere(mb.getMeshData().computeBoundingSphere());
                         if (m_selectedEntity.isValid())
                             m_selectedEntity.updateComponent<Component::Renderable>().pModel = pModel;
-                        m_pWindow->releaseContext();
                     }
 
                     ImGui::TreePop();
@@ -1530,19 +1628,30 @@ void EditorGUI::rightPanel() {
                 if (ImGui::Button("Select")) ImGui::OpenPopup("Select Material");
 
                 if (!pMaterial) {
-                    if (ImGui::Button("New")) pModel->setMaterial(m_pResManager->pMaterials.emplace_back(std::make_unique<Material>()).get());
+                    if (ImGui::Button("New")) {
+                        Material* pNewMaterial = m_pResManager->pMaterials.emplace_back(std::make_unique<Material>()).get();
+                        m_renderChanges.push_back([pModel, pNewMaterial] { pModel->setMaterial(pNewMaterial); });
+                    }
                 } else {
-                    drawMaterialInfo(pMaterial, m_pResManager);
+                    // The material is edited as a copy, put in place by applyRenderChanges()
+                    if (m_pEditedMaterial != pMaterial) m_editedMaterial = *pMaterial;
+                    m_pEditedMaterial = pMaterial;
+                    ImGui::PushID(pMaterial);
+                    drawMaterialInfo(&m_editedMaterial, m_pResManager);
+                    ImGui::PopID();
                 }
 
                 if (ImGui::BeginPopup("Select Material")) {
                     for (auto& pMat : m_pResManager->pMaterials) {
                         std::string name = pMat->getName();
                         if (name.empty()) name = "Untitled material";
-                        if (ImGui::MenuItem(name.c_str(), nullptr, pMat.get() == pMaterial))
-                            pModel->setMaterial(pMat.get());
+                        if (ImGui::MenuItem(name.c_str(), nullptr, pMat.get() == pMaterial)) {
+                            m_renderChanges.push_back([pModel, pMat = pMat.get()] { pModel->setMaterial(pMat); });
+                        }
+                    }
+                    if (ImGui::MenuItem("None", nullptr, !pMaterial)) {
+                        m_renderChanges.push_back([pModel] { pModel->setMaterial(nullptr); });
                     }
-                    if (ImGui::MenuItem("None", nullptr, !pMaterial)) pModel->setMaterial(nullptr);
                     ImGui::EndPopup();
                 }
                 ImGui::TreePop();
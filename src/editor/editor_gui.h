@@ -1,11 +1,15 @@
 #ifndef EDITOR_GUI_H_INCLUDED
 #define EDITOR_GUI_H_INCLUDED
 
+#include <functional>
 #include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "core/ecs/entity.h"
 #include "core/ecs/game_world.h"
+#include "core/ecs/world_file.h"
 #include "core/render/renderer.h"
 #include "core/scene/scene.h"
 #include "core/app/window.h"
@@ -13,6 +17,9 @@
 #include "core/util/mesh_builder.h"
 #include "core/animation/animation_system.h"
 
+struct ImDrawData;
+struct ImDrawList;
+
 class EditorGUI {
 
 public:
@@ -43,10 +50,16 @@ public:
 
     void beginFrame();
 
+    // Also ends the ImGui frame, keeping a copy of its draw data for render()
     void update();
 
+    // Draw the GUI of the oldest updated frame not drawn yet. The next frame may be updated in the meantime
     void render();
 
+    // Make the changes update() left for between frames, to what the render jobs read: the renderer's viewport size,
+    //   materials, and models' meshes and materials. Call with the GL context, the renderer's jobs must not be running
+    void applyRenderChanges();
+
 
 private:
 
@@ -90,6 +103,24 @@ private:
 
     bool m_initialized = false;
 
+    // ImGui reuses its draw lists in the next NewFrame(), which can come before the last frame has been drawn, so each
+    //   frame's draw lists are copied. Up to two frames are in flight at once
+    std::vector<ImDrawList*> m_frameDrawLists[2];
+    std::unique_ptr<ImDrawData> m_pFrameDrawData[2];
+    uint32_t m_numFramesUpdated = 0;
+    uint32_t m_numFramesRendered = 0;
+
+    float m_viewportWidth = 0.0f;
+    float m_viewportHeight = 0.0f;
+
+    // The selected model's material, as edited in the last update()
+    Material* m_pEditedMaterial = nullptr;
+    Material m_editedMaterial;
+
+    std::vector<std::function<void()>> m_renderChanges;
+
+    void copyDrawData();
+
     void initialize();
 
     void updateEntityTransform();
@@ -97,6 +128,8 @@ private:
     void drawTransformGizmo();
     void drawEntityInfo();
 
+    WorldResources getWorldResources();
+
     void leftPanel();
     void centerPanel();
     void rightPanel();
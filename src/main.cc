@@ -1,6 +1,7 @@
 #include <iostream>
 
 #include <exception>
+#include <fstream>
 #include <algorithm>
 #include <memory>
 #include <sstream>
@@ -14,13 +15,16 @@
 
 #include "core/animation/animation_system.h"
 #include "core/audio/audio.h"
+#include "core/ecs/components.h"
 #include "core/ecs/entity.h"
 #include "core/job_scheduler.h"
 #include "core/physics/physics.h"
+#include "core/render/render_snapshot.h"
 #include "core/render/renderer.h"
 #include "core/resources/resource_manager.h"
 #include "core/resources/resource_load.h"
 #include "core/scene/scene.h"
+#include "core/system_registry.h"
 #include "core/util/mesh_builder.h"
 #include "core/util/timer.h"
 
@@ -541,8 +545,15 @@ int main() {
     //CharacterInputState inputState;
     //pApp->getInputManager()->addInputContext(new CharacterInputContext(&inputState));
 
+    // Tracing is left on so the last few frames can be written out whenever something looks slow, see F12 below
+    // One core is left to the main thread, which runs jobs itself while it waits on the frame
+    JobScheduler::InitParameters schedulerParameters;
+    schedulerParameters.enableTracing = true;
+    schedulerParameters.numReservedThreads = 1;
+
     auto pScheduler = std::make_unique<JobScheduler>();
-    pScheduler->spawnThreads();
+    pScheduler->spawnThreads(schedulerParameters);
+    pScheduler->getTracer().setThreadName("Main");
 
     pApp->getWindow()->acquireContext();
     //pApp->getWindow()->setVSyncInterval(1);
@@ -564,12 +575,14 @@ int main() {
 
     // Game World
     auto pGameWorld = std::make_unique<GameWorld>();
+    pGameWorld->setJobScheduler(pScheduler.get());
 //    pGameWorld->setPhysics(pPhysics);
 //    pGameWorld->setScene(pScene);
 
     // Animation
     auto pAnimation = std::make_unique<AnimationSystem>();
     pAnimation->setResourceManager(pResManager.get());
+    pAnimation->setJobScheduler(pScheduler.get());
 
     /*pApp->getWindow()->setFramebufferSizeCallback([&] (int width, int height) {
         pApp->getWindow()->acquireContext();
@@ -626,7 +639,6 @@ int main() {
     Renderer::RendererJobParam rParam = {};
     rParam.pRenderer = pRenderer.get();
     //rParam.pScene = pScene;
-    rParam.pGameWorld = pGameWorld.get();
     rParam.pWindow = pApp->getWindow();
     rParam.pScheduler = pScheduler.get();
     rParam.signalCounterHandle = pScheduler->getCounterByID("pr");
@@ -642,24 +654,30 @@ int main() {
         preRenderDecl,
         renderDecl;
 
+    updateDecl.name = "FrameUpdate";
     updateDecl.param = reinterpret_cast<uintptr_t>(&uParam);
     updateDecl.pFunction = FrameUpdateJob;
     updateDecl.signalCounters[0] = pScheduler->getCounterByID("u");
     updateDecl.numSignalCounters = 1;
 
+    preRenderDecl.name = "PreRender";
     preRenderDecl.param = reinterpret_cast<uintptr_t>(&rParam);
     preRenderDecl.pFunction = Renderer::preRenderJob;
     preRenderDecl.signalCounters[0] = pScheduler->getCounterByID("pr"); //pParam->renderCounter[pParam->frame];
     preRenderDecl.numSignalCounters = 1;
-    preRenderDecl.waitCounter = pScheduler->getCounterByID("clear_buffer");
+    preRenderDecl.waitCounters[0] = pScheduler->getCounterByID("clear_buffer");
+    preRenderDecl.numWaitCounters = 1;
 
+    renderDecl.name = "Render";
     renderDecl.param = reinterpret_cast<uintptr_t>(&rParam);
     renderDecl.pFunction = Renderer::renderJob;
     renderDecl.signalCounters[0] = renderCounters[0]; //pParam->renderCounter[pParam->frame];
     renderDecl.numSignalCounters = 1;
-    renderDecl.waitCounter = pScheduler->getCounterByID("pr");
+    renderDecl.waitCounters[0] = pScheduler->getCounterByID("pr");
+    renderDecl.numWaitCounters = 1;
 
     JobScheduler::JobDeclaration clearBufferDecl;
+    clearBufferDecl.name = "ClearBuffer";
     clearBufferDecl.numSignalCounters = 2;
     clearBufferDecl.signalCounters[0] = pScheduler->getCounterByID("clear_buffer"); //pScheduler->getFreeCounter();
     clearBufferDecl.signalCounters[1] = renderCounters[0];
@@ -672,9 +690,11 @@ int main() {
     };
 
     JobScheduler::JobDeclaration swapBuffersDecl;
+    swapBuffersDecl.name = "SwapBuffers";
     swapBuffersDecl.numSignalCounters = 1;
     swapBuffersDecl.signalCounters[0] = pScheduler->getCounterByID("swap_buffers"); //pScheduler->getFreeCounter();
-    swapBuffersDecl.waitCounter = renderCounters[0];
+    swapBuffersDecl.waitCounters[0] = renderCounters[0];
+    swapBuffersDecl.numWaitCounters = 1;
     swapBuffersDecl.param = reinterpret_cast<uintptr_t>(pApp->getWindow());
     swapBuffersDecl.pFunction = [] (uintptr_t param) {
         AppWindow* pWindow = reinterpret_cast<AppWindow*>(param);
@@ -683,10 +703,12 @@ int main() {
         pWindow->releaseContext();
     };
 
+    // The GUI keeps a copy of each frame's draw data, so the next frame can begin while the last is still being drawn
+    // Its edits to what the render jobs read, like materials, wait for applyRenderChanges() between frames
     JobScheduler::JobDeclaration editorGuiBeginDecl;
+    editorGuiBeginDecl.name = "EditorGuiBegin";
     editorGuiBeginDecl.numSignalCounters = 1;
     editorGuiBeginDecl.signalCounters[0] = pScheduler->getCounterByID("begin_gui"); //pScheduler->getFreeCounter();
-    editorGuiBeginDecl.waitCounter = swapBuffersDecl.signalCounters[0];
     editorGuiBeginDecl.param = reinterpret_cast<uintptr_t>(pEditorGUI.get());
     editorGuiBeginDecl.pFunction = [] (uintptr_t param) {
         EditorGUI* pEditorGUI = reinterpret_cast<EditorGUI*>(param);
@@ -694,10 +716,11 @@ int main() {
     };
 
     JobScheduler::JobDeclaration editorGuiUpdateDecl;
-    editorGuiUpdateDecl.numSignalCounters = 2;
+    editorGuiUpdateDecl.name = "EditorGuiUpdate";
+    editorGuiUpdateDecl.numSignalCounters = 1;
     editorGuiUpdateDecl.signalCounters[0] = pScheduler->getCounterByID("update_gui"); //pScheduler->getFreeCounter();
-    editorGuiUpdateDecl.signalCounters[1] = pScheduler->getCounterByID("render_gui"); //pScheduler->getFreeCounter();
-    editorGuiUpdateDecl.waitCounter = editorGuiBeginDecl.signalCounters[0];
+    editorGuiUpdateDecl.waitCounters[0] = editorGuiBeginDecl.signalCounters[0];
+    editorGuiUpdateDecl.numWaitCounters = 1;
     editorGuiUpdateDecl.param = reinterpret_cast<uintptr_t>(pEditorGUI.get());
     editorGuiUpdateDecl.pFunction = [] (uintptr_t param) {
         EditorGUI* pEditorGUI = reinterpret_cast<EditorGUI*>(param);
@@ -705,20 +728,94 @@ int main() {
     };
 
     JobScheduler::JobDeclaration editorGuiRenderDecl;
+    editorGuiRenderDecl.name = "EditorGuiRender";
     editorGuiRenderDecl.numSignalCounters = 1;
     editorGuiRenderDecl.signalCounters[0] = renderCounters[0];
-    editorGuiRenderDecl.waitCounter = editorGuiUpdateDecl.signalCounters[1]; //pScheduler->getFreeCounter();
+    editorGuiRenderDecl.waitCounters[0] = pScheduler->getCounterByID("render_gui"); //pScheduler->getFreeCounter();
+    editorGuiRenderDecl.numWaitCounters = 1;
     editorGuiRenderDecl.param = reinterpret_cast<uintptr_t>(pEditorGUI.get());
     editorGuiRenderDecl.pFunction = [] (uintptr_t param) {
         EditorGUI* pEditorGUI = reinterpret_cast<EditorGUI*>(param);
         pEditorGUI->render();
     };
 
-    updateDecl.waitCounter = editorGuiUpdateDecl.signalCounters[0];
-    preRenderDecl.waitCounter = updateDecl.signalCounters[0];
-    renderDecl.signalCounters[renderDecl.numSignalCounters++] = editorGuiRenderDecl.waitCounter;
-    clearBufferDecl.signalCounters[clearBufferDecl.numSignalCounters++] = editorGuiRenderDecl.waitCounter;
-
+    // The render jobs don't wait on the update, the frame's snapshot is only captured after it. The next frame's update
+    //   may well be running by the time they start
+    updateDecl.waitCounters[0] = editorGuiUpdateDecl.signalCounters[0];
+    updateDecl.numWaitCounters = 1;
+    renderDecl.signalCounters[renderDecl.numSignalCounters++] = editorGuiRenderDecl.waitCounters[0];
+    clearBufferDecl.signalCounters[clearBufferDecl.numSignalCounters++] = editorGuiRenderDecl.waitCounters[0];
+
+    // The rest of the frame's update. Each system is a job, and runs alongside the others unless they share data
+    // The order systems are added in is the order they run in where they do
+    double frameDt = 0.0;
+    SystemRegistry systems;
+
+    SystemRegistry::ResourceID skeletonsID = systems.getResourceID("Skeletons");
+    SystemRegistry::ResourceID physicsID = systems.getResourceID("Physics");
+    SystemRegistry::ResourceID boundsTreeID = systems.getResourceID("BVH");
+    SystemRegistry::ResourceID cameraID = systems.getResourceID("Camera");
+    SystemRegistry::ResourceID audioID = systems.getResourceID("Audio");
+
+    SystemRegistry::SystemHandle animationSystem = systems.addSystem("Animation",
+        [pAnimation = pAnimation.get(), pDt = &frameDt] {
+            pAnimation->processStateUpdates(static_cast<float>(*pDt));
+            pAnimation->applyPosesToSkeletons();
+        });
+    systems.addWrite(animationSystem, skeletonsID);
+
+    // TODO: Jobify physics update
+    SystemRegistry::SystemHandle physicsSystem = systems.addSystem("Physics",
+        [pPhysics = pPhysics.get(), pDt = &frameDt] {
+            pPhysics->update(static_cast<float>(*pDt));
+        });
+    systems.addWrite(physicsSystem, physicsID);
+
+    SystemRegistry::SystemHandle postPhysicsSystem = systems.addSystem("PostPhysics",
+        [pGameWorld = pGameWorld.get()] {
+            pGameWorld->postPhysicsUpdate();
+        });
+    systems.addRead(postPhysicsSystem, physicsID);
+    systems.addComponentReads<Component::RigidBodyID>(postPhysicsSystem);
+    systems.addComponentWrites<Component::Transform, Component::Transform::DirtyFlag>(postPhysicsSystem);
+
+    // Late update systems go here
+
+    // Entity changes recorded by jobs during the update
+    SystemRegistry::SystemHandle playbackSystem = systems.addSystem("PlaybackCommands",
+        [pGameWorld = pGameWorld.get()] {
+            pGameWorld->playbackCommands();
+        });
+    systems.setExclusive(playbackSystem);
+
+    SystemRegistry::SystemHandle preRenderUpdateSystem = systems.addSystem("PreRenderUpdate",
+        [pGameWorld = pGameWorld.get()] {
+            pGameWorld->preRenderUpdate();
+        });
+    systems.addComponentReads<Component::Renderable, Component::Parent, Component::Children>(preRenderUpdateSystem);
+    systems.addComponentWrites<Component::Transform, Component::Transform::DirtyFlag, PointLight,
+                               Component::RenderBucketID, Component::RenderBucketID::DirtyFlag>(preRenderUpdateSystem);
+
+    SystemRegistry::SystemHandle boundingSpheresSystem = systems.addSystem("UpdateBoundingSpheres",
+        [pGameWorld = pGameWorld.get()] {
+            pGameWorld->updateBoundingSpheres();
+            //pScene->computeBoundingSpheres();
+        });
+    systems.addRead(boundingSpheresSystem, skeletonsID);
+    systems.addComponentReads<Component::Renderable, Component::Transform>(boundingSpheresSystem);
+    systems.addComponentWrites<BoundingSphere, Component::BVHProxy>(boundingSpheresSystem);
+    systems.addWrite(boundingSpheresSystem, boundsTreeID);
+
+    // TODO: Jobify audio update
+    SystemRegistry::SystemHandle audioSystem = systems.addSystem("Audio",
+        [pScene = pScene.get()] {
+            Audio::setListenerInverseTransform(pScene->getActiveCamera()->calculateViewMatrix());
+            Audio::update(false);
+        });
+    systems.addRead(audioSystem, cameraID);
+    systems.addWrite(audioSystem, audioID);
+
+    JobScheduler::CounterHandle systemsCounter = pScheduler->getCounterByID("systems");
 
     int frame = 0;
     bool pause = false;
@@ -729,6 +826,14 @@ int main() {
 
     double longestFrame = 0.0;
 
+    bool traceKeyDown = false;
+
+    // Frames are pipelined: once a frame's render jobs are enqueued, the next frame is simulated while they run
+    // The render jobs only read the frame's snapshot, captured at the end of its simulation. There are two, so the
+    //   next frame's can be captured while the last is rendered
+    RenderSnapshot renderSnapshots[2];
+    bool frameInFlight = false;
+
     // Main Loop
     while (pApp->isRunning()) {
         // Input handling
@@ -762,6 +867,16 @@ int main() {
             break;
         }
 
+        // Write the last frames' jobs for chrome://tracing or ui.perfetto.dev
+        bool traceKeyWasDown = traceKeyDown;
+        traceKeyDown = (glfwGetKey(pApp->getWindow()->getHandle(), GLFW_KEY_F12) == GLFW_PRESS);
+        if (traceKeyDown && !traceKeyWasDown) {
+            std::string traceFile = "job_trace.json";
+            std::ofstream traceStream(traceFile);
+            pScheduler->writeTrace(traceStream, 60);
+            std::cout << "Wrote job trace: '" << traceFile << "'" << std::endl;
+        }
+
         // Game timers update
         double time = glfwGetTime();
         double dt = time - lastFrameTime;
@@ -788,29 +903,34 @@ int main() {
         // Send game state update job to scheduler
         pScheduler->enqueueJob(updateDecl);
 
-        pScheduler->waitForCounter(updateDecl.signalCounters[0]);
+        pScheduler->waitForCounterAndHelp(updateDecl.signalCounters[0]);
 
-        // Animation update
-        pAnimation->processStateUpdates(dt);
-        pAnimation->applyPosesToSkeletons();
+        frameDt = dt;
+        systems.run(pScheduler.get(), systemsCounter);
+        pScheduler->waitForCounterAndHelp(systemsCounter);
 
-        // TODO: Jobify physics update
-        pPhysics->update(dt);
-        pGameWorld->postPhysicsUpdate();
+        renderSnapshots[frame].capture(pGameWorld.get(), pScene->getActiveCamera(),
+                                       &pScene->getDirectionalLight(), pScene->getAmbientLightIntensity());
 
-        // Late update callbacks go here
+        // The renderer's passes aren't double-buffered, so the last frame has to be on screen before this one's
+        //   render jobs start
+        if (frameInFlight) {
+            pScheduler->waitForCounterAndHelp(swapBuffersDecl.signalCounters[0]);
 
-        pGameWorld->preRenderUpdate();
-        pGameWorld->updateBoundingSpheres();
-        //pScene->computeBoundingSpheres();
+            Timer::incrementFrame();
+            pScheduler->getTracer().markFrame();
+        }
 
-        rParam.pDirectionalLight = &pScene->getDirectionalLight();
-        rParam.ambientLightIntensity = pScene->getAmbientLightIntensity();
-        rParam.pCamera = pScene->getActiveCamera();
+        pApp->getWindow()->acquireContext();
+        pEditorGUI->applyRenderChanges();
+        pApp->getWindow()->releaseContext();
 
-        // TODO: Jobify audio update
-        Audio::setListenerInverseTransform(pScene->getActiveCamera()->calculateViewMatrix());
-        Audio::update(false);
+        rParam.pSnapshot = &renderSnapshots[frame];
+
+        clearBufferDecl.signalCounters[1] = renderCounters[frame];
+        renderDecl.signalCounters[0] = renderCounters[frame];
+        editorGuiRenderDecl.signalCounters[0] = renderCounters[frame];
+        swapBuffersDecl.waitCounters[0] = renderCounters[frame];
 
         pScheduler->enqueueJob(clearBufferDecl);
 
@@ -823,23 +943,17 @@ int main() {
 
         pScheduler->enqueueJob(editorGuiRenderDecl);
         pScheduler->enqueueJob(swapBuffersDecl);
+        frameInFlight = true;
 
-
-        // Synchronize
-        pScheduler->waitForCounter(swapBuffersDecl.signalCounters[0]);
-
-        Timer::incrementFrame();
-
-        //preRenderDecl.waitCounter = renderCounters[frame];
+        //preRenderDecl.waitCounters[0] = renderCounters[frame];
 
         frame = (frame+1)%2;
-
-        clearBufferDecl.signalCounters[1] = renderCounters[frame];
-        renderDecl.signalCounters[0] = renderCounters[frame];
-        editorGuiRenderDecl.signalCounters[0] = renderCounters[frame];
-        swapBuffersDecl.waitCounter = renderCounters[frame];
     }
 
+    // Synchronize with the last frame, and the GUI update enqueued before quitting
+    pScheduler->waitForCounterAndHelp(editorGuiUpdateDecl.signalCounters[0]);
+    if (frameInFlight) pScheduler->waitForCounterAndHelp(swapBuffersDecl.signalCounters[0]);
+
     // Signal the worker threads to stop processing their queues (regardless if there is still work in the queue) and join
     pScheduler->joinThreads();
 